@@ -2,12 +2,11 @@
 //! plugins.
 
 use std::any::{Any, TypeId};
-use std::cell::RefCell;
 use std::collections::HashMap;
 use std::env;
 use std::fmt;
 use std::path::PathBuf;
-use std::rc::Rc;
+use std::sync::{Arc, Mutex};
 
 use crate::data::{types::FileId, RawData};
 use crate::queries::{Query, QueryArgs, QueryKey};
@@ -51,15 +50,22 @@ impl fmt::Display for InvalidData {
 /// Moreover, it provides several useful methods which retrieve some information
 /// from the raw data in a nice form.
 ///
+/// The API can be shared among threads, the queries are then computed only
+/// once and their results are shared immutably.
+///
 /// [`Query`]: ../queries/index.html
 pub struct Api {
     data: RawData,
-    // RefCell enables to mutably borrow the cache even when Api is borrowed
-    // immutably. Use of Rc allows us to safely return a reference to the cached
-    // query without the need of expensively cloning it.
-    queries: RefCell<HashMap<(QueryKey, TypeId), Rc<dyn Any>>>,
+    // Mutex enables to mutate the cache even when Api is borrowed immutably.
+    // Each query has its own cell which is locked while the query is computed,
+    // so concurrent requests for the same query wait for the result instead of
+    // computing it again. Use of Arc allows us to safely return a reference to
+    // the cached query without the need of expensively cloning it.
+    queries: Mutex<HashMap<(QueryKey, TypeId), QueryCell>>,
 }
 
+type QueryCell = Arc<Mutex<Option<Arc<dyn Any + Send + Sync>>>>;
+
 impl Api {
     pub(crate) fn new(data: RawData) -> Result<Self, InvalidData> {
         if data.modules.files.is_empty() || data.modules.functions.is_empty() {
@@ -78,7 +84,7 @@ impl Api {
         } else {
             Ok(Api {
                 data,
-                queries: RefCell::new(HashMap::new()),
+                queries: Mutex::new(HashMap::new()),
             })
         }
     }
@@ -86,53 +92,48 @@ impl Api {
     /// Makes the query without any argument. See [`query_with`] for more
     /// details.
     ///
-    /// This function is not thread-safe!
-    ///
     /// [`query_with`]: #method.query_with
-    pub fn query<Q: Query<Args = ()>>(&self) -> Result<Rc<Q>, Q::Error> {
+    pub fn query<Q: Query<Args = ()>>(&self) -> Result<Arc<Q>, Q::Error> {
         self.query_with(&())
     }
 
     /// Makes the query with given argument. All queries are type-based and by
     /// their type and the argument they are also memoized. The return value is
     /// either a reference-counted pointer or an error if it happens.
-    ///
-    /// This function is not thread-safe!
-    pub fn query_with<Q: Query>(&self, args: &Q::Args) -> Result<Rc<Q>, Q::Error> {
+    pub fn query_with<Q: Query>(&self, args: &Q::Args) -> Result<Arc<Q>, Q::Error> {
         let type_id = TypeId::of::<Q>();
         let key = args.key();
 
-        // We cannot use `entry` API since it would break support for nested
-        // queries as it would violate exclusive mutable borrow rules enforced
-        // by RefCell.
-        let value = if !self.queries.borrow().contains_key(&(key.clone(), type_id)) {
-            // If a query, whose creation is erroneous, is requested multiple
-            // times, it is also recomputed (with failed result) multiple times
-            // since it is not stored in the cache. We accept this behavior
-            // since we consider failed query to be an ill state for the
-            // localization and such process would end up with an error early.
-            //
-            // It is important that calling `Q::init` is done *before* mutably
-            // borrowing the queries cache. In this way, nested queries will
-            // work fine because at this point, the cache is not borrowed by
-            // anything.
-            let value = Rc::new(Q::init(&self.data, args, self)?);
-
-            // Create a new pointer to the now-compted query.
-            self.queries
-                .borrow_mut()
-                .insert((key, type_id), value.clone());
-
-            value
-        } else {
-            // The query is already in the cache. We can safely unwrap it and
-            // create a new pointer to the cached query.
-            let value = self.queries.borrow().get(&(key, type_id)).unwrap().clone();
-
-            // Cast the value to the concrete type. Since we store the
-            // any-values by their type id, we are sure that the cast will end
-            // up successful.
-            value.downcast::<Q>().unwrap()
+        // The cache itself is locked only for getting the cell of the query.
+        // This is important for nested queries, because at the time `Q::init`
+        // is called, the cache is not locked by anything and only the cell of
+        // this query is. The queries depend on each other acyclically, so the
+        // cells of nested queries are never locked in opposite order.
+        let cell = self
+            .queries
+            .lock()
+            .unwrap()
+            .entry((key, type_id))
+            .or_default()
+            .clone();
+        let mut cached = cell.lock().unwrap();
+
+        let value = match &*cached {
+            // The query is already in the cache. Cast the value to the concrete
+            // type. Since we store the any-values by their type id, we are
+            // sure that the cast will end up successful.
+            Some(value) => value.clone().downcast::<Q>().unwrap(),
+            None => {
+                // If a query, whose creation is erroneous, is requested
+                // multiple times, it is also recomputed (with failed result)
+                // multiple times since it is not stored in the cache. We accept
+                // this behavior since we consider failed query to be an ill
+                // state for the localization and such process would end up
+                // with an error early.
+                let value = Arc::new(Q::init(&self.data, args, self)?);
+                *cached = Some(value.clone());
+                value
+            }
         };
 
         Ok(value)
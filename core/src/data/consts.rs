@@ -2,6 +2,33 @@ pub const TOKEN_STATEMENT: u8 = 0xff;
 pub const TOKEN_FUNCTION: u8 = 0xfe;
 pub const TOKEN_EXTERNAL: u8 = 0xfe;
 pub const TOKEN_FILENAMES: u8 = 0xfd;
+pub const TOKEN_CHUNK: u8 = 0xfd;
+pub const TOKEN_FILE_INDEX: u8 = 0xfc;
+pub const TOKEN_FILE_SWITCH: u8 = 0xfb;
+pub const TOKEN_UNTRACED_FUNCTION: u8 = 0xfb;
+pub const TOKEN_TRACE_BLOCK: u8 = 0xfc;
+pub const TOKEN_STATEMENT_DELTA: u8 = 0xfa;
+pub const TOKEN_INDUCTION_STEP: u8 = 0xfa;
+pub const TOKEN_BLOCK: u8 = 0xf9;
+pub const TOKEN_TEST_STATUS: u8 = 0xf8;
+pub const TOKEN_GAP: u8 = 0xf7;
+pub const TOKEN_STRING: u8 = 0xf6;
+pub const TOKEN_EXTERNAL_REF: u8 = 0xf5;
+pub const TOKEN_TEST_STATUS_REF: u8 = 0xf4;
+
+pub const TEST_FAILED: u8 = 0x00;
+pub const TEST_PASSED: u8 = 0x01;
+
+pub const SECTION_FUNCTIONS: u8 = 0x01;
+pub const SECTION_STATEMENTS: u8 = 0x02;
+pub const SECTION_FILES: u8 = 0x03;
+pub const SECTION_TYPES: u8 = 0x04;
+
+pub const FUNCTION_UNTRACED: u8 = 0x01;
+
+pub const SUCC_NEXT: u8 = 0xff;
+
+pub const ZSTD_MAGIC: [u8; 4] = [0x28, 0xb5, 0x2f, 0xfd];
 
 pub const TOKEN_VALUE_SCALAR: u8 = 0xe0;
 pub const TOKEN_VALUE_STRUCTURAL: u8 = 0xe1;
@@ -19,6 +46,9 @@ pub const TOKEN_DATA_U64: u8 = 0x18;
 pub const TOKEN_DATA_F32: u8 = 0x19;
 pub const TOKEN_DATA_F64: u8 = 0x20;
 pub const TOKEN_DATA_BOOL: u8 = 0x21;
+pub const TOKEN_DATA_NAMED: u8 = 0x28;
+pub const TOKEN_DATA_BLOB: u8 = 0x2a;
+pub const TOKEN_DATA_NAMED_REF: u8 = 0x2b;
 
 pub const META: u8 = 0x60;
 pub const META_ARG: u8 = 0x61;
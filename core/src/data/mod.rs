@@ -20,8 +20,8 @@
 //! ## Static Analysis Data Format
 //!
 //! It starts with a magic sequence `0x41 0x41 0x52 0x44 0x2f 0x53` (i.e.,
-//! `AARD/S` in ASCII) followed by the version number in ASCII (currently *1*,
-//! i.e., `0x31`).
+//! `AARD/S` in ASCII) followed by the version number in ASCII (*1*, i.e.,
+//! `0x31`, or *2* and *3* described below).
 //!
 //! The file is then sequence of byte tokens followed by the data specific for
 //! the item the token represents. We now describe individual "data types" as
@@ -50,12 +50,67 @@
 //!
 //! * `Function`: `0xfe ; null-terminated string`. Function name. All statements
 //!   which follow this token are considered to belong to this function.
+//! * `UntracedFunction`: `0xfb`. Marks the function which is currently being
+//!   defined as skipped by the instrumentation. Its statements never appear in
+//!   the trace.
 //!
 //! **Other types:**
 //!
 //! * `Filenames`: `0xfd ; 4B for n_files ; n_files * Filename`. Mapping from
 //!   numeric identifiers to actual file paths. The paths **must** be absolute.
 //! * `Filename`: `FileId ; null-terminated string`.
+//! * `TraceBlock`: `0xfc ; GlobalId ; 4B for n_stmts ; n_stmts * GlobalId`.
+//!   Sequence of statements which is traced as a single event in block
+//!   instrumentation mode. The block is identified by its first statement. All
+//!   statements must belong to the function which is currently being defined.
+//! * `InductionStep`: `0xfa ; GlobalId ; 8B step ; 4B for n_defs ; n_defs *
+//!   GlobalId`. Statement which increases a variable by a constant step and
+//!   whose value is not traced. Its value is the last value of the variable
+//!   (defined by one of the listed statements or the step itself) plus the
+//!   step. The frontend guarantees that such definition always precedes the
+//!   statement in the trace of the thread. It must precede trace blocks of the
+//!   same function.
+//!
+//! ### Sectioned Static Analysis Data Format
+//!
+//! Version *2* (i.e., `0x32`) contains the same items, but they are grouped
+//! into sections, so a consumer can go straight to the statements of a single
+//! function. The magic sequence is followed by `4B for n_sections ;
+//! n_sections * Section`.
+//!
+//! * `Section`: `1B for kind ; 8B for offset ; 8B for size`. The offset is
+//!   relative to the beginning of the file.
+//! * `Functions` section (kind `0x01`): `4B for n_functions ; n_functions *
+//!   FunctionEntry`.
+//! * `FunctionEntry`: `null-terminated string ; 1B for flags ; 8B for offset ;
+//!   8B for size`. The body of the function is stored at the offset relative
+//!   to the beginning of the statements section. Flag `0x01` marks the
+//!   function as untraced.
+//! * `Statements` section (kind `0x02`): Bodies of the functions. A body is a
+//!   sequence of `Statement`, `InductionStep` and `TraceBlock` items of the
+//!   function.
+//! * `Files` section (kind `0x03`): `4B for n_files ; n_files * Filename`.
+//! * `Types` section (kind `0x04`): `4B for n_types ; n_types * TypeEntry`.
+//!   Layouts of composite types whose values are traced as blobs. It is present
+//!   only if there is such a type.
+//! * `TypeEntry`: `8B for type_id ; null-terminated string ; 4B for size ; 4B
+//!   for n_fields ; n_fields * FieldEntry`. Nested types are flattened into
+//!   their primitive fields.
+//! * `FieldEntry`: `4B for offset ; 1B for data type token ; null-terminated
+//!   string`. The token is one of the variable trace tokens below for primitive
+//!   types.
+//!
+//! The frontend writes the sections in this order. Unknown sections are
+//! skipped.
+//!
+//! ### Compact Static Analysis Data Format
+//!
+//! Version *3* (i.e., `0x33`) is the sectioned format in which the successor of
+//! a statement is implied if it is the only one and it is the next statement in
+//! the body of the function. Such statement has `0xff` in place of `n_succ` and
+//! no successor ids follow. Therefore, only the edges between basic blocks are
+//! stored explicitly. The last statement of a function body never has an
+//! implied successor.
 //!
 //! ## Runtime Data Format
 //!
@@ -73,6 +128,18 @@
 //!   identified by its global identifier.
 //! * `External`: `0xfe ; null-terminated string`. Determines the start of a
 //!   test case.
+//! * `Gap`: `0xf7`. Some events are missing at this place, because the
+//!   runtime did not trace some function invocations (sampling) or evicted
+//!   them from its flight recorder. In the latter case, the statements of the
+//!   evicted events are logged in arbitrary order, each followed by a gap.
+//! * `Test status`: `0xf8 ; 1B status ; null-terminated string`. Status of the
+//!   named test case (`0x00` for failed, `0x01` for passed), reported by test
+//!   frameworks running in the traced process. It takes precedence over the
+//!   test results file.
+//! * `Block`: `0xf9 ; GlobalId`. Indicates execution of all statements of the
+//!   trace block identified by its first statement. When loaded, it is
+//!   expanded to individual statements, and the values traced after the event
+//!   are assigned to the statements of the block which define variables.
 //!
 //! **Variable trace types:**
 //!
@@ -95,11 +162,97 @@
 //! * `f32`: `0x19 ; 4B`.
 //! * `f64`: `0x20 ; 8B`.
 //! * `bool`: `0x21 ; 1B`. Any non-zero value is considered as *true*.
+//! * `Named`: `0x28 ; null-terminated string`. Value given by its name (e.g.,
+//!   an enumeration variant). It is loaded as unsupported for now.
+//! * `Blob`: `0x2a ; 8B for type_id ; 4B for n_bytes ; n_bytes`. Raw memory of
+//!   a composite value whose layout is in the types section of the static data.
+//!   The fields are decoded only on demand.
+//!
+//! The file may end with a sequence of zero bytes, which is ignored. It is left
+//! by the memory-mapped mode of the runtime when the process does not exit
+//! normally.
+//!
+//! ### Thread-tagged Runtime Data Format
+//!
+//! Version *2* (i.e., `0x32`) is used by runtimes which trace multi-threaded
+//! programs. The file is a sequence of chunks, where each chunk contains items
+//! of version *1* produced by a single thread during a single test case.
+//!
+//! * `Chunk`: `0xfd ; 8B for thread_id ; 8B for epoch ; 4B for n_bytes ;
+//!   n_bytes of items`. The epoch is incremented by the runtime on every test
+//!   case marker, so the chunks of different threads can be assigned to the
+//!   right test case.
+//! * `External`: `0xfe ; null-terminated string`. When it appears outside of a
+//!   chunk, it was written by another process and all following epochs belong
+//!   to this test case.
+//!
+//! When loaded, the items of each thread form a contiguous sequence within the
+//! test case, so the trace is ordered from the perspective of every thread.
+//!
+//! ### Compact Runtime Data Format
+//!
+//! Version *3* (i.e., `0x33`) has the same structure as version *2*, but the
+//! chunks may also contain compactly encoded statements and strings. Every
+//! chunk starts with empty file and string tables and previous statement id
+//! equal to zero, so the chunks can be decoded independently.
+//!
+//! * `File index`: `0xfc ; varint for index ; 8B for file_id`. Assigns the
+//!   index in the file table and makes the file current.
+//! * `File switch`: `0xfb ; varint for index`. Makes the file with given index
+//!   current.
+//! * `Statement`: `0xfa ; varint for delta`. Statement in the current file with
+//!   id equal to the previous statement id plus the delta, which is signed and
+//!   zigzag-encoded.
+//!
+//! * `String`: `0xf6 ; varint for index ; null-terminated string`. Assigns the
+//!   string to the index in the string table of the chunk. The index can be
+//!   reassigned later in the chunk.
+//! * `External reference`: `0xf5 ; varint for index`. Start of the test case
+//!   named by the string with given index.
+//! * `Test status reference`: `0xf4 ; 1B status ; varint for index`. Status of
+//!   the test case named by the string with given index.
+//! * `Named reference`: `0x2b ; varint for index`. Named value given by the
+//!   string with given index.
+//!
+//! Varints use LEB128 encoding (7 bits per byte, least significant group first,
+//! the most significant bit set in all bytes except the last one).
+//!
+//! ### Compressed Runtime Data Format
+//!
+//! Any of the formats above can be compressed as a sequence of independent
+//! [zstd](https://facebook.github.io/zstd/) frames, which is detected by the
+//! zstd magic number at the beginning of the file. The buffered runtimes write
+//! every buffer (chunk) as a separate frame, so the frame boundaries match the
+//! chunk boundaries.
+//!
+//! ### Trace Index Format
+//!
+//! The buffered runtimes can write a side index of the thread-tagged trace
+//! (`<trace file>.index`), which allows to find the chunks touching given files
+//! without reading the whole trace. It starts with `AARD/I` followed by the
+//! version number in ASCII (*1*). The records follow in the order of writing,
+//! which may slightly differ from the order in the trace when several processes
+//! append to it.
+//!
+//! * `Chunk`: `0xfd ; 8B for offset ; 4B for n_bytes ; 8B for thread_id ; 8B
+//!   for epoch ; 32B for files`. The chunk at given offset in the trace,
+//!   occupying n_bytes there (offset and size of its zstd frame if the trace is
+//!   compressed). The files form a bloom filter of 256 bits, the statements of
+//!   a file may be in the chunk only if both bits of the file are set. The
+//!   bits are the highest and second highest byte of `file_id *
+//!   0x9e3779b97f4a7c15` (wrapping multiplication).
+//! * `External`: `0xfe ; 8B for offset ; null-terminated string`. Test case
+//!   marker outside of chunks at given offset.
+//! * `Chunk external`: `0xfc ; 8B for offset ; null-terminated string`. Test
+//!   case marker inside the chunk at given offset, which names the test case of
+//!   its epoch.
 //!
 //! ## Test results data format
 //!
 //! Test results are in textual form, where each test case name is on its line
 //! prefixed either with `PASS: ` or `FAIL: `.
+//!
+//! The file is optional when all statuses are reported in the trace.
 
 pub mod access;
 mod consts;
@@ -140,9 +293,9 @@ impl RawData {
         }
     }
 
-    pub fn parse<'a, R1: BufRead + 'a, R2: BufRead, R3: BufRead>(
+    pub fn parse<'a, 'b, R1: BufRead + 'a, R2: BufRead + 'b, R3: BufRead>(
         module_files: impl Iterator<Item = &'a mut R1>,
-        trace_file: &mut R2,
+        trace_files: impl Iterator<Item = &'b mut R2>,
         test_suite_file: &mut R3,
         ignore_corrupted: bool,
     ) -> parser::ParseResult<RawData> {
@@ -155,8 +308,32 @@ impl RawData {
             parser::parse_module(module_file, &mut modules, &mut arenas)?;
         }
 
-        parser::parse_trace(trace_file, &mut trace, &mut arenas, ignore_corrupted)?;
+        // The first trace is the main one, the others come from the processes
+        // forked or executed by the traced program.
+        let mut merged = false;
+        for (index, trace_file) in trace_files.enumerate() {
+            let start = trace.trace.len();
+            parser::parse_trace(
+                trace_file,
+                &mut trace,
+                &modules,
+                &mut arenas,
+                ignore_corrupted,
+            )?;
+
+            if index > 0 {
+                trace.strip_untested(start);
+                merged = true;
+            }
+        }
+
+        if merged {
+            trace.group_tests();
+        }
+
+        trace.index_tests();
         parser::parse_test_suite(test_suite_file, &mut test_suite, &mut arenas)?;
+        test_suite.tests.extend(trace.statuses.drain(..));
 
         // Set global singletons.
         arenas.seal();
@@ -183,6 +360,10 @@ impl<T> UniqueArena<T> {
         }
     }
 
+    fn get(&self, ptr: &P<T>) -> &T {
+        self.arena.get(ptr)
+    }
+
     fn into_inner(self) -> Arena<T> {
         self.arena
     }
@@ -245,6 +426,15 @@ impl<T: Hash + Eq> IdMap<T> {
     }
 }
 
+impl<T: Clone> IdMap<T> {
+    /// Returns the keys ordered by their ids.
+    pub fn keys(&self) -> Vec<T> {
+        let mut keys = self.0.iter().collect::<Vec<_>>();
+        keys.sort_unstable_by_key(|(_, id)| **id);
+        keys.into_iter().map(|(key, _)| key.clone()).collect()
+    }
+}
+
 pub(crate) struct Arenas {
     stmt_id: IdMap<(FileId, u64)>,
     stmt: UniqueArena<statement::Statement>,
@@ -257,14 +447,18 @@ pub(crate) struct Arenas {
 
 impl Arenas {
     fn new() -> Self {
+        Self::with_capacity(1 << 16)
+    }
+
+    fn with_capacity(capacity: usize) -> Self {
         Arenas {
-            stmt_id: IdMap::with_capacity(1 << 16),
-            stmt: UniqueArena::with_capacity(1 << 16),
-            access: UniqueArena::with_capacity(1 << 16),
-            value: ValueArena::with_capacity(1 << 16),
-            func: UniqueStringArena::with_capacity(1 << 16),
-            test: UniqueStringArena::with_capacity(1 << 16),
-            file: UniqueStringArena::with_capacity(1 << 8),
+            stmt_id: IdMap::with_capacity(capacity),
+            stmt: UniqueArena::with_capacity(capacity),
+            access: UniqueArena::with_capacity(capacity),
+            value: ValueArena::with_capacity(capacity),
+            func: UniqueStringArena::with_capacity(capacity),
+            test: UniqueStringArena::with_capacity(capacity),
+            file: UniqueStringArena::with_capacity(capacity.min(1 << 8)),
         }
     }
 
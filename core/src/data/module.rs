@@ -1,9 +1,10 @@
 //! Data related to static analysis.
 
-use std::collections::HashMap;
+use std::collections::{HashMap, HashSet};
 
 use super::statement::Statement;
 use super::types::{FileId, FileName, FuncName, StmtId};
+use super::values::ValueType;
 use crate::arena::{P, S};
 
 /// Data from all modules of the program.
@@ -15,6 +16,64 @@ pub struct Modules {
 
     /// Mapping from file identifiers to their absolute paths.
     pub files: HashMap<FileId, S<FileName>>,
+
+    /// Mapping from trace block identifiers to their structure. It is empty
+    /// unless the program was instrumented in block mode.
+    pub blocks: HashMap<StmtId, TraceBlock>,
+
+    /// Mapping from statements whose values are not traced to the description
+    /// how to reconstruct them.
+    pub inductions: HashMap<StmtId, InductionStep>,
+
+    /// Functions which were skipped by the instrumentation. Their statements
+    /// never appear in the trace even if they are executed.
+    pub untraced: HashSet<S<FuncName>>,
+
+    /// Mapping from type identifiers to layouts of composite types whose values
+    /// are traced as raw bytes.
+    pub types: HashMap<u64, TypeLayout>,
+}
+
+/// A sequence of statements in a basic block which is traced as a single event.
+/// It is identified by its first statement.
+pub struct TraceBlock {
+    /// Statements of the block in execution order.
+    pub stmts: Vec<StmtId>,
+    /// Whether the corresponding statement defines a variable, that is, its
+    /// value is traced right after the statement.
+    pub defs: Vec<bool>,
+}
+
+/// A statement which increases a variable by a constant (e.g., `i++` in a loop).
+/// Its value is not traced and is reconstructed from the last value of the
+/// variable instead.
+pub struct InductionStep {
+    /// Value added to the variable.
+    pub step: i64,
+    /// All other statements which define the variable.
+    pub defs: Vec<StmtId>,
+}
+
+/// Layout of a composite type (e.g., a structure or an array) as exported by
+/// the frontend. Nested types are flattened into the primitive fields.
+pub struct TypeLayout {
+    /// Name of the type in the source language.
+    pub name: String,
+    /// Size of the type in bytes.
+    pub size: u32,
+    /// Primitive fields of the type in the order of their offsets.
+    pub fields: Vec<FieldLayout>,
+}
+
+/// A primitive field of a composite type.
+pub struct FieldLayout {
+    /// Path of the field within the type (e.g., `1[2]` for the third element of
+    /// an array which is the second field of a structure).
+    pub name: String,
+    /// Offset of the field from the start of the value in bytes.
+    pub offset: u32,
+    /// Data type of the field.
+    pub value_type: ValueType,
 }
 
 impl Modules {
@@ -23,6 +82,10 @@ impl Modules {
         Modules {
             functions: HashMap::new(),
             files: HashMap::new(),
+            blocks: HashMap::new(),
+            inductions: HashMap::new(),
+            untraced: HashSet::new(),
+            types: HashMap::new(),
         }
     }
 }
@@ -1,15 +1,16 @@
-use std::collections::HashMap;
+use std::collections::{BTreeMap, HashMap};
 use std::fmt;
-use std::io::{self, BufRead};
+use std::io::{self, BufRead, BufReader};
+use std::thread;
 
 use super::access::Access;
 use super::consts;
-use super::module::Modules;
+use super::module::{FieldLayout, InductionStep, Modules, TraceBlock, TypeLayout};
 use super::statement::{Loc, Metadata, Statement};
 use super::tests::{TestStatus, TestSuite};
 use super::trace::{Trace, TraceItem};
-use super::types::{FileId, FuncName, StmtId};
-use super::values::{IntoValue, Value, ValueRef, ValueType};
+use super::types::{FileId, FuncName, StmtId, TestName};
+use super::values::{IntoValue, Value, ValueArena, ValueRef, ValueType};
 use super::Arenas;
 use crate::arena::{P, S};
 
@@ -129,6 +130,51 @@ impl<'a, R: BufRead> Source<'a, R> {
         Ok(n_bytes)
     }
 
+    pub fn skip(&mut self, n_bytes: usize) -> ParseResult<()> {
+        let mut remaining = n_bytes;
+        while remaining > 0 {
+            let available = self
+                .inner
+                .fill_buf()
+                .map_err(|err| ParseError::ReadError { inner: err })?
+                .len();
+
+            if available == 0 {
+                return Err(ParseError::UnexpectedEof { n_bytes: remaining });
+            }
+
+            let n_bytes = available.min(remaining);
+            self.inner.consume(n_bytes);
+            self.byte_pos += n_bytes;
+            remaining -= n_bytes;
+        }
+        Ok(())
+    }
+
+    // Consumes zero bytes and returns whether they extend up to the end of the
+    // input.
+    pub fn skip_padding(&mut self) -> ParseResult<bool> {
+        loop {
+            let buf = self
+                .inner
+                .fill_buf()
+                .map_err(|err| ParseError::ReadError { inner: err })?;
+
+            if buf.is_empty() {
+                return Ok(true);
+            }
+
+            let n_bytes = buf.iter().take_while(|byte| **byte == 0).count();
+            let padded = n_bytes == buf.len();
+            self.inner.consume(n_bytes);
+            self.byte_pos += n_bytes;
+
+            if !padded {
+                return Ok(false);
+            }
+        }
+    }
+
     pub fn read_line(&mut self, buf: &mut String) -> ParseResult<usize> {
         let n_bytes = self
             .inner
@@ -182,136 +228,1116 @@ pub(crate) fn parse_module<'a, 'b, R: BufRead>(
     arenas: &'b mut Arenas,
 ) -> ParseResult<()> {
     let mut parser = Parser::new(source, arenas);
-    let mut statements = HashMap::new();
-    let mut func_ptr = None;
 
     match parser.parse_header()? {
         Format {
             kind: FormatKind::Static,
             version: 1,
-        } => {}
+        } => parser.parse_module_stream(modules),
+        Format {
+            kind: FormatKind::Static,
+            version: 2,
+        } => parser.parse_module_sections(modules, false),
+        Format {
+            kind: FormatKind::Static,
+            version: 3,
+        } => parser.parse_module_sections(modules, true),
         Format {
             kind: FormatKind::Static,
             version,
-        } => return Err(ParseError::UnsupportedVersion { version }),
+        } => Err(ParseError::UnsupportedVersion { version }),
         Format {
             kind: FormatKind::Runtime,
             ..
-        } => return Err(ParseError::InvalidFormat),
+        } => Err(ParseError::InvalidFormat),
     }
+}
 
-    while let Ok(token) = parser.parse_u8() {
-        match token {
-            consts::TOKEN_STATEMENT => {
-                if let Some(func) = func_ptr {
-                    let (id, stmt) = parser.parse_stmt(func)?;
-                    statements.insert(id, stmt);
-                } else {
-                    return Err(ParseError::InvalidData {
-                        reason: "every statement must be inside a function".to_owned(),
-                    });
+// Compressed trace is a sequence of zstd frames (each starting with the magic
+// number), which decompresses into the uncompressed trace.
+pub(crate) fn parse_trace<'a, 'b, R: BufRead>(
+    source: &'a mut R,
+    trace: &mut Trace,
+    modules: &Modules,
+    arenas: &'b mut Arenas,
+    ignore_corrupted: bool,
+) -> ParseResult<()> {
+    let compressed = source
+        .fill_buf()
+        .map_err(|err| ParseError::ReadError { inner: err })?
+        .starts_with(&consts::ZSTD_MAGIC);
+
+    if compressed {
+        let decoder = zstd::stream::read::Decoder::with_buffer(source)
+            .map_err(|err| ParseError::ReadError { inner: err })?;
+        parse_trace_uncompressed(
+            &mut BufReader::new(decoder),
+            trace,
+            modules,
+            arenas,
+            ignore_corrupted,
+        )
+    } else {
+        parse_trace_uncompressed(source, trace, modules, arenas, ignore_corrupted)
+    }
+}
+
+fn parse_trace_uncompressed<'a, 'b, R: BufRead>(
+    source: &'a mut R,
+    trace: &mut Trace,
+    modules: &Modules,
+    arenas: &'b mut Arenas,
+    ignore_corrupted: bool,
+) -> ParseResult<()> {
+    let mut parser = Parser::new(source, arenas);
+    let context = TraceContext::new(modules);
+
+    match parser.parse_header()? {
+        Format {
+            kind: FormatKind::Runtime,
+            version: 1,
+        } => parser.parse_trace_stream(trace, &context, ignore_corrupted),
+        Format {
+            kind: FormatKind::Runtime,
+            version: 2,
+        }
+        | Format {
+            kind: FormatKind::Runtime,
+            version: 3,
+        } => parser.parse_trace_chunks(trace, &context, ignore_corrupted),
+        Format {
+            kind: FormatKind::Runtime,
+            version,
+        } => Err(ParseError::UnsupportedVersion { version }),
+        Format {
+            kind: FormatKind::Static,
+            ..
+        } => Err(ParseError::InvalidFormat),
+    }
+}
+
+/// Static data needed to reconstruct the trace from the runtime data.
+struct TraceContext<'m> {
+    blocks: &'m HashMap<StmtId, TraceBlock>,
+    inductions: &'m HashMap<StmtId, InductionStep>,
+    /// For every statement which defines the variable of an induction step,
+    /// the steps which use its value (including the steps themselves).
+    updates: HashMap<StmtId, Vec<StmtId>>,
+}
+
+impl<'m> TraceContext<'m> {
+    pub fn new(modules: &'m Modules) -> Self {
+        let mut updates = HashMap::<StmtId, Vec<StmtId>>::new();
+
+        for (id, induction) in modules.inductions.iter() {
+            updates.entry(*id).or_default().push(*id);
+
+            for def in induction.defs.iter() {
+                updates.entry(*def).or_default().push(*id);
+            }
+        }
+
+        TraceContext {
+            blocks: &modules.blocks,
+            inductions: &modules.inductions,
+            updates,
+        }
+    }
+}
+
+/// Items of a single test case in thread-tagged trace, grouped by threads.
+#[derive(Default)]
+struct TraceSegment {
+    test: Option<S<TestName>>,
+    threads: BTreeMap<u64, Vec<RawItem>>,
+}
+
+/// Approximate amount of chunk payloads read before they are decoded in
+/// parallel. It bounds the memory held by undecoded chunks.
+const CHUNK_BATCH_SIZE: usize = 64 << 20;
+
+/// Thread-tagged chunk whose payload is not decoded yet.
+struct RawChunk {
+    segment: u64,
+    thread: u64,
+    epoch: u64,
+    payload: Vec<u8>,
+}
+
+/// Chunk decoded into the arenas of a worker.
+#[derive(Default)]
+struct DecodedChunk {
+    test: Option<S<TestName>>,
+    items: Vec<RawItem>,
+    statuses: Vec<(S<TestName>, TestStatus)>,
+}
+
+fn decode_chunk_group(
+    chunks: &[RawChunk],
+    ignore_corrupted: bool,
+) -> ParseResult<(Arenas, Vec<DecodedChunk>)> {
+    let mut arenas = Arenas::with_capacity(1 << 10);
+    let mut decoded = Vec::with_capacity(chunks.len());
+
+    for chunk in chunks {
+        let mut source = &chunk.payload[..];
+        let mut parser = Parser::new(&mut source, &mut arenas);
+        decoded.push(parser.parse_chunk(chunk.payload.len(), ignore_corrupted)?);
+    }
+
+    Ok((arenas, decoded))
+}
+
+/// Translates the references into the arenas of a worker to the shared arenas
+/// after the data are moved into them.
+struct ChunkMapping {
+    stmts: Vec<StmtId>,
+    values: u32,
+    tests: HashMap<S<TestName>, S<TestName>>,
+}
+
+impl ChunkMapping {
+    fn new(local: Arenas, arenas: &mut Arenas) -> Self {
+        // Statements are assigned in the order of their local ids to keep the
+        // global ids deterministic.
+        let stmts = local
+            .stmt_id
+            .keys()
+            .into_iter()
+            .map(|key| StmtId::new(arenas.stmt_id.get(key)))
+            .collect();
+
+        let tests = local
+            .test
+            .cache
+            .iter()
+            .map(|(name, test)| (*test, arenas.test.alloc(name)))
+            .collect();
+
+        ChunkMapping {
+            stmts,
+            values: arenas.value.append(local.value),
+            tests,
+        }
+    }
+
+    fn stmt(&self, stmt: StmtId) -> StmtId {
+        self.stmts[stmt.as_index()]
+    }
+
+    fn test(&self, test: S<TestName>) -> S<TestName> {
+        self.tests[&test]
+    }
+
+    fn raw_item(&self, item: RawItem) -> RawItem {
+        match item {
+            RawItem::Item(TraceItem::Statement(stmt)) => {
+                RawItem::Item(TraceItem::Statement(self.stmt(stmt)))
+            }
+            RawItem::Item(TraceItem::Test(test)) => RawItem::Item(TraceItem::Test(self.test(test))),
+            RawItem::Item(TraceItem::Value(value)) => {
+                RawItem::Item(TraceItem::Value(value.rebase(self.values)))
+            }
+            RawItem::Item(TraceItem::Gap) => RawItem::Item(TraceItem::Gap),
+            RawItem::Block(stmt) => RawItem::Block(self.stmt(stmt)),
+            RawItem::Status(test, status) => RawItem::Status(self.test(test), status),
+        }
+    }
+}
+
+/// Trace item as stored in the runtime data, before trace blocks are expanded.
+enum RawItem {
+    Item(TraceItem),
+    Block(StmtId),
+    Status(S<TestName>, TestStatus),
+}
+
+/// Expands trace blocks into their statements. The statements are released
+/// lazily, because the values of variables defined by them are traced right
+/// after the corresponding statement and not after the whole block.
+struct BlockExpander<'m> {
+    blocks: &'m HashMap<StmtId, TraceBlock>,
+    pending: Option<(&'m TraceBlock, usize)>,
+}
+
+impl<'m> BlockExpander<'m> {
+    pub fn new(blocks: &'m HashMap<StmtId, TraceBlock>) -> Self {
+        BlockExpander {
+            blocks,
+            pending: None,
+        }
+    }
+
+    pub fn push(&mut self, item: RawItem, trace: &mut Vec<TraceItem>) -> ParseResult<()> {
+        match item {
+            RawItem::Block(id) => {
+                self.finish(trace);
+
+                match self.blocks.get(&id) {
+                    Some(block) => self.pending = Some((block, 0)),
+                    None => {
+                        return Err(ParseError::InvalidData {
+                            reason: "unknown trace block".to_owned(),
+                        })
+                    }
+                }
+            }
+            RawItem::Item(TraceItem::Value(value)) => {
+                // Release the statements up to the first one which defines a
+                // variable (or all if there is no such statement).
+                if let Some((block, index)) = self.pending.take() {
+                    let end = block.defs[index..]
+                        .iter()
+                        .position(|def| *def)
+                        .map(|pos| index + pos + 1)
+                        .unwrap_or(block.stmts.len());
+
+                    Self::release(block, index, end, trace);
+
+                    if end < block.stmts.len() {
+                        self.pending = Some((block, end));
+                    }
                 }
+
+                trace.push(TraceItem::Value(value));
+            }
+            RawItem::Item(item) => {
+                self.finish(trace);
+                trace.push(item);
             }
-            consts::TOKEN_FUNCTION => {
-                // Register previously encountered function since we collected
-                // all its statements.
-                if !statements.is_empty() {
+            // Test statuses are not part of the trace sequence.
+            RawItem::Status(..) => {}
+        }
+
+        Ok(())
+    }
+
+    pub fn finish(&mut self, trace: &mut Vec<TraceItem>) {
+        if let Some((block, index)) = self.pending.take() {
+            Self::release(block, index, block.stmts.len(), trace);
+        }
+    }
+
+    fn release(block: &TraceBlock, begin: usize, end: usize, trace: &mut Vec<TraceItem>) {
+        trace.extend(
+            block.stmts[begin..end]
+                .iter()
+                .map(|stmt| TraceItem::Statement(*stmt)),
+        );
+    }
+}
+
+/// Reconstructs the values of induction steps, which are not traced, from the
+/// last value of their variable. It processes the items after trace blocks are
+/// expanded.
+struct InductionRebuilder<'c, 'm> {
+    context: &'c TraceContext<'m>,
+    /// The last value of the variable of each induction step.
+    bases: HashMap<StmtId, ValueRef>,
+    /// Definition of an induction variable whose value is the next item.
+    pending: Option<StmtId>,
+}
+
+impl<'c, 'm> InductionRebuilder<'c, 'm> {
+    pub fn new(context: &'c TraceContext<'m>) -> Self {
+        InductionRebuilder {
+            context,
+            bases: HashMap::new(),
+            pending: None,
+        }
+    }
+
+    pub fn extend<I: Iterator<Item = TraceItem>>(
+        &mut self,
+        items: I,
+        trace: &mut Vec<TraceItem>,
+        values: &mut ValueArena,
+    ) {
+        if self.context.inductions.is_empty() {
+            trace.extend(items);
+            return;
+        }
+
+        for item in items {
+            match item {
+                TraceItem::Statement(stmt) => {
+                    self.pending = None;
+                    trace.push(TraceItem::Statement(stmt));
+
+                    if let Some(induction) = self.context.inductions.get(&stmt) {
+                        let value = Self::step(self.bases.get(&stmt), induction.step, values);
+                        self.update(stmt, value);
+                        trace.push(TraceItem::Value(value));
+                    } else if self.context.updates.contains_key(&stmt) {
+                        self.pending = Some(stmt);
+                    }
+                }
+                TraceItem::Value(value) => {
+                    if let Some(def) = self.pending.take() {
+                        self.update(def, value);
+                    }
+
+                    trace.push(TraceItem::Value(value));
+                }
+                TraceItem::Test(test) => {
+                    self.bases.clear();
+                    self.pending = None;
+                    trace.push(TraceItem::Test(test));
+                }
+                TraceItem::Gap => {
+                    // Definitions of the variables may be lost in the gap.
+                    self.bases.clear();
+                    self.pending = None;
+                    trace.push(TraceItem::Gap);
+                }
+            }
+        }
+    }
+
+    fn update(&mut self, def: StmtId, value: ValueRef) {
+        if let Some(steps) = self.context.updates.get(&def) {
+            for step in steps {
+                self.bases.insert(*step, value);
+            }
+        }
+    }
+
+    // Integer overflow wraps around as in the instrumented program.
+    fn step(base: Option<&ValueRef>, step: i64, values: &mut ValueArena) -> ValueRef {
+        let (value, value_type) = match base {
+            Some(base) => values.value(base),
+            None => (Value::Unsupported, ValueType::Unsupported),
+        };
+
+        let sum = value.as_signed().map(|value| value.wrapping_add(step));
+
+        match (sum, value_type) {
+            (Some(sum), ValueType::I8) => values.alloc(Value::Signed(sum as i8 as i64), value_type),
+            (Some(sum), ValueType::I16) => {
+                values.alloc(Value::Signed(sum as i16 as i64), value_type)
+            }
+            (Some(sum), ValueType::I32) => {
+                values.alloc(Value::Signed(sum as i32 as i64), value_type)
+            }
+            (Some(sum), ValueType::I64) => values.alloc(Value::Signed(sum), value_type),
+            _ => values.alloc(Value::Unsupported, ValueType::Unsupported),
+        }
+    }
+}
+
+/// State of compact statement encoding. It is reset for every chunk.
+#[derive(Default)]
+struct CompactState {
+    files: HashMap<u64, FileId>,
+    current_file: Option<FileId>,
+    last_stmt: u64,
+    // Interned strings are test names, except for named values which are not
+    // supported yet, so they are allocated right in the test name arena.
+    strings: HashMap<u64, S<TestName>>,
+}
+
+pub(crate) fn parse_test_suite<'a, 'b, R: BufRead>(
+    source: &'a mut R,
+    test_suite: &mut TestSuite,
+    arenas: &'b mut Arenas,
+) -> ParseResult<()> {
+    let mut parser = Parser::new(source, arenas);
+
+    loop {
+        let mut line = String::new();
+        match parser.source.read_line(&mut line)? {
+            0 => return Ok(()),
+            _ => match &line[0..6] {
+                "PASS: " => test_suite.tests.insert(
+                    parser.arenas.test.alloc(line[6..].trim()),
+                    TestStatus::Passed,
+                ),
+                "FAIL: " => test_suite.tests.insert(
+                    parser.arenas.test.alloc(line[6..].trim()),
+                    TestStatus::Failed,
+                ),
+                result => {
+                    return Err(ParseError::InvalidTestResult {
+                        value: result.to_owned(),
+                    })
+                }
+            },
+        };
+    }
+}
+
+fn version_from_ascii(byte: u8) -> u8 {
+    byte.overflowing_sub('0' as u8).0
+}
+
+// Can be implemented as a normal function after const generics get stabilized.
+// Tracking issue: https://github.com/rust-lang/rust/issues/44580.
+macro_rules! read_n {
+    ($parser:expr, $n:expr) => {{
+        let mut buf = [0u8; $n];
+        $parser.source.read_exact(&mut buf).map(|_| buf)
+    }};
+}
+
+impl<'a, 'b, R: BufRead> Parser<'a, 'b, R> {
+    fn parse_header(&mut self) -> ParseResult<Format> {
+        let buf = read_n!(self, 7).map_err(|_| ParseError::InvalidFormat)?;
+        if &buf[0..6] == "AARD/S".as_bytes() {
+            Ok(Format {
+                kind: FormatKind::Static,
+                version: version_from_ascii(buf[6]),
+            })
+        } else if &buf[0..6] == "AARD/D".as_bytes() {
+            Ok(Format {
+                kind: FormatKind::Runtime,
+                version: version_from_ascii(buf[6]),
+            })
+        } else {
+            Err(ParseError::InvalidFormat)
+        }
+    }
+
+    fn parse_module_stream(&mut self, modules: &mut Modules) -> ParseResult<()> {
+        let mut statements = HashMap::new();
+        let mut func_ptr = None;
+
+        while let Ok(token) = self.parse_u8() {
+            match token {
+                consts::TOKEN_STATEMENT => {
                     if let Some(func) = func_ptr {
-                        modules
-                            .functions
-                            .insert(func, std::mem::replace(&mut statements, HashMap::new()));
+                        let (id, stmt) = self.parse_stmt(func)?;
+                        statements.insert(id, stmt);
                     } else {
                         return Err(ParseError::InvalidData {
-                            reason: "there are statements that do not belong to any function"
-                                .to_owned(),
+                            reason: "every statement must be inside a function".to_owned(),
                         });
                     }
                 }
+                consts::TOKEN_FUNCTION => {
+                    // Register previously encountered function since we collected
+                    // all its statements.
+                    if !statements.is_empty() {
+                        if let Some(func) = func_ptr {
+                            modules
+                                .functions
+                                .insert(func, std::mem::replace(&mut statements, HashMap::new()));
+                        } else {
+                            return Err(ParseError::InvalidData {
+                                reason: "there are statements that do not belong to any function"
+                                    .to_owned(),
+                            });
+                        }
+                    }
 
-                let function = parser.parse_cstr()?;
-                func_ptr = Some(parser.arenas.func.alloc(function));
-            }
-            consts::TOKEN_FILENAMES => {
-                let n_files = parser.parse_u32()?;
-                for _ in 0..n_files {
-                    let file_id = parser.parse_file_id()?;
-                    let filepath = parser.parse_cstr()?;
-                    modules
-                        .files
-                        .insert(file_id, parser.arenas.file.alloc(filepath));
+                    let function = self.parse_cstr()?;
+                    func_ptr = Some(self.arenas.func.alloc(function));
+                }
+                consts::TOKEN_TRACE_BLOCK => self.parse_trace_block(&statements, modules)?,
+                consts::TOKEN_INDUCTION_STEP => self.parse_induction_step(&statements, modules)?,
+                consts::TOKEN_UNTRACED_FUNCTION => {
+                    if let Some(func) = func_ptr {
+                        modules.untraced.insert(func);
+                    } else {
+                        return Err(ParseError::InvalidData {
+                            reason: "untraced function marker must follow a function".to_owned(),
+                        });
+                    }
                 }
+                consts::TOKEN_FILENAMES => self.parse_filenames(modules)?,
+                byte => {
+                    return Err(ParseError::UnexpectedByte {
+                        pos: self.source.byte_pos(),
+                        byte,
+                        expected: vec![
+                            consts::TOKEN_STATEMENT,
+                            consts::TOKEN_FUNCTION,
+                            consts::TOKEN_FILENAMES,
+                            consts::TOKEN_TRACE_BLOCK,
+                            consts::TOKEN_UNTRACED_FUNCTION,
+                            consts::TOKEN_INDUCTION_STEP,
+                        ],
+                    })
+                }
+            }
+        }
+
+        if !statements.is_empty() {
+            if let Some(func) = func_ptr {
+                modules.functions.insert(func, statements);
+            } else {
+                return Err(ParseError::InvalidData {
+                    reason: "there are statements that do not belong to any function".to_owned(),
+                });
+            }
+        }
+
+        Ok(())
+    }
+
+    // Sectioned format (AARD/S2) starts with a table of sections. The sections
+    // are read in the order of their offsets and unknown sections are skipped.
+    // The compact format (AARD/S3) differs only in the successors of the
+    // statements.
+    fn parse_module_sections(&mut self, modules: &mut Modules, compact: bool) -> ParseResult<()> {
+        let n_sections = self.parse_u32()?;
+        let mut sections = self.parse_vec(n_sections, |parser| {
+            Ok((parser.parse_u8()?, parser.parse_u64()?, parser.parse_u64()?))
+        })?;
+        sections.sort_by_key(|(_, offset, _)| *offset);
+
+        let mut functions = Vec::new();
+
+        for (kind, offset, size) in sections {
+            self.skip_to(offset)?;
+
+            match kind {
+                consts::SECTION_FUNCTIONS => {
+                    let n_functions = self.parse_u32()?;
+                    functions = self.parse_vec(n_functions, |parser| {
+                        let function = parser.parse_cstr()?;
+                        let func = parser.arenas.func.alloc(function);
+                        Ok((
+                            func,
+                            parser.parse_u8()?,
+                            parser.parse_u64()?,
+                            parser.parse_u64()?,
+                        ))
+                    })?;
+                    functions.sort_by_key(|(_, _, offset, _)| *offset);
+                }
+                consts::SECTION_STATEMENTS => {
+                    for (func, flags, func_offset, func_size) in functions.iter() {
+                        if flags & consts::FUNCTION_UNTRACED != 0 {
+                            modules.untraced.insert(*func);
+                        }
+
+                        self.skip_to(offset + func_offset)?;
+                        let end = offset + func_offset + func_size;
+                        let statements = self.parse_function_body(*func, end, compact, modules)?;
+
+                        if !statements.is_empty() {
+                            modules.functions.insert(*func, statements);
+                        }
+                    }
+                }
+                consts::SECTION_FILES => self.parse_filenames(modules)?,
+                consts::SECTION_TYPES => self.parse_types(modules)?,
+                _ => {}
+            }
+
+            if self.source.byte_pos() as u64 > offset + size {
+                return Err(ParseError::InvalidData {
+                    reason: "data exceed the size of their section".to_owned(),
+                });
             }
-            byte => {
-                return Err(ParseError::UnexpectedByte {
-                    pos: parser.source.byte_pos(),
-                    byte,
-                    expected: vec![
-                        consts::TOKEN_STATEMENT,
-                        consts::TOKEN_FUNCTION,
-                        consts::TOKEN_FILENAMES,
-                    ],
+        }
+
+        Ok(())
+    }
+
+    fn parse_types(&mut self, modules: &mut Modules) -> ParseResult<()> {
+        let n_types = self.parse_u32()?;
+
+        for _ in 0..n_types {
+            let id = self.parse_u64()?;
+            let name = self.parse_cstr()?;
+            let size = self.parse_u32()?;
+            let n_fields = self.parse_u32()?;
+
+            let fields = self.parse_vec(n_fields, |parser| {
+                let offset = parser.parse_u32()?;
+                let value_type = match parser.parse_u8()? {
+                    consts::TOKEN_DATA_I8 => ValueType::I8,
+                    consts::TOKEN_DATA_I16 => ValueType::I16,
+                    consts::TOKEN_DATA_I32 => ValueType::I32,
+                    consts::TOKEN_DATA_I64 => ValueType::I64,
+                    consts::TOKEN_DATA_U8 => ValueType::U8,
+                    consts::TOKEN_DATA_U16 => ValueType::U16,
+                    consts::TOKEN_DATA_U32 => ValueType::U32,
+                    consts::TOKEN_DATA_U64 => ValueType::U64,
+                    consts::TOKEN_DATA_F32 => ValueType::F32,
+                    consts::TOKEN_DATA_F64 => ValueType::F64,
+                    consts::TOKEN_DATA_BOOL => ValueType::Boolean,
+                    _ => {
+                        return Err(ParseError::InvalidData {
+                            reason: "unknown type of composite type field".to_owned(),
+                        })
+                    }
+                };
+                let name = parser.parse_cstr()?;
+
+                if offset as usize + value_type.size() > size as usize {
+                    return Err(ParseError::InvalidData {
+                        reason: "field exceeds the size of its composite type".to_owned(),
+                    });
+                }
+
+                Ok(FieldLayout {
+                    name,
+                    offset,
+                    value_type,
                 })
+            })?;
+
+            modules.types.insert(id, TypeLayout { name, size, fields });
+        }
+
+        Ok(())
+    }
+
+    fn parse_function_body(
+        &mut self,
+        func: S<FuncName>,
+        end: u64,
+        compact: bool,
+        modules: &mut Modules,
+    ) -> ParseResult<HashMap<StmtId, P<Statement>>> {
+        let mut statements = HashMap::new();
+        // Statement whose only successor is the next statement, which is not
+        // known until it is parsed.
+        let mut pending: Option<(Statement, Vec<u8>)> = None;
+
+        while (self.source.byte_pos() as u64) < end {
+            let token = self.parse_u8()?;
+
+            if token != consts::TOKEN_STATEMENT && pending.is_some() {
+                return Err(ParseError::InvalidData {
+                    reason: "implied successor is not a statement".to_owned(),
+                });
+            }
+
+            match token {
+                consts::TOKEN_STATEMENT => {
+                    let (stmt, buffer, implied) = self.parse_stmt_record(func, compact)?;
+
+                    if let Some((mut prev, buffer)) = pending.take() {
+                        prev.succ.push(stmt.id);
+                        let (id, ptr) = self.alloc_stmt(prev, &buffer);
+                        statements.insert(id, ptr);
+                    }
+
+                    if implied {
+                        pending = Some((stmt, buffer));
+                    } else {
+                        let (id, ptr) = self.alloc_stmt(stmt, &buffer);
+                        statements.insert(id, ptr);
+                    }
+                }
+                consts::TOKEN_TRACE_BLOCK => self.parse_trace_block(&statements, modules)?,
+                consts::TOKEN_INDUCTION_STEP => self.parse_induction_step(&statements, modules)?,
+                byte => {
+                    return Err(ParseError::UnexpectedByte {
+                        pos: self.source.byte_pos(),
+                        byte,
+                        expected: vec![
+                            consts::TOKEN_STATEMENT,
+                            consts::TOKEN_TRACE_BLOCK,
+                            consts::TOKEN_INDUCTION_STEP,
+                        ],
+                    })
+                }
             }
         }
+
+        if pending.is_some() {
+            return Err(ParseError::InvalidData {
+                reason: "last statement of function has implied successor".to_owned(),
+            });
+        }
+
+        Ok(statements)
     }
 
-    if !statements.is_empty() {
-        if let Some(func) = func_ptr {
-            modules.functions.insert(func, statements);
-        } else {
+    fn parse_trace_block(
+        &mut self,
+        statements: &HashMap<StmtId, P<Statement>>,
+        modules: &mut Modules,
+    ) -> ParseResult<()> {
+        let id = self.parse_stmt_id()?;
+        let n_stmts = self.parse_u32()?;
+        let stmts = self.parse_vec(n_stmts, Self::parse_stmt_id)?;
+
+        // The statements of a block belong to the function which is currently
+        // being parsed.
+        let defs = stmts
+            .iter()
+            .map(|stmt| match statements.get(stmt) {
+                // Values of induction steps are not traced.
+                Some(ptr) => Ok(!self.arenas.stmt.get(ptr).defs.is_empty()
+                    && !modules.inductions.contains_key(stmt)),
+                None => Err(ParseError::InvalidData {
+                    reason: "trace block contains unknown statement".to_owned(),
+                }),
+            })
+            .collect::<ParseResult<_>>()?;
+
+        modules.blocks.insert(id, TraceBlock { stmts, defs });
+        Ok(())
+    }
+
+    fn parse_induction_step(
+        &mut self,
+        statements: &HashMap<StmtId, P<Statement>>,
+        modules: &mut Modules,
+    ) -> ParseResult<()> {
+        let id = self.parse_stmt_id()?;
+        let step = self.parse_i64()?;
+        let n_defs = self.parse_u32()?;
+        let defs = self.parse_vec(n_defs, Self::parse_stmt_id)?;
+
+        if !statements.contains_key(&id) {
             return Err(ParseError::InvalidData {
-                reason: "there are statements that do not belong to any function".to_owned(),
+                reason: "induction step is not a statement of the function".to_owned(),
             });
         }
+
+        modules.inductions.insert(id, InductionStep { step, defs });
+        Ok(())
     }
 
-    Ok(())
-}
+    fn parse_filenames(&mut self, modules: &mut Modules) -> ParseResult<()> {
+        let n_files = self.parse_u32()?;
+        for _ in 0..n_files {
+            let file_id = self.parse_file_id()?;
+            let filepath = self.parse_cstr()?;
+            modules
+                .files
+                .insert(file_id, self.arenas.file.alloc(filepath));
+        }
+        Ok(())
+    }
 
-pub(crate) fn parse_trace<'a, 'b, R: BufRead>(
-    source: &'a mut R,
-    trace: &mut Trace,
-    arenas: &'b mut Arenas,
-    ignore_corrupted: bool,
-) -> ParseResult<()> {
-    let mut parser = Parser::new(source, arenas);
+    fn skip_to(&mut self, pos: u64) -> ParseResult<()> {
+        let current = self.source.byte_pos() as u64;
+        if pos < current {
+            return Err(ParseError::InvalidData {
+                reason: "sections overlap".to_owned(),
+            });
+        }
 
-    match parser.parse_header()? {
-        Format {
-            kind: FormatKind::Runtime,
-            version: 1,
-        } => {}
-        Format {
-            kind: FormatKind::Runtime,
-            version,
-        } => return Err(ParseError::UnsupportedVersion { version }),
-        Format {
-            kind: FormatKind::Static,
-            ..
-        } => return Err(ParseError::InvalidFormat),
+        self.source.skip((pos - current) as usize)
     }
 
-    macro_rules! try_parse {
-        ($action:expr) => {
-            match $action {
-                Ok(value) => value,
-                Err(error) => {
-                    if ignore_corrupted {
-                        continue;
-                    } else {
-                        return Err(error.into());
+    fn parse_trace_stream(
+        &mut self,
+        trace: &mut Trace,
+        context: &TraceContext,
+        ignore_corrupted: bool,
+    ) -> ParseResult<()> {
+        let mut expander = BlockExpander::new(context.blocks);
+        let mut rebuilder = InductionRebuilder::new(context);
+        let mut expanded = Vec::new();
+        let mut state = CompactState::default();
+
+        while let Ok(token) = self.parse_u8() {
+            // Memory-mapped trace of a process that did not exit normally is
+            // padded with zeros up to the end of the file extent. If the
+            // process executed another program, its trace continues after the
+            // padding.
+            if token == 0 {
+                if self.source.skip_padding()? {
+                    break;
+                }
+
+                continue;
+            }
+
+            match self.parse_raw_item(token, &mut state) {
+                Ok(Some(RawItem::Status(test, status))) => trace.statuses.push((test, status)),
+                Ok(Some(raw_item)) => {
+                    expander.push(raw_item, &mut expanded)?;
+                    rebuilder.extend(expanded.drain(..), &mut trace.trace, &mut self.arenas.value);
+                }
+                Ok(None) => {}
+                // Read next byte.
+                Err(_) if ignore_corrupted => continue,
+                Err(error) => return Err(error),
+            }
+        }
+
+        expander.finish(&mut expanded);
+        rebuilder.extend(expanded.drain(..), &mut trace.trace, &mut self.arenas.value);
+        Ok(())
+    }
+
+    // Thread-tagged trace is a sequence of chunks, each containing the items of
+    // a single thread produced in a single test case (epoch). Test case markers
+    // written by external processes are outside of chunks and start a new
+    // segment of epochs. The chunks are demultiplexed such that the items of
+    // each thread form a contiguous sequence within the test case.
+    fn parse_trace_chunks(
+        &mut self,
+        trace: &mut Trace,
+        context: &TraceContext,
+        ignore_corrupted: bool,
+    ) -> ParseResult<()> {
+        let mut segments = BTreeMap::<(u64, u64), TraceSegment>::new();
+        let mut segment = 0;
+        let mut batch = Vec::new();
+        let mut batch_size = 0;
+
+        while let Ok(token) = self.parse_u8() {
+            match token {
+                consts::TOKEN_CHUNK => {
+                    let thread = self.parse_u64()?;
+                    let epoch = self.parse_u64()?;
+                    let size = self.parse_u32()? as usize;
+
+                    // Only the framing is read here, the payload is decoded
+                    // together with other chunks of the batch.
+                    let mut payload = vec![0; size];
+                    self.source.read_exact(&mut payload)?;
+
+                    batch_size += size;
+                    batch.push(RawChunk {
+                        segment,
+                        thread,
+                        epoch,
+                        payload,
+                    });
+
+                    if batch_size >= CHUNK_BATCH_SIZE {
+                        self.decode_chunks(&batch, &mut segments, trace, ignore_corrupted)?;
+                        batch.clear();
+                        batch_size = 0;
                     }
                 }
+                consts::TOKEN_EXTERNAL => {
+                    let parsed = self.parse_cstr()?;
+                    segment += 1;
+                    segments.entry((segment, 0)).or_default().test =
+                        Some(self.arenas.test.alloc(parsed));
+                }
+                _ if ignore_corrupted => continue,
+                byte => {
+                    return Err(ParseError::UnexpectedByte {
+                        pos: self.source.byte_pos(),
+                        byte,
+                        expected: vec![consts::TOKEN_CHUNK, consts::TOKEN_EXTERNAL],
+                    })
+                }
             }
-        };
+        }
+
+        self.decode_chunks(&batch, &mut segments, trace, ignore_corrupted)?;
+
+        for (_, trace_segment) in segments {
+            if let Some(test) = trace_segment.test {
+                trace.trace.push(TraceItem::Test(test));
+            }
+
+            for (_, items) in trace_segment.threads {
+                let mut expander = BlockExpander::new(context.blocks);
+                let mut expanded = Vec::new();
+
+                for raw_item in items {
+                    expander.push(raw_item, &mut expanded)?;
+                }
+
+                expander.finish(&mut expanded);
+
+                // Induction variables are local to the thread.
+                InductionRebuilder::new(context).extend(
+                    expanded.into_iter(),
+                    &mut trace.trace,
+                    &mut self.arenas.value,
+                );
+            }
+        }
+
+        Ok(())
+    }
+
+    // Chunks are independent (each has its own compact state), so the batch is
+    // split among workers which decode it into their own arenas. The results
+    // are then moved into the shared arenas in the order of the chunks, so the
+    // outcome does not depend on the number of workers.
+    fn decode_chunks(
+        &mut self,
+        chunks: &[RawChunk],
+        segments: &mut BTreeMap<(u64, u64), TraceSegment>,
+        trace: &mut Trace,
+        ignore_corrupted: bool,
+    ) -> ParseResult<()> {
+        if chunks.is_empty() {
+            return Ok(());
+        }
+
+        let n_workers = thread::available_parallelism()
+            .map(|n| n.get())
+            .unwrap_or(1)
+            .min(chunks.len());
+        let group_size = (chunks.len() + n_workers - 1) / n_workers;
+
+        let decoded = thread::scope(|scope| {
+            let workers = chunks
+                .chunks(group_size)
+                .map(|group| scope.spawn(move || decode_chunk_group(group, ignore_corrupted)))
+                .collect::<Vec<_>>();
+
+            workers
+                .into_iter()
+                .map(|worker| worker.join().expect("chunk decoding panicked"))
+                .collect::<Vec<_>>()
+        });
+
+        for (group, result) in chunks.chunks(group_size).zip(decoded) {
+            let (arenas, decoded) = result?;
+            let mapping = ChunkMapping::new(arenas, self.arenas);
+
+            for (chunk, decoded) in group.iter().zip(decoded) {
+                trace.statuses.extend(
+                    decoded
+                        .statuses
+                        .into_iter()
+                        .map(|(test, status)| (mapping.test(test), status)),
+                );
+
+                let trace_segment = segments.entry((chunk.segment, chunk.epoch)).or_default();
+
+                if let Some(test) = decoded.test {
+                    trace_segment.test = Some(mapping.test(test));
+                }
+
+                trace_segment
+                    .threads
+                    .entry(chunk.thread)
+                    .or_default()
+                    .extend(decoded.items.into_iter().map(|item| mapping.raw_item(item)));
+            }
+        }
+
+        Ok(())
+    }
+
+    fn parse_chunk(&mut self, size: usize, ignore_corrupted: bool) -> ParseResult<DecodedChunk> {
+        let mut decoded = DecodedChunk::default();
+        let mut state = CompactState::default();
+
+        while self.source.byte_pos() < size {
+            let token = self.parse_u8()?;
+            match self.parse_raw_item(token, &mut state) {
+                Ok(None) => {}
+                Ok(Some(RawItem::Item(TraceItem::Test(name)))) => decoded.test = Some(name),
+                Ok(Some(RawItem::Status(test, status))) => decoded.statuses.push((test, status)),
+                Ok(Some(raw_item)) => decoded.items.push(raw_item),
+                // We cannot synchronize inside the chunk, skip the rest of it.
+                Err(_) if ignore_corrupted => break,
+                Err(error) => return Err(error),
+            }
+        }
+
+        Ok(decoded)
+    }
+
+    // Compact encoding (AARD/D3) extends the chunks with file index definitions,
+    // strings interned in the string table of the chunk and statements encoded
+    // relatively to the previous one. Tokens which do not produce any trace item
+    // return None.
+    fn parse_raw_item(
+        &mut self,
+        token: u8,
+        state: &mut CompactState,
+    ) -> ParseResult<Option<RawItem>> {
+        match token {
+            consts::TOKEN_FILE_INDEX => {
+                let index = self.parse_varint()?;
+                let file_id = self.parse_file_id()?;
+                state.files.insert(index, file_id);
+                state.current_file = Some(file_id);
+                Ok(None)
+            }
+            consts::TOKEN_FILE_SWITCH => {
+                let index = self.parse_varint()?;
+                match state.files.get(&index) {
+                    Some(file_id) => {
+                        state.current_file = Some(*file_id);
+                        Ok(None)
+                    }
+                    None => Err(ParseError::InvalidData {
+                        reason: format!("undefined file index {}", index),
+                    }),
+                }
+            }
+            consts::TOKEN_STATEMENT_DELTA => {
+                let zigzag = self.parse_varint()?;
+                let delta = ((zigzag >> 1) as i64) ^ -((zigzag & 1) as i64);
+                let stmt_id = state.last_stmt.wrapping_add(delta as u64);
+                state.last_stmt = stmt_id;
+
+                match state.current_file {
+                    Some(file_id) => Ok(Some(RawItem::Item(TraceItem::Statement(StmtId::new(
+                        self.arenas.stmt_id.get((file_id, stmt_id)),
+                    ))))),
+                    None => Err(ParseError::InvalidData {
+                        reason: String::from("statement without file index"),
+                    }),
+                }
+            }
+            consts::TOKEN_BLOCK => Ok(Some(RawItem::Block(self.parse_stmt_id()?))),
+            consts::TOKEN_TEST_STATUS => {
+                let status = self.parse_test_status()?;
+                let parsed = self.parse_cstr()?;
+                Ok(Some(RawItem::Status(
+                    self.arenas.test.alloc(parsed),
+                    status,
+                )))
+            }
+            consts::TOKEN_STRING => {
+                let index = self.parse_varint()?;
+                let parsed = self.parse_cstr()?;
+                state.strings.insert(index, self.arenas.test.alloc(parsed));
+                Ok(None)
+            }
+            consts::TOKEN_EXTERNAL_REF => {
+                let test = Self::lookup_string(state, self.parse_varint()?)?;
+                Ok(Some(RawItem::Item(TraceItem::Test(test))))
+            }
+            consts::TOKEN_TEST_STATUS_REF => {
+                let status = self.parse_test_status()?;
+                let test = Self::lookup_string(state, self.parse_varint()?)?;
+                Ok(Some(RawItem::Status(test, status)))
+            }
+            consts::TOKEN_DATA_NAMED_REF => {
+                Self::lookup_string(state, self.parse_varint()?)?;
+                Ok(Some(RawItem::Item(TraceItem::Value(
+                    self.arenas
+                        .value
+                        .alloc(Value::Unsupported, ValueType::Unsupported),
+                ))))
+            }
+            _ => self
+                .parse_trace_item(token)
+                .map(|item| Some(RawItem::Item(item))),
+        }
     }
 
-    while let Ok(token) = parser.parse_u8() {
-        let trace_item = match token {
-            consts::TOKEN_STATEMENT => TraceItem::Statement(try_parse!(parser.parse_stmt_id())),
+    fn parse_test_status(&mut self) -> ParseResult<TestStatus> {
+        match self.parse_u8()? {
+            consts::TEST_FAILED => Ok(TestStatus::Failed),
+            consts::TEST_PASSED => Ok(TestStatus::Passed),
+            status => Err(ParseError::InvalidData {
+                reason: format!("invalid test status {}", status),
+            }),
+        }
+    }
+
+    fn lookup_string(state: &CompactState, index: u64) -> ParseResult<S<TestName>> {
+        match state.strings.get(&index) {
+            Some(string) => Ok(*string),
+            None => Err(ParseError::InvalidData {
+                reason: format!("undefined string index {}", index),
+            }),
+        }
+    }
+
+    fn parse_trace_item(&mut self, token: u8) -> ParseResult<TraceItem> {
+        match token {
+            consts::TOKEN_STATEMENT => Ok(TraceItem::Statement(self.parse_stmt_id()?)),
+            consts::TOKEN_GAP => Ok(TraceItem::Gap),
             consts::TOKEN_EXTERNAL => {
-                let parsed = try_parse!(parser.parse_cstr());
-                TraceItem::Test(parser.arenas.test.alloc(parsed))
+                let parsed = self.parse_cstr()?;
+                Ok(TraceItem::Test(self.arenas.test.alloc(parsed)))
             }
             consts::TOKEN_DATA_UNSUPPORTED
             | consts::TOKEN_DATA_I8
@@ -324,110 +1350,59 @@ pub(crate) fn parse_trace<'a, 'b, R: BufRead>(
             | consts::TOKEN_DATA_U64
             | consts::TOKEN_DATA_F32
             | consts::TOKEN_DATA_F64
-            | consts::TOKEN_DATA_BOOL => TraceItem::Value(try_parse!(parser.parse_value(token))),
-            byte => {
-                if ignore_corrupted {
-                    // Read next byte.
-                    continue;
-                } else {
-                    return Err(ParseError::UnexpectedByte {
-                        pos: parser.source.byte_pos(),
-                        byte,
-                        expected: vec![
-                            consts::TOKEN_STATEMENT,
-                            consts::TOKEN_EXTERNAL,
-                            consts::TOKEN_DATA_UNSUPPORTED,
-                            consts::TOKEN_DATA_I8,
-                            consts::TOKEN_DATA_I16,
-                            consts::TOKEN_DATA_I32,
-                            consts::TOKEN_DATA_I64,
-                            consts::TOKEN_DATA_U8,
-                            consts::TOKEN_DATA_U16,
-                            consts::TOKEN_DATA_U32,
-                            consts::TOKEN_DATA_U64,
-                            consts::TOKEN_DATA_F32,
-                            consts::TOKEN_DATA_F64,
-                            consts::TOKEN_DATA_BOOL,
-                        ],
-                    });
-                }
-            }
-        };
-
-        trace.trace.push(trace_item);
-    }
-
-    Ok(())
-}
-
-pub(crate) fn parse_test_suite<'a, 'b, R: BufRead>(
-    source: &'a mut R,
-    test_suite: &mut TestSuite,
-    arenas: &'b mut Arenas,
-) -> ParseResult<()> {
-    let mut parser = Parser::new(source, arenas);
-
-    loop {
-        let mut line = String::new();
-        match parser.source.read_line(&mut line)? {
-            0 => return Ok(()),
-            _ => match &line[0..6] {
-                "PASS: " => test_suite.tests.insert(
-                    parser.arenas.test.alloc(line[6..].trim()),
-                    TestStatus::Passed,
-                ),
-                "FAIL: " => test_suite.tests.insert(
-                    parser.arenas.test.alloc(line[6..].trim()),
-                    TestStatus::Failed,
-                ),
-                result => {
-                    return Err(ParseError::InvalidTestResult {
-                        value: result.to_owned(),
-                    })
-                }
-            },
-        };
-    }
-}
-
-fn version_from_ascii(byte: u8) -> u8 {
-    byte.overflowing_sub('0' as u8).0
-}
-
-// Can be implemented as a normal function after const generics get stabilized.
-// Tracking issue: https://github.com/rust-lang/rust/issues/44580.
-macro_rules! read_n {
-    ($parser:expr, $n:expr) => {{
-        let mut buf = [0u8; $n];
-        $parser.source.read_exact(&mut buf).map(|_| buf)
-    }};
-}
-
-impl<'a, 'b, R: BufRead> Parser<'a, 'b, R> {
-    fn parse_header(&mut self) -> ParseResult<Format> {
-        let buf = read_n!(self, 7).map_err(|_| ParseError::InvalidFormat)?;
-        if &buf[0..6] == "AARD/S".as_bytes() {
-            Ok(Format {
-                kind: FormatKind::Static,
-                version: version_from_ascii(buf[6]),
-            })
-        } else if &buf[0..6] == "AARD/D".as_bytes() {
-            Ok(Format {
-                kind: FormatKind::Runtime,
-                version: version_from_ascii(buf[6]),
-            })
-        } else {
-            Err(ParseError::InvalidFormat)
+            | consts::TOKEN_DATA_BOOL
+            | consts::TOKEN_DATA_NAMED
+            | consts::TOKEN_DATA_BLOB => Ok(TraceItem::Value(self.parse_value(token)?)),
+            byte => Err(ParseError::UnexpectedByte {
+                pos: self.source.byte_pos(),
+                byte,
+                expected: vec![
+                    consts::TOKEN_STATEMENT,
+                    consts::TOKEN_EXTERNAL,
+                    consts::TOKEN_DATA_UNSUPPORTED,
+                    consts::TOKEN_DATA_I8,
+                    consts::TOKEN_DATA_I16,
+                    consts::TOKEN_DATA_I32,
+                    consts::TOKEN_DATA_I64,
+                    consts::TOKEN_DATA_U8,
+                    consts::TOKEN_DATA_U16,
+                    consts::TOKEN_DATA_U32,
+                    consts::TOKEN_DATA_U64,
+                    consts::TOKEN_DATA_F32,
+                    consts::TOKEN_DATA_F64,
+                    consts::TOKEN_DATA_BOOL,
+                    consts::TOKEN_DATA_NAMED,
+                    consts::TOKEN_DATA_BLOB,
+                ],
+            }),
         }
     }
 
     fn parse_stmt(&mut self, func: S<FuncName>) -> ParseResult<(StmtId, P<Statement>)> {
+        let (stmt, buffer, _) = self.parse_stmt_record(func, false)?;
+        Ok(self.alloc_stmt(stmt, &buffer))
+    }
+
+    // Parses the statement without allocating it, because its successors may
+    // not be complete. Returns also the bytes identifying the statement and
+    // whether the next statement is its implied successor (compact format
+    // only).
+    fn parse_stmt_record(
+        &mut self,
+        func: S<FuncName>,
+        compact: bool,
+    ) -> ParseResult<(Statement, Vec<u8>, bool)> {
         self.buffer.clear();
         let id = self.parse_stmt_id()?;
         let buffer = self.buffer.clone();
 
         let n_succ = self.parse_u8()?;
-        let succ = self.parse_vec(n_succ, Self::parse_stmt_id)?;
+        let implied = compact && n_succ == consts::SUCC_NEXT;
+        let succ = if implied {
+            Vec::with_capacity(1)
+        } else {
+            self.parse_vec(n_succ, Self::parse_stmt_id)?
+        };
 
         let n_defs = self.parse_u8()?;
         let defs = self.parse_vec(n_defs, Self::parse_access)?;
@@ -440,20 +1415,22 @@ impl<'a, 'b, R: BufRead> Parser<'a, 'b, R> {
         let loc = self.parse_loc()?;
         let metadata = self.parse_metadata()?;
 
-        let ptr = self.arenas.stmt.alloc(
-            Statement {
-                id,
-                succ,
-                defs,
-                uses,
-                loc,
-                metadata,
-                func,
-            },
-            &buffer,
-        );
+        let stmt = Statement {
+            id,
+            succ,
+            defs,
+            uses,
+            loc,
+            metadata,
+            func,
+        };
+
+        Ok((stmt, buffer, implied))
+    }
 
-        Ok((id, ptr))
+    fn alloc_stmt(&mut self, stmt: Statement, buffer: &[u8]) -> (StmtId, P<Statement>) {
+        let id = stmt.id;
+        (id, self.arenas.stmt.alloc(stmt, buffer))
     }
 
     fn parse_stmt_id(&mut self) -> ParseResult<StmtId> {
@@ -574,6 +1551,21 @@ impl<'a, 'b, R: BufRead> Parser<'a, 'b, R> {
                 let (value, value_type) = parsed.into_value();
                 self.arenas.value.alloc(value, value_type)
             }
+            consts::TOKEN_DATA_NAMED => {
+                // Named values (e.g., enumeration variants) are not supported
+                // by the analysis yet.
+                self.parse_cstr()?;
+                self.arenas
+                    .value
+                    .alloc(Value::Unsupported, ValueType::Unsupported)
+            }
+            consts::TOKEN_DATA_BLOB => {
+                let type_id = self.parse_u64()?;
+                let size = self.parse_u32()?;
+                let mut bytes = vec![0; size as usize];
+                self.source.read_exact(&mut bytes)?;
+                self.arenas.value.alloc_blob(type_id, &bytes)
+            }
             _ => unreachable!(),
         };
 
@@ -624,6 +1616,24 @@ impl<'a, 'b, R: BufRead> Parser<'a, 'b, R> {
         Ok(u64::from_ne_bytes(read_n!(self, 8)?))
     }
 
+    // LEB128 encoding of unsigned integers.
+    fn parse_varint(&mut self) -> ParseResult<u64> {
+        let mut value = 0u64;
+        let mut shift = 0;
+
+        loop {
+            let byte = self.parse_u8()?;
+            if shift < 64 {
+                value |= ((byte & 0x7f) as u64) << shift;
+            }
+            shift += 7;
+
+            if byte & 0x80 == 0 {
+                return Ok(value);
+            }
+        }
+    }
+
     fn parse_f32(&mut self) -> ParseResult<f32> {
         Ok(f32::from_ne_bytes(read_n!(self, 4)?))
     }
@@ -649,3 +1659,750 @@ impl<'a, 'b, R: BufRead> Parser<'a, 'b, R> {
         })
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn chunk(thread: u64, epoch: u64, payload: &[u8]) -> Vec<u8> {
+        let mut bytes = vec![consts::TOKEN_CHUNK];
+        bytes.extend_from_slice(&thread.to_ne_bytes());
+        bytes.extend_from_slice(&epoch.to_ne_bytes());
+        bytes.extend_from_slice(&(payload.len() as u32).to_ne_bytes());
+        bytes.extend_from_slice(payload);
+        bytes
+    }
+
+    fn stmt(id: u64) -> Vec<u8> {
+        let mut bytes = vec![consts::TOKEN_STATEMENT];
+        bytes.extend_from_slice(&1u64.to_ne_bytes());
+        bytes.extend_from_slice(&id.to_ne_bytes());
+        bytes
+    }
+
+    #[test]
+    fn thread_tagged_chunks_demultiplexed() {
+        let mut external = vec![consts::TOKEN_EXTERNAL];
+        external.extend_from_slice(b"test\0");
+
+        let mut bytes = b"AARD/D2".to_vec();
+        bytes.extend(chunk(1, 1, &[external, stmt(1)].concat()));
+        bytes.extend(chunk(2, 1, &stmt(2)));
+        bytes.extend(chunk(1, 1, &stmt(3)));
+        bytes.extend(chunk(1, 0, &stmt(4)));
+
+        let mut arenas = Arenas::new();
+        let mut trace = Trace::new();
+        parse_trace(
+            &mut bytes.as_slice(),
+            &mut trace,
+            &Modules::new(),
+            &mut arenas,
+            false,
+        )
+        .unwrap();
+
+        let ids = [4, 1, 3, 2]
+            .iter()
+            .map(|id| StmtId::new(arenas.stmt_id.get((FileId::new(1), *id))))
+            .collect::<Vec<_>>();
+
+        let test = arenas.test.alloc("test");
+
+        match trace.trace.as_slice() {
+            [TraceItem::Statement(s4), TraceItem::Test(t), TraceItem::Statement(s1), TraceItem::Statement(s3), TraceItem::Statement(s2)] =>
+            {
+                assert_eq!(vec![*s4, *s1, *s3, *s2], ids);
+                assert!(*t == test);
+            }
+            _ => panic!("unexpected trace structure"),
+        }
+    }
+
+    #[test]
+    fn chunks_decoded_in_parallel() {
+        let mut bytes = b"AARD/D2".to_vec();
+
+        for test in 0..16u64 {
+            bytes.push(consts::TOKEN_EXTERNAL);
+            bytes.extend_from_slice(format!("test{}\0", test).as_bytes());
+
+            for thread in 0..4u64 {
+                let mut payload = stmt(test * 4 + thread);
+                payload.push(consts::TOKEN_DATA_I32);
+                payload.extend_from_slice(&((test * 4 + thread) as i32).to_ne_bytes());
+                bytes.extend(chunk(thread, 0, &payload));
+            }
+        }
+
+        let mut arenas = Arenas::new();
+        let mut trace = Trace::new();
+        parse_trace(
+            &mut bytes.as_slice(),
+            &mut trace,
+            &Modules::new(),
+            &mut arenas,
+            false,
+        )
+        .unwrap();
+        trace.index_tests();
+
+        for test in 0..16u64 {
+            let name = arenas.test.alloc(format!("test{}", test));
+            let items = trace.find_test(&name).collect::<Vec<_>>();
+            assert_eq!(items.len(), 8);
+
+            for (thread, pair) in items.chunks(2).enumerate() {
+                let expected = test * 4 + thread as u64;
+                match pair {
+                    [TraceItem::Statement(stmt), TraceItem::Value(value)] => {
+                        assert_eq!(
+                            *stmt,
+                            StmtId::new(arenas.stmt_id.get((FileId::new(1), expected)))
+                        );
+                        assert_eq!(
+                            arenas.value.value(value).0.as_signed(),
+                            Some(expected as i64)
+                        );
+                    }
+                    _ => panic!("unexpected trace structure"),
+                }
+            }
+        }
+    }
+
+    #[test]
+    fn process_traces_merged() {
+        let external = |name: &str| {
+            let mut bytes = vec![consts::TOKEN_EXTERNAL];
+            bytes.extend_from_slice(name.as_bytes());
+            bytes.push(0);
+            bytes
+        };
+
+        let main = [
+            b"AARD/D1".to_vec(),
+            external("t1"),
+            stmt(1),
+            external("t2"),
+            stmt(2),
+        ]
+        .concat();
+        // Forked in t1, then ran its own test case.
+        let child = [
+            b"AARD/D1".to_vec(),
+            external("t1"),
+            stmt(3),
+            external("c"),
+            stmt(4),
+        ]
+        .concat();
+        // Forked before any test case.
+        let orphan = [b"AARD/D1".to_vec(), stmt(5)].concat();
+
+        let mut arenas = Arenas::new();
+        let mut trace = Trace::new();
+
+        for (index, bytes) in [main, child, orphan].iter().enumerate() {
+            let start = trace.trace.len();
+            parse_trace(
+                &mut bytes.as_slice(),
+                &mut trace,
+                &Modules::new(),
+                &mut arenas,
+                false,
+            )
+            .unwrap();
+
+            if index > 0 {
+                trace.strip_untested(start);
+            }
+        }
+
+        trace.group_tests();
+
+        let ids = [1, 3, 2, 4]
+            .iter()
+            .map(|id| StmtId::new(arenas.stmt_id.get((FileId::new(1), *id))))
+            .collect::<Vec<_>>();
+        let tests = ["t1", "t2", "c"]
+            .iter()
+            .map(|name| arenas.test.alloc(*name))
+            .collect::<Vec<_>>();
+
+        match trace.trace.as_slice() {
+            [TraceItem::Test(t1), TraceItem::Statement(s1), TraceItem::Statement(s3), TraceItem::Test(t2), TraceItem::Statement(s2), TraceItem::Test(c), TraceItem::Statement(s4)] =>
+            {
+                assert_eq!(vec![*t1, *t2, *c], tests);
+                assert_eq!(vec![*s1, *s3, *s2, *s4], ids);
+            }
+            _ => panic!("unexpected trace structure"),
+        }
+    }
+
+    #[test]
+    fn compressed_frames_decoded() {
+        let mut external = vec![consts::TOKEN_EXTERNAL];
+        external.extend_from_slice(b"test\0");
+
+        let parts = vec![
+            b"AARD/D2".to_vec(),
+            chunk(1, 1, &[external, stmt(1)].concat()),
+            chunk(2, 1, &stmt(2)),
+        ];
+
+        let mut bytes = Vec::new();
+        for part in parts.iter() {
+            bytes.extend(zstd::encode_all(part.as_slice(), 1).unwrap());
+        }
+
+        let parse = |bytes: &[u8]| {
+            let mut arenas = Arenas::new();
+            let mut trace = Trace::new();
+            parse_trace(
+                &mut &bytes[..],
+                &mut trace,
+                &Modules::new(),
+                &mut arenas,
+                false,
+            )
+            .unwrap();
+
+            trace
+                .trace
+                .iter()
+                .map(|item| match item {
+                    TraceItem::Statement(_) => "stmt",
+                    TraceItem::Test(_) => "test",
+                    TraceItem::Value(_) => "value",
+                    TraceItem::Gap => "gap",
+                })
+                .collect::<Vec<_>>()
+        };
+
+        assert_eq!(parse(&bytes), parse(&parts.concat()));
+        assert_eq!(parse(&bytes), vec!["test", "stmt", "stmt"]);
+    }
+
+    #[test]
+    fn test_statuses_collected() {
+        let status = |name: &[u8], status: u8| {
+            let mut bytes = vec![consts::TOKEN_TEST_STATUS, status];
+            bytes.extend_from_slice(name);
+            bytes
+        };
+
+        let mut stream = b"AARD/D1".to_vec();
+        stream.extend([stmt(1), status(b"first\0", consts::TEST_PASSED)].concat());
+
+        let mut chunks = b"AARD/D2".to_vec();
+        chunks.extend(chunk(
+            1,
+            1,
+            &[stmt(1), status(b"second\0", consts::TEST_FAILED)].concat(),
+        ));
+
+        let mut arenas = Arenas::new();
+        let mut trace = Trace::new();
+
+        for bytes in [stream, chunks].iter() {
+            parse_trace(
+                &mut bytes.as_slice(),
+                &mut trace,
+                &Modules::new(),
+                &mut arenas,
+                false,
+            )
+            .unwrap();
+        }
+
+        assert_eq!(trace.trace.len(), 2);
+        assert_eq!(trace.statuses.len(), 2);
+
+        let first = arenas.test.alloc("first");
+        let second = arenas.test.alloc("second");
+
+        assert!(trace.statuses[0].0 == first && trace.statuses[0].1.is_passed());
+        assert!(trace.statuses[1].0 == second && trace.statuses[1].1.is_failed());
+    }
+
+    #[test]
+    fn gaps_kept_in_trace() {
+        let mut bytes = b"AARD/D1".to_vec();
+        bytes.extend([stmt(1), vec![consts::TOKEN_GAP], stmt(2)].concat());
+
+        let mut trace = Trace::new();
+        parse_trace(
+            &mut bytes.as_slice(),
+            &mut trace,
+            &Modules::new(),
+            &mut Arenas::new(),
+            false,
+        )
+        .unwrap();
+
+        let kinds = trace
+            .trace
+            .iter()
+            .map(|item| match item {
+                TraceItem::Statement(_) => 's',
+                TraceItem::Gap => 'g',
+                _ => '?',
+            })
+            .collect::<String>();
+
+        assert_eq!(kinds, "sgs");
+    }
+
+    #[test]
+    fn padding_skipped_between_events() {
+        let mut bytes = b"AARD/D1".to_vec();
+        bytes.extend([stmt(1), vec![0; 64], stmt(2), vec![0; 16]].concat());
+
+        let mut trace = Trace::new();
+        parse_trace(
+            &mut bytes.as_slice(),
+            &mut trace,
+            &Modules::new(),
+            &mut Arenas::new(),
+            false,
+        )
+        .unwrap();
+
+        assert_eq!(trace.trace.len(), 2);
+    }
+
+    #[test]
+    fn compact_statements_decoded() {
+        let mut payload = vec![consts::TOKEN_FILE_INDEX, 0];
+        payload.extend_from_slice(&7u64.to_ne_bytes());
+        // 300 = 0b10_0101100, zigzag encoded as 600.
+        payload.extend_from_slice(&[consts::TOKEN_STATEMENT_DELTA, 0xd8, 0x04]);
+        payload.extend_from_slice(&[consts::TOKEN_STATEMENT_DELTA, 0x03]);
+        payload.extend_from_slice(&[consts::TOKEN_FILE_INDEX, 1]);
+        payload.extend_from_slice(&9u64.to_ne_bytes());
+        payload.extend_from_slice(&[consts::TOKEN_STATEMENT_DELTA, 0x04]);
+        payload.extend_from_slice(&[consts::TOKEN_FILE_SWITCH, 0]);
+        payload.extend_from_slice(&[consts::TOKEN_STATEMENT_DELTA, 0x00]);
+
+        let mut bytes = b"AARD/D3".to_vec();
+        bytes.extend(chunk(1, 0, &payload));
+        // The state is reset in every chunk.
+        bytes.extend(chunk(1, 0, &stmt(5)));
+
+        let mut arenas = Arenas::new();
+        let mut trace = Trace::new();
+        parse_trace(
+            &mut bytes.as_slice(),
+            &mut trace,
+            &Modules::new(),
+            &mut arenas,
+            false,
+        )
+        .unwrap();
+
+        let ids = [(7, 300), (7, 298), (9, 300), (7, 300), (1, 5)]
+            .iter()
+            .map(|(file, id)| StmtId::new(arenas.stmt_id.get((FileId::new(*file), *id))))
+            .collect::<Vec<_>>();
+
+        let actual = trace
+            .trace
+            .iter()
+            .map(|item| match item {
+                TraceItem::Statement(stmt) => *stmt,
+                _ => panic!("unexpected trace item"),
+            })
+            .collect::<Vec<_>>();
+
+        assert_eq!(actual, ids);
+    }
+
+    #[test]
+    fn interned_strings_resolved() {
+        let mut payload = vec![consts::TOKEN_STRING, 5];
+        payload.extend_from_slice(b"first\0");
+        payload.extend_from_slice(&[consts::TOKEN_EXTERNAL_REF, 5]);
+        payload.extend(stmt(1));
+        payload.extend_from_slice(&[consts::TOKEN_TEST_STATUS_REF, consts::TEST_PASSED, 5]);
+
+        let mut bytes = b"AARD/D3".to_vec();
+        bytes.extend(chunk(1, 1, &payload));
+
+        let mut arenas = Arenas::new();
+        let mut trace = Trace::new();
+        parse_trace(
+            &mut bytes.as_slice(),
+            &mut trace,
+            &Modules::new(),
+            &mut arenas,
+            false,
+        )
+        .unwrap();
+
+        let first = arenas.test.alloc("first");
+
+        assert_eq!(trace.trace.len(), 2);
+        assert!(match trace.trace[0] {
+            TraceItem::Test(test) => test == first,
+            _ => false,
+        });
+        assert_eq!(trace.statuses.len(), 1);
+        assert!(trace.statuses[0].0 == first && trace.statuses[0].1.is_passed());
+
+        // The string table is reset in every chunk.
+        bytes.extend(chunk(1, 2, &[consts::TOKEN_EXTERNAL_REF, 5]));
+        let result = parse_trace(
+            &mut bytes.as_slice(),
+            &mut Trace::new(),
+            &Modules::new(),
+            &mut arenas,
+            false,
+        );
+
+        assert!(result.is_err());
+    }
+
+    #[test]
+    fn trace_blocks_expanded() {
+        let mut arenas = Arenas::new();
+        let ids = (0..4)
+            .map(|id| StmtId::new(arenas.stmt_id.get((FileId::new(1), id))))
+            .collect::<Vec<_>>();
+
+        let mut modules = Modules::new();
+        modules.blocks.insert(
+            ids[1],
+            TraceBlock {
+                stmts: vec![ids[1], ids[2], ids[3]],
+                defs: vec![true, false, true],
+            },
+        );
+
+        let mut block = stmt(1);
+        block[0] = consts::TOKEN_BLOCK;
+        let value = vec![consts::TOKEN_DATA_BOOL, 1];
+
+        let mut bytes = b"AARD/D1".to_vec();
+        bytes.extend([block.clone(), value.clone(), value.clone()].concat());
+        bytes.extend([block, stmt(0)].concat());
+
+        let mut trace = Trace::new();
+        parse_trace(
+            &mut bytes.as_slice(),
+            &mut trace,
+            &modules,
+            &mut arenas,
+            false,
+        )
+        .unwrap();
+
+        let actual = trace
+            .trace
+            .iter()
+            .map(|item| match item {
+                TraceItem::Statement(stmt) => Some(*stmt),
+                _ => None,
+            })
+            .collect::<Vec<_>>();
+
+        let expected = vec![
+            Some(ids[1]),
+            None,
+            Some(ids[2]),
+            Some(ids[3]),
+            None,
+            Some(ids[1]),
+            Some(ids[2]),
+            Some(ids[3]),
+            Some(ids[0]),
+        ];
+
+        assert_eq!(actual, expected);
+    }
+
+    #[test]
+    fn untraced_functions_marked() {
+        let mut bytes = b"AARD/S1".to_vec();
+        bytes.push(consts::TOKEN_FUNCTION);
+        bytes.extend_from_slice(b"hash\0");
+        bytes.push(consts::TOKEN_UNTRACED_FUNCTION);
+        bytes.push(consts::TOKEN_FUNCTION);
+        bytes.extend_from_slice(b"main\0");
+
+        let mut arenas = Arenas::new();
+        let mut modules = Modules::new();
+        parse_module(&mut bytes.as_slice(), &mut modules, &mut arenas).unwrap();
+
+        assert!(modules.untraced.contains(&arenas.func.alloc("hash")));
+        assert!(!modules.untraced.contains(&arenas.func.alloc("main")));
+    }
+
+    #[test]
+    fn sectioned_static_data_parsed() {
+        let static_stmt = |id: u64| {
+            let mut bytes = vec![consts::TOKEN_STATEMENT];
+            bytes.extend_from_slice(&1u64.to_ne_bytes());
+            bytes.extend_from_slice(&id.to_ne_bytes());
+            // No successors, defs and uses.
+            bytes.extend_from_slice(&[0, 0, 0]);
+            bytes.extend_from_slice(&1u64.to_ne_bytes());
+            bytes.extend_from_slice(&[0; 16]);
+            bytes.push(0);
+            bytes
+        };
+
+        let hash = static_stmt(1);
+        let main = [static_stmt(2), static_stmt(3)].concat();
+
+        let mut functions = 2u32.to_ne_bytes().to_vec();
+        for (name, flags, offset, size) in &[
+            ("hash", consts::FUNCTION_UNTRACED, 0, hash.len()),
+            ("main", 0, hash.len(), main.len()),
+        ] {
+            functions.extend_from_slice(name.as_bytes());
+            functions.push(0);
+            functions.push(*flags);
+            functions.extend_from_slice(&(*offset as u64).to_ne_bytes());
+            functions.extend_from_slice(&(*size as u64).to_ne_bytes());
+        }
+
+        let mut files = 1u32.to_ne_bytes().to_vec();
+        files.extend_from_slice(&1u64.to_ne_bytes());
+        files.extend_from_slice(b"/main.c\0");
+
+        let sections = [
+            (consts::SECTION_FUNCTIONS, functions),
+            (consts::SECTION_STATEMENTS, [hash, main].concat()),
+            (consts::SECTION_FILES, files),
+        ];
+
+        let mut bytes = b"AARD/S2".to_vec();
+        bytes.extend_from_slice(&(sections.len() as u32).to_ne_bytes());
+
+        let mut offset = bytes.len() + sections.len() * 17;
+        for (kind, section) in sections.iter() {
+            bytes.push(*kind);
+            bytes.extend_from_slice(&(offset as u64).to_ne_bytes());
+            bytes.extend_from_slice(&(section.len() as u64).to_ne_bytes());
+            offset += section.len();
+        }
+
+        for (_, section) in sections.iter() {
+            bytes.extend_from_slice(section);
+        }
+
+        let mut arenas = Arenas::new();
+        let mut modules = Modules::new();
+        parse_module(&mut bytes.as_slice(), &mut modules, &mut arenas).unwrap();
+
+        let hash = arenas.func.alloc("hash");
+        let main = arenas.func.alloc("main");
+
+        assert_eq!(modules.functions[&hash].len(), 1);
+        assert_eq!(modules.functions[&main].len(), 2);
+        assert!(modules.untraced.contains(&hash));
+        assert!(!modules.untraced.contains(&main));
+        assert_eq!(modules.files.len(), 1);
+    }
+
+    #[test]
+    fn implied_successors_resolved() {
+        let static_stmt = |id: u64, succ: &[u64]| {
+            let mut bytes = vec![consts::TOKEN_STATEMENT];
+            bytes.extend_from_slice(&1u64.to_ne_bytes());
+            bytes.extend_from_slice(&id.to_ne_bytes());
+            if succ.is_empty() {
+                bytes.push(consts::SUCC_NEXT);
+            } else {
+                bytes.push(succ.len() as u8);
+                for succ in succ {
+                    bytes.extend_from_slice(&1u64.to_ne_bytes());
+                    bytes.extend_from_slice(&succ.to_ne_bytes());
+                }
+            }
+            // No defs and uses.
+            bytes.extend_from_slice(&[0, 0]);
+            bytes.extend_from_slice(&1u64.to_ne_bytes());
+            bytes.extend_from_slice(&[0; 16]);
+            bytes.push(0);
+            bytes
+        };
+
+        // A loop whose body is straight-line.
+        let main = [
+            static_stmt(1, &[]),
+            static_stmt(2, &[]),
+            static_stmt(3, &[1, 4]),
+            static_stmt(4, &[1]),
+        ]
+        .concat();
+
+        let mut functions = 1u32.to_ne_bytes().to_vec();
+        functions.extend_from_slice(b"main\0");
+        functions.push(0);
+        functions.extend_from_slice(&0u64.to_ne_bytes());
+        functions.extend_from_slice(&(main.len() as u64).to_ne_bytes());
+
+        let build = |main: &[u8]| {
+            let mut bytes = b"AARD/S3".to_vec();
+            bytes.extend_from_slice(&2u32.to_ne_bytes());
+            let offset = bytes.len() + 2 * 17;
+            bytes.push(consts::SECTION_FUNCTIONS);
+            bytes.extend_from_slice(&(offset as u64).to_ne_bytes());
+            bytes.extend_from_slice(&(functions.len() as u64).to_ne_bytes());
+            bytes.push(consts::SECTION_STATEMENTS);
+            bytes.extend_from_slice(&((offset + functions.len()) as u64).to_ne_bytes());
+            bytes.extend_from_slice(&(main.len() as u64).to_ne_bytes());
+            bytes.extend_from_slice(&functions);
+            bytes.extend_from_slice(main);
+            bytes
+        };
+
+        let bytes = build(&main);
+        let mut arenas = Arenas::new();
+        let mut modules = Modules::new();
+        parse_module(&mut bytes.as_slice(), &mut modules, &mut arenas).unwrap();
+
+        let ids = (1..=4)
+            .map(|id| StmtId::new(arenas.stmt_id.get((FileId::new(1), id))))
+            .collect::<Vec<_>>();
+        let statements = &modules.functions[&arenas.func.alloc("main")];
+        let succ = |id: StmtId| arenas.stmt.get(&statements[&id]).succ.clone();
+
+        assert_eq!(succ(ids[0]), vec![ids[1]]);
+        assert_eq!(succ(ids[1]), vec![ids[2]]);
+        assert_eq!(succ(ids[2]), vec![ids[0], ids[3]]);
+        assert_eq!(succ(ids[3]), vec![ids[0]]);
+
+        // The last statement of a function cannot have an implied successor.
+        let main = [static_stmt(1, &[]), static_stmt(2, &[])].concat();
+        let bytes = build(&main);
+        let mut arenas = Arenas::new();
+        let mut modules = Modules::new();
+        assert!(parse_module(&mut bytes.as_slice(), &mut modules, &mut arenas).is_err());
+    }
+
+    #[test]
+    fn composite_values_decoded() {
+        let mut types = 1u32.to_ne_bytes().to_vec();
+        types.extend_from_slice(&42u64.to_ne_bytes());
+        types.extend_from_slice(b"{ i16, i1 }\0");
+        types.extend_from_slice(&4u32.to_ne_bytes());
+        types.extend_from_slice(&2u32.to_ne_bytes());
+        for (offset, token, name) in &[
+            (0u32, consts::TOKEN_DATA_I16, "0"),
+            (2, consts::TOKEN_DATA_BOOL, "1"),
+        ] {
+            types.extend_from_slice(&offset.to_ne_bytes());
+            types.push(*token);
+            types.extend_from_slice(name.as_bytes());
+            types.push(0);
+        }
+
+        let mut bytes = b"AARD/S2".to_vec();
+        bytes.extend_from_slice(&1u32.to_ne_bytes());
+        // The section follows right after its entry in the table.
+        let offset = bytes.len() + 17;
+        bytes.push(consts::SECTION_TYPES);
+        bytes.extend_from_slice(&(offset as u64).to_ne_bytes());
+        bytes.extend_from_slice(&(types.len() as u64).to_ne_bytes());
+        bytes.extend_from_slice(&types);
+
+        let mut arenas = Arenas::new();
+        let mut modules = Modules::new();
+        parse_module(&mut bytes.as_slice(), &mut modules, &mut arenas).unwrap();
+
+        let layout = &modules.types[&42];
+        assert_eq!(layout.size, 4);
+        assert_eq!(layout.fields.len(), 2);
+
+        let mut bytes = b"AARD/D1".to_vec();
+        bytes.extend(stmt(0));
+        bytes.push(consts::TOKEN_DATA_BLOB);
+        bytes.extend_from_slice(&42u64.to_ne_bytes());
+        bytes.extend_from_slice(&4u32.to_ne_bytes());
+        bytes.extend_from_slice(&(-3i16).to_ne_bytes());
+        bytes.extend_from_slice(&[1, 0]);
+
+        let mut trace = Trace::new();
+        parse_trace(
+            &mut bytes.as_slice(),
+            &mut trace,
+            &modules,
+            &mut arenas,
+            false,
+        )
+        .unwrap();
+
+        let value = match trace.trace[1] {
+            TraceItem::Value(value) => value,
+            _ => panic!("expected value"),
+        };
+
+        assert_eq!(arenas.value.value_type(&value), ValueType::Composite);
+        assert_eq!(
+            arenas.value.fields(&value, &modules.types),
+            Some(vec![
+                ("0", Value::Signed(-3), ValueType::I16),
+                ("1", Value::Boolean(true), ValueType::Boolean),
+            ])
+        );
+    }
+
+    #[test]
+    fn induction_steps_reconstructed() {
+        let mut arenas = Arenas::new();
+        let ids = (0..3)
+            .map(|id| StmtId::new(arenas.stmt_id.get((FileId::new(1), id))))
+            .collect::<Vec<_>>();
+
+        let mut modules = Modules::new();
+        modules.inductions.insert(
+            ids[2],
+            InductionStep {
+                step: -1,
+                defs: vec![ids[1]],
+            },
+        );
+
+        let value = |value: i32| {
+            let mut bytes = vec![consts::TOKEN_DATA_I32];
+            bytes.extend_from_slice(&value.to_ne_bytes());
+            bytes
+        };
+
+        let mut bytes = b"AARD/D1".to_vec();
+        bytes.extend([stmt(1), value(2), stmt(2), stmt(2)].concat());
+        bytes.extend([stmt(0), value(7), stmt(1), value(5), stmt(2)].concat());
+        bytes.extend([stmt(1), value(3), vec![consts::TOKEN_GAP], stmt(2)].concat());
+
+        let mut trace = Trace::new();
+        parse_trace(
+            &mut bytes.as_slice(),
+            &mut trace,
+            &modules,
+            &mut arenas,
+            false,
+        )
+        .unwrap();
+
+        let actual = trace
+            .trace
+            .iter()
+            .filter_map(|item| match item {
+                TraceItem::Value(value) => Some(arenas.value.value(value)),
+                _ => None,
+            })
+            .collect::<Vec<_>>();
+
+        let mut expected = [2, 1, 0, 7, 5, 4, 3]
+            .iter()
+            .map(|value| (Value::Signed(*value as i64), ValueType::I32))
+            .collect::<Vec<_>>();
+        // The base value is not known after the gap.
+        expected.push((Value::Unsupported, ValueType::Unsupported));
+
+        assert_eq!(actual, expected);
+    }
+}
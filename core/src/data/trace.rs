@@ -1,5 +1,8 @@
 //! Data related to the instrumented program execution.
 
+use std::collections::HashMap;
+
+use super::tests::TestStatus;
 use super::types::{StmtId, TestName};
 use super::values::ValueRef;
 use crate::arena::S;
@@ -12,27 +15,107 @@ pub enum TraceItem {
     Test(S<TestName>),
     /// Variable value.
     Value(ValueRef),
+    /// Indication that some items are missing at this place, because the
+    /// runtime did not trace some function invocations (sampling) or evicted
+    /// them from its flight recorder. The items around a gap are not
+    /// consecutive, although they are still correct.
+    Gap,
 }
 
 /// Runtime trace.
 ///
-/// It is simply a long sequence of items.
+/// It is simply a long sequence of items. If the program was traced per thread,
+/// the items of each thread within a test case follow each other.
 pub struct Trace {
     pub trace: Vec<TraceItem>,
+    /// Test statuses reported in the trace by in-process test frameworks. They
+    /// are moved into the test suite when the data are loaded.
+    pub(crate) statuses: Vec<(S<TestName>, TestStatus)>,
+    /// Position of the first item of each test case in the trace.
+    tests: HashMap<S<TestName>, usize>,
 }
 
 impl Trace {
     /// Initializes empty data.
     pub(crate) fn new() -> Self {
-        Trace { trace: Vec::new() }
+        Trace {
+            trace: Vec::new(),
+            statuses: Vec::new(),
+            tests: HashMap::new(),
+        }
+    }
+
+    /// Removes the items from given position up to the next test case marker.
+    /// A trace of another process appended at the position would otherwise
+    /// continue the last test case of the previous trace, although the items
+    /// were traced outside of any test case.
+    pub(crate) fn strip_untested(&mut self, start: usize) {
+        let end = self.trace[start..]
+            .iter()
+            .position(|item| match item {
+                TraceItem::Test(_) => true,
+                _ => false,
+            })
+            .map(|offset| start + offset)
+            .unwrap_or_else(|| self.trace.len());
+
+        self.trace.drain(start..end);
+    }
+
+    /// Moves the items of every test case which occurs in the trace more than
+    /// once (e.g., because it was traced by several processes) after its first
+    /// occurrence, so the items of each test case form a contiguous sequence.
+    pub(crate) fn group_tests(&mut self) {
+        let mut order = Vec::new();
+        let mut groups = HashMap::<S<TestName>, Vec<TraceItem>>::new();
+        let mut current = None;
+
+        for item in std::mem::take(&mut self.trace) {
+            match item {
+                TraceItem::Test(test) => {
+                    groups.entry(test).or_insert_with(|| {
+                        order.push(test);
+                        Vec::new()
+                    });
+                    current = Some(test);
+                }
+                item => match current {
+                    Some(test) => groups.get_mut(&test).unwrap().push(item),
+                    None => self.trace.push(item),
+                },
+            }
+        }
+
+        for test in order {
+            self.trace.push(TraceItem::Test(test));
+            self.trace.extend(groups.remove(&test).unwrap());
+        }
+    }
+
+    /// Records where the test cases start so they can be found without
+    /// scanning the whole trace.
+    pub(crate) fn index_tests(&mut self) {
+        self.tests.clear();
+
+        for (index, item) in self.trace.iter().enumerate() {
+            if let TraceItem::Test(test) = item {
+                self.tests.entry(*test).or_insert(index);
+            }
+        }
     }
 
     /// Filters the trace such that all the items belong to just the given test
     /// case.
     pub fn find_test(&self, test: &S<TestName>) -> TestTraceIter<'_> {
-        // FIXME: Very inefficient. Probably use global Vars query as before.
+        let start = match self.tests.get(test) {
+            Some(start) => *start,
+            // Not indexed, fall back to scanning.
+            None if self.tests.is_empty() => 0,
+            None => self.trace.len(),
+        };
+
         TestTraceIter {
-            inner: self.trace.iter(),
+            inner: self.trace[start..].iter(),
             state: TestTraceIterState::Fresh,
             test: *test,
         }
@@ -89,6 +89,10 @@ impl StmtId {
         StmtId(stmt_id as u32)
     }
 
+    pub(crate) fn as_index(&self) -> usize {
+        self.0 as usize
+    }
+
     #[cfg(test)]
     pub const fn new_test(stmt_id: usize) -> Self {
         StmtId(stmt_id as u32)
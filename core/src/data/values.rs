@@ -1,9 +1,12 @@
 //! Data related to variable trace.
 
+use std::collections::HashMap;
 use std::convert::TryInto;
 use std::fmt;
 use std::hash::{Hash, Hasher};
 
+use super::module::TypeLayout;
+
 /// Reference type for [`ValueArena`] container.
 ///
 /// [`ValueArena`]: struct.ValueArena.html
@@ -12,6 +15,18 @@ pub struct ValueRef {
     index: u32,
 }
 
+impl ValueRef {
+    /// Returns the reference moved by given base, used when the arena it
+    /// points to is appended to another one (see [`append`]).
+    ///
+    /// [`append`]: struct.ValueArena.html#method.append
+    pub(crate) fn rebase(self, base: u32) -> ValueRef {
+        ValueRef {
+            index: self.index + base,
+        }
+    }
+}
+
 /// An arena-like collection for variable values.
 ///
 /// The data are stored as raw bytes in a compressed form. Each item starts with
@@ -115,11 +130,90 @@ impl ValueArena {
             ValueType::Boolean => self
                 .storage
                 .extend_from_slice(&[consts::TYPE_BOOL, value.as_boolean().unwrap() as u8]),
+            ValueType::Composite => unreachable!("composite values are allocated as blobs"),
         };
 
         ptr
     }
 
+    /// Allocates raw bytes of a composite value of given type. The bytes are
+    /// decoded only when the fields are requested (see [`fields`]).
+    ///
+    /// [`fields`]: struct.ValueArena.html#method.fields
+    pub(crate) fn alloc_blob(&mut self, type_id: u64, bytes: &[u8]) -> ValueRef {
+        assert!(
+            self.storage.len() <= u32::MAX as usize,
+            "maximum number of values exceeded"
+        );
+        let ptr = ValueRef {
+            index: self.storage.len() as u32,
+        };
+
+        self.storage.push(consts::TYPE_BLOB);
+        self.storage.extend_from_slice(&type_id.to_ne_bytes());
+        self.storage
+            .extend_from_slice(&(bytes.len() as u32).to_ne_bytes());
+        self.storage.extend_from_slice(bytes);
+
+        ptr
+    }
+
+    /// Moves all values of other arena to the end of this one and returns the
+    /// base by which the references to the other arena must be rebased.
+    pub(crate) fn append(&mut self, mut other: ValueArena) -> u32 {
+        assert!(
+            self.storage.len() + other.storage.len() <= u32::MAX as usize,
+            "maximum number of values exceeded"
+        );
+        let base = self.storage.len() as u32;
+        self.storage.append(&mut other.storage);
+        base
+    }
+
+    /// Returns the type identifier and raw bytes of given reference if it is a
+    /// composite value.
+    pub fn blob(&self, ptr: &ValueRef) -> Option<(u64, &[u8])> {
+        if self.value_type(ptr) != ValueType::Composite {
+            return None;
+        }
+
+        let bytes = &self.storage[(ptr.index as usize + 1)..];
+        let type_id = u64::from_ne_bytes(bytes[0..8].try_into().unwrap());
+        let size = u32::from_ne_bytes(bytes[8..12].try_into().unwrap()) as usize;
+
+        Some((type_id, &bytes[12..(12 + size)]))
+    }
+
+    /// Decodes primitive fields of a composite value using given type layouts.
+    /// Returns `None` if the value is not composite or its type is unknown.
+    pub fn fields<'a>(
+        &self,
+        ptr: &ValueRef,
+        types: &'a HashMap<u64, TypeLayout>,
+    ) -> Option<Vec<(&'a str, Value, ValueType)>> {
+        let (type_id, bytes) = self.blob(ptr)?;
+        let layout = types.get(&type_id)?;
+
+        if layout.size as usize != bytes.len() {
+            return None;
+        }
+
+        let fields = layout
+            .fields
+            .iter()
+            .map(|field| {
+                let bytes = &bytes[(field.offset as usize)..];
+                (
+                    field.name.as_str(),
+                    decode_field(bytes, field.value_type),
+                    field.value_type,
+                )
+            })
+            .collect();
+
+        Some(fields)
+    }
+
     /// Returns data type of given reference. This is very cheap operation since
     /// the data type is determined by the token where the reference directly
     /// points to. If you need just the type and not the value, prefer this
@@ -139,6 +233,7 @@ impl ValueArena {
             consts::TYPE_F32 => ValueType::F32,
             consts::TYPE_F64 => ValueType::F64,
             consts::TYPE_BOOL => ValueType::Boolean,
+            consts::TYPE_BLOB => ValueType::Composite,
             _ => panic!("Invalid value allocation."),
         }
     }
@@ -196,12 +291,39 @@ impl ValueArena {
             ValueType::F32 => Value::Floating(decompress_numeric!(f32) as f64),
             ValueType::F64 => Value::Floating(decompress_numeric!(f64, f32)),
             ValueType::Boolean => Value::Boolean(bytes[0] > 0),
+            // Fields of composite values are obtained separately.
+            ValueType::Composite => Value::Unsupported,
         };
 
         (value, value_type)
     }
 }
 
+// Decodes a primitive field of a composite value. The bytes are in the native
+// byte order as they were copied from the memory of the program.
+fn decode_field(bytes: &[u8], value_type: ValueType) -> Value {
+    macro_rules! decode {
+        ($typ:ty) => {
+            <$typ>::from_ne_bytes(bytes[0..std::mem::size_of::<$typ>()].try_into().unwrap())
+        };
+    }
+
+    match value_type {
+        ValueType::U8 => Value::Unsigned(decode!(u8) as u64),
+        ValueType::U16 => Value::Unsigned(decode!(u16) as u64),
+        ValueType::U32 => Value::Unsigned(decode!(u32) as u64),
+        ValueType::U64 => Value::Unsigned(decode!(u64)),
+        ValueType::I8 => Value::Signed(decode!(i8) as i64),
+        ValueType::I16 => Value::Signed(decode!(i16) as i64),
+        ValueType::I32 => Value::Signed(decode!(i32) as i64),
+        ValueType::I64 => Value::Signed(decode!(i64)),
+        ValueType::F32 => Value::Floating(decode!(f32) as f64),
+        ValueType::F64 => Value::Floating(decode!(f64)),
+        ValueType::Boolean => Value::Boolean(bytes[0] & 1 != 0),
+        ValueType::Unsupported | ValueType::Composite => Value::Unsupported,
+    }
+}
+
 /// Data type of a value.
 ///
 /// This is the enumeration of all types which are supported by Aardwolf at the
@@ -221,6 +343,8 @@ pub enum ValueType {
     F32,
     F64,
     Boolean,
+    /// Structure, array or vector traced as raw bytes.
+    Composite,
 }
 
 /// Actual value of a variable.
@@ -335,6 +459,20 @@ impl fmt::Display for Value {
     }
 }
 
+impl ValueType {
+    /// Size of the primitive type in bytes. It is zero for types which are not
+    /// primitive.
+    pub fn size(&self) -> usize {
+        match self {
+            ValueType::Unsupported | ValueType::Composite => 0,
+            ValueType::U8 | ValueType::I8 | ValueType::Boolean => 1,
+            ValueType::U16 | ValueType::I16 => 2,
+            ValueType::U32 | ValueType::I32 | ValueType::F32 => 4,
+            ValueType::U64 | ValueType::I64 | ValueType::F64 => 8,
+        }
+    }
+}
+
 impl fmt::Display for ValueType {
     fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
         match self {
@@ -350,6 +488,7 @@ impl fmt::Display for ValueType {
             ValueType::F32 => write!(f, "float"),
             ValueType::F64 => write!(f, "double"),
             ValueType::Boolean => write!(f, "bool"),
+            ValueType::Composite => write!(f, "composite"),
         }
     }
 }
@@ -399,6 +538,14 @@ impl ValueRef {
     pub fn value_and_type(&self) -> (Value, ValueType) {
         Self::arena().value(self)
     }
+
+    /// Gets the decoded fields of a composite value from the arena.
+    pub fn fields<'a>(
+        &self,
+        types: &'a HashMap<u64, TypeLayout>,
+    ) -> Option<Vec<(&'a str, Value, ValueType)>> {
+        Self::arena().fields(self, types)
+    }
 }
 
 mod consts {
@@ -419,6 +566,7 @@ mod consts {
     pub const TYPE_F32: u8 = 0b001010 << SPLIT;
     pub const TYPE_F64: u8 = 0b001011 << SPLIT;
     pub const TYPE_BOOL: u8 = 0b001100 << SPLIT;
+    pub const TYPE_BLOB: u8 = 0b001101 << SPLIT;
 
     // Default is NONE.
     #[allow(dead_code)]
@@ -457,4 +605,52 @@ pub mod tests {
         assert_eq!(orig, parsed);
         assert_eq!(orig_type, parsed_type);
     }
+
+    #[test]
+    fn arena_blob_fields() {
+        use super::super::module::FieldLayout;
+
+        let mut arena = ValueArena::empty();
+        let mut types = HashMap::new();
+        types.insert(
+            42,
+            TypeLayout {
+                name: String::from("{ i32, double }"),
+                size: 16,
+                fields: vec![
+                    FieldLayout {
+                        name: String::from("0"),
+                        offset: 0,
+                        value_type: ValueType::I32,
+                    },
+                    FieldLayout {
+                        name: String::from("1"),
+                        offset: 8,
+                        value_type: ValueType::F64,
+                    },
+                ],
+            },
+        );
+
+        let mut bytes = Vec::new();
+        bytes.extend_from_slice(&(-7i32).to_ne_bytes());
+        bytes.extend_from_slice(&[0; 4]);
+        bytes.extend_from_slice(&2.5f64.to_ne_bytes());
+
+        let ptr = arena.alloc_blob(42, &bytes);
+        assert_eq!(
+            arena.value(&ptr),
+            (Value::Unsupported, ValueType::Composite)
+        );
+        assert_eq!(
+            arena.fields(&ptr, &types),
+            Some(vec![
+                ("0", Value::Signed(-7), ValueType::I32),
+                ("1", Value::Floating(2.5), ValueType::F64),
+            ])
+        );
+
+        let unknown = arena.alloc_blob(43, &bytes);
+        assert_eq!(arena.fields(&unknown, &types), None);
+    }
 }
@@ -2,17 +2,22 @@
 
 use std::cmp::Ordering;
 use std::collections::{BTreeMap, HashMap};
+use std::convert::TryFrom;
 use std::env;
 use std::fmt;
 use std::fs::{self, File};
-use std::io::{self, BufReader, Write};
+use std::io::{self, BufRead, BufReader, BufWriter, Write};
+use std::ops::Range;
 use std::path::{Path, PathBuf};
 use std::process::{self, Command};
+use std::thread;
+use std::time::Instant;
 
 use crate::api::Api;
 use crate::config::{Config, LoadConfigError};
 use crate::data::{ParseError, RawData};
 use crate::logger::Logger;
+use crate::mapped::Mapped;
 use crate::plugins::{
     collect_bb::CollectBb, invariants::Invariants, irrelevant::Irrelevant, prob_graph::ProbGraph,
     sbfl::Sbfl, AardwolfPlugin, Metadata, NormalizedResults, PluginError, PluginInitError,
@@ -23,6 +28,11 @@ use crate::ui::{CliUi, JsonUi, Ui, UiName};
 pub const TRACE_FILE: &'static str = "aard.trace";
 pub const RESULT_FILE: &'static str = "aard.result";
 pub const LOG_FILE: &'static str = "aard.log";
+pub const STATIC_CACHE_FILE: &'static str = "aard.static";
+
+// The cache of static data is `magic ; 4B for n_files ; n_files * 8B for size ;
+// contents of the files`, so it is loaded by a single read.
+const STATIC_CACHE_MAGIC: &'static [u8] = b"AARD/C1";
 
 pub const DEFAULT_CONFIG_FILE: &'static str = ".aardwolf.yml";
 pub const DEFAULT_SHELL: &'static str = "bash";
@@ -159,7 +169,11 @@ impl Driver {
         }
 
         let data_handle = logger.perf("load data");
-        let data = ui.unwrap(Self::load_data(&driver_paths, args.ignore_corrupted));
+        let data = ui.unwrap(Self::load_data(
+            &driver_paths,
+            args.reuse,
+            args.ignore_corrupted,
+        ));
         data_handle.stop();
 
         let api = ui.unwrap(Api::new(data));
@@ -227,24 +241,67 @@ impl Driver {
 
     fn load_data(
         driver_paths: &DriverPaths,
+        reuse: bool,
         ignore_corrupted: bool,
     ) -> Result<RawData, LoadDataError> {
-        let mut static_files = Self::find_static_files(driver_paths);
-        let mut dynamic_file =
-            BufReader::new(File::open(&driver_paths.trace_file).map_err(LoadDataError::Io)?);
-        let mut test_file =
-            BufReader::new(File::open(&driver_paths.result_file).map_err(LoadDataError::Io)?);
+        let static_data = Self::load_static_data(driver_paths, reuse).map_err(LoadDataError::Io)?;
+        let mut static_files = static_data.files();
+        let mut dynamic_files = vec![BufReader::new(
+            File::open(&driver_paths.trace_file).map_err(LoadDataError::Io)?,
+        )];
+
+        for path in Self::find_process_traces(driver_paths) {
+            dynamic_files.push(BufReader::new(File::open(path).map_err(LoadDataError::Io)?));
+        }
+
+        // Test statuses may be reported in the trace instead.
+        let mut test_file: Box<dyn BufRead> = if driver_paths.result_file.exists() {
+            Box::new(BufReader::new(
+                File::open(&driver_paths.result_file).map_err(LoadDataError::Io)?,
+            ))
+        } else {
+            Box::new(io::empty())
+        };
 
         RawData::parse(
             static_files.iter_mut(),
-            &mut dynamic_file,
+            dynamic_files.iter_mut(),
             &mut test_file,
             ignore_corrupted,
         )
         .map_err(LoadDataError::Parse)
     }
 
-    fn find_static_files(driver_paths: &DriverPaths) -> Vec<BufReader<File>> {
+    // Loads the contents of all static data files. When the data are reused,
+    // they are loaded from the cache instead of searching the output directory
+    // and mapping the files one by one. The cache is written by the first run
+    // which reuses the data, so the runs which generate them do not pay for
+    // it. It cannot be stale, since these runs remove it with the other data.
+    fn load_static_data(driver_paths: &DriverPaths, reuse: bool) -> io::Result<StaticData> {
+        let cache_file = driver_paths.output_dir.join(STATIC_CACHE_FILE);
+
+        if reuse {
+            if let Ok(cache) = Mapped::open(&cache_file) {
+                if let Some(static_data) = StaticData::from_cache(cache) {
+                    return Ok(static_data);
+                }
+            }
+        }
+
+        let mut static_data = StaticData::new();
+        for path in Self::find_static_files(driver_paths) {
+            static_data.push(Mapped::open(path)?);
+        }
+
+        // The cache is only an optimization for the next runs.
+        if reuse {
+            let _ = static_data.store(&cache_file);
+        }
+
+        Ok(static_data)
+    }
+
+    fn find_static_files(driver_paths: &DriverPaths) -> Vec<PathBuf> {
         let mut files = Vec::new();
 
         let mut dirs = vec![driver_paths.output_dir.clone()];
@@ -258,7 +315,7 @@ impl Driver {
                         if let Some("aard") =
                             entry_path.extension().map(|ext| ext.to_str().unwrap())
                         {
-                            files.push(BufReader::new(File::open(entry_path).unwrap()));
+                            files.push(entry_path);
                         }
                     } else if entry_path.is_dir() {
                         dirs.push(entry_path);
@@ -270,6 +327,31 @@ impl Driver {
         files
     }
 
+    // Traces of the processes forked or executed by the traced program, named
+    // by the process id (aard.trace.<pid>). They are sorted by the id, which
+    // mostly follows the order in which the processes were started.
+    fn find_process_traces(driver_paths: &DriverPaths) -> Vec<PathBuf> {
+        let prefix = format!("{}.", TRACE_FILE);
+        let mut files = Vec::new();
+
+        if let Ok(entries) = driver_paths.output_dir.read_dir() {
+            for entry in entries.filter_map(|entry| entry.ok()) {
+                let pid = entry
+                    .file_name()
+                    .to_str()
+                    .and_then(|name| name.strip_prefix(&prefix))
+                    .and_then(|pid| pid.parse::<u64>().ok());
+
+                if let Some(pid) = pid {
+                    files.push((pid, entry.path()));
+                }
+            }
+        }
+
+        files.sort();
+        files.into_iter().map(|(_, path)| path).collect()
+    }
+
     fn load_config<P: AsRef<Path>>(
         config_path: Option<P>,
     ) -> Result<(Config, PathBuf), LoadConfigError> {
@@ -346,15 +428,38 @@ impl Driver {
 
         let mut all_results = BTreeMap::new();
 
-        for (name, plugin) in plugins {
-            let id = LocalizationId::new(name, all_results.len());
-            let mut results = Results::new(Self::n_results(config, &id));
-
-            let handle = logger.perf(format!("{} (loc)", name));
-            plugin.run_loc(&api, &mut results, &preprocessing)?;
-            handle.stop();
+        // The plugins are independent in the localization stage and the
+        // queries they share are memoized in the API, so they run in parallel.
+        let localized = thread::scope(|scope| {
+            let workers = plugins
+                .iter()
+                .map(|(name, plugin)| {
+                    let preprocessing = &preprocessing;
+                    let mut results =
+                        Results::new(Self::n_results(config, &LocalizationId::new(name, 0)));
+
+                    scope.spawn(move || {
+                        let started = Instant::now();
+                        let status = plugin.run_loc(api, &mut results, preprocessing);
+                        (results, status, started.elapsed())
+                    })
+                })
+                .collect::<Vec<_>>();
+
+            workers
+                .into_iter()
+                .map(|worker| worker.join().expect("localization plugin panicked"))
+                .collect::<Vec<_>>()
+        });
+
+        // Results are collected in the order of the plugins, so the output is
+        // the same as if they ran one after another.
+        for ((name, _), (results, status, took)) in plugins.iter().zip(localized) {
+            logger.perf_took(format!("{} (loc)", name), took);
+            status?;
 
             if results.any() {
+                let id = LocalizationId::new(name, all_results.len());
                 all_results.insert(id, results.normalize());
             }
         }
@@ -444,6 +549,92 @@ impl Driver {
     }
 }
 
+/// Contents of all static data files, mapped into memory so they are parsed in
+/// place. If the data are loaded from the cache, all files share its mapping.
+struct StaticData {
+    storage: Vec<Mapped>,
+    files: Vec<(usize, Range<usize>)>,
+}
+
+impl StaticData {
+    fn new() -> Self {
+        StaticData {
+            storage: Vec::new(),
+            files: Vec::new(),
+        }
+    }
+
+    fn from_cache(cache: Mapped) -> Option<Self> {
+        let magic_len = STATIC_CACHE_MAGIC.len();
+
+        if cache.len() < magic_len + 4 || &cache[..magic_len] != STATIC_CACHE_MAGIC {
+            return None;
+        }
+
+        let mut n_files = [0; 4];
+        n_files.copy_from_slice(&cache[magic_len..magic_len + 4]);
+        let n_files = u32::from_le_bytes(n_files) as usize;
+
+        // The sizes come from the file, so a corrupted cache must not overflow.
+        let mut offset = n_files.checked_mul(8)?.checked_add(magic_len + 4)?;
+        if offset > cache.len() {
+            return None;
+        }
+
+        let mut files = Vec::with_capacity(n_files);
+
+        for index in 0..n_files {
+            let pos = magic_len + 4 + index * 8;
+            let mut size = [0; 8];
+            size.copy_from_slice(cache.get(pos..pos + 8)?);
+            let size = usize::try_from(u64::from_le_bytes(size)).ok()?;
+            let end = offset.checked_add(size)?;
+
+            files.push((0, offset..end));
+            offset = end;
+        }
+
+        if offset != cache.len() {
+            return None;
+        }
+
+        Some(StaticData {
+            storage: vec![cache],
+            files,
+        })
+    }
+
+    fn push(&mut self, contents: Mapped) {
+        self.files.push((self.storage.len(), 0..contents.len()));
+        self.storage.push(contents);
+    }
+
+    fn files(&self) -> Vec<&[u8]> {
+        self.files
+            .iter()
+            .map(|(index, range)| &self.storage[*index][range.clone()])
+            .collect()
+    }
+
+    fn store<P: AsRef<Path>>(&self, path: P) -> io::Result<()> {
+        let mut file = BufWriter::new(File::create(path)?);
+        let contents = self.files();
+
+        file.write_all(STATIC_CACHE_MAGIC)?;
+        file.write_all(&(contents.len() as u32).to_le_bytes())?;
+
+        for content in contents.iter() {
+            file.write_all(&(content.len() as u64).to_le_bytes())?;
+        }
+
+        for content in contents {
+            file.write_all(content)?;
+        }
+
+        file.flush()
+    }
+}
+
 enum RunScriptError {
     Initialization(io::Error),
     Execution(io::Error),
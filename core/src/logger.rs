@@ -4,7 +4,7 @@ use std::fmt;
 use std::fs::File;
 use std::io::prelude::*;
 use std::path::Path;
-use std::time::Instant;
+use std::time::{Duration, Instant};
 
 /// A simple logging system.
 pub struct Logger {
@@ -39,6 +39,15 @@ impl Logger {
         }
     }
 
+    /// Writes time execution log with given message for a measurement which
+    /// was taken elsewhere (e.g., in another thread).
+    pub fn perf_took<S: fmt::Display>(&mut self, id: S, took: Duration) {
+        self.log(
+            "perf",
+            format!("\"{}\" took {:.5} secs", id, took.as_secs_f32()),
+        );
+    }
+
     fn log<M: fmt::Display>(&mut self, header: &str, message: M) {
         writeln!(
             self.file,
@@ -61,8 +70,6 @@ pub struct PerfHandle<'a> {
 impl<'a> PerfHandle<'a> {
     /// Writes the message along with the elapsed time.
     pub fn stop(self) {
-        let elapsed = self.started.elapsed().as_secs_f32();
-        self.logger
-            .log("perf", format!("\"{}\" took {:.5} secs", self.id, elapsed));
+        self.logger.perf_took(self.id, self.started.elapsed());
     }
 }
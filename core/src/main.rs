@@ -6,6 +6,7 @@ pub mod data;
 mod driver;
 mod graph_ext;
 mod logger;
+mod mapped;
 pub mod plugins;
 pub mod queries;
 mod ui;
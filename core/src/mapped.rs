@@ -0,0 +1,130 @@
+//! Read-only file contents mapped into memory.
+
+use std::fs::File;
+use std::io;
+use std::ops::Deref;
+use std::path::Path;
+
+/// Contents of a file which are accessed in place, without reading them into
+/// a heap buffer first. The pages are loaded by the operating system only when
+/// they are touched.
+///
+/// The file must not be modified while it is mapped. This holds for Aardwolf
+/// data files, which are only written by the instrumented program and the
+/// driver before they are loaded.
+///
+/// On platforms without `mmap`, the contents are read into memory instead.
+pub struct Mapped {
+    inner: Inner,
+}
+
+enum Inner {
+    #[cfg(unix)]
+    Map {
+        ptr: *mut libc::c_void,
+        len: usize,
+    },
+    Owned(Vec<u8>),
+}
+
+impl Mapped {
+    pub fn open<P: AsRef<Path>>(path: P) -> io::Result<Self> {
+        let file = File::open(path)?;
+        let len = file.metadata()?.len() as usize;
+
+        // Mapping of an empty file fails.
+        if len == 0 {
+            return Ok(Mapped {
+                inner: Inner::Owned(Vec::new()),
+            });
+        }
+
+        Self::map(&file, len)
+    }
+
+    #[cfg(unix)]
+    fn map(file: &File, len: usize) -> io::Result<Self> {
+        use std::os::unix::io::AsRawFd;
+
+        let ptr = unsafe {
+            libc::mmap(
+                std::ptr::null_mut(),
+                len,
+                libc::PROT_READ,
+                libc::MAP_PRIVATE,
+                file.as_raw_fd(),
+                0,
+            )
+        };
+
+        if ptr == libc::MAP_FAILED {
+            return Err(io::Error::last_os_error());
+        }
+
+        Ok(Mapped {
+            inner: Inner::Map { ptr, len },
+        })
+    }
+
+    #[cfg(not(unix))]
+    fn map(mut file: &File, len: usize) -> io::Result<Self> {
+        use std::io::Read;
+
+        let mut buffer = Vec::with_capacity(len);
+        file.read_to_end(&mut buffer)?;
+
+        Ok(Mapped {
+            inner: Inner::Owned(buffer),
+        })
+    }
+}
+
+impl Deref for Mapped {
+    type Target = [u8];
+
+    fn deref(&self) -> &Self::Target {
+        match &self.inner {
+            #[cfg(unix)]
+            Inner::Map { ptr, len } => unsafe {
+                std::slice::from_raw_parts(*ptr as *const u8, *len)
+            },
+            Inner::Owned(buffer) => buffer.as_slice(),
+        }
+    }
+}
+
+impl Drop for Mapped {
+    fn drop(&mut self) {
+        #[cfg(unix)]
+        {
+            if let Inner::Map { ptr, len } = self.inner {
+                unsafe {
+                    libc::munmap(ptr, len);
+                }
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    use std::env;
+    use std::fs;
+
+    #[test]
+    fn mapped_contents_match() {
+        let path = env::temp_dir().join(format!("aardwolf-mapped-{}", std::process::id()));
+        fs::write(&path, b"AARD/S2 contents").unwrap();
+
+        let mapped = Mapped::open(&path).unwrap();
+        assert_eq!(&mapped[..], b"AARD/S2 contents");
+        drop(mapped);
+
+        fs::write(&path, b"").unwrap();
+        assert!(Mapped::open(&path).unwrap().is_empty());
+
+        fs::remove_file(&path).unwrap();
+    }
+}
@@ -476,7 +476,10 @@ pub type PluginInitError = String;
 // ```
 
 /// All plugins in Aardwolf implement this trait.
-pub trait AardwolfPlugin {
+///
+/// The localization stages of the plugins run in parallel, so the plugins must
+/// be shareable among threads.
+pub trait AardwolfPlugin: Sync {
     /// Initializes the plugin given the API and options.
     fn init(api: &Api, opts: &HashMap<String, Yaml>) -> Result<Self, PluginInitError>
     where
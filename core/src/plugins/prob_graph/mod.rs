@@ -1,7 +1,7 @@
 mod models;
 mod trace;
 
-use std::collections::{BTreeSet, HashMap};
+use std::collections::{BTreeSet, HashMap, HashSet};
 use std::hash::Hash;
 
 use yaml_rust::Yaml;
@@ -9,6 +9,8 @@ use yaml_rust::Yaml;
 use self::models::*;
 use self::trace::*;
 use crate::api::Api;
+use crate::arena::S;
+use crate::data::types::FuncName;
 use crate::plugins::{AardwolfPlugin, Preprocessing, PluginError, PluginInitError, Results};
 use crate::queries::Tests;
 
@@ -57,39 +59,53 @@ impl ProbGraph {
     ) -> Result<(), PluginError> {
         let tests = api.query::<Tests>()?;
 
-        let ppdg = self.learn_ppdg::<M>(api);
+        // Only the nodes from failing traces are localized, so the dependence
+        // graphs are built and learned only for the functions they execute.
+        let scope = tests
+            .iter_failed()
+            .flat_map(|test| tests.iter_stmts(test).unwrap())
+            .map(|stmt| stmt.as_ref().func)
+            .collect::<HashSet<_>>();
+
+        let ppdg = self.learn_ppdg::<M>(api, &scope);
 
         for test in tests.iter_failed() {
-            let trace: Trace<_, M> = Trace::new(tests.iter_stmts(test).unwrap().copied(), api);
+            let trace: Trace<_, M> =
+                Trace::new(tests.iter_stmts(test).unwrap().copied(), api, &scope);
             M::run_loc(trace, &ppdg, api, results)?;
         }
 
         Ok(())
     }
 
-    pub fn learn_ppdg<M: Model>(&self, api: &Api) -> Ppdg {
+    pub fn learn_ppdg<M: Model>(&self, api: &Api, scope: &HashSet<S<FuncName>>) -> Ppdg {
         let tests = api.query::<Tests>().unwrap();
         let mut ppdg = Ppdg::new();
 
         // Learn PPDG on passing tests.
         for test in tests.iter_passed() {
-            // We don't filter irrelevant statements because it might negatively affect the parent state computation.
-            let trace: Trace<_, M> = Trace::new(tests.iter_stmts(test).unwrap().copied(), api);
-
-            for item in trace {
-                // Increment n(X)
-                ppdg.inc_occurrence(item.node);
-
-                // Increment n(X = x)
-                ppdg.inc_state_conf(StateConf::from_node(item.node, item.node_state.clone()));
-
-                if let Some(mut parents_state_conf) = item.parents_state_conf {
-                    // Increment n(Pa(X) = pa)
-                    ppdg.inc_state_conf(parents_state_conf.clone());
-
-                    // Increment n(X = x, Pa(X) = pa)
-                    parents_state_conf.insert((item.node, item.node_state));
-                    ppdg.inc_state_conf(parents_state_conf);
+            // The states of the nodes would be computed from unrelated context
+            // across the gaps left by sampling, so each segment is learned
+            // separately.
+            for segment in tests.iter_segments(test).unwrap() {
+                // We don't filter irrelevant statements because it might negatively affect the parent state computation.
+                let trace: Trace<_, M> = Trace::new(segment.iter().copied(), api, scope);
+
+                for item in trace {
+                    // Increment n(X)
+                    ppdg.inc_occurrence(item.node);
+
+                    // Increment n(X = x)
+                    ppdg.inc_state_conf(StateConf::from_node(item.node, item.node_state.clone()));
+
+                    if let Some(mut parents_state_conf) = item.parents_state_conf {
+                        // Increment n(Pa(X) = pa)
+                        ppdg.inc_state_conf(parents_state_conf.clone());
+
+                        // Increment n(X = x, Pa(X) = pa)
+                        parents_state_conf.insert((item.node, item.node_state));
+                        ppdg.inc_state_conf(parents_state_conf);
+                    }
                 }
             }
         }
@@ -291,28 +291,28 @@ pub struct Trace<'a, I: Iterator<Item = P<Statement>>, M: Model> {
     next_items: VecDeque<TraceItem>,
     api: &'a Api,
     models: HashMap<S<FuncName>, M>,
+    scope: &'a HashSet<S<FuncName>>,
 }
 
 impl<'a, I: Iterator<Item = P<Statement>>, M: Model> Trace<'a, I, M> {
-    pub fn new(trace: I, api: &'a Api) -> Self {
+    /// Creates the trace whose items are generated only for the statements of
+    /// functions in given scope. The dependence graphs of other functions are
+    /// never built, but their statements are still followed to keep the stack
+    /// frames consistent.
+    pub fn new(trace: I, api: &'a Api, scope: &'a HashSet<S<FuncName>>) -> Self {
         Trace {
             stack_frames: vec![StackFrame::new()],
             trace: trace.peekable(),
             next_items: VecDeque::with_capacity(2),
             api,
             models: HashMap::new(),
+            scope,
         }
     }
-}
-
-impl<'a, I: Iterator<Item = P<Statement>>, M: Model> Iterator for Trace<'a, I, M> {
-    type Item = TraceItem;
-
-    fn next(&mut self) -> Option<Self::Item> {
-        if !self.next_items.is_empty() {
-            return self.next_items.pop_front();
-        }
 
+    // Processes the next statement in the trace, possibly generating some
+    // items. Returns None if the trace is exhausted.
+    fn advance(&mut self) -> Option<()> {
         let stmts = self.api.query::<Stmts>().unwrap();
 
         let stmt_ptr = self.trace.next()?;
@@ -320,6 +320,29 @@ impl<'a, I: Iterator<Item = P<Statement>>, M: Model> Iterator for Trace<'a, I, M
 
         let func = stmts.find_fn(&stmt.id).unwrap();
 
+        if self.scope.contains(func) {
+            self.generate_items(stmt_ptr, func);
+        }
+
+        if stmt.metadata.is_ret() {
+            // This statement returns from a function,
+            // hence we can throw associated stack frame away.
+            self.stack_frames.pop();
+        }
+
+        // We cannot use just stmt.is_call() because static analysis in some cases would not detect
+        // that the statement is call, especially in dynamic languages.
+        if let Some(next_stmt) = self.trace.peek() {
+            if !stmt.is_succ(next_stmt.as_ref()) {
+                // Initialize new stack frame which will be used in the called function.
+                self.stack_frames.push(StackFrame::new());
+            }
+        }
+
+        Some(())
+    }
+
+    fn generate_items(&mut self, stmt_ptr: P<Statement>, func: &S<FuncName>) {
         // There should always exist a stack frame. If there is not, then one of the following happened:
         //   * The function from top-level stack frame returned
         //     and there exists a statement in the trace that follows it.
@@ -373,20 +396,15 @@ impl<'a, I: Iterator<Item = P<Statement>>, M: Model> Iterator for Trace<'a, I, M
             self.next_items
                 .push_back(TraceItem::new(node, state, parents.canonicalize()));
         }
+    }
+}
 
-        if stmt.metadata.is_ret() {
-            // This statement returns from a function,
-            // hence we can throw associated stack frame away.
-            self.stack_frames.pop();
-        }
+impl<'a, I: Iterator<Item = P<Statement>>, M: Model> Iterator for Trace<'a, I, M> {
+    type Item = TraceItem;
 
-        // We cannot use just stmt.is_call() because static analysis in some cases would not detect
-        // that the statement is call, especially in dynamic languages.
-        if let Some(next_stmt) = self.trace.peek() {
-            if !stmt.is_succ(next_stmt.as_ref()) {
-                // Initialize new stack frame which will be used in the called function.
-                self.stack_frames.push(StackFrame::new());
-            }
+    fn next(&mut self) -> Option<Self::Item> {
+        while self.next_items.is_empty() {
+            self.advance()?;
         }
 
         self.next_items.pop_front()
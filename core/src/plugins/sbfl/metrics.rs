@@ -6,7 +6,7 @@ use crate::plugins::PluginInitError;
 
 const SAFE_DENOMINATOR: f32 = 0.5;
 
-pub trait Metric {
+pub trait Metric: Send + Sync {
     fn calc(&self, aep: f32, anp: f32, aef: f32, anf: f32) -> f32;
 }
 
@@ -12,28 +12,6 @@ use crate::plugins::{
 };
 use crate::queries::{Spectra, Stmts, Tests};
 
-struct Counters {
-    pub aep: f32,
-    pub anp: f32,
-    pub aef: f32,
-    pub anf: f32,
-}
-
-impl Counters {
-    fn new() -> Self {
-        Counters {
-            aep: 0.0,
-            anp: 0.0,
-            aef: 0.0,
-            anf: 0.0,
-        }
-    }
-
-    fn as_spectrum(&self) -> (f32, f32, f32, f32) {
-        (self.aep, self.anp, self.aef, self.anf)
-    }
-}
-
 pub struct Sbfl {
     metric: Box<dyn Metric>,
 }
@@ -62,34 +40,28 @@ impl AardwolfPlugin for Sbfl {
         rationale
             .add_text("The element is executed more in failing tests and less in passing tests.");
 
-        let mut counters = HashMap::new();
+        // The counts of all statements are computed on the packed coverage
+        // rows, so the test cases are not iterated per statement.
+        let passed = spectra.mask(tests.iter_passed());
+        let failed = spectra.mask(tests.iter_failed());
+        let n_passed = tests.iter_passed().count();
+        let n_failed = tests.iter_failed().count();
 
         for stmt in stmts
             .iter_stmts()
             .filter(|stmt| preprocessing.is_stmt_relevant(stmt.as_ref()))
         {
-            let stmt_counters = counters.entry(stmt).or_insert(Counters::new());
-
-            for test in tests.iter_names() {
-                match (
-                    spectra.is_executed_in(test, stmt.as_ref()),
-                    tests.is_passed(test),
-                ) {
-                    (false, false) => stmt_counters.anf += 1.0,
-                    (false, true) => stmt_counters.anp += 1.0,
-                    (true, false) => stmt_counters.aef += 1.0,
-                    (true, true) => stmt_counters.aep += 1.0,
-                }
-            }
-
-            let spectrum = stmt_counters.as_spectrum();
+            let aep = spectra.count_executed(&stmt.as_ref().id, &passed);
+            let aef = spectra.count_executed(&stmt.as_ref().id, &failed);
+            let anp = n_passed - aep;
+            let anf = n_failed - aef;
 
             results.add(
                 LocalizationItem::new(
                     stmt.as_ref().loc,
                     *stmt,
                     self.metric
-                        .calc(spectrum.0, spectrum.1, spectrum.2, spectrum.3),
+                        .calc(aep as f32, anp as f32, aef as f32, anf as f32),
                     rationale.clone(),
                 )
                 .unwrap(),
@@ -80,9 +80,10 @@ impl QueryArgs for () {
 /// Query is intended to provide high-level interface over raw data which should
 /// not be used in fault localization plugins directly. User is encouraged to
 /// implement their own queries.
-pub trait Query: Sized + 'static {
-    // The trait needs to be Sized due to use in Result and needs to be 'static
-    // in order to allow conversion to Any.
+pub trait Query: Sized + Send + Sync + 'static {
+    // The trait needs to be Sized due to use in Result, needs to be 'static in
+    // order to allow conversion to Any and needs to be Send and Sync so the
+    // memoized result can be shared among plugins running in parallel.
 
     /// Error type used when the query fails.
     type Error;
@@ -99,7 +100,7 @@ pub trait Query: Sized + 'static {
 
 #[derive(Debug)]
 pub enum QueryInitError {
-    Custom(Box<dyn fmt::Debug>),
+    Custom(Box<dyn fmt::Debug + Send>),
     InvalidFuncName(S<FuncName>),
     InvalidTestName(S<TestName>),
 }
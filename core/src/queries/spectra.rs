@@ -1,6 +1,6 @@
 //! Statement coverage spectrum for the whole program.
 
-use std::collections::{HashMap, HashSet};
+use std::collections::HashMap;
 
 use super::Query;
 use crate::api::Api;
@@ -12,16 +12,64 @@ use crate::data::{
     RawData,
 };
 
+const NO_ROW: u32 = u32::MAX;
+
+/// Coverage matrix of statements (rows) and test cases (columns). Each row is
+/// a packed bitset over the test cases, so the counts needed by spectrum-based
+/// techniques are computed by masking whole words and counting their bits.
 pub struct Spectra {
-    spectra: HashMap<S<TestName>, HashSet<StmtId>>,
+    tests: HashMap<S<TestName>, usize>,
+    // Row index of each statement, `NO_ROW` if it is never executed.
+    rows: Vec<u32>,
+    words: usize,
+    matrix: Vec<u64>,
 }
 
+/// Set of test cases in the layout of the rows of [`Spectra`].
+///
+/// [`Spectra`]: struct.Spectra.html
+pub struct TestMask(Vec<u64>);
+
 impl Spectra {
     pub fn is_executed_in(&self, test: &S<TestName>, stmt: &Statement) -> bool {
-        if let Some(stmts) = self.spectra.get(test) {
-            stmts.contains(&stmt.id)
-        } else {
-            false
+        match (self.tests.get(test), self.row(&stmt.id)) {
+            (Some(column), Some(row)) => row[column / 64] & (1 << (column % 64)) != 0,
+            _ => false,
+        }
+    }
+
+    /// Creates the mask of given test cases. Test cases which are not present
+    /// in the trace are ignored.
+    pub fn mask<'a>(&self, tests: impl Iterator<Item = &'a S<TestName>>) -> TestMask {
+        let mut mask = vec![0; self.words];
+
+        for column in tests.filter_map(|test| self.tests.get(test)) {
+            mask[column / 64] |= 1 << (column % 64);
+        }
+
+        TestMask(mask)
+    }
+
+    /// Counts the test cases from given mask in which the statement is
+    /// executed.
+    pub fn count_executed(&self, stmt: &StmtId, mask: &TestMask) -> usize {
+        match self.row(stmt) {
+            Some(row) => row
+                .iter()
+                .zip(mask.0.iter())
+                .map(|(executed, tests)| (executed & tests).count_ones() as usize)
+                .sum(),
+            None => 0,
+        }
+    }
+
+    fn row(&self, stmt: &StmtId) -> Option<&[u64]> {
+        match self.rows.get(stmt.as_index()) {
+            Some(&row) if row != NO_ROW => {
+                let start = row as usize * self.words;
+                Some(&self.matrix[start..(start + self.words)])
+            }
+            _ => None,
         }
     }
 }
@@ -31,31 +79,50 @@ impl Query for Spectra {
     type Args = ();
 
     fn init(data: &RawData, _args: &Self::Args, _api: &Api) -> Result<Self, Self::Error> {
-        let mut spectra = HashMap::new();
-        let mut stmts = HashSet::new();
-        let mut test_case = None;
+        // The number of test cases determines the width of the rows, so the
+        // columns are assigned first.
+        let mut tests = HashMap::new();
 
         for item in data.trace.trace.iter() {
-            match item {
-                TraceItem::Test(name) => {
-                    if !stmts.is_empty() && test_case.is_some() {
-                        spectra.insert(test_case.unwrap(), stmts.clone());
-                    }
+            if let TraceItem::Test(name) = item {
+                let column = tests.len();
+                tests.entry(*name).or_insert(column);
+            }
+        }
 
-                    test_case = Some(name.clone());
-                    stmts.clear();
-                }
+        let words = (tests.len() + 63) / 64;
+        let mut rows = Vec::new();
+        let mut matrix = Vec::new();
+        let mut column = None;
+
+        for item in data.trace.trace.iter() {
+            match item {
+                TraceItem::Test(name) => column = tests.get(name).copied(),
                 TraceItem::Statement(stmt) => {
-                    stmts.insert(*stmt);
+                    if let Some(column) = column {
+                        let index = stmt.as_index();
+
+                        if index >= rows.len() {
+                            rows.resize(index + 1, NO_ROW);
+                        }
+
+                        if rows[index] == NO_ROW {
+                            rows[index] = (matrix.len() / words) as u32;
+                            matrix.resize(matrix.len() + words, 0);
+                        }
+
+                        matrix[rows[index] as usize * words + column / 64] |= 1 << (column % 64);
+                    }
                 }
-                TraceItem::Value(_) => {} // Ignore
+                TraceItem::Value(_) | TraceItem::Gap => {} // Ignore
             }
         }
 
-        if !stmts.is_empty() && test_case.is_some() {
-            spectra.insert(test_case.unwrap(), stmts);
-        }
-
-        Ok(Spectra { spectra })
+        Ok(Spectra {
+            tests,
+            rows,
+            words,
+            matrix,
+        })
     }
 }
@@ -42,7 +42,8 @@ impl Stmts {
         self.get(id).map(|stmt| &stmt.as_ref().func)
     }
 
-    /// Gets the total number of statements in the program.
+    /// Gets the total number of statements in the program (excluding untraced
+    /// functions).
     pub fn get_n_total(&self) -> usize {
         self.n_total
     }
@@ -73,7 +74,13 @@ impl Query for Stmts {
             }
         }
 
-        for (_, stmts) in data.modules.functions.iter() {
+        for (func, stmts) in data.modules.functions.iter() {
+            // Statements of untraced functions cannot be distinguished from
+            // not executed ones, so they are not counted at all.
+            if data.modules.untraced.contains(func) {
+                continue;
+            }
+
             for (id, stmt) in stmts.iter() {
                 n_total += 1;
 
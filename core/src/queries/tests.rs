@@ -1,6 +1,7 @@
 //! Several utilities for test suite.
 
 use std::collections::hash_map::{HashMap, Iter, Keys};
+use std::iter;
 use std::mem;
 
 use super::stmts::Stmts;
@@ -14,6 +15,9 @@ use crate::data::{
 pub struct Tests {
     tests: HashMap<S<TestName>, TestStatus>,
     traces: HashMap<S<TestName>, Vec<P<Statement>>>,
+    // Positions in the traces where some statements are missing because of
+    // sampling.
+    gaps: HashMap<S<TestName>, Vec<usize>>,
 }
 
 impl Tests {
@@ -32,6 +36,28 @@ impl Tests {
         self.traces.get(test).map(|stmts| stmts.iter())
     }
 
+    /// Checks if the trace of given test case is complete, that is, the runtime
+    /// did not leave out any function invocation because of sampling.
+    pub fn is_complete(&self, test: &S<TestName>) -> bool {
+        !self.gaps.contains_key(test)
+    }
+
+    /// Iterates over the parts of the trace of given test case which are
+    /// separated by gaps. Complete trace forms a single segment.
+    pub fn iter_segments(
+        &self,
+        test: &S<TestName>,
+    ) -> Option<impl Iterator<Item = &[P<Statement>]>> {
+        let gaps = self.gaps.get(test).map(Vec::as_slice).unwrap_or(&[]);
+
+        self.traces.get(test).map(move |stmts| {
+            iter::once(0)
+                .chain(gaps.iter().copied())
+                .zip(gaps.iter().copied().chain(iter::once(stmts.len())))
+                .map(move |(start, end)| &stmts[start..end])
+        })
+    }
+
     /// Checks if given test case is passing.
     pub fn is_passed(&self, test: &S<TestName>) -> bool {
         if let Some(status) = self.tests.get(test) {
@@ -74,8 +100,11 @@ impl Query for Tests {
 
         let mut traces = HashMap::with_capacity(data.test_suite.tests.len());
 
+        let mut gaps = HashMap::new();
+
         let mut test = None;
         let mut trace = Vec::new();
+        let mut trace_gaps = Vec::new();
 
         for item in data.trace.trace.iter() {
             match item {
@@ -91,6 +120,10 @@ impl Query for Tests {
                     if let Some(test) = test {
                         // Insert the trace and clear reset the trace variable in one step.
                         traces.insert(test, mem::take(&mut trace));
+
+                        if !trace_gaps.is_empty() {
+                            gaps.insert(test, mem::take(&mut trace_gaps));
+                        }
                     } else {
                         // Clear the trace when when it is not empty
                         // as we don't have a test to associate the statements with anyway.
@@ -99,6 +132,12 @@ impl Query for Tests {
 
                     test = Some(new_test.clone());
                 }
+                TraceItem::Gap => {
+                    // Consecutive gaps are merged.
+                    if trace_gaps.last() != Some(&trace.len()) {
+                        trace_gaps.push(trace.len());
+                    }
+                }
                 TraceItem::Value(_) => {} // Ignore
             }
         }
@@ -106,11 +145,16 @@ impl Query for Tests {
         // Insert the statements that remain.
         if let Some(test) = test {
             traces.insert(test, mem::take(&mut trace));
+
+            if !trace_gaps.is_empty() {
+                gaps.insert(test, trace_gaps);
+            }
         }
 
         Ok(Tests {
             tests: data.test_suite.tests.clone(),
             traces,
+            gaps,
         })
     }
 }
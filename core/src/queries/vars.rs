@@ -51,7 +51,9 @@ impl Query for Vars {
 
         for item in data.trace.find_test(args) {
             match item {
-                TraceItem::Test(_) => {}
+                // Sampling drops whole function invocations, so the values
+                // still follow their statements.
+                TraceItem::Test(_) | TraceItem::Gap => {}
                 TraceItem::Statement(id) => {
                     // Stmts are built from dynamic trace so a statement with this id certainly exists.
                     let stmt_ptr = stmts.get(id).unwrap();
@@ -13,8 +13,9 @@ int __GLOBAL_STATUS = 0;
 void test(const char *name, test_fn *fn)
 {
     __GLOBAL_STATUS = 1;
-    aardwolf_write_external(name);
+    aardwolf_test_start(name);
     fn();
+    aardwolf_test_end(name, __GLOBAL_STATUS ? AARDWOLF_TEST_PASSED : AARDWOLF_TEST_FAILED);
     printf("%s: %s\n", __GLOBAL_STATUS ? "PASS" : "FAIL", name);
 }
 
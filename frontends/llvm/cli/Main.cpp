@@ -1,6 +1,8 @@
 #include "DynamicData.h"
+#include "Options.h"
 #include "StatementDetection.h"
 #include "StaticData.h"
+#include "Statistics.h"
 
 #include <stdlib.h>
 
@@ -40,6 +42,70 @@ static llvm::cl::opt<bool>
                       llvm::cl::desc("Do not write instrumented bitcode file"),
                       llvm::cl::cat{AardwolfCategory});
 
+static llvm::cl::opt<InstrumentationMode> Mode(
+    "instrumentation", llvm::cl::desc("Granularity of the instrumentation"),
+    llvm::cl::values(clEnumValN(InstrumentationMode::Statement, "statement",
+                                "Trace every statement (default)"),
+                     clEnumValN(InstrumentationMode::Block, "block",
+                                "Trace every executed block of statements"),
+                     clEnumValN(InstrumentationMode::Coverage, "coverage",
+                                "Record only executed statements per test")),
+    llvm::cl::init(InstrumentationMode::Statement),
+    llvm::cl::cat{AardwolfCategory});
+
+static llvm::cl::opt<bool> Inline(
+    "inline",
+    llvm::cl::desc("Append the events directly into the trace buffer of "
+                   "buffered runtime instead of calling runtime functions"),
+    llvm::cl::cat{AardwolfCategory});
+
+static llvm::cl::opt<bool> ReconstructInductions(
+    "reconstruct-inductions",
+    llvm::cl::desc("Do not trace values of induction variable steps in loops, "
+                   "Aardwolf reconstructs them"),
+    llvm::cl::cat{AardwolfCategory});
+
+static llvm::cl::opt<bool> Sampling(
+    "sampling",
+    llvm::cl::desc("Let the runtime decide which function invocations are "
+                   "traced (see AARDWOLF_SAMPLE_* variables of the runtime)"),
+    llvm::cl::cat{AardwolfCategory});
+
+static llvm::cl::opt<std::string> StaticCache(
+    "static-cache",
+    llvm::cl::desc("Cache static data by the hash of the module in given "
+                   "directory"),
+    llvm::cl::value_desc("directory name"), llvm::cl::init(""),
+    llvm::cl::cat{AardwolfCategory});
+
+static llvm::cl::opt<bool> Stats(
+    "stats",
+    llvm::cl::desc("Write the instrumentation statistics next to the static "
+                   "data file and print their summary"),
+    llvm::cl::cat{AardwolfCategory});
+
+static llvm::cl::list<std::string> InstrumentFunctions(
+    "instrument-functions",
+    llvm::cl::desc("Instrument only functions matching given glob patterns"),
+    llvm::cl::CommaSeparated, llvm::cl::cat{AardwolfCategory});
+
+static llvm::cl::list<std::string> SkipFunctions(
+    "skip-functions",
+    llvm::cl::desc("Do not instrument functions matching given glob patterns"),
+    llvm::cl::CommaSeparated, llvm::cl::cat{AardwolfCategory});
+
+static llvm::cl::list<std::string> InstrumentFiles(
+    "instrument-files",
+    llvm::cl::desc("Instrument only functions defined in source files "
+                   "matching given glob patterns"),
+    llvm::cl::CommaSeparated, llvm::cl::cat{AardwolfCategory});
+
+static llvm::cl::list<std::string> SkipFiles(
+    "skip-files",
+    llvm::cl::desc("Do not instrument functions defined in source files "
+                   "matching given glob patterns"),
+    llvm::cl::CommaSeparated, llvm::cl::cat{AardwolfCategory});
+
 std::string basename(const std::string &Path) {
   char Sep = '/';
 
@@ -57,8 +123,21 @@ std::string basename(const std::string &Path) {
 
 static void process(llvm::Module &M) {
   llvm::ModulePassManager MPM;
-  StaticData StaticData(OutputDirectory);
-  DynamicData DynamicData;
+
+  Options Opts;
+  Opts.Mode = Mode;
+  Opts.Inline = Inline;
+  Opts.ReconstructInductions = ReconstructInductions;
+  Opts.Sampling = Sampling;
+  Opts.StaticCache = StaticCache;
+  Opts.Statistics = Stats;
+  Opts.InstrumentFunctions = InstrumentFunctions;
+  Opts.SkipFunctions = SkipFunctions;
+  Opts.InstrumentFiles = InstrumentFiles;
+  Opts.SkipFiles = SkipFiles;
+
+  StaticData StaticData(OutputDirectory, Opts);
+  DynamicData DynamicData(Opts);
 
   MPM.addPass(StaticData);
 
@@ -67,7 +146,7 @@ static void process(llvm::Module &M) {
   }
 
   llvm::ModuleAnalysisManager MAM;
-  MAM.registerPass([&] { return StatementDetection(); });
+  MAM.registerPass([&] { return StatementDetection(Opts); });
 
   llvm::PassBuilder PB;
   PB.registerModuleAnalyses(MAM);
@@ -114,6 +193,15 @@ int main(int Argc, char **Argv) {
 
   process(*M);
 
+  if (Stats) {
+    auto Filename =
+        getStatisticsFilename(getStaticDataFilename(OutputDirectory, *M));
+
+    if (!printStatisticsSummary(Filename, llvm::outs())) {
+      llvm::errs() << "Error reading statistics file: " << Filename << "\n";
+    }
+  }
+
   if (!NoInstrumentation) {
     Out->keep();
     llvm::WriteBitcodeToFile(*M, Out.get()->os());
@@ -5,16 +5,27 @@
 #include "llvm/IR/PassManager.h"
 #include "llvm/Pass.h"
 
+#include "Options.h"
 #include "StatementRepository.h"
 
 namespace aardwolf {
 
 struct DynamicDataBase {
+  Options Opts;
+  DynamicDataBase();
+  DynamicDataBase(const Options &Opts);
+
   bool runBase(llvm::Module &M, StatementRepository &Repo);
+
+private:
+  bool instrument(llvm::Module &M, StatementRepository &Repo);
 };
 
 struct DynamicData : public llvm::PassInfoMixin<DynamicData>,
                      public DynamicDataBase {
+  DynamicData();
+  DynamicData(const Options &Opts);
+
   llvm::PreservedAnalyses run(llvm::Module &M,
                               llvm::ModuleAnalysisManager &MAM);
 };
@@ -22,6 +33,7 @@ struct DynamicData : public llvm::PassInfoMixin<DynamicData>,
 struct LegacyDynamicData : public llvm::ModulePass, public DynamicDataBase {
   static char ID;
   LegacyDynamicData();
+  LegacyDynamicData(const Options &Opts);
 
   virtual bool runOnModule(llvm::Module &M);
   virtual void getAnalysisUsage(llvm::AnalysisUsage &AU) const;
@@ -0,0 +1,98 @@
+#ifndef AARDWOLF_OPTIONS_H
+#define AARDWOLF_OPTIONS_H
+
+#include <string>
+#include <vector>
+
+#include "llvm/IR/Function.h"
+#include "llvm/Support/GlobPattern.h"
+
+namespace aardwolf {
+
+// Granularity of the dynamic instrumentation.
+enum class InstrumentationMode {
+  // Every statement is traced by a separate runtime call.
+  Statement,
+  // Every executed trace block (a sequence of statements in a basic block
+  // which does not contain any call except of the last statement) is traced
+  // by a single runtime call. The statements of the blocks are exported into
+  // static data so the statement trace can be reconstructed.
+  Block,
+  // Every statement only sets its flag in the coverage map of the module and
+  // the runtime logs the executed statements once per test case. No values
+  // are traced, so the data are useful only for spectrum-based analyses.
+  Coverage,
+};
+
+struct Options {
+  InstrumentationMode Mode = InstrumentationMode::Statement;
+
+  // Emit inline code which appends the events directly into the trace buffer
+  // of the buffered runtime instead of calling the runtime functions. They are
+  // called only when the buffer is full or unavailable.
+  bool Inline = false;
+
+  // Do not trace the values of induction steps (e.g., `i++` in a for loop)
+  // which Aardwolf can reconstruct from the previous value of the variable and
+  // the step exported into static data.
+  bool ReconstructInductions = false;
+
+  // Guard every instrumented function by the sampling calls of the runtime,
+  // which decide whether its invocation is traced. Not used in coverage mode.
+  bool Sampling = false;
+
+  // The whole program is instrumented at link time (full LTO) by the
+  // aardwolf-lto pipeline, so the passes are not registered into the
+  // pipelines which compile individual modules.
+  bool Lto = false;
+
+  // The passes are registered at the end of the optimization pipeline of
+  // clang, so the program is instrumented also when compiled with
+  // optimizations. Variables are then recovered from the debug values.
+  bool Optimized = false;
+
+  // Collect the cost of the instrumentation (time of the passes, numbers of
+  // statements and inserted trace calls, estimated trace size) and write it as
+  // JSON next to the static data file.
+  bool Statistics = false;
+
+  // Directory where the static data are cached by the hash of the module, so
+  // they are not regenerated for unchanged modules. Empty disables the cache.
+  std::string StaticCache;
+
+  // Glob patterns of functions (mangled or demangled names) and source files
+  // (absolute paths) which are instrumented or skipped. If the instrument list
+  // is empty, everything what is not skipped is instrumented.
+  std::vector<std::string> InstrumentFunctions;
+  std::vector<std::string> SkipFunctions;
+  std::vector<std::string> InstrumentFiles;
+  std::vector<std::string> SkipFiles;
+
+  // Loads the options from AARDWOLF_* environment variables. Used when the
+  // passes are loaded by clang or opt directly.
+  static Options fromEnv();
+};
+
+bool parseInstrumentationMode(const std::string &Value,
+                              InstrumentationMode &Mode);
+const char *getInstrumentationModeName(InstrumentationMode Mode);
+
+// Decides which functions are instrumented according to the function and file
+// lists in the options. Skipped functions are still analyzed and exported into
+// static data, but marked as untraced.
+class InstrumentationFilter {
+public:
+  InstrumentationFilter(const Options &Opts);
+
+  bool shouldInstrument(const llvm::Function &F) const;
+
+private:
+  std::vector<llvm::GlobPattern> InstrumentFunctions;
+  std::vector<llvm::GlobPattern> SkipFunctions;
+  std::vector<llvm::GlobPattern> InstrumentFiles;
+  std::vector<llvm::GlobPattern> SkipFiles;
+};
+
+} // namespace aardwolf
+
+#endif // AARDWOLF_OPTIONS_H
@@ -1,9 +1,11 @@
 #ifndef AARDWOLF_STATEMENT_H
 #define AARDWOLF_STATEMENT_H
 
-#include <unordered_set>
+#include <unordered_map>
 
-#include "llvm/ADT/SmallSet.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/SmallVector.h"
 
 #include "llvm/IR/DebugInfoMetadata.h"
 #include "llvm/IR/Instructions.h"
@@ -13,75 +15,57 @@ namespace aardwolf {
 
 enum AccessType { Structural, ArrayLike };
 
-struct Access {
-private:
-  const llvm::Value *Value;
+// Index of an access in AccessArena.
+typedef uint32_t AccessId;
 
-  const std::shared_ptr<Access> Base;
-  const std::vector<Access> Accessors;
-  const AccessType Type;
+// Accesses sorted by their indices.
+typedef llvm::SmallVector<AccessId, 4> AccessList;
 
-  Access(const llvm::Value *Value)
-      : Value(Value), Base(nullptr), Type(AccessType::Structural) {}
+// Hash-consed storage of accesses (scalar values, structure fields and array
+// elements). Structurally equal accesses are stored only once, so they can be
+// compared by their indices.
+class AccessArena {
+public:
+  AccessId makeScalar(const llvm::Value *Value);
+  AccessId makeStructural(AccessId Base, AccessId Field);
+  AccessId makeArrayLike(AccessId Base, llvm::ArrayRef<AccessId> Index);
 
-  Access(const Access Base, const std::vector<Access> Accessors,
-         const AccessType Type)
-      : Value(nullptr), Base(std::make_shared<Access>(Base)),
-        Accessors(Accessors.begin(), Accessors.end()), Type(Type) {}
+  // Copies the access (including its base and accessors) from another arena.
+  AccessId import(const AccessArena &Other, AccessId Id);
 
-public:
-  static Access makeScalar(const llvm::Value *Value);
-  static Access makeStructural(Access Base, Access Field);
-  static Access makeArrayLike(Access Base, Access Index);
-  static Access makeArrayLike(Access Base, std::vector<Access> Index);
-
-  bool isScalar() const;
-
-  const llvm::Value *getValue() const;
-
-  const Access &getBase() const;
-  const std::vector<Access> &getAccessors() const;
-  const AccessType &getType() const;
-
-  const llvm::Value *getValueOrBase() const;
-
-  void print(llvm::raw_ostream &Stream) const;
-
-  std::size_t hash() const {
-    if (isScalar()) {
-      return std::hash<const llvm::Value *>()(Value);
-    } else {
-      auto h1 = std::hash<const AccessType>()(Type);
-      // auto h2 = std::hash<const Access *>()(Base.get());
-      auto h2 = Base->hash();
-
-      std::size_t h = h1 ^ (h2 << 1);
-
-      for (std::vector<Access>::size_type i = 0; i < Accessors.size(); i++) {
-        h = h ^ (Accessors[i].hash() << (i + 2));
-      }
-
-      return h;
-    }
-  }
-
-  friend bool operator==(const Access &lhs, const Access &rhs) {
-    if (lhs.isScalar() && rhs.isScalar()) {
-      return lhs.Value == rhs.Value;
-    } else if (!lhs.isScalar() && !rhs.isScalar()) {
-      return lhs.Type == rhs.Type && *lhs.Base == *rhs.Base;
-    } else {
-      return false;
-    }
-  }
-
-  friend bool operator!=(const Access &lhs, const Access &rhs) {
-    return !(lhs == rhs);
-  }
-};
+  bool isScalar(AccessId Id) const;
+
+  const llvm::Value *getValue(AccessId Id) const;
 
-struct AccessHasher {
-  std::size_t operator()(const Access &access) const { return access.hash(); }
+  AccessId getBase(AccessId Id) const;
+  llvm::ArrayRef<AccessId> getAccessors(AccessId Id) const;
+  AccessType getType(AccessId Id) const;
+
+  const llvm::Value *getValueOrBase(AccessId Id) const;
+
+  void print(AccessId Id, llvm::raw_ostream &Stream) const;
+
+private:
+  struct Node {
+    // Set only for scalar accesses.
+    const llvm::Value *Value;
+    AccessId Base;
+    AccessType Type;
+    // Range of the accessors in the Accessors vector.
+    uint32_t AccessorsBegin;
+    uint32_t AccessorsSize;
+    // Precomputed structural hash (it does not depend on the indices).
+    std::size_t Hash;
+  };
+
+  AccessId intern(const llvm::Value *Value, AccessId Base, AccessType Type,
+                  llvm::ArrayRef<AccessId> Accessors, std::size_t Hash);
+
+  std::vector<Node> Nodes;
+  std::vector<AccessId> Accessors;
+
+  // Mapping from hashes to the accesses with that hash.
+  std::unordered_multimap<std::size_t, AccessId> Lookup;
 };
 
 struct LineCol {
@@ -105,12 +89,13 @@ struct Statement {
 
   // Set of input values which go into the statement as inputs.
   // These can be variables (either local or global), constants or
-  // the results of function calls.
-  std::unordered_set<Access, AccessHasher> In;
+  // the results of function calls. The accesses are stored in the arena of
+  // the statement repository.
+  AccessList In;
 
   // Value which comes out of the statement as its result.
   // Not all statements have an output value.
-  std::shared_ptr<Access> Out;
+  llvm::Optional<AccessId> Out;
 
   // Location of the statement in the original source code.
   Location Loc;
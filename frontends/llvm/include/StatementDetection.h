@@ -5,6 +5,7 @@
 #include "llvm/IR/PassManager.h"
 #include "llvm/Pass.h"
 
+#include "Options.h"
 #include "Statement.h"
 #include "StatementRepository.h"
 
@@ -12,6 +13,9 @@ namespace aardwolf {
 
 struct StatementDetectionBase {
   StatementRepository Repo;
+  Options Opts;
+  StatementDetectionBase();
+  StatementDetectionBase(const Options &Opts);
 
   bool runBase(llvm::Module &M);
 };
@@ -20,6 +24,9 @@ struct StatementDetection : public llvm::AnalysisInfoMixin<StatementDetection>,
                             public StatementDetectionBase {
   using Result = StatementRepository;
 
+  StatementDetection();
+  StatementDetection(const Options &Opts);
+
   Result run(llvm::Module &M, llvm::ModuleAnalysisManager &);
 
   static llvm::AnalysisKey Key;
@@ -30,6 +37,7 @@ struct LegacyStatementDetection : public llvm::ModulePass,
   static char ID;
 
   LegacyStatementDetection();
+  LegacyStatementDetection(const Options &Opts);
 
   virtual bool runOnModule(llvm::Module &M);
   virtual void getAnalysisUsage(llvm::AnalysisUsage &AU) const;
@@ -1,56 +1,115 @@
 #ifndef AARDWOLF_STATEMENT_REPOSITORY_H
 #define AARDWOLF_STATEMENT_REPOSITORY_H
 
-#include <map>
-#include <unordered_map>
+#include <vector>
 
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Sequence.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/IR/DebugInfoMetadata.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Value.h"
 
 #include "Statement.h"
+#include "Statistics.h"
 
 namespace aardwolf {
 
+// Index of a statement in the repository. Statements are stored in the order
+// of their registration, which follows the order of occurrence in the source
+// code.
+typedef uint32_t StmtIdx;
+
+// Statement which increments a local variable by a constant (e.g., `i++` in a
+// for loop) such that its value can be reconstructed from the previous value
+// of the variable.
+struct InductionStep {
+  int64_t Step;
+  // All other statements which store to the variable.
+  std::vector<StmtIdx> Defs;
+};
+
 struct StatementRepository {
 public:
+  // Storage of all accesses used in the statements.
+  AccessArena Accesses;
+
+  // All aardwolf statements indexed by StmtIdx.
+  std::vector<Statement> Statements;
+
   // Mapping from llvm instruction to aardwolf statement.
-  std::map<llvm::Instruction *, Statement> InstrStmtMap;
+  llvm::DenseMap<const llvm::Instruction *, StmtIdx> InstrStmtMap;
 
-  // Mapping from function to list of aardwolf statements
-  // (represented by internal llvm instructions).
-  std::map<llvm::Function *, std::vector<llvm::Instruction *>> FuncInstrsMap;
+  // Mapping from function to the range of its statements. Statements of a
+  // function are always stored contiguously.
+  llvm::DenseMap<const llvm::Function *, std::pair<StmtIdx, StmtIdx>>
+      FuncStmts;
 
-  // All successors of each statement (represented by internal llvm
-  // instruction).
-  std::map<llvm::Instruction *, std::vector<llvm::Instruction *>> InstrSucc;
+  // Mapping from the first statement of a trace block to all statements of the
+  // block in execution order. Used in block instrumentation mode, the block is
+  // identified by its first statement.
+  llvm::DenseMap<StmtIdx, std::vector<StmtIdx>> TraceBlocks;
 
-  // Mapping from aardwolf statements (represented by llvm instructions
-  // themselves) to assigned numeric id.
-  std::unordered_map<const llvm::Instruction *, std::pair<uint64_t, uint64_t>>
-      StmtsIdMap;
+  // Statements whose values do not need to be traced, because they can be
+  // reconstructed, mapped to the description of the step.
+  llvm::DenseMap<StmtIdx, InductionStep> InductionSteps;
 
   // Mapping from llvm values (used for variables) to assigned numeric id.
-  std::unordered_map<const llvm::Value *, uint64_t> ValuesIdMap;
+  llvm::DenseMap<const llvm::Value *, uint64_t> ValuesIdMap;
 
   // Mapping from filenames in analysed module to assigned numeric id.
-  std::map<const std::string, uint64_t> FilesIdMap;
+  llvm::StringMap<uint64_t> FilesIdMap;
+
+  // Cost of the instrumentation, collected only if enabled in the options.
+  // Detection times are measured always.
+  Statistics Stats;
 
   // TODO: Mappings: Function names to statements (for function-level
   // granularity).
 
-  // Registers the statement and assigns it and its values a numeric id.
-  void registerStatement(llvm::Function *F, Statement &Stmt);
+  // Adds the statement without assigning any numeric ids and returns its
+  // index. Used for repository shards which are merged into the main
+  // repository later. Statements of a function must be added consecutively.
+  StmtIdx addStatement(llvm::Function *F, Statement Stmt);
+
+  // Registers Succ as the successor of Stmt in the repository shard.
+  void addSuccessor(StmtIdx Stmt, StmtIdx Succ);
 
-  // Registers Succ as the successor of Stmt. The arguments are llvm
-  // instructions behind the statements. Both Stmt and Succ must be already
-  // registered.
-  void addSuccessor(llvm::Instruction *Stmt, llvm::Instruction *Succ);
+  // Appends Stmt to the trace block starting with Leader in the repository
+  // shard.
+  void addToBlock(StmtIdx Leader, StmtIdx Stmt);
 
-  std::pair<uint64_t, uint64_t> getStatementId(Statement &Stmt);
+  // Moves all statements of the shard into this repository and assigns them
+  // and their values numeric ids in the order in which they were added to the
+  // shard.
+  void merge(StatementRepository &Shard);
+
+  // Indices of all statements of the function.
+  auto getFunctionStatements(const llvm::Function *F) const {
+    auto Range = FuncStmts.lookup(F);
+    return llvm::seq(Range.first, Range.second);
+  }
+
+  // All successors of the statement. Available only for merged statements.
+  llvm::ArrayRef<StmtIdx> getSuccessors(StmtIdx Stmt) const;
+
+  const std::pair<uint64_t, uint64_t> &getStatementId(StmtIdx Stmt) const;
   uint64_t getValueId(const llvm::Value *Value);
   uint64_t getFileId(const std::string &File);
+
+private:
+  // Numeric ids of the statements indexed by StmtIdx.
+  std::vector<std::pair<uint64_t, uint64_t>> StmtIds;
+
+  // Successors of all statements in compressed form. Successors of statement
+  // Idx are stored in Succs[SuccOffsets[Idx] .. SuccOffsets[Idx + 1]].
+  std::vector<uint32_t> SuccOffsets = {0};
+  std::vector<StmtIdx> Succs;
+
+  // Successor edges of the shard which are not yet compressed.
+  std::vector<std::pair<StmtIdx, StmtIdx>> PendingSuccs;
 };
 } // namespace aardwolf
 
@@ -1,27 +1,39 @@
 #ifndef AARDWOLF_STATIC_DATA_H
 #define AARDWOLF_STATIC_DATA_H
 
+#include "llvm/ADT/STLExtras.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/PassManager.h"
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/Pass.h"
 
+#include "Options.h"
 #include "StatementRepository.h"
 
 namespace aardwolf {
 
 struct StaticDataBase {
   std::string DestDir;
+  Options Opts;
   StaticDataBase();
   StaticDataBase(std::string &DestDir);
+  StaticDataBase(std::string &DestDir, const Options &Opts);
 
-  bool runBase(llvm::Module &M, StatementRepository &Repo);
+  // The statements are requested only if the static data are not found in
+  // the cache.
+  bool runBase(llvm::Module &M,
+               llvm::function_ref<StatementRepository &()> GetRepo);
 };
 
+// Path of the static data file of the module in given directory.
+std::string getStaticDataFilename(const std::string &DestDir,
+                                  const llvm::Module &M);
+
 struct StaticData : public llvm::PassInfoMixin<StaticData>,
                     public StaticDataBase {
   std::string DestDir;
   StaticData(std::string &DestDir);
+  StaticData(std::string &DestDir, const Options &Opts);
 
   llvm::PreservedAnalyses run(llvm::Module &M,
                               llvm::ModuleAnalysisManager &MAM);
@@ -31,6 +43,7 @@ struct LegacyStaticData : public llvm::ModulePass, public StaticDataBase {
   static char ID;
   LegacyStaticData();
   LegacyStaticData(std::string &DestDir);
+  LegacyStaticData(std::string &DestDir, const Options &Opts);
 
   virtual bool runOnModule(llvm::Module &M);
   virtual void getAnalysisUsage(llvm::AnalysisUsage &AU) const;
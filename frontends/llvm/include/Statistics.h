@@ -0,0 +1,87 @@
+#ifndef AARDWOLF_STATISTICS_H
+#define AARDWOLF_STATISTICS_H
+
+#include <array>
+#include <chrono>
+#include <string>
+
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Function.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "Options.h"
+
+namespace aardwolf {
+
+struct StatementRepository;
+
+// Kinds of the tracing code inserted by the dynamic instrumentation.
+enum class TraceCallKind {
+  Statement,
+  Block,
+  Value,
+  Blob,
+  Coverage,
+  Sampling,
+};
+
+constexpr size_t NumTraceCallKinds = 6;
+
+struct FunctionStatistics {
+  // Time of the statement detection in seconds.
+  double DetectionTime = 0;
+  std::array<uint64_t, NumTraceCallKinds> TraceCalls = {};
+  // Bytes written into the (uncompressed) trace if every statement of the
+  // function is executed once.
+  uint64_t TracedBytes = 0;
+};
+
+// Cost of the instrumentation of a module, collected when enabled in the
+// options. The statistics are kept in the statement repository, which is
+// shared by all passes processing the module, and every pass rewrites the
+// statistics file next to the static data file with what is known so far.
+struct Statistics {
+  // Time spent in the passes in seconds.
+  double DetectionTime = 0;
+  double StaticDataTime = 0;
+  double DynamicDataTime = 0;
+
+  // Static data were copied from the cache.
+  bool Cached = false;
+
+  std::string StaticFilename;
+
+  // In the order of the functions in the module.
+  llvm::MapVector<const llvm::Function *, FunctionStatistics> Functions;
+
+  void addTraceCall(const llvm::Function *F, TraceCallKind Kind,
+                    uint64_t Bytes);
+
+  // Writes the statistics together with the counts of statements, accesses
+  // and successors in the repository as JSON.
+  void write(const StatementRepository &Repo, const Options &Opts) const;
+};
+
+// Measures the time since its construction.
+class Stopwatch {
+public:
+  double elapsed() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         Start)
+        .count();
+  }
+
+private:
+  std::chrono::steady_clock::time_point Start =
+      std::chrono::steady_clock::now();
+};
+
+std::string getStatisticsFilename(llvm::StringRef StaticFilename);
+
+// Prints a short human-readable summary of the statistics file.
+bool printStatisticsSummary(llvm::StringRef Filename, llvm::raw_ostream &OS);
+
+} // namespace aardwolf
+
+#endif // AARDWOLF_STATISTICS_H
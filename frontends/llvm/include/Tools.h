@@ -1,6 +1,11 @@
 #ifndef AARDWOLF_TOOLS_H
 #define AARDWOLF_TOOLS_H
 
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "llvm/IR/DataLayout.h"
 #include "llvm/IR/DebugInfoMetadata.h"
 #include "llvm/IR/DebugLoc.h"
 #include "llvm/IR/IntrinsicInst.h"
@@ -12,6 +17,32 @@ const llvm::DebugLoc getInstrLoc(const llvm::Instruction *I);
 const std::string getDebugLocFile(llvm::DebugLoc Loc);
 uint64_t getFileUniqueId(const std::string &File);
 
+// Value defined by the statement which is traced after it, if any.
+llvm::Value *getVarValue(llvm::Instruction *I);
+
+// Memory layout of a composite value (structure, array or vector) which is
+// traced as a single blob. The fields are its scalar leaves, pointers are
+// left out. The identifier is a hash of the layout, so it is the same in all
+// modules.
+struct TypeLayout {
+  struct Field {
+    std::string Name;
+    uint32_t Offset;
+    // Data token of the runtime format (see encoding.h).
+    uint8_t Token;
+  };
+
+  uint64_t Id;
+  std::string Name;
+  uint32_t Size;
+  std::vector<Field> Fields;
+};
+
+// Returns the layout if the type is composite and small enough to be traced
+// as a blob.
+std::optional<TypeLayout> getTypeLayout(const llvm::DataLayout &DL,
+                                        llvm::Type *Ty);
+
 } // namespace aardwolf
 
 #endif // AARDWOLF_TOOLS_H
@@ -2,11 +2,16 @@
 
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/MDBuilder.h"
 #include "llvm/IR/Module.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
 
 #include "Statement.h"
 #include "StatementDetection.h"
 #include "StatementRepository.h"
+#include "Tools.h"
+#include "encoding.h"
 
 using namespace aardwolf;
 
@@ -32,18 +37,17 @@ llvm::FunctionCallee getWriteStmtTracer(llvm::Module &M) {
   return M.getOrInsertFunction("aardwolf_write_statement", WriteStmtTy);
 }
 
-llvm::Value *getVarValue(llvm::Instruction *I) {
-  if (auto SI = llvm::dyn_cast<llvm::StoreInst>(I)) {
-    return SI->getOperand(0);
-  } else if (auto CI = llvm::dyn_cast<llvm::CallBase>(I)) {
-    if (CI->getType()->isVoidTy()) {
-      return nullptr;
-    } else {
-      return CI;
-    }
-  } else {
-    return nullptr;
-  }
+llvm::FunctionCallee getWriteBlockTracer(llvm::Module &M) {
+  auto &Ctx = M.getContext();
+
+  auto VoidTy = llvm::Type::getVoidTy(Ctx);
+
+  std::vector<llvm::Type *> WriteParams;
+  WriteParams.push_back(getFileRefTy(Ctx));
+  WriteParams.push_back(getStmtRefTy(Ctx));
+
+  auto WriteBlockTy = llvm::FunctionType::get(VoidTy, WriteParams, false);
+  return M.getOrInsertFunction("aardwolf_write_block", WriteBlockTy);
 }
 
 std::optional<std::pair<llvm::FunctionCallee, std::vector<llvm::Value *>>>
@@ -96,60 +100,410 @@ getDefVarTracer(llvm::Module &M, llvm::Instruction *I) {
       std::make_pair(M.getOrInsertFunction(Name, TraceTy), Args));
 }
 
+// Token of the data event for a value traced by the runtime function returned
+// by getDefVarTracer.
+uint8_t getDataToken(const std::vector<llvm::Value *> &Args) {
+  if (Args.empty()) {
+    return TOKEN_DATA_UNSUPPORTED;
+  }
+
+  auto ValueTy = Args[0]->getType();
+
+  if (ValueTy->isIntegerTy(8)) {
+    return TOKEN_DATA_I8;
+  } else if (ValueTy->isIntegerTy(16)) {
+    return TOKEN_DATA_I16;
+  } else if (ValueTy->isIntegerTy(32)) {
+    return TOKEN_DATA_I32;
+  } else if (ValueTy->isIntegerTy(64)) {
+    return TOKEN_DATA_I64;
+  } else if (ValueTy->isFloatTy()) {
+    return TOKEN_DATA_F32;
+  } else if (ValueTy->isDoubleTy()) {
+    return TOKEN_DATA_F64;
+  } else {
+    return TOKEN_DATA_BOOL;
+  }
+}
+
+// Thread-local cursor to the trace buffer (struct aardwolf_cursor in
+// runtime.h).
+llvm::GlobalVariable *getCursor(llvm::Module &M) {
+  if (auto Cursor = M.getGlobalVariable("aardwolf_cursor")) {
+    return Cursor;
+  }
+
+  auto Int8PtrTy = llvm::Type::getInt8PtrTy(M.getContext());
+  auto CursorTy = llvm::StructType::get(Int8PtrTy, Int8PtrTy);
+
+  // The runtime is linked to the program, so the cursor can be accessed
+  // relative to the thread pointer without calling __tls_get_addr.
+  return new llvm::GlobalVariable(M, CursorTy, false,
+                                  llvm::GlobalValue::ExternalLinkage, nullptr,
+                                  "aardwolf_cursor", nullptr,
+                                  llvm::GlobalValue::InitialExecTLSModel);
+}
+
+// Size of the event in the trace, that is, the token followed by the raw
+// arguments (booleans are written as bytes). Used only for the statistics.
+uint64_t getEventSize(const llvm::DataLayout &DL,
+                      const std::vector<llvm::Value *> &Args) {
+  uint64_t Size = 1;
+
+  for (auto Arg : Args) {
+    Size += DL.getTypeStoreSize(Arg->getType());
+  }
+
+  return Size;
+}
+
+// Emits the code which appends the event directly into the trace buffer if
+// there is enough space, and calls the runtime function otherwise. The layout
+// of the event is the same as the runtime function would write, that is, the
+// token followed by the raw arguments.
+void insertInlineTracer(llvm::Module &M, llvm::Instruction *InsertBefore,
+                        uint8_t Token, llvm::FunctionCallee Tracer,
+                        std::vector<llvm::Value *> &Args) {
+  auto &Ctx = M.getContext();
+  auto Int8Ty = llvm::Type::getInt8Ty(Ctx);
+  auto Int8PtrTy = llvm::Type::getInt8PtrTy(Ctx);
+
+  auto Cursor = getCursor(M);
+  auto CursorTy = Cursor->getValueType();
+
+  // Packed structure, so the fields are stored without any alignment.
+  std::vector<llvm::Type *> Fields;
+  Fields.push_back(Int8Ty);
+  for (auto Arg : Args) {
+    // Booleans are written as bytes.
+    Fields.push_back(Arg->getType()->isIntegerTy(1) ? Int8Ty : Arg->getType());
+  }
+
+  auto EventTy = llvm::StructType::get(Ctx, Fields, true);
+  uint64_t EventSize = M.getDataLayout().getTypeAllocSize(EventTy);
+
+  llvm::IRBuilder<> Builder(InsertBefore);
+  auto PosPtr = Builder.CreateStructGEP(CursorTy, Cursor, 0);
+  auto EndPtr = Builder.CreateStructGEP(CursorTy, Cursor, 1);
+  auto Pos = Builder.CreateLoad(Int8PtrTy, PosPtr);
+  auto End = Builder.CreateLoad(Int8PtrTy, EndPtr);
+  auto Next = Builder.CreateGEP(Int8Ty, Pos, Builder.getInt64(EventSize));
+
+  // If End is NULL, the condition is always false.
+  auto Fits = Builder.CreateICmpULE(Next, End);
+
+  llvm::Instruction *FastTerm = nullptr;
+  llvm::Instruction *SlowTerm = nullptr;
+  auto Weights = llvm::MDBuilder(Ctx).createBranchWeights(1 << 20, 1);
+  llvm::SplitBlockAndInsertIfThenElse(Fits, InsertBefore, &FastTerm, &SlowTerm,
+                                      Weights);
+
+  Builder.SetInsertPoint(FastTerm);
+  llvm::Value *Event = llvm::UndefValue::get(EventTy);
+  Event = Builder.CreateInsertValue(Event, Builder.getInt8(Token), 0);
+
+  for (unsigned Idx = 0; Idx < Args.size(); Idx++) {
+    auto Arg = Args[Idx];
+
+    if (Arg->getType()->isIntegerTy(1)) {
+      Arg = Builder.CreateZExt(Arg, Int8Ty);
+    }
+
+    Event = Builder.CreateInsertValue(Event, Arg, Idx + 1);
+  }
+
+  Builder.CreateStore(Event,
+                      Builder.CreateBitCast(Pos, EventTy->getPointerTo()));
+  Builder.CreateStore(Next, PosPtr);
+
+  Builder.SetInsertPoint(SlowTerm);
+  Builder.CreateCall(Tracer, Args);
+}
+
+// Tracing code cannot be inserted among the phi nodes and exception handling
+// pads at the beginning of a basic block (phi nodes are statements in
+// optimized code), so it is inserted right after them.
+llvm::Instruction *getTracePoint(llvm::Instruction *I) {
+  if (llvm::isa<llvm::PHINode>(I) || I->isEHPad()) {
+    return &*I->getParent()->getFirstInsertionPt();
+  }
+
+  return I;
+}
+
+// Point for tracing the value defined by given (non-terminator) instruction.
+llvm::Instruction *getTracePointAfter(llvm::Instruction *I) {
+  return getTracePoint(I->getNextNode());
+}
+
+// Inserts the tracing code before given instruction.
+void insertTracer(llvm::Module &M, llvm::Instruction *InsertBefore,
+                  bool Inline, uint8_t Token, llvm::FunctionCallee Tracer,
+                  std::vector<llvm::Value *> &Args) {
+  if (Inline) {
+    insertInlineTracer(M, InsertBefore, Token, Tracer, Args);
+  } else {
+    llvm::IRBuilder<> Builder(InsertBefore);
+    Builder.CreateCall(Tracer, Args);
+  }
+}
+
+// Traces a composite value with a single runtime call. The value is spilled
+// into a stack slot allocated in the entry block and Aardwolf decodes its
+// fields using the type layout exported in static data.
+void insertBlobTracer(llvm::Module &M, llvm::Instruction *InsertBefore,
+                      llvm::Value *Value, const TypeLayout &Layout) {
+  auto &Ctx = M.getContext();
+  auto Int8PtrTy = llvm::Type::getInt8PtrTy(Ctx);
+  auto Int32Ty = llvm::Type::getInt32Ty(Ctx);
+  auto Int64Ty = llvm::Type::getInt64Ty(Ctx);
+
+  auto Tracer = M.getOrInsertFunction(
+      "aardwolf_write_data_blob",
+      llvm::FunctionType::get(llvm::Type::getVoidTy(Ctx),
+                              {Int64Ty, Int8PtrTy, Int32Ty}, false));
+
+  auto &Entry = InsertBefore->getFunction()->getEntryBlock();
+  llvm::IRBuilder<> EntryBuilder(&*Entry.getFirstInsertionPt());
+  auto Slot =
+      EntryBuilder.CreateAlloca(Value->getType(), nullptr, "aardwolf.blob");
+
+  llvm::IRBuilder<> Builder(InsertBefore);
+  Builder.CreateStore(Value, Slot);
+  Builder.CreateCall(Tracer, {llvm::ConstantInt::get(Int64Ty, Layout.Id),
+                              Builder.CreatePointerCast(Slot, Int8PtrTy),
+                              llvm::ConstantInt::get(Int32Ty, Layout.Size)});
+}
+
+// Guards the function by the sampling calls of the runtime. The invocation
+// counter is a global variable per function. The previous state is restored
+// before every return and resume, an unwinding through the function without a
+// landing pad keeps the state of the callee.
+void insertSamplingGuard(llvm::Module &M, llvm::Function &F) {
+  auto &Ctx = M.getContext();
+  auto Int8Ty = llvm::Type::getInt8Ty(Ctx);
+  auto Int32Ty = llvm::Type::getInt32Ty(Ctx);
+
+  auto Enter = M.getOrInsertFunction(
+      "aardwolf_sample_enter",
+      llvm::FunctionType::get(Int8Ty, {Int32Ty->getPointerTo()}, false));
+  auto Exit = M.getOrInsertFunction(
+      "aardwolf_sample_exit",
+      llvm::FunctionType::get(llvm::Type::getVoidTy(Ctx), {Int8Ty}, false));
+
+  auto Counter = new llvm::GlobalVariable(
+      M, Int32Ty, false, llvm::GlobalValue::InternalLinkage,
+      llvm::ConstantInt::get(Int32Ty, 0), "aardwolf.sample");
+
+  std::vector<llvm::Instruction *> Exits;
+  for (auto &BB : F) {
+    auto Term = BB.getTerminator();
+    if (llvm::isa<llvm::ReturnInst>(Term) ||
+        llvm::isa<llvm::ResumeInst>(Term)) {
+      Exits.push_back(Term);
+    }
+  }
+
+  llvm::IRBuilder<> Builder(&*F.getEntryBlock().getFirstInsertionPt());
+  auto Muted = Builder.CreateCall(Enter, {Counter});
+
+  for (auto Term : Exits) {
+    Builder.SetInsertPoint(Term);
+    Builder.CreateCall(Exit, {Muted});
+  }
+}
+
+// Instruments every statement to set its flag in the coverage map of the
+// module. The map is registered in the runtime by a module constructor.
+bool instrumentCoverage(llvm::Module &M, StatementRepository &Repo,
+                        const InstrumentationFilter &Filter) {
+  auto &Ctx = M.getContext();
+  auto Int8Ty = llvm::Type::getInt8Ty(Ctx);
+  auto Int64Ty = llvm::Type::getInt64Ty(Ctx);
+
+  std::vector<llvm::Instruction *> Instrs;
+  std::vector<llvm::Constant *> Ids;
+
+  for (auto &F : M) {
+    if (F.isDeclaration() || !Filter.shouldInstrument(F)) {
+      continue;
+    }
+
+    for (auto Idx : Repo.getFunctionStatements(&F)) {
+      auto &Id = Repo.getStatementId(Idx);
+      Repo.Stats.addTraceCall(&F, TraceCallKind::Coverage, 0);
+      Instrs.push_back(Repo.Statements[Idx].Instr);
+      Ids.push_back(llvm::ConstantInt::get(getFileRefTy(Ctx), Id.first));
+      Ids.push_back(llvm::ConstantInt::get(getStmtRefTy(Ctx), Id.second));
+    }
+  }
+
+  if (Instrs.empty()) {
+    return false;
+  }
+
+  auto MapTy = llvm::ArrayType::get(Int8Ty, Instrs.size());
+  auto Map = new llvm::GlobalVariable(M, MapTy, false,
+                                      llvm::GlobalValue::InternalLinkage,
+                                      llvm::ConstantAggregateZero::get(MapTy),
+                                      "aardwolf.coverage");
+
+  auto StmtsTy = llvm::ArrayType::get(Int64Ty, Ids.size());
+  auto Stmts = new llvm::GlobalVariable(
+      M, StmtsTy, true, llvm::GlobalValue::PrivateLinkage,
+      llvm::ConstantArray::get(StmtsTy, Ids), "aardwolf.coverage.stmts");
+
+  for (uint64_t Idx = 0; Idx < Instrs.size(); Idx++) {
+    // Setting the flag (instead of incrementing a counter) does not need to
+    // read the map and is safe in multi-threaded programs.
+    llvm::IRBuilder<> Builder(getTracePoint(Instrs[Idx]));
+    auto Flag = Builder.CreateConstInBoundsGEP2_64(MapTy, Map, 0, Idx);
+    Builder.CreateStore(Builder.getInt8(1), Flag);
+  }
+
+  auto RegisterTy = llvm::FunctionType::get(
+      llvm::Type::getVoidTy(Ctx),
+      {llvm::Type::getInt8PtrTy(Ctx), llvm::Type::getInt64PtrTy(Ctx), Int64Ty},
+      false);
+  auto Register =
+      M.getOrInsertFunction("aardwolf_register_coverage", RegisterTy);
+
+  auto Init = llvm::Function::Create(
+      llvm::FunctionType::get(llvm::Type::getVoidTy(Ctx), false),
+      llvm::GlobalValue::InternalLinkage, "aardwolf.coverage.init", M);
+
+  llvm::IRBuilder<> Builder(llvm::BasicBlock::Create(Ctx, "", Init));
+  Builder.CreateCall(Register,
+                     {Builder.CreateConstInBoundsGEP2_64(MapTy, Map, 0, 0),
+                      Builder.CreateConstInBoundsGEP2_64(StmtsTy, Stmts, 0, 0),
+                      Builder.getInt64(Instrs.size())});
+  Builder.CreateRetVoid();
+
+  llvm::appendToGlobalCtors(M, Init, 0);
+  return true;
+}
+
+DynamicDataBase::DynamicDataBase() {}
+
+DynamicDataBase::DynamicDataBase(const Options &Opts) : Opts(Opts) {}
+
 bool DynamicDataBase::runBase(llvm::Module &M, StatementRepository &Repo) {
+  Stopwatch Time;
+  bool Changed = instrument(M, Repo);
+
+  // The static data pass sets the filename, without it there is nowhere to
+  // write the statistics.
+  if (Opts.Statistics && !Repo.Stats.StaticFilename.empty()) {
+    Repo.Stats.DynamicDataTime = Time.elapsed();
+    Repo.Stats.write(Repo, Opts);
+  }
+
+  return Changed;
+}
+
+bool DynamicDataBase::instrument(llvm::Module &M, StatementRepository &Repo) {
+  InstrumentationFilter Filter(Opts);
+
+  if (Opts.Mode == InstrumentationMode::Coverage) {
+    return instrumentCoverage(M, Repo, Filter);
+  }
+
   auto &Ctx = M.getContext();
   auto FileRefTy = getFileRefTy(Ctx);
   auto StmtRefTy = getStmtRefTy(Ctx);
 
-  auto WriteStmt = getWriteStmtTracer(M);
+  auto &DL = M.getDataLayout();
+
+  auto BlockMode = Opts.Mode == InstrumentationMode::Block;
+  auto WriteStmt = BlockMode ? getWriteBlockTracer(M) : getWriteStmtTracer(M);
+  uint8_t StmtToken = BlockMode ? TOKEN_BLOCK : TOKEN_STATEMENT;
+  auto StmtKind = BlockMode ? TraceCallKind::Block : TraceCallKind::Statement;
 
   std::vector<llvm::Value *> Args;
-  llvm::IRBuilder<> Builder(Ctx);
 
   for (auto &F : M) {
-    if (F.isDeclaration()) {
+    if (F.isDeclaration() || !Filter.shouldInstrument(F)) {
       continue;
     }
 
-    for (auto I : Repo.FuncInstrsMap[&F]) {
-      Args.clear();
-      auto Id = Repo.getStatementId(Repo.InstrStmtMap[I]);
-      Args.push_back(llvm::ConstantInt::get(FileRefTy, Id.first));
-      Args.push_back(llvm::ConstantInt::get(StmtRefTy, Id.second));
+    for (auto Idx : Repo.getFunctionStatements(&F)) {
+      auto &Stmt = Repo.Statements[Idx];
+      auto I = Stmt.Instr;
+
+      // In block mode, only the first statement of each trace block is traced,
+      // and the block is identified by it. Variable values are traced as usual.
+      if (!BlockMode || Repo.TraceBlocks.count(Idx) > 0) {
+        Args.clear();
+        auto &Id = Repo.getStatementId(Idx);
+        Args.push_back(llvm::ConstantInt::get(FileRefTy, Id.first));
+        Args.push_back(llvm::ConstantInt::get(StmtRefTy, Id.second));
+
+        // Instruction can be a terminator, we need to put the printing
+        // statement before it.
+        insertTracer(M, getTracePoint(I), Opts.Inline, StmtToken, WriteStmt,
+                     Args);
+        Repo.Stats.addTraceCall(&F, StmtKind, getEventSize(DL, Args));
+      }
 
-      auto CI = Builder.CreateCall(WriteStmt, Args);
-      // Instruction can be a terminator, we need to put the printing statement
-      // before it.
-      CI->insertBefore(I);
+      // The value of induction step is reconstructed by Aardwolf.
+      if (Opts.ReconstructInductions && Repo.InductionSteps.count(Idx) > 0) {
+        continue;
+      }
+
+      // Composite values are dumped at once. Results of terminators (i.e.,
+      // invokes) are not available before them.
+      auto Value = getVarValue(I);
+      if (Value != nullptr && !I->isTerminator()) {
+        if (auto Layout = getTypeLayout(M.getDataLayout(), Value->getType())) {
+          insertBlobTracer(M, getTracePointAfter(I), Value, *Layout);
+          // Token, type identifier, size and the contents.
+          Repo.Stats.addTraceCall(&F, TraceCallKind::Blob,
+                                  1 + 8 + 4 + Layout->Size);
+          continue;
+        }
+      }
 
       auto WriteVarOptional = getDefVarTracer(M, I);
       if (WriteVarOptional.has_value()) {
-        if (Repo.InstrStmtMap[I].Out == nullptr) {
+        if (!Stmt.Out.hasValue()) {
           // TODO: Invalid var trace.
         }
 
         auto WriteVar = WriteVarOptional.value();
-        auto CI = Builder.CreateCall(WriteVar.first, WriteVar.second);
+        auto Token = getDataToken(WriteVar.second);
+        Repo.Stats.addTraceCall(&F, TraceCallKind::Value,
+                                getEventSize(DL, WriteVar.second));
 
         if (I->isTerminator()) {
           // Instruction is terminator, we need to place the tracing call before
           // it.
-          CI->insertBefore(I);
+          insertTracer(M, I, Opts.Inline, Token, WriteVar.first,
+                       WriteVar.second);
         } else {
           // Instruction is not a terminator, so we can put the tracing call
           // after it. In case of function call, it is even required since we
           // dump the output of the call.
-          CI->insertAfter(I);
+          insertTracer(M, getTracePointAfter(I), Opts.Inline, Token,
+                       WriteVar.first, WriteVar.second);
         }
-      } else if (Repo.InstrStmtMap[I].Out == nullptr) {
+      } else if (!Stmt.Out.hasValue()) {
         // TODO: Forgotten var trace.
       }
     }
+
+    if (Opts.Sampling) {
+      insertSamplingGuard(M, F);
+      Repo.Stats.addTraceCall(&F, TraceCallKind::Sampling, 0);
+    }
   }
 
   return true;
 }
 
+DynamicData::DynamicData() {}
+
+DynamicData::DynamicData(const Options &Opts) : DynamicDataBase(Opts) {}
+
 llvm::PreservedAnalyses DynamicData::run(llvm::Module &M,
                                          llvm::ModuleAnalysisManager &MAM) {
   if (runBase(M, MAM.getResult<StatementDetection>(M))) {
@@ -161,6 +515,9 @@ llvm::PreservedAnalyses DynamicData::run(llvm::Module &M,
 
 LegacyDynamicData::LegacyDynamicData() : llvm::ModulePass(ID) {}
 
+LegacyDynamicData::LegacyDynamicData(const Options &Opts)
+    : llvm::ModulePass(ID), DynamicDataBase(Opts) {}
+
 bool LegacyDynamicData::runOnModule(llvm::Module &M) {
   return runBase(M, getAnalysis<LegacyStatementDetection>().Repo);
 }
@@ -0,0 +1,172 @@
+#include "Options.h"
+
+#include <cstdlib>
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Demangle/Demangle.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace aardwolf;
+
+bool aardwolf::parseInstrumentationMode(const std::string &Value,
+                                        InstrumentationMode &Mode) {
+  if (Value == "statement") {
+    Mode = InstrumentationMode::Statement;
+  } else if (Value == "block") {
+    Mode = InstrumentationMode::Block;
+  } else if (Value == "coverage") {
+    Mode = InstrumentationMode::Coverage;
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+const char *aardwolf::getInstrumentationModeName(InstrumentationMode Mode) {
+  switch (Mode) {
+  case InstrumentationMode::Statement:
+    return "statement";
+  case InstrumentationMode::Block:
+    return "block";
+  case InstrumentationMode::Coverage:
+    return "coverage";
+  }
+
+  llvm_unreachable("Unknown instrumentation mode");
+}
+
+// Splits comma-separated list of patterns from an environment variable.
+void readPatternsEnv(const char *Name, std::vector<std::string> &Patterns) {
+  if (auto Env = std::getenv(Name)) {
+    llvm::SmallVector<llvm::StringRef, 4> Parts;
+    llvm::StringRef(Env).split(Parts, ',', -1, false);
+
+    for (auto Part : Parts) {
+      Patterns.push_back(Part.str());
+    }
+  }
+}
+
+Options Options::fromEnv() {
+  Options Opts;
+
+  if (auto ModeEnv = std::getenv("AARDWOLF_INSTRUMENTATION")) {
+    if (!parseInstrumentationMode(ModeEnv, Opts.Mode)) {
+      llvm::errs() << "Unknown instrumentation mode \"" << ModeEnv
+                   << "\", using \"statement\".\n";
+    }
+  }
+
+  if (auto InlineEnv = std::getenv("AARDWOLF_INLINE")) {
+    Opts.Inline = std::string(InlineEnv) == "1";
+  }
+
+  if (auto InductionsEnv = std::getenv("AARDWOLF_RECONSTRUCT_INDUCTIONS")) {
+    Opts.ReconstructInductions = std::string(InductionsEnv) == "1";
+  }
+
+  if (auto SamplingEnv = std::getenv("AARDWOLF_SAMPLING")) {
+    Opts.Sampling = std::string(SamplingEnv) == "1";
+  }
+
+  if (auto LtoEnv = std::getenv("AARDWOLF_LTO")) {
+    Opts.Lto = std::string(LtoEnv) == "1";
+  }
+
+  if (auto OptimizedEnv = std::getenv("AARDWOLF_OPTIMIZED")) {
+    Opts.Optimized = std::string(OptimizedEnv) == "1";
+  }
+
+  if (auto StatisticsEnv = std::getenv("AARDWOLF_STATISTICS")) {
+    Opts.Statistics = std::string(StatisticsEnv) == "1";
+  }
+
+  if (auto StaticCacheEnv = std::getenv("AARDWOLF_STATIC_CACHE")) {
+    Opts.StaticCache = StaticCacheEnv;
+  }
+
+  readPatternsEnv("AARDWOLF_INSTRUMENT_FUNCTIONS", Opts.InstrumentFunctions);
+  readPatternsEnv("AARDWOLF_SKIP_FUNCTIONS", Opts.SkipFunctions);
+  readPatternsEnv("AARDWOLF_INSTRUMENT_FILES", Opts.InstrumentFiles);
+  readPatternsEnv("AARDWOLF_SKIP_FILES", Opts.SkipFiles);
+
+  return Opts;
+}
+
+std::vector<llvm::GlobPattern>
+compilePatterns(const std::vector<std::string> &Patterns) {
+  std::vector<llvm::GlobPattern> Compiled;
+
+  for (auto &Pattern : Patterns) {
+    auto Glob = llvm::GlobPattern::create(Pattern);
+
+    if (Glob) {
+      Compiled.push_back(std::move(Glob.get()));
+    } else {
+      llvm::errs() << "Invalid pattern \"" << Pattern
+                   << "\": " << llvm::toString(Glob.takeError()) << "\n";
+    }
+  }
+
+  return Compiled;
+}
+
+bool matchesAny(const std::vector<llvm::GlobPattern> &Patterns,
+                const std::vector<std::string> &Names) {
+  for (auto &Pattern : Patterns) {
+    for (auto &Name : Names) {
+      if (Pattern.match(Name)) {
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+// Empty allow list allows everything.
+bool isAllowed(const std::vector<llvm::GlobPattern> &Instrument,
+               const std::vector<llvm::GlobPattern> &Skip,
+               const std::vector<std::string> &Names) {
+  return (Instrument.empty() || matchesAny(Instrument, Names)) &&
+         !matchesAny(Skip, Names);
+}
+
+InstrumentationFilter::InstrumentationFilter(const Options &Opts)
+    : InstrumentFunctions(compilePatterns(Opts.InstrumentFunctions)),
+      SkipFunctions(compilePatterns(Opts.SkipFunctions)),
+      InstrumentFiles(compilePatterns(Opts.InstrumentFiles)),
+      SkipFiles(compilePatterns(Opts.SkipFiles)) {}
+
+bool InstrumentationFilter::shouldInstrument(const llvm::Function &F) const {
+  if (!InstrumentFunctions.empty() || !SkipFunctions.empty()) {
+    auto Name = F.getName().str();
+    std::vector<std::string> Names = {Name, llvm::demangle(Name)};
+
+    if (!isAllowed(InstrumentFunctions, SkipFunctions, Names)) {
+      return false;
+    }
+  }
+
+  if (!InstrumentFiles.empty() || !SkipFiles.empty()) {
+    std::vector<std::string> Files;
+
+    // Functions without debug information cannot be matched to any file.
+    if (auto SP = F.getSubprogram()) {
+      if (SP->getDirectory() == "") {
+        Files.push_back(SP->getFilename().str());
+      } else {
+        Files.push_back((SP->getDirectory() + "/" + SP->getFilename()).str());
+      }
+    }
+
+    if (!isAllowed(InstrumentFiles, SkipFiles, Files)) {
+      return false;
+    }
+  }
+
+  return true;
+}
@@ -1,4 +1,5 @@
 #include "DynamicData.h"
+#include "Options.h"
 #include "StatementDetection.h"
 #include "StaticData.h"
 
@@ -24,31 +25,62 @@ llvm::PassPluginLibraryInfo getAardwolfPluginInfo() {
   return {LLVM_PLUGIN_API_VERSION, "aardwolf-llvm", LLVM_VERSION_STRING,
           [](llvm::PassBuilder &PB) {
             auto DestDir = getDestDir();
+            auto Opts = Options::fromEnv();
 
             PB.registerAnalysisRegistrationCallback(
-                [](llvm::ModuleAnalysisManager &MAM) {
-                  MAM.registerPass([&] { return StatementDetection(); });
+                [Opts](llvm::ModuleAnalysisManager &MAM) {
+                  MAM.registerPass([Opts] { return StatementDetection(Opts); });
                 });
 
             PB.registerPipelineParsingCallback(
-                [&DestDir](llvm::StringRef Name, llvm::ModulePassManager &MPM,
-                           llvm::ArrayRef<llvm::PassBuilder::PipelineElement>) {
+                [DestDir, Opts](
+                    llvm::StringRef Name, llvm::ModulePassManager &MPM,
+                    llvm::ArrayRef<llvm::PassBuilder::PipelineElement>) mutable {
                   if (Name == "aardwolf-static-data") {
-                    MPM.addPass(StaticData(DestDir));
+                    MPM.addPass(StaticData(DestDir, Opts));
                     return true;
                   }
                   return false;
                 });
 
             PB.registerPipelineParsingCallback(
-                [](llvm::StringRef Name, llvm::ModulePassManager &MPM,
-                   llvm::ArrayRef<llvm::PassBuilder::PipelineElement>) {
+                [Opts](llvm::StringRef Name, llvm::ModulePassManager &MPM,
+                       llvm::ArrayRef<llvm::PassBuilder::PipelineElement>) {
                   if (Name == "aardwolf-dynamic-data") {
-                    MPM.addPass(DynamicData());
+                    MPM.addPass(DynamicData(Opts));
                     return true;
                   }
                   return false;
                 });
+
+            // Both passes on the merged module of full LTO (e.g.,
+            // --lto-newpm-passes=aardwolf-lto,lto<O2> in lld), which gives a
+            // single static data file for the whole program. ThinLTO backends
+            // see only one module with imported copies of other functions, so
+            // they are not supported.
+            PB.registerPipelineParsingCallback(
+                [DestDir, Opts](
+                    llvm::StringRef Name, llvm::ModulePassManager &MPM,
+                    llvm::ArrayRef<llvm::PassBuilder::PipelineElement>) mutable {
+                  if (Name == "aardwolf-lto") {
+                    MPM.addPass(StaticData(DestDir, Opts));
+                    MPM.addPass(DynamicData(Opts));
+                    return true;
+                  }
+                  return false;
+                });
+
+            // Optimized code in the pipelines of clang. The optimizer-last
+            // extension point of LLVM 9 takes only function passes, so the
+            // module is instrumented at the start of the pipeline and the
+            // instrumented code is optimized afterwards.
+            if (Opts.Optimized && !Opts.Lto) {
+              PB.registerPipelineStartEPCallback(
+                  [DestDir, Opts](llvm::ModulePassManager &MPM) mutable {
+                    MPM.addPass(StaticData(DestDir, Opts));
+                    MPM.addPass(DynamicData(Opts));
+                  });
+            }
           }};
 }
 
@@ -79,12 +111,30 @@ static llvm::RegisterPass<LegacyDynamicData>
 static void registerLegacy(const llvm::PassManagerBuilder &,
                            llvm::legacy::PassManagerBase &PM) {
   auto DestDir = getDestDir();
+  auto Opts = Options::fromEnv();
 
-  PM.add(new LegacyStatementDetection());
-  PM.add(new LegacyStaticData(DestDir));
-  PM.add(new LegacyDynamicData());
+  // Instrumented at link time instead.
+  if (Opts.Lto) {
+    return;
+  }
+
+  PM.add(new LegacyStatementDetection(Opts));
+  PM.add(new LegacyStaticData(DestDir, Opts));
+  PM.add(new LegacyDynamicData(Opts));
+}
+
+// The extension point is used only when the optimizations are enabled.
+static void registerLegacyOptimized(const llvm::PassManagerBuilder &Builder,
+                                    llvm::legacy::PassManagerBase &PM) {
+  if (Options::fromEnv().Optimized) {
+    registerLegacy(Builder, PM);
+  }
 }
 
 static llvm::RegisterStandardPasses
     RegisterInjectFuncCall(llvm::PassManagerBuilder::EP_EnabledOnOptLevel0,
                            registerLegacy);
+
+static llvm::RegisterStandardPasses
+    RegisterInjectFuncCallOptimized(llvm::PassManagerBuilder::EP_OptimizerLast,
+                                    registerLegacyOptimized);
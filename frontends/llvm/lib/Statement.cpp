@@ -2,74 +2,127 @@
 
 #include <cassert>
 
+#include "llvm/ADT/Hashing.h"
+#include "llvm/IR/IntrinsicInst.h"
+
 using namespace aardwolf;
 
-Access Access::makeScalar(const llvm::Value *Value) { return Access(Value); }
+AccessId AccessArena::makeScalar(const llvm::Value *Value) {
+  auto Hash = std::hash<const llvm::Value *>()(Value);
+  return intern(Value, 0, AccessType::Structural, {}, Hash);
+}
+
+AccessId AccessArena::makeStructural(AccessId Base, AccessId Field) {
+  auto Hash = llvm::hash_combine(AccessType::Structural, Nodes[Base].Hash,
+                                 Nodes[Field].Hash);
+  return intern(nullptr, Base, AccessType::Structural, {Field}, Hash);
+}
+
+AccessId AccessArena::makeArrayLike(AccessId Base,
+                                    llvm::ArrayRef<AccessId> Index) {
+  llvm::hash_code Hash =
+      llvm::hash_combine(AccessType::ArrayLike, Nodes[Base].Hash);
+  for (auto A : Index) {
+    Hash = llvm::hash_combine(Hash, Nodes[A].Hash);
+  }
 
-Access Access::makeStructural(Access Base, Access Field) {
-  std::vector<Access> Accessors;
-  Accessors.push_back(Field);
-  return Access(Base, Accessors, AccessType::Structural);
+  return intern(nullptr, Base, AccessType::ArrayLike, Index, Hash);
 }
 
-Access Access::makeArrayLike(Access Base, Access Index) {
-  std::vector<Access> Accessors;
-  Accessors.push_back(Index);
-  return Access(Base, Accessors, AccessType::ArrayLike);
+AccessId AccessArena::import(const AccessArena &Other, AccessId Id) {
+  auto &Node = Other.Nodes[Id];
+
+  if (Node.Value != nullptr) {
+    return intern(Node.Value, 0, Node.Type, {}, Node.Hash);
+  }
+
+  auto Base = import(Other, Node.Base);
+
+  AccessList Index;
+  for (auto A : Other.getAccessors(Id)) {
+    Index.push_back(import(Other, A));
+  }
+
+  return intern(nullptr, Base, Node.Type, Index, Node.Hash);
 }
 
-Access Access::makeArrayLike(Access Base, std::vector<Access> Index) {
-  return Access(Base, Index, AccessType::ArrayLike);
+AccessId AccessArena::intern(const llvm::Value *Value, AccessId Base,
+                             AccessType Type,
+                             llvm::ArrayRef<AccessId> Index,
+                             std::size_t Hash) {
+  auto Range = Lookup.equal_range(Hash);
+  for (auto It = Range.first; It != Range.second; ++It) {
+    auto &Node = Nodes[It->second];
+    // The base and the accessors are already interned, so they are compared
+    // by their indices.
+    if (Node.Value == Value && Node.Base == Base && Node.Type == Type &&
+        getAccessors(It->second) == Index) {
+      return It->second;
+    }
+  }
+
+  AccessId Id = Nodes.size();
+  Nodes.push_back({Value, Base, Type, (uint32_t)Accessors.size(),
+                   (uint32_t)Index.size(), Hash});
+  Accessors.insert(Accessors.end(), Index.begin(), Index.end());
+  Lookup.insert({Hash, Id});
+  return Id;
 }
 
-bool Access::isScalar() const { return Value != nullptr; }
+bool AccessArena::isScalar(AccessId Id) const {
+  return Nodes[Id].Value != nullptr;
+}
 
-const llvm::Value *Access::getValue() const {
-  assert(isScalar() && "Access must be scalar to access the value");
-  return Value;
+const llvm::Value *AccessArena::getValue(AccessId Id) const {
+  assert(isScalar(Id) && "Access must be scalar to access the value");
+  return Nodes[Id].Value;
 }
 
-const Access &Access::getBase() const {
-  assert(!isScalar() && "Access must not be scalar to access the base");
-  return *Base;
+AccessId AccessArena::getBase(AccessId Id) const {
+  assert(!isScalar(Id) && "Access must not be scalar to access the base");
+  return Nodes[Id].Base;
 }
 
-const std::vector<Access> &Access::getAccessors() const {
-  assert(!isScalar() && "Access must not be scalar to access the accessors");
-  return Accessors;
+llvm::ArrayRef<AccessId> AccessArena::getAccessors(AccessId Id) const {
+  auto &Node = Nodes[Id];
+  return llvm::makeArrayRef(Accessors).slice(Node.AccessorsBegin,
+                                             Node.AccessorsSize);
 }
 
-const AccessType &Access::getType() const {
-  assert(!isScalar() && "Access must not be scalar to access the access type");
-  return Type;
+AccessType AccessArena::getType(AccessId Id) const {
+  assert(!isScalar(Id) &&
+         "Access must not be scalar to access the access type");
+  return Nodes[Id].Type;
 }
 
-const llvm::Value *Access::getValueOrBase() const {
-  if (isScalar()) {
-    return Value;
-  } else {
-    return Base->getValueOrBase();
+const llvm::Value *AccessArena::getValueOrBase(AccessId Id) const {
+  while (!isScalar(Id)) {
+    Id = Nodes[Id].Base;
   }
+
+  return Nodes[Id].Value;
 }
 
-void Access::print(llvm::raw_ostream &Stream) const {
-  if (isScalar()) {
+void AccessArena::print(AccessId Id, llvm::raw_ostream &Stream) const {
+  auto &Node = Nodes[Id];
+
+  if (isScalar(Id)) {
     Stream << "Scalar(";
-    Value->print(Stream);
+    Node.Value->print(Stream);
     Stream << ")";
   } else {
-    if (Type == AccessType::Structural) {
+    if (Node.Type == AccessType::Structural) {
       Stream << "Structural(";
-      Base->print(Stream);
+      print(Node.Base, Stream);
       Stream << " :: ";
-      Accessors[0].print(Stream);
+      print(getAccessors(Id)[0], Stream);
       Stream << ")";
-    } else if (Type == AccessType::ArrayLike) {
+    } else if (Node.Type == AccessType::ArrayLike) {
       Stream << "Structural(";
-      Base->print(Stream);
+      print(Node.Base, Stream);
       Stream << " :: [";
-      for (auto A : Accessors) {
-        A.print(Stream);
+      for (auto A : getAccessors(Id)) {
+        print(A, Stream);
         Stream << "  ";
       }
       Stream << "])";
@@ -83,16 +136,27 @@ Location::Location(std::string File, LineCol Begin, LineCol End)
     : File(File), Begin(Begin), End(End) {}
 
 Statement::Statement()
-    : Instr(nullptr), In(16), Out(nullptr),
+    : Instr(nullptr), In(), Out(),
       Loc("", LineCol(0, 0), LineCol(0, 0)) {}
 
 bool Statement::isArg() const {
+  // In optimized code, the argument is described by a debug value.
+  if (auto DVI = llvm::dyn_cast<llvm::DbgValueInst>(Instr)) {
+    return llvm::isa<llvm::Argument>(DVI->getValue());
+  }
+
   // Argument is the first operand of a store instruction (if the instruction
   // represents initialization of local variable with argument value).
-  return Instr->getNumOperands() > 0 &&
-         llvm::isa<llvm::Argument>(Instr->getOperand(0));
+  // Optimized code can use the arguments directly in other instructions.
+  return llvm::isa<llvm::StoreInst>(Instr) &&
+         llvm::isa<llvm::Argument>(Instr->getOperand(0)) &&
+         llvm::isa<llvm::AllocaInst>(Instr->getOperand(1));
 }
 
 bool Statement::isRet() const { return llvm::isa<llvm::ReturnInst>(Instr); }
 
-bool Statement::isCall() const { return llvm::isa<llvm::CallBase>(Instr); }
+bool Statement::isCall() const {
+  // Debug values which represent statements in optimized code are not calls.
+  return llvm::isa<llvm::CallBase>(Instr) &&
+         !llvm::isa<llvm::IntrinsicInst>(Instr);
+}
@@ -1,15 +1,22 @@
 #include "StatementDetection.h"
 
 #include <cassert>
+#include <map>
 #include <queue>
+#include <unordered_map>
 #include <unordered_set>
 
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Analysis/LoopInfo.h"
 #include "llvm/IR/Constants.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/InstIterator.h"
 #include "llvm/IR/Instruction.h"
 #include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/Value.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/ThreadPool.h"
 #include "llvm/Transforms/Utils/Local.h"
 
 #include "Exceptions.h"
@@ -18,96 +25,147 @@
 
 using namespace aardwolf;
 
-std::shared_ptr<Access> getValueAccess(const llvm::User *U);
-std::unordered_set<Access, AccessHasher> findInputs(const llvm::Instruction *I);
+// Memoized results of the value analysis within a single function. The same
+// operand chains (GEPs, loads of the same variable, casts) are shared by many
+// statements, so each of them is resolved only once.
+struct AccessCache {
+  // Arena of the repository shard where the accesses are stored.
+  AccessArena &Arena;
+
+  // Resolved access for each value (None if it is not a supported value).
+  std::unordered_map<const llvm::User *, llvm::Optional<AccessId>> Accesses;
+
+  // Inputs reachable from the operands of intermediate values.
+  std::unordered_map<const llvm::User *, AccessList> Inputs;
+
+  // Values whose inputs are being collected at the moment.
+  std::unordered_set<const llvm::User *> Visiting;
+
+  // Debug descriptions of the values which hold source variables. These are
+  // present only in optimized code, where the variables live in SSA values
+  // instead of allocas.
+  llvm::DenseMap<const llvm::Value *, const llvm::DbgValueInst *> DbgValues;
+
+  AccessCache(AccessArena &Arena) : Arena(Arena) {}
+};
+
+// Whether the debug value describes the whole source variable (not only its
+// fragment) and the variable is defined at this point.
+bool isVariableDef(const llvm::DbgValueInst *DVI) {
+  auto Value = DVI->getValue();
+  return Value != nullptr && !llvm::isa<llvm::UndefValue>(Value) &&
+         DVI->getExpression()->getNumElements() == 0;
+}
+
+// Maps the values of the function to the source variables they hold. If a
+// value is described multiple times, the first description wins.
+void collectDbgValues(llvm::Function &F, AccessCache &Cache) {
+  for (auto &I : llvm::instructions(F)) {
+    if (auto DVI = llvm::dyn_cast<llvm::DbgValueInst>(&I)) {
+      if (isVariableDef(DVI)) {
+        Cache.DbgValues.try_emplace(DVI->getValue(), DVI);
+      }
+    }
+  }
+}
+
+// The variable is represented by the metadata operand of its debug value,
+// which is shared by all descriptions of the same variable.
+AccessId makeVariable(const llvm::DbgValueInst *DVI, AccessCache &Cache) {
+  return Cache.Arena.makeScalar(DVI->getArgOperand(1));
+}
+
+llvm::Optional<AccessId> getValueAccess(const llvm::User *U,
+                                        AccessCache &Cache);
+AccessList findInputs(const llvm::Instruction *I, AccessCache &Cache);
 
 // Gets value that corresponds to the base "pointer" of a composite type (the
 // array or structure itself).
-const std::shared_ptr<Access>
-findCompositeBase(const llvm::GetElementPtrInst *GEPI) {
+llvm::Optional<AccessId>
+findCompositeBase(const llvm::GetElementPtrInst *GEPI, AccessCache &Cache) {
   auto B = GEPI->getOperand(0);
 
   if (auto GEPI2 = llvm::dyn_cast<llvm::GetElementPtrInst>(B)) {
-    return getValueAccess(GEPI2);
+    return getValueAccess(GEPI2, Cache);
   } else if (auto I = llvm::dyn_cast<llvm::Instruction>(B)) {
     // Found on first try (this is true for arrays).
     if (llvm::isa<llvm::AllocaInst>(I)) {
-      return std::make_shared<Access>(Access::makeScalar(I));
+      return Cache.Arena.makeScalar(I);
     }
 
     // Find the alloca instruction transitively.
-    auto Inputs = findInputs(I);
+    auto Inputs = findInputs(I, Cache);
     if (Inputs.size() == 1) {
-      return std::make_shared<Access>(*Inputs.begin());
+      return Inputs.front();
     }
 
-    return nullptr;
+    return llvm::None;
   } else if (llvm::isa<llvm::GlobalVariable>(B)) {
-    return std::make_shared<Access>(Access::makeScalar(B));
+    return Cache.Arena.makeScalar(B);
   }
 
-  return nullptr;
+  return llvm::None;
 }
 
 // Gets values that determine the access to the composite type (e.g., index,
 // field, etc.).
-std::vector<Access> findCompositeAccessors(const llvm::GetElementPtrInst *GEPI,
-                                           bool isStruct) {
-  std::vector<Access> Output;
+AccessList findCompositeAccessors(const llvm::GetElementPtrInst *GEPI,
+                                  bool isStruct, AccessCache &Cache) {
+  AccessList Output;
 
   auto AU =
       llvm::dyn_cast<llvm::User>(GEPI->getOperand(GEPI->getNumOperands() - 1));
 
   // Try if the accessor is valid access on its own.
-  auto A = getValueAccess(AU);
+  auto A = getValueAccess(AU, Cache);
 
-  if (A == nullptr) {
+  if (!A.hasValue()) {
     if (auto C = llvm::dyn_cast<llvm::Constant>(AU)) {
       // Constant. Fields of structures are encoded as numbers.
       if (isStruct) {
-        Output.push_back(Access::makeScalar(C));
+        Output.push_back(Cache.Arena.makeScalar(C));
       }
     } else if (auto I = llvm::dyn_cast<llvm::Instruction>(AU)) {
       // Find the alloca/method call instructions.
-      for (auto Input : findInputs(I)) {
-        Output.push_back(Input);
-      }
+      Output = findInputs(I, Cache);
     }
   } else {
-    Output.push_back(*A);
+    Output.push_back(A.getValue());
   }
 
   return Output;
 }
 
-std::shared_ptr<Access> getValueAccess(const llvm::User *U) {
-  if (U == nullptr) {
-    return nullptr;
+llvm::Optional<AccessId> resolveValueAccess(const llvm::User *U,
+                                            AccessCache &Cache) {
+  if (auto DVI = Cache.DbgValues.lookup(U)) {
+    // Value of a variable in optimized code.
+    return makeVariable(DVI, Cache);
   } else if (llvm::isa<llvm::AllocaInst>(U)) {
     // Local variable.
-    return std::make_shared<Access>(Access::makeScalar(U));
+    return Cache.Arena.makeScalar(U);
   } else if (llvm::isa<llvm::CallInst>(U)) {
     // Result of a function call.
-    return std::make_shared<Access>(Access::makeScalar(U));
+    return Cache.Arena.makeScalar(U);
   } else if (auto GV = llvm::dyn_cast<llvm::GlobalVariable>(U)) {
     if (GV->isConstant()) {
       // If isConstant is true, then the value is immutable throughout the
       // execution, therefore we do not treat such values as variables.
-      return nullptr;
+      return llvm::None;
     }
 
     // Global variable.
-    return std::make_shared<Access>(Access::makeScalar(GV));
+    return Cache.Arena.makeScalar(GV);
   } else if (auto GEPI = llvm::dyn_cast<llvm::GetElementPtrInst>(U)) {
     auto isStruct = GEPI->getSourceElementType()->isStructTy();
 
-    auto B = findCompositeBase(GEPI);
-    auto A = findCompositeAccessors(GEPI, isStruct);
+    auto B = findCompositeBase(GEPI, Cache);
+    auto A = findCompositeAccessors(GEPI, isStruct, Cache);
 
-    // assert(B != nullptr && !A.empty() && "Internal error.");
-    if (B == nullptr) {
+    // assert(B.hasValue() && !A.empty() && "Internal error.");
+    if (!B.hasValue()) {
       // FIXME
-      return nullptr;
+      return llvm::None;
     }
 
     // Struct pointer is special for us, all other are treated as general
@@ -115,97 +173,152 @@ std::shared_ptr<Access> getValueAccess(const llvm::User *U) {
     if (isStruct) {
       if (A.empty()) {
         // FIXME
-        return nullptr;
+        return llvm::None;
       }
 
-      return std::make_shared<Access>(Access::makeStructural(*B, *A.begin()));
+      return Cache.Arena.makeStructural(B.getValue(), A.front());
     } else {
-      return std::make_shared<Access>(Access::makeArrayLike(*B, A));
+      return Cache.Arena.makeArrayLike(B.getValue(), A);
     }
   } else if (auto CE = llvm::dyn_cast<llvm::ConstantExpr>(U)) {
     // Assignment of a constant to a static array with compile-time known index.
     if (CE->isGEPWithNoNotionalOverIndexing()) {
-      std::vector<Access> Empty;
-      auto B = getValueAccess(llvm::dyn_cast<llvm::User>(CE->getOperand(0)));
+      auto B =
+          getValueAccess(llvm::dyn_cast<llvm::User>(CE->getOperand(0)), Cache);
 
-      if (B != nullptr) {
-        return std::make_shared<Access>(Access::makeArrayLike(*B, Empty));
+      if (B.hasValue()) {
+        return Cache.Arena.makeArrayLike(B.getValue(), {});
       }
     }
 
-    return nullptr;
+    return llvm::None;
   } else if (auto LI = llvm::dyn_cast<llvm::LoadInst>(U)) {
     if (LI->getType()->isPointerTy()) {
       // Dereferencing a pointer. Treat it like array[0] because we do not have
       // any other information.
-      auto B = getValueAccess(llvm::dyn_cast<llvm::User>(LI->getOperand(0)));
-      if (B == nullptr) {
-        return nullptr;
+      auto B =
+          getValueAccess(llvm::dyn_cast<llvm::User>(LI->getOperand(0)), Cache);
+      if (!B.hasValue()) {
+        return llvm::None;
       } else {
         // If we treat it as array[0], zero is a constant which would not be
-        // included in index variables, so we pass an empty vector.
-        std::vector<Access> Empty;
-        return std::make_shared<Access>(Access::makeArrayLike(*B, Empty));
+        // included in index variables, so we pass no accessors.
+        return Cache.Arena.makeArrayLike(B.getValue(), {});
       }
     } else {
-      return nullptr;
+      return llvm::None;
     }
   } else {
-    return nullptr;
+    return llvm::None;
   }
 }
 
-// Finds inputs of an instruction which are then used as inputs
-// in the Statement structure.
+llvm::Optional<AccessId> getValueAccess(const llvm::User *U,
+                                        AccessCache &Cache) {
+  if (U == nullptr) {
+    return llvm::None;
+  }
+
+  auto Found = Cache.Accesses.find(U);
+  if (Found != Cache.Accesses.end()) {
+    return Found->second;
+  }
+
+  auto Result = resolveValueAccess(U, Cache);
+  Cache.Accesses[U] = Result;
+  return Result;
+}
+
+// Sorts the accesses and removes the duplicates.
+void normalizeInputs(AccessList &Inputs) {
+  llvm::sort(Inputs);
+  Inputs.erase(std::unique(Inputs.begin(), Inputs.end()), Inputs.end());
+}
+
+// Collects inputs reachable from the operands of given value into Result.
+// Search backwards in the data flow for values that represent supported values
+// (see Statement.h) and properly handle "transitive" nodes like loads,
+// arithmetics or conversions which might use the values that we are looking
+// for. Inputs of the transitive nodes are memoized.
 //
-// If given instruction is StoreInst, the resulting set does not contain
-// the destination variable.
-std::unordered_set<Access, AccessHasher>
-findInputs(const llvm::Instruction *I) {
-  std::unordered_set<Access, AccessHasher> Result(16);
-
-  // Use BFS-like search backwards in the control flow graph and search for
-  // instructions that represent supported values (see Statement.h). While doing
-  // it, properly handle "transitive" nodes like loads, arithmetics or
-  // conversions which might use the instructions that we are looking for.
-  std::queue<const llvm::User *> Q;
-  Q.push(I);
-
-  while (!Q.empty()) {
-    auto QU = Q.front();
-    Q.pop();
-
-    auto V = getValueAccess(QU);
-    if (QU != I && V != nullptr) {
-      Result.insert(*V);
-    } else if (auto *SI = llvm::dyn_cast<llvm::StoreInst>(QU)) {
-      // If the instruction is StoreInst, we must not to include the destination
-      // variable.
-      if (auto *In = llvm::dyn_cast<llvm::User>(SI->getOperand(0))) {
-        Q.push(In);
-      }
+// Returns false if the search ran into a cycle (through phi nodes) and hence
+// the collected inputs must not be memoized.
+bool collectInputs(const llvm::User *U, AccessCache &Cache,
+                   AccessList &Result) {
+  auto Found = Cache.Inputs.find(U);
+  if (Found != Cache.Inputs.end()) {
+    Result.append(Found->second.begin(), Found->second.end());
+    return true;
+  }
+
+  if (!Cache.Visiting.insert(U).second) {
+    return false;
+  }
+
+  AccessList Inputs;
+  bool Complete = true;
+
+  auto Visit = [&](const llvm::User *In) {
+    if (auto V = getValueAccess(In, Cache)) {
+      Inputs.push_back(V.getValue());
     } else {
-      // Add all operands as neighbors into the queue.
-      for (const llvm::Use &U : QU->operands()) {
-        if (auto *In = llvm::dyn_cast<llvm::User>(U)) {
-          // FIXME: These are now supported by `getValueAccess`. However, it
-          // certainly limits the scope of applicability.
-          if (llvm::isa<llvm::Instruction>(In) ||
-              llvm::isa<llvm::GlobalVariable>(In) ||
-              llvm::isa<llvm::ConstantExpr>(In)) {
-            Q.push(In);
-          }
+      Complete = collectInputs(In, Cache, Inputs) && Complete;
+    }
+  };
+
+  if (auto *SI = llvm::dyn_cast<llvm::StoreInst>(U)) {
+    // If the instruction is StoreInst, we must not to include the destination
+    // variable.
+    if (auto *In = llvm::dyn_cast<llvm::User>(SI->getOperand(0))) {
+      Visit(In);
+    }
+  } else {
+    // Visit all operands as neighbors.
+    for (const llvm::Use &Op : U->operands()) {
+      if (llvm::isa<llvm::Argument>(Op)) {
+        // Arguments are variables only in optimized code, otherwise they are
+        // stored into allocas first.
+        if (auto DVI = Cache.DbgValues.lookup(Op)) {
+          Inputs.push_back(makeVariable(DVI, Cache));
+        }
+      } else if (auto *In = llvm::dyn_cast<llvm::User>(Op)) {
+        // FIXME: These are now supported by `getValueAccess`. However, it
+        // certainly limits the scope of applicability.
+        if (llvm::isa<llvm::Instruction>(In) ||
+            llvm::isa<llvm::GlobalVariable>(In) ||
+            llvm::isa<llvm::ConstantExpr>(In)) {
+          Visit(In);
         }
       }
     }
   }
 
+  Cache.Visiting.erase(U);
+  normalizeInputs(Inputs);
+  Result.append(Inputs.begin(), Inputs.end());
+
+  if (Complete) {
+    Cache.Inputs.emplace(U, std::move(Inputs));
+  }
+
+  return Complete;
+}
+
+// Finds inputs of an instruction which are then used as inputs
+// in the Statement structure.
+//
+// If given instruction is StoreInst, the resulting set does not contain
+// the destination variable.
+AccessList findInputs(const llvm::Instruction *I, AccessCache &Cache) {
+  AccessList Result;
+  collectInputs(I, Cache, Result);
+  normalizeInputs(Result);
   return Result;
 }
 
 // Retrieves the location of the whole statement in the original source code.
-const Location getStmtLoc(const Statement &Stmt) {
-  auto InstrLoc = getInstrLoc(Stmt.Instr);
+const Location getStmtLoc(const llvm::Instruction *I) {
+  auto InstrLoc = getInstrLoc(I);
   auto Line = InstrLoc.getLine();
   auto Col = InstrLoc.getCol();
   auto File = getDebugLocFile(InstrLoc);
@@ -216,12 +329,16 @@ const Location getStmtLoc(const Statement &Stmt) {
   return Location(File, LineCol(Line, Col), LineCol(Line, Col));
 }
 
-Statement runOnInstr(llvm::Instruction *I) {
+const Location getStmtLoc(const Statement &Stmt) {
+  return getStmtLoc(Stmt.Instr);
+}
+
+Statement runOnInstr(llvm::Instruction *I, AccessCache &Cache) {
   Statement Result;
 
   if (auto *RI = llvm::dyn_cast<llvm::ReturnInst>(I)) {
     Result.Instr = RI;
-    Result.In = findInputs(RI);
+    Result.In = findInputs(RI, Cache);
     Result.Loc = getStmtLoc(Result);
     return Result;
   }
@@ -229,7 +346,7 @@ Statement runOnInstr(llvm::Instruction *I) {
   if (auto *BI = llvm::dyn_cast<llvm::BranchInst>(I)) {
     if (BI->isConditional()) {
       Result.Instr = BI;
-      Result.In = findInputs(BI);
+      Result.In = findInputs(BI, Cache);
       Result.Loc = getStmtLoc(Result);
       return Result;
     }
@@ -237,26 +354,40 @@ Statement runOnInstr(llvm::Instruction *I) {
 
   if (auto *SI = llvm::dyn_cast<llvm::SwitchInst>(I)) {
     Result.Instr = SI;
-    Result.In = findInputs(SI);
+    Result.In = findInputs(SI, Cache);
     Result.Loc = getStmtLoc(Result);
     return Result;
   }
 
   if (auto *II = llvm::dyn_cast<llvm::InvokeInst>(I)) {
     Result.Instr = II;
-    Result.In = findInputs(II);
+    Result.In = findInputs(II, Cache);
     Result.Loc = getStmtLoc(Result);
     return Result;
   }
 
   if (auto *SI = llvm::dyn_cast<llvm::StoreInst>(I)) {
     Result.Instr = SI;
-    Result.In = findInputs(SI);
-    Result.Out = getValueAccess(llvm::dyn_cast<llvm::User>(SI->getOperand(1)));
+    Result.In = findInputs(SI, Cache);
+    Result.Out =
+        getValueAccess(llvm::dyn_cast<llvm::User>(SI->getOperand(1)), Cache);
     Result.Loc = getStmtLoc(Result);
     return Result;
   }
 
+  // In optimized code, the assignments of arguments and constants to
+  // variables are not present as instructions anymore, so their debug values
+  // represent the statements.
+  if (auto *DVI = llvm::dyn_cast<llvm::DbgValueInst>(I)) {
+    if (isVariableDef(DVI) && (llvm::isa<llvm::Argument>(DVI->getValue()) ||
+                               llvm::isa<llvm::Constant>(DVI->getValue()))) {
+      Result.Instr = DVI;
+      Result.Out = makeVariable(DVI, Cache);
+      Result.Loc = getStmtLoc(Result);
+      return Result;
+    }
+  }
+
   // Filter debugging intrinsic calls before processing function calls
   if (llvm::isa<llvm::DbgInfoIntrinsic>(I)) {
     return Result;
@@ -265,129 +396,409 @@ Statement runOnInstr(llvm::Instruction *I) {
   // TODO: Consider `memset`, `memcpy`, etc. as definition calls (i.e., they do
   // not *use* the pointer as the argument, but *define* its value)?
   if (auto *CI = llvm::dyn_cast<llvm::CallInst>(I)) {
-    auto Inputs = findInputs(CI);
     Result.Instr = CI;
-    Result.In = findInputs(CI);
+    Result.In = findInputs(CI, Cache);
     Result.Loc = getStmtLoc(Result);
 
-    if (!CI->getType()->isVoidTy()) {
-      Result.Out = std::make_shared<Access>(Access::makeScalar(CI));
+    if (auto DVI = Cache.DbgValues.lookup(CI)) {
+      Result.Out = makeVariable(DVI, Cache);
+    } else if (!CI->getType()->isVoidTy()) {
+      Result.Out = Cache.Arena.makeScalar(CI);
     }
 
     return Result;
   }
 
+  // Other values which are assigned to variables in optimized code (e.g.,
+  // arithmetic, loads or phi nodes).
+  if (auto DVI = Cache.DbgValues.lookup(I)) {
+    Result.Instr = I;
+    Result.In = findInputs(I, Cache);
+    Result.Out = makeVariable(DVI, Cache);
+    // Phi nodes and hoisted instructions usually do not have a location.
+    Result.Loc = I->getDebugLoc() ? getStmtLoc(Result) : getStmtLoc(DVI);
+    return Result;
+  }
+
   return Result;
 }
 
-bool StatementDetectionBase::runBase(llvm::Module &M) {
-  // First and last statements for each non-empty basic block.
-  std::map<const llvm::BasicBlock *,
-           std::pair<llvm::Instruction *, llvm::Instruction *>>
-      BBBounds;
+bool isCall(const llvm::Instruction *I) {
+  return llvm::isa<llvm::CallBase>(I) && !llvm::isa<llvm::IntrinsicInst>(I);
+}
 
-  for (auto &F : M) {
-    if (F.isDeclaration()) {
-      // Only functions that are defined.
+// Local variable whose address does not escape, so it can be modified only by
+// the stores in the function.
+bool isLocalVariable(const llvm::AllocaInst *Var) {
+  for (auto U : Var->users()) {
+    if (llvm::isa<llvm::LoadInst>(U) || llvm::isa<llvm::DbgInfoIntrinsic>(U)) {
       continue;
     }
 
-    // First, detect all statements in the function.
-    for (auto &BB : F) {
-      // Store the first detected statement for proper successor chaining
-      // between basic blocks.
-      llvm::Instruction *First = nullptr;
-      // Store previous detected statement for chaining statements.
-      llvm::Instruction *Prev = nullptr;
-
-      for (auto &I : BB) {
-        Statement Stmt;
-        try {
-          Stmt = runOnInstr(&I);
-        } catch (UnknownLocation &) {
-          // This statement does not have a location. It can be an instruction
-          // that is not present in the source code and is added by the
-          // compiler.
-          continue;
-        }
+    auto SI = llvm::dyn_cast<llvm::StoreInst>(U);
+    if (SI == nullptr || SI->getValueOperand() == Var) {
+      return false;
+    }
+  }
 
-        // If the instruction represents a valid statement.
-        if (Stmt.Instr != nullptr) {
-          // Register the statement at this point for user-friendly identifiers
-          // that follow the order of occurrence of the statement in the source
-          // code.
-          Repo.registerStatement(&F, Stmt);
-
-          if (First == nullptr) {
-            First = Stmt.Instr;
-            Prev = Stmt.Instr;
-          } else {
-            // Chain the statements.
-            Repo.addSuccessor(Prev, Stmt.Instr);
-            Prev = Stmt.Instr;
-          }
-        }
+  return true;
+}
+
+// Whether the last store to the variable in the basic block is not followed by
+// any call, that is, it is the last traced value of the variable when the
+// execution leaves the block.
+bool endsWithStore(const llvm::BasicBlock *BB, const llvm::AllocaInst *Var) {
+  for (auto It = BB->rbegin(), Et = BB->rend(); It != Et; ++It) {
+    if (auto SI = llvm::dyn_cast<llvm::StoreInst>(&*It)) {
+      if (SI->getPointerOperand() == Var) {
+        return true;
       }
+    } else if (isCall(&*It)) {
+      return false;
+    }
+  }
+
+  return false;
+}
+
+// Matches `Var = Var + C` (or `Var = Var - C`) and returns the step.
+llvm::Optional<int64_t> matchStep(const llvm::StoreInst *SI,
+                                  const llvm::AllocaInst *Var) {
+  auto BO = llvm::dyn_cast<llvm::BinaryOperator>(SI->getValueOperand());
+  if (BO == nullptr || (BO->getOpcode() != llvm::Instruction::Add &&
+                        BO->getOpcode() != llvm::Instruction::Sub)) {
+    return llvm::None;
+  }
 
-      // Non-empty basic block.
-      if (Prev != nullptr) {
-        // Store the first
-        BBBounds[&BB] = std::make_pair(First, Prev);
+  auto Load = llvm::dyn_cast<llvm::LoadInst>(BO->getOperand(0));
+  auto C = llvm::dyn_cast<llvm::ConstantInt>(BO->getOperand(1));
+
+  if (BO->getOpcode() == llvm::Instruction::Add && Load == nullptr) {
+    Load = llvm::dyn_cast<llvm::LoadInst>(BO->getOperand(1));
+    C = llvm::dyn_cast<llvm::ConstantInt>(BO->getOperand(0));
+  }
+
+  if (Load == nullptr || C == nullptr || Load->getPointerOperand() != Var ||
+      Load->getParent() != SI->getParent()) {
+    return llvm::None;
+  }
+
+  // The loaded value must be the current value of the variable.
+  for (auto I = Load->getNextNode(); I != SI; I = I->getNextNode()) {
+    if (I == nullptr) {
+      return llvm::None;
+    }
+
+    if (auto Other = llvm::dyn_cast<llvm::StoreInst>(I)) {
+      if (Other->getPointerOperand() == Var) {
+        return llvm::None;
       }
     }
+  }
+
+  auto Step = C->getSExtValue();
+  return BO->getOpcode() == llvm::Instruction::Add ? Step : -Step;
+}
+
+// Finds the statements which step a local variable by a constant in a loop
+// without calls. Their values can be reconstructed from the previous value of
+// the variable, because the loop is always entered right after a traced store
+// to the variable and no other code runs in the thread while in the loop.
+void findInductionSteps(llvm::Function &F, StatementRepository &Repo) {
+  llvm::DominatorTree DT(F);
+  llvm::LoopInfo LI(DT);
 
-    // Chain also statements between the basic blocks.
-    for (auto &BB : F) {
-      auto BBFound = BBBounds.find(&BB);
-      if (BBFound == BBBounds.end()) {
-        // If the basic block is empty, ignore it.
+  if (LI.empty()) {
+    return;
+  }
+
+  std::map<const llvm::Loop *, bool> HasCall;
+
+  for (auto Idx : Repo.getFunctionStatements(&F)) {
+    auto SI = llvm::dyn_cast<llvm::StoreInst>(Repo.Statements[Idx].Instr);
+    if (SI == nullptr) {
+      continue;
+    }
+
+    auto Var = llvm::dyn_cast<llvm::AllocaInst>(SI->getPointerOperand());
+    auto Ty = SI->getValueOperand()->getType();
+    if (Var == nullptr || !Ty->isIntegerTy() ||
+        Ty->getIntegerBitWidth() < 8 || Ty->getIntegerBitWidth() > 64) {
+      continue;
+    }
+
+    auto L = LI.getLoopFor(SI->getParent());
+    if (L == nullptr) {
+      continue;
+    }
+
+    auto Step = matchStep(SI, Var);
+    if (!Step.hasValue() || !isLocalVariable(Var)) {
+      continue;
+    }
+
+    if (HasCall.find(L) == HasCall.end()) {
+      HasCall[L] = llvm::any_of(L->blocks(), [](const llvm::BasicBlock *BB) {
+        return llvm::any_of(*BB, [](const llvm::Instruction &I) {
+          return isCall(&I);
+        });
+      });
+    }
+
+    if (HasCall[L]) {
+      continue;
+    }
+
+    bool Entered = true;
+    for (auto Pred : llvm::predecessors(L->getHeader())) {
+      if (!L->contains(Pred) && !endsWithStore(Pred, Var)) {
+        Entered = false;
+      }
+    }
+
+    if (!Entered) {
+      continue;
+    }
+
+    InductionStep Induction;
+    Induction.Step = Step.getValue();
+
+    for (auto Def : Repo.getFunctionStatements(&F)) {
+      auto Store = llvm::dyn_cast<llvm::StoreInst>(Repo.Statements[Def].Instr);
+      if (Store != nullptr && Store != SI &&
+          Store->getPointerOperand() == Var) {
+        Induction.Defs.push_back(Def);
+      }
+    }
+
+    // All stores to the variable must be statements, so their values are
+    // traced.
+    auto NStores = llvm::count_if(Var->users(), [](const llvm::User *U) {
+      return llvm::isa<llvm::StoreInst>(U);
+    });
+
+    if ((size_t)NStores == Induction.Defs.size() + 1) {
+      Repo.InductionSteps[Idx] = Induction;
+    }
+  }
+}
+
+// Detects all statements in the function and adds them to the repository
+// shard of the function. Functions are independent of each other, so this can
+// run for multiple functions concurrently.
+void detectStatements(llvm::Function &F, StatementRepository &Shard,
+                      const Options &Opts) {
+  AccessCache Cache(Shard.Accesses);
+  collectDbgValues(F, Cache);
+
+  // First and last statements for each non-empty basic block.
+  llvm::DenseMap<const llvm::BasicBlock *, std::pair<StmtIdx, StmtIdx>>
+      BBBounds;
+
+  // First, detect all statements in the function.
+  for (auto &BB : F) {
+    // Store the first detected statement for proper successor chaining
+    // between basic blocks.
+    llvm::Optional<StmtIdx> First;
+    // Store previous detected statement for chaining statements.
+    llvm::Optional<StmtIdx> Prev;
+    // First statement of the current trace block.
+    llvm::Optional<StmtIdx> Leader;
+
+    for (auto &I : BB) {
+      // Calls may execute other instrumented code, so the statements after
+      // them start a new trace block. Intrinsics are not real calls.
+      bool EndsBlock =
+          llvm::isa<llvm::CallBase>(&I) && !llvm::isa<llvm::IntrinsicInst>(&I);
+
+      Statement Stmt;
+      try {
+        Stmt = runOnInstr(&I, Cache);
+      } catch (UnknownLocation &) {
+        // This statement does not have a location. It can be an instruction
+        // that is not present in the source code and is added by the
+        // compiler.
+        if (EndsBlock) {
+          Leader = llvm::None;
+        }
         continue;
       }
 
-      std::queue<llvm::BasicBlock *> BBPred;
+      // If the instruction represents a valid statement.
+      if (Stmt.Instr != nullptr) {
+        // Add the statement at this point for user-friendly identifiers that
+        // follow the order of occurrence of the statement in the source code.
+        // The identifiers are assigned when the shard is merged.
+        auto Idx = Shard.addStatement(&F, std::move(Stmt));
+
+        if (!First.hasValue()) {
+          First = Idx;
+          Prev = Idx;
+        } else {
+          // Chain the statements.
+          Shard.addSuccessor(Prev.getValue(), Idx);
+          Prev = Idx;
+        }
+
+        if (!Leader.hasValue()) {
+          Leader = Idx;
+        }
+
+        Shard.addToBlock(Leader.getValue(), Idx);
+      }
 
-      for (auto It = llvm::pred_begin(&BB), Et = llvm::pred_end(&BB); It != Et;
-           ++It) {
-        // Add all predecessors by default.
-        BBPred.push(*It);
+      if (EndsBlock) {
+        Leader = llvm::None;
       }
+    }
 
-      while (!BBPred.empty()) {
-        auto P = BBPred.front();
-        BBPred.pop();
-        auto PredFound = BBBounds.find(P);
-
-        if (PredFound == BBBounds.end()) {
-          // If the predecessor basic block is empty, add also its predecessor
-          // to the queue. That is, we need to find all non-empty predecessors
-          // of the basic block.
-          for (auto It = llvm::pred_begin(P), Et = llvm::pred_end(P); It != Et;
-               ++It) {
-            BBPred.push(*It);
-          }
+    // Non-empty basic block.
+    if (Prev.hasValue()) {
+      // Store the first
+      BBBounds[&BB] = std::make_pair(First.getValue(), Prev.getValue());
+    }
+  }
+
+  // Non-empty basic blocks which precede each empty basic block, possibly
+  // through other empty basic blocks. They are found once per function,
+  // because an empty block (e.g., a loop latch) is often a predecessor of
+  // several non-empty blocks.
+  llvm::DenseMap<const llvm::BasicBlock *,
+                 llvm::SmallVector<const llvm::BasicBlock *, 4>>
+      EmptyPreds;
+
+  for (auto &BB : F) {
+    if (BBBounds.count(&BB)) {
+      continue;
+    }
+
+    auto &Preds = EmptyPreds[&BB];
+    // Empty blocks may form a cycle.
+    llvm::SmallPtrSet<const llvm::BasicBlock *, 8> Visited;
+    std::queue<const llvm::BasicBlock *> Queue;
+
+    Visited.insert(&BB);
+    Queue.push(&BB);
+
+    while (!Queue.empty()) {
+      auto P = Queue.front();
+      Queue.pop();
+
+      for (auto Pred : llvm::predecessors(P)) {
+        if (!Visited.insert(Pred).second) {
+          continue;
+        }
+
+        if (BBBounds.count(Pred)) {
+          Preds.push_back(Pred);
         } else {
-          // Add the successors between the basic blocks.
-          // That is, chain the last statement of the predecessor basic block
-          // with the first statement in the current basic block.
-          Repo.addSuccessor(PredFound->second.second, BBFound->second.first);
+          Queue.push(Pred);
         }
       }
     }
   }
 
+  // Chain also statements between the basic blocks. That is, chain the last
+  // statement of each non-empty predecessor with the first statement in the
+  // current basic block.
+  for (auto &BB : F) {
+    auto BBFound = BBBounds.find(&BB);
+    if (BBFound == BBBounds.end()) {
+      // If the basic block is empty, ignore it.
+      continue;
+    }
+
+    auto First = BBFound->second.first;
+
+    for (auto Pred : llvm::predecessors(&BB)) {
+      auto PredFound = BBBounds.find(Pred);
+
+      if (PredFound != BBBounds.end()) {
+        Shard.addSuccessor(PredFound->second.second, First);
+      } else {
+        for (auto NonEmpty : EmptyPreds.find(Pred)->second) {
+          Shard.addSuccessor(BBBounds.lookup(NonEmpty).second, First);
+        }
+      }
+    }
+  }
+
+  // The loop analysis is not cheap, so it is done only if the induction
+  // steps are used.
+  if (Opts.ReconstructInductions) {
+    findInductionSteps(F, Shard);
+  }
+}
+
+StatementDetectionBase::StatementDetectionBase() {}
+
+StatementDetectionBase::StatementDetectionBase(const Options &Opts)
+    : Opts(Opts) {}
+
+bool StatementDetectionBase::runBase(llvm::Module &M) {
+  std::vector<llvm::Function *> Functions;
+  for (auto &F : M) {
+    if (!F.isDeclaration()) {
+      // Only functions that are defined.
+      Functions.push_back(&F);
+    }
+  }
+
+  Stopwatch Total;
+  std::vector<StatementRepository> Shards(Functions.size());
+  std::vector<double> Times(Functions.size());
+
+  auto Detect = [&](size_t Idx) {
+    Stopwatch Function;
+    detectStatements(*Functions[Idx], Shards[Idx], Opts);
+    Times[Idx] = Function.elapsed();
+  };
+
+  if (Functions.size() > 1) {
+    llvm::ThreadPool Pool;
+    for (size_t Idx = 0; Idx < Functions.size(); Idx++) {
+      Pool.async([&, Idx] { Detect(Idx); });
+    }
+    Pool.wait();
+  } else if (Functions.size() == 1) {
+    Detect(0);
+  }
+
+  // Merge the shards in the order of the functions in the module, so the
+  // assigned identifiers do not depend on the scheduling of the threads.
+  for (auto &Shard : Shards) {
+    Repo.merge(Shard);
+  }
+
+  for (size_t Idx = 0; Idx < Functions.size(); Idx++) {
+    Repo.Stats.Functions[Functions[Idx]].DetectionTime = Times[Idx];
+  }
+
+  Repo.Stats.DetectionTime = Total.elapsed();
+
   return false;
 }
 
+StatementDetection::StatementDetection() {}
+
+StatementDetection::StatementDetection(const Options &Opts)
+    : StatementDetectionBase(Opts) {}
+
 StatementRepository StatementDetection::run(llvm::Module &M,
                                             llvm::ModuleAnalysisManager &) {
   runBase(M);
-  return Repo;
+  // The result is cached by the analysis manager and shared by reference
+  // between the passes, so it is moved out instead of copied.
+  return std::move(Repo);
 }
 
 llvm::AnalysisKey StatementDetection::Key;
 
 LegacyStatementDetection::LegacyStatementDetection() : llvm::ModulePass(ID) {}
 
+LegacyStatementDetection::LegacyStatementDetection(const Options &Opts)
+    : llvm::ModulePass(ID), StatementDetectionBase(Opts) {}
+
 bool LegacyStatementDetection::runOnModule(llvm::Module &M) {
   return runBase(M);
 }
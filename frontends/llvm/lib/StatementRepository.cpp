@@ -1,22 +1,18 @@
 #include "StatementRepository.h"
 
+#include <cassert>
+
+#include "llvm/ADT/STLExtras.h"
+
 #include "Statement.h"
 #include "Tools.h"
 
 using namespace aardwolf;
 
-std::pair<uint64_t, uint64_t>
-StatementRepository::getStatementId(Statement &Stmt) {
-  auto Found = StmtsIdMap.find(Stmt.Instr);
-  if (Found == StmtsIdMap.end()) {
-    auto FileId = getFileId(getDebugLocFile(getInstrLoc(Stmt.Instr)));
-    uint64_t StmtId = StmtsIdMap.size() + 1;
-    auto Id = std::make_pair(FileId, StmtId);
-    StmtsIdMap.insert({Stmt.Instr, Id});
-    return Id;
-  } else {
-    return Found->second;
-  }
+const std::pair<uint64_t, uint64_t> &
+StatementRepository::getStatementId(StmtIdx Stmt) const {
+  assert(Stmt < StmtIds.size() && "Statement must be merged to have an id");
+  return StmtIds[Stmt];
 }
 
 uint64_t StatementRepository::getValueId(const llvm::Value *Value) {
@@ -41,25 +37,105 @@ uint64_t StatementRepository::getFileId(const std::string &File) {
   }
 }
 
-void StatementRepository::registerStatement(llvm::Function *F,
-                                            Statement &Stmt) {
-  InstrStmtMap.insert({Stmt.Instr, Stmt});
+StmtIdx StatementRepository::addStatement(llvm::Function *F, Statement Stmt) {
+  StmtIdx Idx = Statements.size();
+
+  auto Found = FuncStmts.find(F);
+  if (Found == FuncStmts.end()) {
+    FuncStmts.insert({F, {Idx, Idx + 1}});
+  } else {
+    assert(Found->second.second == Idx &&
+           "Statements of a function must be added consecutively");
+    Found->second.second = Idx + 1;
+  }
+
+  InstrStmtMap.insert({Stmt.Instr, Idx});
+  Statements.push_back(std::move(Stmt));
+  return Idx;
+}
+
+void StatementRepository::addSuccessor(StmtIdx Stmt, StmtIdx Succ) {
+  PendingSuccs.push_back({Stmt, Succ});
+}
+
+void StatementRepository::addToBlock(StmtIdx Leader, StmtIdx Stmt) {
+  TraceBlocks[Leader].push_back(Stmt);
+}
+
+void StatementRepository::merge(StatementRepository &Shard) {
+  StmtIdx Base = Statements.size();
+
+  for (auto &Func : Shard.FuncStmts) {
+    FuncStmts[Func.first] = {Base + Func.second.first,
+                             Base + Func.second.second};
+  }
+
+  for (auto &Stmt : Shard.Statements) {
+    // Move the accesses into the arena of this repository.
+    for (auto &Use : Stmt.In) {
+      Use = Accesses.import(Shard.Accesses, Use);
+    }
+    llvm::sort(Stmt.In);
+
+    if (Stmt.Out.hasValue()) {
+      Stmt.Out = Accesses.import(Shard.Accesses, Stmt.Out.getValue());
+    }
+
+    // Assign the ids at this point for user-friendly identifiers that follow
+    // the order of occurrence of the statement in the source code.
+    StmtIds.push_back({getFileId(Stmt.Loc.File), StmtIds.size() + 1});
+
+    for (auto I : Stmt.In) {
+      getValueId(Accesses.getValueOrBase(I));
+    }
+
+    if (Stmt.Out.hasValue()) {
+      getValueId(Accesses.getValueOrBase(Stmt.Out.getValue()));
+    }
 
-  getStatementId(Stmt);
+    InstrStmtMap.insert({Stmt.Instr, Statements.size()});
+    Statements.push_back(std::move(Stmt));
+  }
+
+  // Compress the successors, the order of the successors of each statement is
+  // preserved.
+  std::vector<uint32_t> Counts(Shard.Statements.size() + 1, 0);
+  for (auto &Edge : Shard.PendingSuccs) {
+    Counts[Edge.first + 1]++;
+  }
+
+  auto Offset = Succs.size();
+  for (size_t Idx = 1; Idx < Counts.size(); Idx++) {
+    Counts[Idx] += Counts[Idx - 1];
+    SuccOffsets.push_back(Offset + Counts[Idx]);
+  }
+
+  Succs.resize(Offset + Shard.PendingSuccs.size());
+  for (auto &Edge : Shard.PendingSuccs) {
+    Succs[Offset + Counts[Edge.first]++] = Base + Edge.second;
+  }
 
-  for (auto I : Stmt.In) {
-    getValueId(I.getValueOrBase());
+  for (auto &Block : Shard.TraceBlocks) {
+    auto &Stmts = TraceBlocks[Base + Block.first];
+    for (auto Stmt : Block.second) {
+      Stmts.push_back(Base + Stmt);
+    }
   }
 
-  if (Stmt.Out != nullptr) {
-    getValueId(Stmt.Out->getValueOrBase());
+  for (auto &Induction : Shard.InductionSteps) {
+    auto &Step = InductionSteps[Base + Induction.first];
+    Step.Step = Induction.second.Step;
+    for (auto Def : Induction.second.Defs) {
+      Step.Defs.push_back(Base + Def);
+    }
   }
 
-  FuncInstrsMap[F].push_back(Stmt.Instr);
+  Shard = StatementRepository();
 }
 
-void StatementRepository::addSuccessor(llvm::Instruction *Stmt,
-                                       llvm::Instruction *Succ) {
-  // TODO: Check if they are both already registered.
-  InstrSucc[Stmt].push_back(Succ);
+llvm::ArrayRef<StmtIdx> StatementRepository::getSuccessors(StmtIdx Stmt) const {
+  assert(Stmt + 1 < SuccOffsets.size() &&
+         "Statement must be merged to have successors");
+  return llvm::makeArrayRef(Succs).slice(
+      SuccOffsets[Stmt], SuccOffsets[Stmt + 1] - SuccOffsets[Stmt]);
 }
@@ -1,53 +1,47 @@
 #include "StaticData.h"
 
+#include <cassert>
 #include <cstdint>
 #include <cstdlib>
+#include <map>
 
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Config/llvm-config.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Pass.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
 #include "llvm/Support/raw_ostream.h"
 
 #include "Statement.h"
 #include "StatementDetection.h"
 #include "StatementRepository.h"
+#include "Tools.h"
+#include "encoding.h"
 
 using namespace aardwolf;
 
-#define TOKEN_STATEMENT 0xff
-#define TOKEN_FUNCTION 0xfe
-#define TOKEN_FILENAMES 0xfd
-
-#define TOKEN_VALUE_SCALAR 0xe0
-#define TOKEN_VALUE_STRUCTURAL 0xe1
-#define TOKEN_VALUE_ARRAY_LIKE 0xe2
-
-#define META_ARG 0x61
-#define META_RET 0x62
-#define META_CALL 0x64
-
-// TODO: Is there an idiomatic C++ way how to do these writeBytes functions?
-void writeBytes(llvm::raw_ostream &Stream, uint8_t value) {
-  Stream.write((const char *)&value, sizeof(uint8_t));
-}
-
-void writeBytes(llvm::raw_ostream &Stream, uint32_t value) {
-  Stream.write((const char *)&value, sizeof(uint32_t));
-}
-
-void writeBytes(llvm::raw_ostream &Stream, uint64_t value) {
-  Stream.write((const char *)&value, sizeof(uint64_t));
+// Numbers are written with their full width, so the callers cast them to the
+// width given by the format.
+template <typename T> void writeBytes(llvm::raw_ostream &Stream, T Value) {
+  encoding::write<encoding::Fixed>(Stream, Value);
 }
 
-void writeBytes(llvm::raw_ostream &Stream, std::string value) {
-  Stream.write(value.c_str(), sizeof(char) * value.size());
+void writeBytes(llvm::raw_ostream &Stream, llvm::StringRef Value) {
+  Stream << Value;
   Stream.write(0);
 }
 
-void exportFunctionName(llvm::raw_ostream &Stream, llvm::Function &F) {
-  writeBytes(Stream, (uint8_t)TOKEN_FUNCTION);
-  writeBytes(Stream, F.getName().str());
+// Writes an entry of the function table. The body of the function is stored
+// in the statements section at given offset (relative to the section).
+void exportFunction(llvm::raw_ostream &Stream, llvm::Function &F, uint8_t Flags,
+                    uint64_t Offset, uint64_t Size) {
+  writeBytes(Stream, F.getName());
+  writeBytes(Stream, Flags);
+  writeBytes(Stream, Offset);
+  writeBytes(Stream, Size);
 }
 
 void exportStatementId(llvm::raw_ostream &Stream,
@@ -57,22 +51,23 @@ void exportStatementId(llvm::raw_ostream &Stream,
 }
 
 void exportAccess(StatementRepository &Repo, llvm::raw_ostream &Stream,
-                  const Access *Access) {
-  if (Access->isScalar()) {
+                  AccessId Id) {
+  auto &Accesses = Repo.Accesses;
+
+  if (Accesses.isScalar(Id)) {
     writeBytes(Stream, (uint8_t)TOKEN_VALUE_SCALAR);
-    writeBytes(Stream, Repo.getValueId(Access->getValue()));
+    writeBytes(Stream, Repo.getValueId(Accesses.getValue(Id)));
   } else {
-    if (Access->getType() == AccessType::Structural) {
+    if (Accesses.getType(Id) == AccessType::Structural) {
       writeBytes(Stream, (uint8_t)TOKEN_VALUE_STRUCTURAL);
-      // writeBytes(Stream, Repo.getValueId(Access->getBase()));
-      exportAccess(Repo, Stream, &Access->getBase());
-      exportAccess(Repo, Stream, &Access->getAccessors()[0]);
-    } else if (Access->getType() == AccessType::ArrayLike) {
+      exportAccess(Repo, Stream, Accesses.getBase(Id));
+      exportAccess(Repo, Stream, Accesses.getAccessors(Id)[0]);
+    } else if (Accesses.getType(Id) == AccessType::ArrayLike) {
       writeBytes(Stream, (uint8_t)TOKEN_VALUE_ARRAY_LIKE);
-      exportAccess(Repo, Stream, &Access->getBase());
-      writeBytes(Stream, (uint32_t)Access->getAccessors().size());
-      for (auto Var : Access->getAccessors()) {
-        exportAccess(Repo, Stream, &Var);
+      exportAccess(Repo, Stream, Accesses.getBase(Id));
+      writeBytes(Stream, (uint32_t)Accesses.getAccessors(Id).size());
+      for (auto Var : Accesses.getAccessors(Id)) {
+        exportAccess(Repo, Stream, Var);
       }
     }
   }
@@ -97,23 +92,40 @@ uint8_t getMetadata(Statement &Stmt) {
 }
 
 void exportStatement(StatementRepository &Repo, llvm::raw_ostream &Stream,
-                     Statement &Stmt, std::vector<Statement *> &Successors) {
+                     StmtIdx Idx) {
+  auto &Stmt = Repo.Statements[Idx];
+
   // Statement id.
   writeBytes(Stream, (uint8_t)TOKEN_STATEMENT);
-  exportStatementId(Stream, Repo.getStatementId(Stmt));
+  exportStatementId(Stream, Repo.getStatementId(Idx));
+
+  // Successors. A statement can be reached from its predecessor through
+  // multiple edges (e.g., a switch with multiple cases leading to the same
+  // block), so they are deduplicated while preserving their order.
+  llvm::SmallVector<StmtIdx, 4> Successors;
+  for (auto Succ : Repo.getSuccessors(Idx)) {
+    if (!llvm::is_contained(Successors, Succ)) {
+      Successors.push_back(Succ);
+    }
+  }
 
-  // Successors.
-  writeBytes(Stream, (uint8_t)Successors.size());
+  // The only successor of most statements is the next statement in the
+  // function, which is implied instead of stored.
+  if (Successors.size() == 1 && Successors[0] == Idx + 1) {
+    writeBytes(Stream, (uint8_t)SUCC_NEXT);
+  } else {
+    assert(Successors.size() < SUCC_NEXT && "Too many successors.");
+    writeBytes(Stream, (uint8_t)Successors.size());
 
-  // TODO: Deduplicate successors using std::unique
-  for (auto Succ : Successors) {
-    exportStatementId(Stream, Repo.getStatementId(*Succ));
+    for (auto Succ : Successors) {
+      exportStatementId(Stream, Repo.getStatementId(Succ));
+    }
   }
 
   // Defs.
-  if (Stmt.Out != nullptr) {
+  if (Stmt.Out.hasValue()) {
     writeBytes(Stream, (uint8_t)1);
-    exportAccess(Repo, Stream, Stmt.Out.get());
+    exportAccess(Repo, Stream, Stmt.Out.getValue());
   } else {
     writeBytes(Stream, (uint8_t)0);
   }
@@ -122,7 +134,7 @@ void exportStatement(StatementRepository &Repo, llvm::raw_ostream &Stream,
   writeBytes(Stream, (uint8_t)Stmt.In.size());
 
   for (auto Use : Stmt.In) {
-    exportAccess(Repo, Stream, &Use);
+    exportAccess(Repo, Stream, Use);
   }
 
   // Location.
@@ -136,13 +148,63 @@ void exportStatement(StatementRepository &Repo, llvm::raw_ostream &Stream,
   writeBytes(Stream, getMetadata(Stmt));
 }
 
-void exportMetadata(StatementRepository &Repo, llvm::raw_ostream &Stream) {
-  writeBytes(Stream, (uint8_t)TOKEN_FILENAMES);
+void exportBlock(StatementRepository &Repo, llvm::raw_ostream &Stream,
+                 StmtIdx Leader, const std::vector<StmtIdx> &Stmts) {
+  writeBytes(Stream, (uint8_t)TOKEN_TRACE_BLOCK);
+  exportStatementId(Stream, Repo.getStatementId(Leader));
+  writeBytes(Stream, (uint32_t)Stmts.size());
+
+  for (auto Stmt : Stmts) {
+    exportStatementId(Stream, Repo.getStatementId(Stmt));
+  }
+}
+
+void exportInductionStep(StatementRepository &Repo, llvm::raw_ostream &Stream,
+                         StmtIdx Stmt, const InductionStep &Induction) {
+  writeBytes(Stream, (uint8_t)TOKEN_INDUCTION_STEP);
+  exportStatementId(Stream, Repo.getStatementId(Stmt));
+  writeBytes(Stream, (uint64_t)Induction.Step);
+  writeBytes(Stream, (uint32_t)Induction.Defs.size());
+
+  for (auto Def : Induction.Defs) {
+    exportStatementId(Stream, Repo.getStatementId(Def));
+  }
+}
+
+void exportFilenames(StatementRepository &Repo, llvm::raw_ostream &Stream) {
   writeBytes(Stream, (uint32_t)Repo.FilesIdMap.size());
 
-  for (auto F : Repo.FilesIdMap) {
-    writeBytes(Stream, F.second);
-    writeBytes(Stream, F.first);
+  // Export the filenames in sorted order, so the output is deterministic.
+  std::vector<llvm::StringRef> Files;
+  for (auto &F : Repo.FilesIdMap) {
+    Files.push_back(F.getKey());
+  }
+  llvm::sort(Files);
+
+  for (auto F : Files) {
+    writeBytes(Stream, Repo.FilesIdMap[F]);
+    writeBytes(Stream, F);
+  }
+}
+
+// Writes the layouts of composite values traced as blobs.
+void exportTypes(llvm::raw_ostream &Stream,
+                 const std::map<uint64_t, TypeLayout> &Layouts) {
+  writeBytes(Stream, (uint32_t)Layouts.size());
+
+  for (auto &Entry : Layouts) {
+    auto &Layout = Entry.second;
+
+    writeBytes(Stream, Layout.Id);
+    writeBytes(Stream, llvm::StringRef(Layout.Name));
+    writeBytes(Stream, Layout.Size);
+    writeBytes(Stream, (uint32_t)Layout.Fields.size());
+
+    for (auto &Field : Layout.Fields) {
+      writeBytes(Stream, Field.Offset);
+      writeBytes(Stream, Field.Token);
+      writeBytes(Stream, llvm::StringRef(Field.Name));
+    }
   }
 }
 
@@ -156,18 +218,124 @@ std::string getFilename(std::string Name) {
   }
 }
 
+// Stream which only feeds the written data into a hash.
+class HashStream : public llvm::raw_ostream {
+public:
+  HashStream() { SetUnbuffered(); }
+
+  llvm::MD5 Hash;
+
+private:
+  uint64_t Pos = 0;
+
+  void write_impl(const char *Ptr, size_t Size) override {
+    Hash.update(llvm::StringRef(Ptr, Size));
+    Pos += Size;
+  }
+
+  uint64_t current_pos() const override { return Pos; }
+};
+
+// Key of the static data in the cache. The static data depend only on the
+// module, the options which affect the export and the version of Aardwolf and
+// LLVM (which may detect the statements differently). The module is hashed in
+// its bitcode form, which is much cheaper to produce than the textual IR and
+// still includes the debug locations the static data are built from.
+std::string getCacheKey(llvm::Module &M, const Options &Opts) {
+  HashStream Stream;
+
+  Stream << AARDWOLF_VERSION << '\0' << LLVM_VERSION_STRING << '\0';
+  Stream << (int)Opts.Mode << (int)Opts.ReconstructInductions << '\0';
+
+  for (auto Patterns : {&Opts.InstrumentFunctions, &Opts.SkipFunctions,
+                        &Opts.InstrumentFiles, &Opts.SkipFiles}) {
+    for (auto &Pattern : *Patterns) {
+      Stream << Pattern << ',';
+    }
+    Stream << '\0';
+  }
+
+  llvm::WriteBitcodeToFile(M, Stream);
+  Stream.flush();
+
+  llvm::MD5::MD5Result Result;
+  Stream.Hash.final(Result);
+  return Result.digest().str().str();
+}
+
+// Stores the static data into the cache. The file is renamed into place, so
+// concurrent compilations never see it incomplete.
+void storeInCache(const std::string &CachedFilename,
+                  const llvm::SmallVectorImpl<char> &Buffer) {
+  int FD;
+  llvm::SmallString<128> TempFilename;
+
+  if (llvm::sys::fs::createUniqueFile(CachedFilename + "-%%%%%%.tmp", FD,
+                                      TempFilename)) {
+    return;
+  }
+
+  {
+    llvm::raw_fd_ostream Stream(FD, true);
+    Stream.write(Buffer.data(), Buffer.size());
+  }
+
+  if (llvm::sys::fs::rename(TempFilename, CachedFilename)) {
+    llvm::sys::fs::remove(TempFilename);
+  }
+}
+
 StaticDataBase::StaticDataBase() {}
 
 StaticDataBase::StaticDataBase(std::string &DestDir) : DestDir(DestDir) {}
 
-bool StaticDataBase::runBase(llvm::Module &M, StatementRepository &Repo) {
+StaticDataBase::StaticDataBase(std::string &DestDir, const Options &Opts)
+    : DestDir(DestDir), Opts(Opts) {}
+
+std::string aardwolf::getStaticDataFilename(const std::string &DestDir,
+                                            const llvm::Module &M) {
   std::string Dest;
 
   if (!DestDir.empty()) {
     Dest = DestDir + '/';
   }
 
-  std::string Filename = (Dest + getFilename(M.getName().str()) + ".aard");
+  return Dest + getFilename(M.getName().str()) + ".aard";
+}
+
+// The statistics need the statements, so the repository is requested even if
+// the static data were found in the cache. The time of the pass is taken
+// before that, so that it does not include the statement detection on a hit.
+void writeStatistics(StatementRepository &Repo, const Options &Opts,
+                     const std::string &Filename, bool Cached,
+                     double StaticDataTime) {
+  Repo.Stats.StaticFilename = Filename;
+  Repo.Stats.Cached = Cached;
+  Repo.Stats.StaticDataTime = StaticDataTime;
+  Repo.Stats.write(Repo, Opts);
+}
+
+bool StaticDataBase::runBase(
+    llvm::Module &M, llvm::function_ref<StatementRepository &()> GetRepo) {
+  Stopwatch Time;
+  std::string Filename = getStaticDataFilename(DestDir, M);
+
+  // The module must be hashed before it is instrumented.
+  std::string CachedFilename;
+  if (!Opts.StaticCache.empty()) {
+    CachedFilename = Opts.StaticCache + '/' + getCacheKey(M, Opts) + ".aard";
+
+    if (!llvm::sys::fs::copy_file(CachedFilename, Filename)) {
+      if (Opts.Statistics) {
+        double Elapsed = Time.elapsed();
+        writeStatistics(GetRepo(), Opts, Filename, true, Elapsed);
+      }
+
+      return false;
+    }
+  }
+
+  auto &Repo = GetRepo();
   std::error_code EC;
   llvm::raw_fd_ostream Stream(llvm::StringRef(Filename), EC);
 
@@ -176,44 +344,165 @@ bool StaticDataBase::runBase(llvm::Module &M, StatementRepository &Repo) {
     return false;
   }
 
-  // Header.
-  Stream << "AARD/S1";
+  InstrumentationFilter Filter(Opts);
+
+  // The sections are built in separate buffers first, so their offsets are
+  // known when the header is written.
+  llvm::SmallVector<char, 0> Functions;
+  llvm::SmallVector<char, 0> Statements;
+  llvm::SmallVector<char, 0> Files;
+  llvm::SmallVector<char, 0> Types;
+
+  // Rough estimate of the encoded size of a statement.
+  Statements.reserve(Repo.Statements.size() * 96);
 
-  std::vector<Statement *> Outgoing;
+  llvm::raw_svector_ostream FunctionsStream(Functions);
+  llvm::raw_svector_ostream StatementsStream(Statements);
+  llvm::raw_svector_ostream FilesStream(Files);
+  llvm::raw_svector_ostream TypesStream(Types);
+
+  // Ordered by the identifier, so the output is deterministic.
+  std::map<uint64_t, TypeLayout> Layouts;
+
+  uint32_t NFunctions = 0;
+
+  for (auto &F : M) {
+    if (!F.isDeclaration()) {
+      NFunctions++;
+    }
+  }
+
+  writeBytes(FunctionsStream, NFunctions);
 
   for (auto &F : M) {
     if (F.isDeclaration()) {
       continue;
     }
 
-    exportFunctionName(Stream, F);
+    uint64_t Offset = StatementsStream.tell();
 
-    for (auto &BB : F) {
-      for (auto &I : BB) {
-        auto Stmt = Repo.InstrStmtMap.find(&I);
+    for (auto Idx : Repo.getFunctionStatements(&F)) {
+      exportStatement(Repo, StatementsStream, Idx);
+    }
 
-        if (Stmt != Repo.InstrStmtMap.end()) {
-          for (auto Succ : Repo.InstrSucc[Stmt->first]) {
-            Outgoing.push_back(&Repo.InstrStmtMap[Succ]);
-          }
+    // Induction steps must precede trace blocks, because their statements
+    // are not followed by a value in the trace.
+    if (Opts.ReconstructInductions &&
+        Opts.Mode != InstrumentationMode::Coverage &&
+        Filter.shouldInstrument(F)) {
+      for (auto Idx : Repo.getFunctionStatements(&F)) {
+        auto Induction = Repo.InductionSteps.find(Idx);
+
+        if (Induction != Repo.InductionSteps.end()) {
+          exportInductionStep(Repo, StatementsStream, Induction->first,
+                              Induction->second);
+        }
+      }
+    }
+
+    // Trace blocks are needed only when the program is instrumented in block
+    // mode.
+    if (Opts.Mode == InstrumentationMode::Block) {
+      for (auto Idx : Repo.getFunctionStatements(&F)) {
+        auto Block = Repo.TraceBlocks.find(Idx);
 
-          exportStatement(Repo, Stream, Stmt->second, Outgoing);
-          Outgoing.clear();
+        if (Block != Repo.TraceBlocks.end()) {
+          exportBlock(Repo, StatementsStream, Block->first, Block->second);
         }
       }
     }
+
+    // Layouts of composite values which the instrumentation traces as blobs.
+    if (Opts.Mode != InstrumentationMode::Coverage &&
+        Filter.shouldInstrument(F)) {
+      for (auto Idx : Repo.getFunctionStatements(&F)) {
+        auto I = Repo.Statements[Idx].Instr;
+        auto Value = getVarValue(I);
+
+        if (Value != nullptr && !I->isTerminator()) {
+          if (auto Layout =
+                  getTypeLayout(M.getDataLayout(), Value->getType())) {
+            Layouts.emplace(Layout->Id, *Layout);
+          }
+        }
+      }
+    }
+
+    // Statements of functions skipped by the instrumentation are exported as
+    // usual, but Aardwolf must know that they are never traced.
+    uint8_t Flags = Filter.shouldInstrument(F) ? 0 : FUNCTION_UNTRACED;
+    exportFunction(FunctionsStream, F, Flags, Offset,
+                   StatementsStream.tell() - Offset);
+  }
+
+  exportFilenames(Repo, FilesStream);
+
+  // Header with the section table.
+  const char Magic[] = "AARD/S3";
+  llvm::SmallVector<std::pair<uint8_t, llvm::SmallVectorImpl<char> *>, 4>
+      Sections = {{SECTION_FUNCTIONS, &Functions},
+                  {SECTION_STATEMENTS, &Statements},
+                  {SECTION_FILES, &Files}};
+
+  // The section is present only if there are any composite values.
+  if (!Layouts.empty()) {
+    exportTypes(TypesStream, Layouts);
+    Sections.push_back({SECTION_TYPES, &Types});
+  }
+
+  uint64_t Offset =
+      sizeof(Magic) - 1 + sizeof(uint32_t) +
+      Sections.size() * (sizeof(uint8_t) + 2 * sizeof(uint64_t));
+  uint64_t Size = Offset;
+  for (auto &Section : Sections) {
+    Size += Section.second->size();
+  }
+
+  // The whole file is written at once from a single buffer.
+  llvm::SmallVector<char, 0> Buffer;
+  Buffer.reserve(Size);
+  llvm::raw_svector_ostream BufferStream(Buffer);
+
+  BufferStream << Magic;
+  writeBytes(BufferStream, (uint32_t)Sections.size());
+
+  for (auto &Section : Sections) {
+    writeBytes(BufferStream, Section.first);
+    writeBytes(BufferStream, Offset);
+    writeBytes(BufferStream, (uint64_t)Section.second->size());
+    Offset += Section.second->size();
   }
 
-  exportMetadata(Repo, Stream);
+  for (auto &Section : Sections) {
+    BufferStream << llvm::StringRef(Section.second->data(),
+                                    Section.second->size());
+  }
+
+  Stream.write(Buffer.data(), Buffer.size());
+
+  if (!CachedFilename.empty()) {
+    storeInCache(CachedFilename, Buffer);
+  }
+
+  if (Opts.Statistics) {
+    writeStatistics(Repo, Opts, Filename, false, Time.elapsed());
+  }
 
   return false;
 }
 
 StaticData::StaticData(std::string &DestDir) : StaticDataBase(DestDir) {}
 
+StaticData::StaticData(std::string &DestDir, const Options &Opts)
+    : StaticDataBase(DestDir, Opts) {}
+
 llvm::PreservedAnalyses StaticData::run(llvm::Module &M,
                                         llvm::ModuleAnalysisManager &MAM) {
-  if (runBase(M, MAM.getResult<StatementDetection>(M))) {
+  auto GetRepo = [&]() -> StatementRepository & {
+    return MAM.getResult<StatementDetection>(M);
+  };
+
+  if (runBase(M, GetRepo)) {
     return llvm::PreservedAnalyses::none();
   } else {
     return llvm::PreservedAnalyses::all();
@@ -225,10 +514,20 @@ LegacyStaticData::LegacyStaticData() : llvm::ModulePass(ID) {}
 LegacyStaticData::LegacyStaticData(std::string &DestDir)
     : llvm::ModulePass(ID), StaticDataBase(DestDir) {}
 
+LegacyStaticData::LegacyStaticData(std::string &DestDir, const Options &Opts)
+    : llvm::ModulePass(ID), StaticDataBase(DestDir, Opts) {}
+
 bool LegacyStaticData::runOnModule(llvm::Module &M) {
-  return runBase(M, getAnalysis<LegacyStatementDetection>().Repo);
+  auto GetRepo = [&]() -> StatementRepository & {
+    return getAnalysis<LegacyStatementDetection>().Repo;
+  };
+
+  return runBase(M, GetRepo);
 }
 
+// The legacy pass manager cannot request an analysis lazily, so the statements
+// are detected even on a cache hit. It does not matter in the pipelines of
+// clang, where the dynamic data pass needs them anyway.
 void LegacyStaticData::getAnalysisUsage(llvm::AnalysisUsage &AU) const {
   AU.setPreservesAll();
   AU.addRequired<LegacyStatementDetection>();
@@ -0,0 +1,191 @@
+#include "Statistics.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include "StatementRepository.h"
+
+using namespace aardwolf;
+
+const char *TraceCallKindNames[NumTraceCallKinds] = {
+    "statement", "block", "value", "blob", "coverage", "sampling"};
+
+void Statistics::addTraceCall(const llvm::Function *F, TraceCallKind Kind,
+                              uint64_t Bytes) {
+  auto &Stats = Functions[F];
+  Stats.TraceCalls[static_cast<size_t>(Kind)]++;
+  Stats.TracedBytes += Bytes;
+}
+
+// Estimated trace size per executed statement, assuming that all statements
+// are executed equally often.
+double getBytesPerStatement(uint64_t Bytes, uint64_t Statements) {
+  return Statements == 0 ? 0 : (double)Bytes / Statements;
+}
+
+llvm::json::Object toJson(const std::array<uint64_t, NumTraceCallKinds> &Calls) {
+  llvm::json::Object Object;
+
+  for (size_t Kind = 0; Kind < NumTraceCallKinds; Kind++) {
+    Object[TraceCallKindNames[Kind]] = (int64_t)Calls[Kind];
+  }
+
+  return Object;
+}
+
+void Statistics::write(const StatementRepository &Repo,
+                       const Options &Opts) const {
+  uint64_t NStatements = 0;
+  uint64_t NAccesses = 0;
+  uint64_t NSuccessors = 0;
+  uint64_t NTracedStatements = 0;
+  uint64_t TracedBytes = 0;
+  std::array<uint64_t, NumTraceCallKinds> TraceCalls = {};
+
+  llvm::json::Array FunctionsJson;
+
+  for (auto &Entry : Functions) {
+    auto &Stats = Entry.second;
+    uint64_t FuncStatements = 0;
+
+    for (auto Idx : Repo.getFunctionStatements(Entry.first)) {
+      auto &Stmt = Repo.Statements[Idx];
+      FuncStatements++;
+      NAccesses += Stmt.In.size() + (Stmt.Out.hasValue() ? 1 : 0);
+      NSuccessors += Repo.getSuccessors(Idx).size();
+    }
+
+    NStatements += FuncStatements;
+
+    uint64_t FuncTraceCalls = 0;
+    for (size_t Kind = 0; Kind < NumTraceCallKinds; Kind++) {
+      TraceCalls[Kind] += Stats.TraceCalls[Kind];
+      FuncTraceCalls += Stats.TraceCalls[Kind];
+    }
+
+    // Only the instrumented functions contribute to the trace.
+    if (FuncTraceCalls > 0) {
+      NTracedStatements += FuncStatements;
+      TracedBytes += Stats.TracedBytes;
+    }
+
+    FunctionsJson.push_back(llvm::json::Object{
+        {"name", Entry.first->getName()},
+        {"statements", (int64_t)FuncStatements},
+        {"detection_time", Stats.DetectionTime},
+        {"trace_calls", toJson(Stats.TraceCalls)},
+        {"bytes_per_statement",
+         getBytesPerStatement(Stats.TracedBytes, FuncStatements)}});
+  }
+
+  llvm::json::Object Json{
+      {"static_data", StaticFilename},
+      {"mode", getInstrumentationModeName(Opts.Mode)},
+      {"cached", Cached},
+      {"time",
+       llvm::json::Object{{"detection", DetectionTime},
+                          {"static_data", StaticDataTime},
+                          {"dynamic_data", DynamicDataTime}}},
+      {"statements", (int64_t)NStatements},
+      {"accesses", (int64_t)NAccesses},
+      {"successors", (int64_t)NSuccessors},
+      {"trace_calls", toJson(TraceCalls)},
+      {"bytes_per_statement",
+       getBytesPerStatement(TracedBytes, NTracedStatements)},
+      {"functions", std::move(FunctionsJson)}};
+
+  std::error_code EC;
+  llvm::raw_fd_ostream Stream(getStatisticsFilename(StaticFilename), EC);
+
+  if (EC) {
+    llvm::errs() << EC.message() << "\n";
+    return;
+  }
+
+  Stream << llvm::formatv("{0:2}", llvm::json::Value(std::move(Json)))
+         << "\n";
+}
+
+std::string aardwolf::getStatisticsFilename(llvm::StringRef StaticFilename) {
+  return (StaticFilename.drop_back(llvm::StringRef(".aard").size()) +
+          ".stats.json")
+      .str();
+}
+
+bool aardwolf::printStatisticsSummary(llvm::StringRef Filename,
+                                      llvm::raw_ostream &OS) {
+  auto Buffer = llvm::MemoryBuffer::getFile(Filename);
+  if (!Buffer) {
+    return false;
+  }
+
+  auto Parsed = llvm::json::parse((*Buffer)->getBuffer());
+  if (!Parsed) {
+    llvm::consumeError(Parsed.takeError());
+    return false;
+  }
+
+  auto Json = Parsed->getAsObject();
+  if (Json == nullptr) {
+    return false;
+  }
+
+  auto getInteger = [](const llvm::json::Object *Object, llvm::StringRef Key) {
+    return Object ? Object->getInteger(Key).getValueOr(0) : 0;
+  };
+  auto getNumber = [](const llvm::json::Object *Object, llvm::StringRef Key) {
+    return Object ? Object->getNumber(Key).getValueOr(0) : 0;
+  };
+
+  OS << "Statements: " << getInteger(Json, "statements")
+     << " (accesses: " << getInteger(Json, "accesses")
+     << ", successors: " << getInteger(Json, "successors") << ")\n";
+
+  OS << "Trace calls:";
+  auto Calls = Json->getObject("trace_calls");
+  for (size_t Kind = 0; Kind < NumTraceCallKinds; Kind++) {
+    OS << (Kind == 0 ? " " : ", ") << TraceCallKindNames[Kind] << " "
+       << getInteger(Calls, TraceCallKindNames[Kind]);
+  }
+  OS << "\n";
+
+  OS << llvm::formatv("Estimated trace: {0:F2} bytes per executed statement\n",
+                      getNumber(Json, "bytes_per_statement"));
+
+  auto Time = Json->getObject("time");
+  OS << llvm::formatv(
+      "Time: detection {0:F3}s, static data {1:F3}s, dynamic data {2:F3}s\n",
+      getNumber(Time, "detection"), getNumber(Time, "static_data"),
+      getNumber(Time, "dynamic_data"));
+
+  // The densest functions are the best candidates for the skip lists.
+  std::vector<std::pair<double, llvm::StringRef>> Densest;
+  if (auto Functions = Json->getArray("functions")) {
+    for (auto &Function : *Functions) {
+      auto Object = Function.getAsObject();
+      if (Object != nullptr && getInteger(Object, "statements") > 0) {
+        Densest.push_back({getNumber(Object, "bytes_per_statement"),
+                           Object->getString("name").getValueOr("")});
+      }
+    }
+  }
+
+  std::sort(Densest.begin(), Densest.end(),
+            [](auto &A, auto &B) { return A.first > B.first; });
+  Densest.resize(std::min<size_t>(Densest.size(), 5));
+
+  if (!Densest.empty() && Densest[0].first > 0) {
+    OS << "Densest functions:\n";
+
+    for (auto &Entry : Densest) {
+      OS << llvm::formatv("  {0,8:F2} B/stmt  {1}\n", Entry.first,
+                          Entry.second);
+    }
+  }
+
+  return true;
+}
@@ -2,13 +2,22 @@
 
 #include "llvm/IR/DebugInfoMetadata.h"
 #include "llvm/IR/DebugLoc.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Instructions.h"
 #include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
 #include "llvm/Transforms/Utils/Local.h"
 
 #include "Exceptions.h"
+#include "encoding.h"
 
 using namespace aardwolf;
 
+// Bigger composite values are traced as unsupported.
+#define MAX_BLOB_SIZE 256
+#define MAX_BLOB_FIELDS 32
+
 // Retrieves the instruction location in the original source code. If this data
 // is not available, it throws an UnknownLocation exception.
 const llvm::DebugLoc aardwolf::getInstrLoc(const llvm::Instruction *I) {
@@ -69,3 +78,143 @@ uint64_t aardwolf::getFileUniqueId(const std::string &File) {
   }
 }
 #endif
+
+llvm::Value *aardwolf::getVarValue(llvm::Instruction *I) {
+  if (auto SI = llvm::dyn_cast<llvm::StoreInst>(I)) {
+    return SI->getOperand(0);
+  } else if (auto DVI = llvm::dyn_cast<llvm::DbgValueInst>(I)) {
+    // Argument or constant assigned to a variable in optimized code.
+    return DVI->getValue();
+  } else if (auto CI = llvm::dyn_cast<llvm::CallBase>(I)) {
+    if (CI->getType()->isVoidTy()) {
+      return nullptr;
+    } else {
+      return CI;
+    }
+  } else if (!I->getType()->isVoidTy() && !I->isTerminator()) {
+    // Value assigned to a variable in optimized code.
+    return I;
+  } else {
+    return nullptr;
+  }
+}
+
+// Appends the scalar leaves of the type at given offset. Returns false if the
+// type contains something which cannot be decoded.
+static bool collectFields(const llvm::DataLayout &DL, llvm::Type *Ty,
+                          uint64_t Offset, const std::string &Path,
+                          std::vector<TypeLayout::Field> &Fields) {
+  if (auto STy = llvm::dyn_cast<llvm::StructType>(Ty)) {
+    auto SL = DL.getStructLayout(STy);
+
+    for (unsigned I = 0; I < STy->getNumElements(); I++) {
+      if (!collectFields(DL, STy->getElementType(I),
+                         Offset + SL->getElementOffset(I),
+                         Path + "." + std::to_string(I), Fields)) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  llvm::Type *ElemTy = nullptr;
+  uint64_t NElems = 0;
+
+  if (auto ATy = llvm::dyn_cast<llvm::ArrayType>(Ty)) {
+    ElemTy = ATy->getElementType();
+    NElems = ATy->getNumElements();
+  } else if (auto VTy = llvm::dyn_cast<llvm::VectorType>(Ty)) {
+    // Vectors of booleans are packed into bits, the number of elements of
+    // scalable vectors is not known.
+    if (VTy->getElementType()->isIntegerTy(1) || VTy->isScalable()) {
+      return false;
+    }
+
+    ElemTy = VTy->getElementType();
+    NElems = VTy->getNumElements();
+  }
+
+  if (ElemTy != nullptr) {
+    uint64_t ElemSize = DL.getTypeAllocSize(ElemTy);
+
+    for (uint64_t I = 0; I < NElems; I++) {
+      if (!collectFields(DL, ElemTy, Offset + I * ElemSize,
+                         Path + "[" + std::to_string(I) + "]", Fields)) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  uint8_t Token = 0;
+
+  if (Ty->isIntegerTy(8)) {
+    Token = TOKEN_DATA_I8;
+  } else if (Ty->isIntegerTy(16)) {
+    Token = TOKEN_DATA_I16;
+  } else if (Ty->isIntegerTy(32)) {
+    Token = TOKEN_DATA_I32;
+  } else if (Ty->isIntegerTy(64)) {
+    Token = TOKEN_DATA_I64;
+  } else if (Ty->isFloatTy()) {
+    Token = TOKEN_DATA_F32;
+  } else if (Ty->isDoubleTy()) {
+    Token = TOKEN_DATA_F64;
+  } else if (Ty->isIntegerTy(1)) {
+    // Stored as a byte.
+    Token = TOKEN_DATA_BOOL;
+  } else if (Ty->isPointerTy()) {
+    // Addresses are not meaningful across executions.
+    return true;
+  } else {
+    return false;
+  }
+
+  // Field paths of structures start with a dot.
+  auto Name = !Path.empty() && Path[0] == '.' ? Path.substr(1) : Path;
+  Fields.push_back({Name, (uint32_t)Offset, Token});
+
+  return Fields.size() <= MAX_BLOB_FIELDS;
+}
+
+std::optional<TypeLayout> aardwolf::getTypeLayout(const llvm::DataLayout &DL,
+                                                  llvm::Type *Ty) {
+  if (!Ty->isAggregateType() && !llvm::isa<llvm::VectorType>(Ty)) {
+    return std::nullopt;
+  }
+
+  // Opaque structures have no size.
+  if (!Ty->isSized() || DL.getTypeAllocSize(Ty) > MAX_BLOB_SIZE) {
+    return std::nullopt;
+  }
+
+  TypeLayout Layout;
+  Layout.Size = (uint32_t)DL.getTypeAllocSize(Ty);
+
+  if (!collectFields(DL, Ty, 0, "", Layout.Fields) || Layout.Fields.empty()) {
+    return std::nullopt;
+  }
+
+  auto STy = llvm::dyn_cast<llvm::StructType>(Ty);
+  if (STy != nullptr && STy->hasName()) {
+    // Printing named structures prints their whole definition.
+    Layout.Name = STy->getName().str();
+  } else {
+    llvm::raw_string_ostream NameStream(Layout.Name);
+    Ty->print(NameStream);
+    NameStream.flush();
+  }
+
+  // Everything that is exported determines the identifier.
+  std::string Key = Layout.Name + ";" + std::to_string(Layout.Size);
+  for (auto &Field : Layout.Fields) {
+    Key += ";" + Field.Name + ":" + std::to_string(Field.Offset) + ":" +
+           std::to_string(Field.Token);
+  }
+
+  Layout.Id = llvm::xxHash64(Key);
+
+  return Layout;
+}
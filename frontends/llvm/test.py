@@ -44,7 +44,12 @@ def process(filename):
     obj_file = change_ext(filename, '.o')
     opt_level = extract_opt_level(filename)
     clang = f'clang -Xclang -load -Xclang {frontend} -c -g {opt_level} -o {obj_file} {filename}'
-    subprocess.run(clang, shell=True, cwd=tmpdir, check=True)
+
+    env = dict(os.environ)
+    if opt_level != '-O0':
+        env['AARDWOLF_OPTIMIZED'] = '1'
+
+    subprocess.run(clang, shell=True, cwd=tmpdir, check=True, env=env)
 
     outfile = os.path.join(tmpdir, os.path.basename(filename)) + '.aard'
 
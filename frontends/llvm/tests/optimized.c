@@ -0,0 +1,18 @@
+// OPT: -O1
+
+// AARD: function: id
+// AARD: #1:1 -> #1:2  ::  defs: %1 / uses:  [@1 5:12-5:12]  { arg }
+int id(int n) {
+    // AARD: #1:2 ->   ::  defs:  / uses: %1 [@1 7:5-7:5]  { ret }
+    return n;
+}
+
+// AARD: function: zero
+int zero(void) {
+    // AARD: #1:3 -> #1:4  ::  defs: %2 / uses:  [@1 13:9-13:9]
+    int x = 0;
+    // AARD: #1:4 ->   ::  defs:  / uses:  [@1 15:5-15:5]  { ret }
+    return x;
+}
+
+// AARD: @1 = optimized.c
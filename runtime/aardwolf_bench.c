@@ -0,0 +1,205 @@
+// Micro-benchmark of the trace writer. It is linked with every runtime variant
+// and drives it with mixes of statement and data events. Every case runs in a
+// forked process with its own trace file, so the time includes the flushing at
+// the exit and the file size gives the number of bytes per event. Results are
+// printed as one JSON object per line.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <dirent.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "runtime.h"
+
+#ifndef BENCH_VARIANT
+#define BENCH_VARIANT "unknown"
+#endif
+
+#define DEFAULT_EVENTS (1 << 21)
+
+struct bench_case {
+    const char *name;
+    // Number of data events traced after every statement.
+    unsigned values;
+    unsigned threads;
+};
+
+static const struct bench_case cases[] = {
+    {"statements", 0, 1},
+    {"balanced", 1, 1},
+    {"data_heavy", 3, 1},
+    {"statements", 0, 4},
+    {"balanced", 1, 4},
+    {"data_heavy", 3, 4},
+};
+
+// Number of events traced by every thread.
+static uint64_t events_per_thread = DEFAULT_EVENTS;
+
+static unsigned current_values = 0;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void * trace_events(void *arg)
+{
+    uint64_t file_id = (uint64_t)(uintptr_t)arg;
+    uint64_t period = 1 + current_values;
+
+    for (uint64_t i = 0; i < events_per_thread; i++) {
+        // Statement identifiers stay small and repeating like in real loops.
+        switch (i % period % 4) {
+            case 0:
+                aardwolf_write_statement(file_id, i / period % 1024);
+                break;
+            case 1:
+                aardwolf_write_data_i32((int32_t)i);
+                break;
+            case 2:
+                aardwolf_write_data_i64((int64_t)i);
+                break;
+            default:
+                aardwolf_write_data_f64((double)i);
+                break;
+        }
+    }
+
+    return NULL;
+}
+
+// Executed in the child process.
+static void run_case(const struct bench_case *bench_case)
+{
+    current_values = bench_case->values;
+
+    pthread_t threads[16];
+    unsigned n_threads = bench_case->threads < 16 ? bench_case->threads : 16;
+
+    // Even a single thread is spawned, so the buffered runtime flushes its
+    // buffer in the thread destructor like for the others.
+    for (unsigned i = 0; i < n_threads; i++) {
+        pthread_create(&threads[i], NULL, trace_events, (void *)(uintptr_t)(i + 1));
+    }
+
+    for (unsigned i = 0; i < n_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+// Removes the temporary directory with all files written into it (the traces
+// of the processes, the index, the counters).
+static void remove_dir(const char *dest)
+{
+    DIR *dir = opendir(dest);
+    struct dirent *entry;
+    char path[64 + sizeof(entry->d_name)];
+
+    while (dir != NULL && (entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+            snprintf(path, sizeof(path), "%.62s/%s", dest, entry->d_name);
+            unlink(path);
+        }
+    }
+
+    if (dir != NULL) {
+        closedir(dir);
+    }
+
+    rmdir(dest);
+}
+
+static void print_env(const char *key, const char *name)
+{
+    char *value = getenv(name);
+
+    if (value == NULL) {
+        printf(", \"%s\": null", key);
+    } else {
+        printf(", \"%s\": \"%s\"", key, value);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 2) {
+        fprintf(stderr, "usage: %s [events per thread]\n", argv[0]);
+        return 1;
+    }
+
+    if (argc == 2 && strtoull(argv[1], NULL, 10) > 0) {
+        events_per_thread = strtoull(argv[1], NULL, 10);
+    }
+
+    char dest[] = "/tmp/aardwolf-bench-XXXXXX";
+    if (mkdtemp(dest) == NULL) {
+        fprintf(stderr, "cannot create temporary directory\n");
+        return 1;
+    }
+
+    // The runtime is never used by this process, only by the children. It became
+    // the owner of the trace when the runtime was loaded, so the children would
+    // write aard.trace.<pid> otherwise.
+    unsetenv("AARDWOLF_TRACE_OWNER");
+    setenv("AARDWOLF_DATA_DEST", dest, 1);
+
+    char trace[sizeof(dest) + 16];
+    snprintf(trace, sizeof(trace), "%s/aard.trace", dest);
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        const struct bench_case *bench_case = &cases[i];
+        uint64_t n_events = events_per_thread * bench_case->threads;
+
+        // The bare runtime appends to the file.
+        unlink(trace);
+        fflush(stdout);
+
+        double start = now();
+        pid_t child = fork();
+
+        if (child == 0) {
+            run_case(bench_case);
+            exit(0);
+        }
+
+        int status = 0;
+        if (child < 0 || waitpid(child, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "case %s failed\n", bench_case->name);
+            remove_dir(dest);
+            return 1;
+        }
+
+        double seconds = now() - start;
+
+        struct stat info;
+        uint64_t bytes = stat(trace, &info) == 0 ? (uint64_t)info.st_size : 0;
+
+        printf("{\"variant\": \"%s\", \"case\": \"%s\", \"values_per_statement\": %u, \"threads\": %u",
+               BENCH_VARIANT, bench_case->name, bench_case->values, bench_case->threads);
+        printf(", \"events\": %llu, \"seconds\": %.6f, \"ns_per_event\": %.3f, \"bytes_per_event\": %.3f"
+               ", \"events_per_second\": %.0f",
+               (unsigned long long)n_events, seconds, seconds * 1e9 / (double)n_events,
+               (double)bytes / (double)n_events, (double)n_events / seconds);
+        print_env("format", "AARDWOLF_TRACE_FORMAT");
+        print_env("mmap", "AARDWOLF_TRACE_MMAP");
+        print_env("compression", "AARDWOLF_TRACE_COMPRESSION");
+        print_env("buffer_size", "AARDWOLF_BUFFER_SIZE");
+        print_env("flight_recorder", "AARDWOLF_FLIGHT_RECORDER");
+        printf("}\n");
+    }
+
+    remove_dir(dest);
+
+    return 0;
+}
@@ -0,0 +1,206 @@
+#ifndef AARDWOLF_ENCODING_H
+#define AARDWOLF_ENCODING_H
+
+// Tokens and encoders of the Aardwolf data formats (see core/src/data/mod.rs
+// for their description). The header is shared by the runtime and the LLVM
+// frontend, so it must stay plain C99 outside of the C++ part at the end.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Runtime data.
+#define TOKEN_STATEMENT 0xff
+#define TOKEN_EXTERNAL 0xfe
+#define TOKEN_CHUNK 0xfd
+#define TOKEN_FILE_INDEX 0xfc
+#define TOKEN_FILE_SWITCH 0xfb
+#define TOKEN_STATEMENT_DELTA 0xfa
+#define TOKEN_BLOCK 0xf9
+#define TOKEN_TEST_STATUS 0xf8
+#define TOKEN_GAP 0xf7
+#define TOKEN_STRING 0xf6
+#define TOKEN_EXTERNAL_REF 0xf5
+#define TOKEN_TEST_STATUS_REF 0xf4
+#define TOKEN_DATA_UNSUPPORTED 0x10
+#define TOKEN_DATA_I8 0x11
+#define TOKEN_DATA_I16 0x12
+#define TOKEN_DATA_I32 0x13
+#define TOKEN_DATA_I64 0x14
+#define TOKEN_DATA_U8 0x15
+#define TOKEN_DATA_U16 0x16
+#define TOKEN_DATA_U32 0x17
+#define TOKEN_DATA_U64 0x18
+#define TOKEN_DATA_F32 0x19
+#define TOKEN_DATA_F64 0x20
+#define TOKEN_DATA_BOOL 0x21
+#define TOKEN_DATA_NAMED 0x28
+#define TOKEN_DATA_NULL 0x29
+#define TOKEN_DATA_BLOB 0x2a
+#define TOKEN_DATA_NAMED_REF 0x2b
+
+// Static data. The statement token is shared with the runtime data.
+#define TOKEN_FUNCTION 0xfe
+#define TOKEN_FILENAMES 0xfd
+#define TOKEN_TRACE_BLOCK 0xfc
+#define TOKEN_UNTRACED_FUNCTION 0xfb
+#define TOKEN_INDUCTION_STEP 0xfa
+#define TOKEN_VALUE_SCALAR 0xe0
+#define TOKEN_VALUE_STRUCTURAL 0xe1
+#define TOKEN_VALUE_ARRAY_LIKE 0xe2
+
+#define SECTION_FUNCTIONS 0x01
+#define SECTION_STATEMENTS 0x02
+#define SECTION_FILES 0x03
+#define SECTION_TYPES 0x04
+
+#define FUNCTION_UNTRACED 0x01
+
+// Successor count of a statement whose only successor is the next one.
+#define SUCC_NEXT 0xff
+
+// Trace index.
+#define INDEX_TOKEN_MARKER 0xfe
+#define INDEX_TOKEN_CHUNK 0xfd
+#define INDEX_TOKEN_CHUNK_MARKER 0xfc
+
+// Size of the filter of files touched by an indexed chunk.
+#define INDEX_FILTER_WORDS 4
+
+#define META_ARG 0x61
+#define META_RET 0x62
+#define META_CALL 0x64
+
+// Maximum size of a varint-encoded 64-bit integer.
+#define AARDWOLF_MAX_VARINT_SIZE 10
+
+// Integers are stored in native byte order with their full width. The
+// encoders return the number of bytes written.
+static inline size_t aardwolf_encode_u8(uint8_t *data, uint8_t value)
+{
+    data[0] = value;
+    return sizeof(uint8_t);
+}
+
+static inline size_t aardwolf_encode_u32(uint8_t *data, uint32_t value)
+{
+    memcpy(data, &value, sizeof(uint32_t));
+    return sizeof(uint32_t);
+}
+
+static inline size_t aardwolf_encode_u64(uint8_t *data, uint64_t value)
+{
+    memcpy(data, &value, sizeof(uint64_t));
+    return sizeof(uint64_t);
+}
+
+// Variable-length encoding (LEB128) of unsigned integers, 7 bits per byte.
+static inline size_t aardwolf_encode_varint(uint8_t *data, uint64_t value)
+{
+    size_t size = 0;
+
+    while (value >= 0x80) {
+        data[size++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+
+    data[size++] = (uint8_t)value;
+    return size;
+}
+
+// Returns the position after the value, or `end` if the value is truncated.
+static inline const uint8_t * aardwolf_decode_varint(const uint8_t *data, const uint8_t *end, uint64_t *value)
+{
+    unsigned shift = 0;
+    *value = 0;
+
+    while (data < end && shift < 64) {
+        uint8_t byte = *data++;
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+
+        if ((byte & 0x80) == 0) {
+            return data;
+        }
+
+        shift += 7;
+    }
+
+    return end;
+}
+
+// Maps signed integers to unsigned ones so that values close to zero have
+// short varint encoding.
+static inline uint64_t aardwolf_zigzag_encode(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t aardwolf_zigzag_decode(uint64_t value)
+{
+    return (int64_t)((value >> 1) ^ (0 - (value & 1)));
+}
+
+// The files touched by a chunk of the trace index form a bloom filter of
+// 256 bits, two of them are set for each file.
+static inline void aardwolf_filter_add(uint64_t *filter, uint64_t file_id)
+{
+    uint64_t hash = file_id * 0x9e3779b97f4a7c15ull;
+    unsigned first = (unsigned)(hash >> 56);
+    unsigned second = (unsigned)(hash >> 48) & 0xff;
+
+    filter[first >> 6] |= 1ull << (first & 63);
+    filter[second >> 6] |= 1ull << (second & 63);
+}
+
+#ifdef __cplusplus
+
+#include <type_traits>
+
+namespace aardwolf {
+namespace encoding {
+
+// Encoding policies. `MaxSize<T>` is the upper bound of the encoded size of a
+// value of type T, so the callers can encode into a fixed array.
+
+struct Fixed {
+  template <typename T> static constexpr size_t MaxSize = sizeof(T);
+
+  template <typename T> static size_t encode(uint8_t *Data, T Value) {
+    static_assert(std::is_arithmetic<T>::value,
+                  "Only numbers can be encoded.");
+    memcpy(Data, &Value, sizeof(T));
+    return sizeof(T);
+  }
+};
+
+// Signed integers are zigzag-encoded first.
+struct Varint {
+  template <typename T>
+  static constexpr size_t MaxSize = (sizeof(T) * 8 + 6) / 7;
+
+  template <typename T> static size_t encode(uint8_t *Data, T Value) {
+    static_assert(std::is_integral<T>::value,
+                  "Only integers can be varint-encoded.");
+
+    if constexpr (std::is_signed<T>::value) {
+      return aardwolf_encode_varint(Data, aardwolf_zigzag_encode(Value));
+    } else {
+      return aardwolf_encode_varint(Data, Value);
+    }
+  }
+};
+
+// Encodes the value into a stream with `write(const char *, size_t)` member
+// (e.g., llvm::raw_ostream).
+template <typename Policy = Fixed, typename Stream, typename T>
+void write(Stream &S, T Value) {
+  uint8_t Data[Policy::template MaxSize<T>];
+  S.write(reinterpret_cast<const char *>(Data), Policy::encode(Data, Value));
+}
+
+} // namespace encoding
+} // namespace aardwolf
+
+#endif // __cplusplus
+
+#endif // AARDWOLF_ENCODING_H
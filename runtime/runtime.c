@@ -4,101 +4,2628 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifndef NO_DATA
+#include <errno.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#endif
+
+#ifdef BUFFERED
+#include <pthread.h>
+#ifdef ASYNC
+#include <semaphore.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#elif !defined(NO_HEADER)
+#include <pthread.h>
+#include <sys/mman.h>
+#endif
 
 #define FILE_FORMAT_VERSION 1
 
-#define ASCII_ZERO 48
+#define ASCII_ZERO 48
+
+// Always NULL in unbuffered runtimes, so the inline instrumentation calls the
+// runtime functions.
+__thread struct aardwolf_cursor aardwolf_cursor = {NULL, NULL};
+
+// Set while the calling thread executes an invocation which is not sampled. The
+// events are dropped, in buffered runtimes it keeps the end of the cursor NULL
+// so the events do not take the fast path.
+static __thread uint8_t __aardwolf_muted = 0;
+
+// Name of the last test case marker. A forked process starts its own trace
+// file with it, so the events traced by the child before its first marker are
+// assigned to the test case in which it was forked.
+static char *__aardwolf_current_test = NULL;
+
+void __aardwolf_set_current_test(const char *name)
+{
+    size_t size = strlen(name) + 1;
+    char *copy = (char *)malloc(size);
+
+    if (copy != NULL) {
+        memcpy(copy, name, size);
+    }
+
+    free(__aardwolf_current_test);
+    __aardwolf_current_test = copy;
+}
+
+// Coverage maps registered by instrumented modules. They are registered from
+// module constructors, so the list is not guarded.
+struct __aardwolf_coverage {
+    uint8_t *map;
+    const uint64_t *stmts;
+    uint64_t count;
+    struct __aardwolf_coverage *next;
+};
+
+static struct __aardwolf_coverage *__aardwolf_coverage = NULL;
+
+// Logs the statements covered since the last call and clears their flags.
+void __aardwolf_write_coverage(void)
+{
+    for (struct __aardwolf_coverage *coverage = __aardwolf_coverage; coverage != NULL; coverage = coverage->next) {
+        for (uint64_t i = 0; i < coverage->count; i++) {
+            // The flags can be set concurrently by other threads.
+            if (coverage->map[i] != 0 && __atomic_exchange_n(&coverage->map[i], 0, __ATOMIC_RELAXED) != 0) {
+                aardwolf_write_statement(coverage->stmts[2 * i], coverage->stmts[2 * i + 1]);
+            }
+        }
+    }
+}
+
+// Default capacity of per-thread buffers in buffered runtime. It can be
+// overridden by AARDWOLF_BUFFER_SIZE environment variable (in bytes).
+#define DEFAULT_BUFFER_SIZE (1 << 20)
+
+#define HEADER_SIZE 7
+
+#define INDEX_FORMAT_VERSION 1
+
+// TOKEN_CHUNK ; 8B thread id ; 8B epoch ; 4B payload size
+#define CHUNK_HEADER_SIZE 21
+
+// Maximum number of files in the file index table of a chunk in compact
+// encoding. When it is full, the indices are reused.
+#define FILE_TABLE_SIZE 64
+
+// Number of entries in the string table of a chunk in compact encoding. The
+// index of a string is determined by its hash, colliding strings replace each
+// other.
+#define STRING_TABLE_SIZE 64
+
+// Maximum size of a statement event in compact encoding (file index
+// definition and the statement itself).
+#define MAX_COMPACT_STATEMENT_SIZE 30
+
+// Buffers smaller than that would not be able to hold any event.
+#define MIN_BUFFER_SIZE 64
+
+// Number of full buffers which can wait for the background writer in
+// asynchronous runtime before the flushing thread blocks.
+#define QUEUE_SIZE 8
+
+// Favours speed, the traces are highly repetitive anyway.
+#define ZSTD_LEVEL 1
+
+// Initial capacity of the set of evicted statements in flight recorder mode.
+#define MIN_COVERED_CAPACITY 256
+
+// Size of the stack buffer in which the evicted statements are encoded.
+#define COVERED_CHUNK_SIZE 4096
+
+// Maximum size of a raw block in the zstd frames written by the crash handler
+// (equal to the window size declared in their header).
+#define RAW_BLOCK_SIZE (128 << 10)
+
+void __write_header(FILE *fd)
+{
+    fputs("AARD/D", fd);
+    fputc(FILE_FORMAT_VERSION + ASCII_ZERO, fd);
+}
+
+// Constructs path to given file respecting AARDWOLF_DATA_DEST. The caller is
+// responsible for freeing the returned string.
+char * __aardwolf_get_path(const char *filename)
+{
+    char *dest_dir = getenv("AARDWOLF_DATA_DEST");
+
+    size_t filename_size = strlen(filename) + 1;
+    char * filepath;
+
+    // NOTE: filename_size includes null terminator as well.
+    if (dest_dir == NULL) {
+        filepath = (char*)malloc(filename_size);
+        strcpy(filepath, filename);
+    } else {
+        size_t destination_length = strlen(dest_dir) + 1;
+
+        filepath = (char*)malloc(destination_length + filename_size);
+        memset(filepath, 0, destination_length + filename_size);
+
+        strcpy(filepath, dest_dir);
+        filepath[destination_length - 1] = '/';
+        strcpy(filepath + destination_length, filename);
+    }
+
+    return filepath;
+}
+
+#ifndef NO_HEADER
+// Process id of the owner of the trace if it already was the owner before it
+// executed the current program, zero otherwise.
+static long __aardwolf_exec_owner = 0;
+
+// The first traced process writes aard.trace and exports its id in
+// AARDWOLF_TRACE_OWNER. The variable is set before any threads exist, since
+// setenv is not thread-safe. An owner keeps its id when it executes another
+// program, which then continues the trace.
+__attribute__((constructor)) static void __aardwolf_init_owner(void)
+{
+    char value[32];
+    long pid = (long)getpid();
+    char *owner = getenv("AARDWOLF_TRACE_OWNER");
+
+    if (owner == NULL) {
+        snprintf(value, sizeof(value), "%ld", pid);
+        setenv("AARDWOLF_TRACE_OWNER", value, 1);
+    } else if (strtol(owner, NULL, 10) == pid) {
+        __aardwolf_exec_owner = pid;
+    }
+}
+
+// Returns whether the trace file written by the owner before it executed the
+// current program must be appended to instead of truncated.
+int __aardwolf_continue_trace(const char *filepath)
+{
+    return __aardwolf_exec_owner == (long)getpid() && access(filepath, F_OK) == 0;
+}
+#endif
+
+// Processes other than the owner (forked by it or executed by its children)
+// write their own aard.trace.<pid>, which Aardwolf merges with the main trace.
+// The bare runtime always appends to the shared file.
+char * __aardwolf_get_filepath(void)
+{
+#ifndef NO_HEADER
+    char filename[64];
+    long pid = (long)getpid();
+    char *owner = getenv("AARDWOLF_TRACE_OWNER");
+
+    if (owner != NULL && strtol(owner, NULL, 10) != pid) {
+        snprintf(filename, sizeof(filename), "aard.trace.%ld", pid);
+        return __aardwolf_get_path(filename);
+    }
+#endif
+
+    return __aardwolf_get_path("aard.trace");
+}
+
+#ifndef NO_DATA
+
+// With AARDWOLF_TRACE_INDEX=1, a side index is written next to the trace file
+// (<trace file>.index). The buffered runtimes record every chunk together with
+// the files it touches and the test case markers in it, aardwolf_external
+// records the markers it appends between the chunks. Aardwolf can then seek
+// to the relevant chunks instead of reading the whole trace.
+int __aardwolf_index_enabled(void)
+{
+    char *index = getenv("AARDWOLF_TRACE_INDEX");
+    return index != NULL && strcmp(index, "1") == 0;
+}
+
+// Returns -1 if the index cannot be opened.
+int __aardwolf_open_index(const char *filepath, int flags)
+{
+    size_t length = strlen(filepath);
+    char *indexpath = (char *)malloc(length + sizeof(".index"));
+
+    if (indexpath == NULL) {
+        return -1;
+    }
+
+    memcpy(indexpath, filepath, length);
+    memcpy(indexpath + length, ".index", sizeof(".index"));
+
+    int file = open(indexpath, O_WRONLY | O_CREAT | O_APPEND | flags, 0644);
+
+    if (file < 0) {
+        fprintf(stderr, "Aardwolf error: cannot open %s.\n", indexpath);
+    }
+
+    free(indexpath);
+    return file;
+}
+
+// Every record is written with a single call, so the records appended by
+// several processes are not interleaved.
+void __aardwolf_write_index(int file, const struct iovec *parts, int count)
+{
+    ssize_t expected = 0;
+    ssize_t written;
+
+    for (int i = 0; i < count; i++) {
+        expected += (ssize_t)parts[i].iov_len;
+    }
+
+    do {
+        written = writev(file, parts, count);
+    } while (written < 0 && errno == EINTR);
+
+    if (written != expected) {
+        fprintf(stderr, "Aardwolf error: cannot write trace index.\n");
+    }
+}
+
+// The name includes the null terminator.
+void __aardwolf_index_marker(int file, uint8_t token, uint64_t offset, const void *name, size_t size)
+{
+    uint8_t record[1 + sizeof(uint64_t)];
+    size_t length = aardwolf_encode_u8(record, token);
+    length += aardwolf_encode_u64(record + length, offset);
+
+    struct iovec parts[2] = {{record, length}, {(void *)name, size}};
+    __aardwolf_write_index(file, parts, 2);
+}
+
+// Several processes (e.g., aardwolf_external) may append to an indexed trace
+// file. Their writes are ordered by an advisory lock on the file, so its size
+// under the lock is the offset of the appended data, even if they take several
+// write calls. Returns -1 if the lock cannot be taken.
+off_t __aardwolf_lock_trace(int file)
+{
+    struct stat info;
+
+    while (flock(file, LOCK_EX) != 0) {
+        if (errno != EINTR) {
+            fprintf(stderr, "Aardwolf error: cannot lock trace file.\n");
+            return -1;
+        }
+    }
+
+    if (fstat(file, &info) != 0) {
+        fprintf(stderr, "Aardwolf error: cannot lock trace file.\n");
+        flock(file, LOCK_UN);
+        return -1;
+    }
+
+    return info.st_size;
+}
+
+void __aardwolf_unlock_trace(int file)
+{
+    flock(file, LOCK_UN);
+}
+
+#endif // NO_DATA
+
+#ifndef NO_DATA
+
+// Self-instrumentation of the runtime (AARDWOLF_RUNTIME_COUNTERS=1). Every
+// thread counts into its own record, so the counting needs no synchronization.
+// The records are never freed, they are dumped to aard.counters at the exit
+// and summed by aardwolf_read_counters.
+struct __aardwolf_thread_counters {
+    struct aardwolf_counters counters;
+    uint64_t thread;
+    struct __aardwolf_thread_counters *next;
+};
+
+// Equal to -1 until the mode is determined on the first API use.
+static int __aardwolf_counting = -1;
+static struct __aardwolf_thread_counters *__aardwolf_all_counters = NULL;
+static uint64_t __aardwolf_counted_threads = 0;
+static __thread struct __aardwolf_thread_counters *__aardwolf_local_counters = NULL;
+
+static inline uint64_t __aardwolf_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static const char * __aardwolf_token_name(uint8_t token)
+{
+    switch (token) {
+        case TOKEN_STATEMENT: return "statement";
+        case TOKEN_EXTERNAL: return "external";
+        case TOKEN_STATEMENT_DELTA: return "statement_delta";
+        case TOKEN_BLOCK: return "block";
+        case TOKEN_TEST_STATUS: return "test_status";
+        case TOKEN_GAP: return "gap";
+        case TOKEN_EXTERNAL_REF: return "external_ref";
+        case TOKEN_TEST_STATUS_REF: return "test_status_ref";
+        case TOKEN_DATA_UNSUPPORTED: return "data_unsupported";
+        case TOKEN_DATA_I8: return "data_i8";
+        case TOKEN_DATA_I16: return "data_i16";
+        case TOKEN_DATA_I32: return "data_i32";
+        case TOKEN_DATA_I64: return "data_i64";
+        case TOKEN_DATA_U8: return "data_u8";
+        case TOKEN_DATA_U16: return "data_u16";
+        case TOKEN_DATA_U32: return "data_u32";
+        case TOKEN_DATA_U64: return "data_u64";
+        case TOKEN_DATA_F32: return "data_f32";
+        case TOKEN_DATA_F64: return "data_f64";
+        case TOKEN_DATA_BOOL: return "data_bool";
+        case TOKEN_DATA_NAMED: return "data_named";
+        case TOKEN_DATA_NULL: return "data_null";
+        case TOKEN_DATA_BLOB: return "data_blob";
+        case TOKEN_DATA_NAMED_REF: return "data_named_ref";
+        default: return NULL;
+    }
+}
+
+// Handler registered by atexit. Appends one JSON object per thread, so the
+// counters of forked processes and repeated runs are kept. Registered before
+// the exit handlers of the buffered runtimes, so it runs after their final
+// flush.
+void __aardwolf_dump_counters(void)
+{
+    char * filepath = __aardwolf_get_path("aard.counters");
+    FILE *fd = fopen(filepath, "a");
+
+    if (fd == NULL) {
+        fprintf(stderr, "Aardwolf error: cannot open %s.\n", filepath);
+        free(filepath);
+        return;
+    }
+
+    free(filepath);
+
+    struct __aardwolf_thread_counters *local = __atomic_load_n(&__aardwolf_all_counters, __ATOMIC_ACQUIRE);
+
+    for (; local != NULL; local = local->next) {
+        const struct aardwolf_counters *counters = &local->counters;
+
+        fprintf(fd, "{\"pid\":%ld,\"thread\":%llu,\"events\":{", (long)getpid(),
+                (unsigned long long)local->thread);
+
+        const char *separator = "";
+        for (int token = 0; token < AARDWOLF_N_TOKENS; token++) {
+            const char *name = __aardwolf_token_name((uint8_t)token);
+
+            if (counters->events[token] > 0 && name != NULL) {
+                fprintf(fd, "%s\"%s\":%llu", separator, name, (unsigned long long)counters->events[token]);
+                separator = ",";
+            }
+        }
+
+        fprintf(fd,
+                "},\"bytes\":%llu,\"written\":%llu,\"flushes\":%llu,\"flush_ns\":%llu,"
+                "\"stalls\":%llu,\"write_data_ns\":%llu}\n",
+                (unsigned long long)counters->bytes, (unsigned long long)counters->written,
+                (unsigned long long)counters->flushes, (unsigned long long)counters->flush_ns,
+                (unsigned long long)counters->stalls, (unsigned long long)counters->write_data_ns);
+    }
+
+    fclose(fd);
+}
+
+int __aardwolf_init_counters(void)
+{
+    char *counters_env = getenv("AARDWOLF_RUNTIME_COUNTERS");
+    int counting = counters_env != NULL && strcmp(counters_env, "1") == 0;
+    int expected = -1;
+
+    // Only the first thread registers the exit handler.
+    if (__atomic_compare_exchange_n(&__aardwolf_counting, &expected, counting, 0, __ATOMIC_SEQ_CST,
+                                    __ATOMIC_SEQ_CST)) {
+        if (counting) {
+            atexit(__aardwolf_dump_counters);
+        }
+
+        return counting;
+    }
+
+    return expected;
+}
+
+static inline int __aardwolf_counters_enabled(void)
+{
+    int counting = __atomic_load_n(&__aardwolf_counting, __ATOMIC_RELAXED);
+    return counting < 0 ? __aardwolf_init_counters() : counting;
+}
+
+// Returns the counters of the calling thread, NULL if the counting is
+// disabled.
+struct aardwolf_counters * __aardwolf_get_counters(void)
+{
+    if (!__aardwolf_counters_enabled()) {
+        return NULL;
+    }
+
+    if (__aardwolf_local_counters == NULL) {
+        struct __aardwolf_thread_counters *local =
+            (struct __aardwolf_thread_counters *)calloc(1, sizeof(struct __aardwolf_thread_counters));
+
+        if (local == NULL) {
+            return NULL;
+        }
+
+        local->thread = __atomic_add_fetch(&__aardwolf_counted_threads, 1, __ATOMIC_RELAXED);
+        local->next = __atomic_load_n(&__aardwolf_all_counters, __ATOMIC_RELAXED);
+
+        while (!__atomic_compare_exchange_n(&__aardwolf_all_counters, &local->next, local, 1, __ATOMIC_RELEASE,
+                                            __ATOMIC_RELAXED)) {
+        }
+
+        __aardwolf_local_counters = local;
+    }
+
+    return &__aardwolf_local_counters->counters;
+}
+
+static inline void __aardwolf_count_event(uint8_t token, size_t size)
+{
+    struct aardwolf_counters *counters = __aardwolf_get_counters();
+
+    if (counters != NULL) {
+        counters->events[token]++;
+        counters->bytes += size;
+    }
+}
+
+// Counts a flush which took given time (in nanoseconds, see
+// __aardwolf_now_ns).
+static inline void __aardwolf_count_flush(uint64_t start)
+{
+    struct aardwolf_counters *counters = __aardwolf_get_counters();
+
+    if (counters != NULL) {
+        counters->flushes++;
+        counters->flush_ns += __aardwolf_now_ns() - start;
+    }
+}
+
+#endif // NO_DATA
+
+#ifndef BUFFERED
+
+// Opened on the first API use. Closed after the process termination.
+static FILE * __aardwolf_fd = NULL;
+
+#ifndef NO_HEADER
+void __aardwolf_register_fork(void);
+#endif
+
+FILE * __aardwolf_get_fd(void)
+{
+    if (__aardwolf_fd == NULL) {
+        char * filepath = __aardwolf_get_filepath();
+
+#ifndef NO_HEADER
+        int append = __aardwolf_continue_trace(filepath);
+        __aardwolf_fd = fopen(filepath, append ? "a" : "w");
+#else
+        __aardwolf_fd = fopen(filepath, "a");
+#endif
+
+        if (__aardwolf_fd == NULL) {
+            fprintf(stderr, "Aardwolf error: cannot open %s.\n", filepath);
+            free(filepath);
+            exit(1);
+        }
+
+#ifndef NO_HEADER
+        if (!append) {
+            __write_header(__aardwolf_fd);
+        }
+
+        __aardwolf_register_fork();
+#endif
+
+        free(filepath);
+    }
+
+    return __aardwolf_fd;
+}
+
+#ifndef NO_HEADER
+
+// The trace file is grown by this many bytes in memory-mapped mode. Must be a
+// multiple of the page size.
+#define MMAP_EXTENT_SIZE (16 << 20)
+
+// Number of extents which can be mapped at once. A writer which lags behind
+// by more extents blocks the others until it copies its event.
+#define MMAP_SLOTS 8
+
+// In memory-mapped mode (AARDWOLF_TRACE_MMAP=1), the events are copied
+// directly into a shared mapping of the trace file. Every event first reserves
+// its bytes by advancing the file position atomically, so the threads copy
+// their events concurrently and the events are never interleaved. Extending
+// the file and mapping the extents is done under the lock. An extent is
+// unmapped by the writer which completes it, so no other writer can still use
+// it. The written data are in the page cache, so they survive a crash of the
+// process.
+//
+// Equal to -1 until the mode is determined on the first API use.
+static int __aardwolf_mmap = -1;
+static pthread_once_t __aardwolf_mmap_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t __aardwolf_mmap_lock = PTHREAD_MUTEX_INITIALIZER;
+// Signalled when a slot is freed.
+static pthread_cond_t __aardwolf_mmap_freed = PTHREAD_COND_INITIALIZER;
+static int __aardwolf_mmap_file = -1;
+// File position of the next event.
+static uint64_t __aardwolf_mmap_pos = 0;
+// File position at which the trace was opened, non-zero if it is continued.
+static uint64_t __aardwolf_mmap_start = 0;
+// Size of the trace file, changed under the lock.
+static uint64_t __aardwolf_mmap_size = 0;
+// Set by the exit handler, the file is not grown by whole extents after that.
+static int __aardwolf_mmap_closed = 0;
+
+struct __aardwolf_mmap_slot {
+    // Index of the mapped extent plus one, zero if the slot is free.
+    uint64_t extent;
+    uint8_t *window;
+    // Number of bytes copied into the extent so far.
+    uint64_t written;
+};
+
+// Extent i is mapped in slot i % MMAP_SLOTS.
+static struct __aardwolf_mmap_slot __aardwolf_mmap_slots[MMAP_SLOTS];
+
+// Extends the file so it contains given position. Called under the lock.
+void __aardwolf_mmap_extend(uint64_t end)
+{
+    if (!__aardwolf_mmap_closed) {
+        end = (end + MMAP_EXTENT_SIZE - 1) / MMAP_EXTENT_SIZE * MMAP_EXTENT_SIZE;
+    }
+
+    if (end > __aardwolf_mmap_size) {
+        if (ftruncate(__aardwolf_mmap_file, (off_t)end) != 0) {
+            fprintf(stderr, "Aardwolf error: cannot extend trace file.\n");
+            exit(1);
+        }
+
+        __atomic_store_n(&__aardwolf_mmap_size, end, __ATOMIC_RELEASE);
+    }
+}
+
+// Returns the mapping of given extent. If its slot is still used by an older
+// extent, waits until that one is completely written.
+uint8_t * __aardwolf_mmap_map(uint64_t extent)
+{
+    struct __aardwolf_mmap_slot *slot = &__aardwolf_mmap_slots[extent % MMAP_SLOTS];
+
+    if (__atomic_load_n(&slot->extent, __ATOMIC_ACQUIRE) == extent + 1) {
+        return slot->window;
+    }
+
+    pthread_mutex_lock(&__aardwolf_mmap_lock);
+
+    while (slot->extent != extent + 1) {
+        if (slot->extent != 0) {
+            pthread_cond_wait(&__aardwolf_mmap_freed, &__aardwolf_mmap_lock);
+            continue;
+        }
+
+        void *window = mmap(NULL, MMAP_EXTENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, __aardwolf_mmap_file,
+                            (off_t)(extent * MMAP_EXTENT_SIZE));
+
+        if (window == MAP_FAILED) {
+            fprintf(stderr, "Aardwolf error: cannot map trace file.\n");
+            exit(1);
+        }
+
+        // The bytes before the start are never written by this process.
+        uint64_t base = extent * MMAP_EXTENT_SIZE;
+        uint64_t skipped = __aardwolf_mmap_start > base ? __aardwolf_mmap_start - base : 0;
+
+        slot->window = (uint8_t *)window;
+        slot->written = skipped < MMAP_EXTENT_SIZE ? skipped : MMAP_EXTENT_SIZE;
+        __atomic_store_n(&slot->extent, extent + 1, __ATOMIC_RELEASE);
+    }
+
+    uint8_t *window = slot->window;
+    pthread_mutex_unlock(&__aardwolf_mmap_lock);
+
+    return window;
+}
+
+// Unmaps the extent when the last of its bytes were copied.
+void __aardwolf_mmap_release(uint64_t extent, size_t n_bytes)
+{
+    struct __aardwolf_mmap_slot *slot = &__aardwolf_mmap_slots[extent % MMAP_SLOTS];
+
+    if (__atomic_add_fetch(&slot->written, n_bytes, __ATOMIC_ACQ_REL) == MMAP_EXTENT_SIZE) {
+        pthread_mutex_lock(&__aardwolf_mmap_lock);
+        munmap(slot->window, MMAP_EXTENT_SIZE);
+        slot->window = NULL;
+        __atomic_store_n(&slot->extent, 0, __ATOMIC_RELEASE);
+        pthread_cond_broadcast(&__aardwolf_mmap_freed);
+        pthread_mutex_unlock(&__aardwolf_mmap_lock);
+    }
+}
+
+// Reserves given number of bytes in the trace file and returns their
+// position.
+uint64_t __aardwolf_mmap_reserve(size_t length)
+{
+    uint64_t pos = __atomic_fetch_add(&__aardwolf_mmap_pos, length, __ATOMIC_RELAXED);
+
+    if (pos + length > __atomic_load_n(&__aardwolf_mmap_size, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_lock(&__aardwolf_mmap_lock);
+        __aardwolf_mmap_extend(pos + length);
+        pthread_mutex_unlock(&__aardwolf_mmap_lock);
+    }
+
+    return pos;
+}
+
+// Copies the bytes to the reserved position.
+void __aardwolf_mmap_copy(uint64_t pos, const void *data, size_t length)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+
+    while (length > 0) {
+        uint64_t extent = pos / MMAP_EXTENT_SIZE;
+        size_t offset = (size_t)(pos % MMAP_EXTENT_SIZE);
+        size_t available = MMAP_EXTENT_SIZE - offset;
+        size_t n_bytes = length < available ? length : available;
+
+        memcpy(__aardwolf_mmap_map(extent) + offset, bytes, n_bytes);
+        __aardwolf_mmap_release(extent, n_bytes);
+
+        pos += n_bytes;
+        bytes += n_bytes;
+        length -= n_bytes;
+    }
+}
+
+void __aardwolf_mmap_write(uint8_t token, const void *data, size_t length)
+{
+    uint64_t pos = __aardwolf_mmap_reserve(1 + length);
+    __aardwolf_mmap_copy(pos, &token, 1);
+    __aardwolf_mmap_copy(pos + 1, data, length);
+}
+
+void __aardwolf_mmap_write_header(void)
+{
+    char header[HEADER_SIZE] = {'A', 'A', 'R', 'D', '/', 'D', FILE_FORMAT_VERSION + ASCII_ZERO};
+    __aardwolf_mmap_copy(__aardwolf_mmap_reserve(HEADER_SIZE), header, HEADER_SIZE);
+}
+
+// Handler registered by atexit. Cuts off the unused part of the last extent.
+// The file is then extended exactly by the events traced in exit handlers that
+// run after this one.
+void __aardwolf_mmap_exit(void)
+{
+    __aardwolf_write_coverage();
+
+    pthread_mutex_lock(&__aardwolf_mmap_lock);
+    __aardwolf_mmap_closed = 1;
+
+    uint64_t end = __atomic_load_n(&__aardwolf_mmap_pos, __ATOMIC_RELAXED);
+
+    if (ftruncate(__aardwolf_mmap_file, (off_t)end) != 0) {
+        fprintf(stderr, "Aardwolf error: cannot truncate trace file.\n");
+    } else {
+        __atomic_store_n(&__aardwolf_mmap_size, end, __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_unlock(&__aardwolf_mmap_lock);
+}
+
+// A continued trace may end with the zero padding of the extent written
+// before the owner executed the current program, Aardwolf skips it.
+void __aardwolf_mmap_open(void)
+{
+    char * filepath = __aardwolf_get_filepath();
+    int append = __aardwolf_continue_trace(filepath);
+    __aardwolf_mmap_file = open(filepath, O_RDWR | O_CREAT | (append ? 0 : O_TRUNC), 0644);
+
+    if (__aardwolf_mmap_file < 0) {
+        fprintf(stderr, "Aardwolf error: cannot open %s.\n", filepath);
+        free(filepath);
+        exit(1);
+    }
+
+    free(filepath);
+
+    off_t end = append ? lseek(__aardwolf_mmap_file, 0, SEEK_END) : 0;
+
+    __aardwolf_mmap_start = end > 0 ? (uint64_t)end : 0;
+    __aardwolf_mmap_pos = __aardwolf_mmap_start;
+    __aardwolf_mmap_size = __aardwolf_mmap_start;
+    __aardwolf_mmap_closed = 0;
+
+    if (!append) {
+        __aardwolf_mmap_write_header();
+    }
+}
+
+void __aardwolf_mmap_init(void)
+{
+    char *mmap_mode = getenv("AARDWOLF_TRACE_MMAP");
+    int enabled = mmap_mode != NULL && strcmp(mmap_mode, "1") == 0;
+
+    if (enabled) {
+        __aardwolf_mmap_open();
+        __aardwolf_register_fork();
+        atexit(__aardwolf_mmap_exit);
+    }
+
+    __atomic_store_n(&__aardwolf_mmap, enabled, __ATOMIC_RELEASE);
+}
+
+// Returns whether the memory-mapped mode is used. The trace file is opened on
+// the first call if so.
+static inline int __aardwolf_mmap_enabled(void)
+{
+    if (__atomic_load_n(&__aardwolf_mmap, __ATOMIC_ACQUIRE) < 0) {
+        pthread_once(&__aardwolf_mmap_once, __aardwolf_mmap_init);
+    }
+
+    return __aardwolf_mmap;
+}
+
+// The events buffered by stdio and the coverage must be written before the
+// fork, otherwise they would be duplicated by the child. In memory-mapped
+// mode, the lock is held over the fork so the child does not inherit it
+// locked by another thread.
+void __aardwolf_fork_prepare(void)
+{
+    __aardwolf_write_coverage();
+
+    if (__aardwolf_mmap > 0) {
+        pthread_mutex_lock(&__aardwolf_mmap_lock);
+    }
+
+    if (__aardwolf_fd != NULL) {
+        fflush(__aardwolf_fd);
+    }
+}
+
+void __aardwolf_fork_parent(void)
+{
+    if (__aardwolf_mmap > 0) {
+        pthread_mutex_unlock(&__aardwolf_mmap_lock);
+    }
+}
+
+// The child gets its own trace file. The shared mappings of the parent's file
+// are unmapped, so the processes do not overwrite each other's events. The
+// events being copied by other threads of the parent are not part of the
+// child's trace. The exit handler then truncates the file of the child.
+void __aardwolf_fork_child(void)
+{
+    if (__aardwolf_mmap > 0) {
+        for (int i = 0; i < MMAP_SLOTS; i++) {
+            if (__aardwolf_mmap_slots[i].window != NULL) {
+                munmap(__aardwolf_mmap_slots[i].window, MMAP_EXTENT_SIZE);
+            }
+
+            __aardwolf_mmap_slots[i].extent = 0;
+            __aardwolf_mmap_slots[i].window = NULL;
+        }
+
+        pthread_mutex_unlock(&__aardwolf_mmap_lock);
+        close(__aardwolf_mmap_file);
+        __aardwolf_mmap_open();
+
+        if (__aardwolf_current_test != NULL) {
+            __aardwolf_mmap_write(TOKEN_EXTERNAL, __aardwolf_current_test, strlen(__aardwolf_current_test) + 1);
+        }
+    } else if (__aardwolf_fd != NULL) {
+        fclose(__aardwolf_fd);
+        __aardwolf_fd = NULL;
+
+        FILE *fd = __aardwolf_get_fd();
+
+        if (__aardwolf_current_test != NULL) {
+            fputc(TOKEN_EXTERNAL, fd);
+            fputs(__aardwolf_current_test, fd);
+            fputc(0, fd); // null terminator
+        }
+    }
+}
+
+void __aardwolf_register_fork(void)
+{
+    static int registered = 0;
+
+    if (!registered) {
+        registered = 1;
+        pthread_atfork(__aardwolf_fork_prepare, __aardwolf_fork_parent, __aardwolf_fork_child);
+    }
+}
+
+#endif
+
+void __aardwolf_emit_data(uint8_t token, const void* data, size_t type_size)
+{
+#ifndef NO_DATA
+    if (__aardwolf_muted) {
+        return;
+    }
+
+#ifndef NO_HEADER
+    if (__aardwolf_mmap_enabled()) {
+        __aardwolf_mmap_write(token, data, type_size);
+        return;
+    }
+#endif
+
+    FILE *fd = __aardwolf_get_fd();
+    fputc(token, fd);
+    fwrite(data, type_size, 1, fd);
+#ifdef NO_HEADER
+    // Important when multiple sources (aardwolf_external, instrumented library,
+    // etc.) write into one file.
+    uint64_t start = __aardwolf_counters_enabled() ? __aardwolf_now_ns() : 0;
+    fflush(fd);
+
+    if (start != 0) {
+        __aardwolf_count_flush(start);
+    }
+#endif
+#endif
+}
+
+#else // BUFFERED
+
+// Statements (or blocks) of the events evicted from the ring in flight recorder
+// mode, stored in an open-addressing hash set. Unused entries have zero token.
+struct __aardwolf_covered_entry {
+    file_ref_t file_id;
+    statement_ref_t stmt_id;
+    uint8_t token;
+};
+
+struct __aardwolf_covered {
+    struct __aardwolf_covered_entry *entries;
+    size_t capacity;
+    size_t count;
+};
+
+// Every thread encodes the events into its own buffer which is written to the
+// trace file with a single write(2) call when it gets full. The buffers are
+// linked together so they can be all flushed at the process exit.
+//
+// In thread-tagged format (AARD/D2), every written buffer forms a chunk which
+// starts with TOKEN_CHUNK, thread id, test case epoch and payload size. The
+// space for the chunk header is reserved at the beginning of the buffer so the
+// chunk is still written with a single call.
+struct __aardwolf_buffer {
+    uint8_t *data;
+    // Thread-local cursor of the owning thread. Its position is the end of the
+    // events in the buffer.
+    struct aardwolf_cursor *cursor;
+    size_t capacity;
+    // Beginning of the payload (i.e., after reserved chunk header).
+    size_t start;
+    uint64_t thread_id;
+    // Test case epoch in which the events in the buffer were produced.
+    uint64_t epoch;
+    // State of compact statement encoding (AARD/D3). It is reset for every
+    // chunk so the chunks can be decoded independently.
+    file_ref_t files[FILE_TABLE_SIZE];
+    uint32_t n_files;
+    uint32_t current_file;
+    statement_ref_t last_stmt;
+    // Hashes of the strings defined in the chunk, zero for unused entries.
+    uint64_t strings[STRING_TABLE_SIZE];
+    // Flight recorder mode. The buffer and its previous contents form a ring,
+    // the events older than that are evicted and only their statements are
+    // kept.
+    uint8_t *previous;
+    size_t previous_length;
+    struct __aardwolf_covered covered;
+    uint8_t dropped;
+    struct __aardwolf_buffer *next;
+};
+
+// Opened on the first API use. Closed after the process termination.
+static int __aardwolf_file = -1;
+
+static size_t __aardwolf_buffer_size = DEFAULT_BUFFER_SIZE;
+
+// Selected by AARDWOLF_TRACE_FORMAT environment variable.
+static uint8_t __aardwolf_format = FILE_FORMAT_VERSION;
+
+// Size of the chunk header, zero if the format does not use chunks.
+static size_t __aardwolf_chunk_header_size = 0;
+
+// Trace index, only the chunked formats are indexed. Opened together with the
+// trace file, -1 if the trace is not indexed.
+static uint8_t __aardwolf_indexed = 0;
+static int __aardwolf_index_file = -1;
+
+// Files and test case markers found in a chunk being indexed.
+struct __aardwolf_index_entry {
+    uint64_t offset;
+    uint64_t files[INDEX_FILTER_WORDS];
+    // Strings defined in the chunk in compact encoding, they point to the
+    // scanned data.
+    const uint8_t *strings[STRING_TABLE_SIZE];
+};
+
+#ifdef HAVE_ZSTD
+// With AARDWOLF_TRACE_COMPRESSION=zstd, every write becomes an independent
+// zstd frame. The concatenation of the frames is a valid zstd stream which
+// decompresses into the usual trace, and the frame boundaries are at whole
+// buffers (chunks). The writes are serialized, so a single context and output
+// buffer suffice.
+static ZSTD_CCtx *__aardwolf_zstd = NULL;
+static uint8_t *__aardwolf_compressed = NULL;
+static size_t __aardwolf_compressed_capacity = 0;
+
+// The crash handler cannot call the compressor (it allocates), it wraps the
+// chunks into frames of raw blocks instead. The frame buffer is allocated in
+// advance in flight recorder mode.
+static uint8_t *__aardwolf_raw_frame = NULL;
+static size_t __aardwolf_raw_frame_capacity = 0;
+#endif
+
+// In flight recorder mode (AARDWOLF_FLIGHT_RECORDER=1), the events are kept
+// only in the per-thread rings and written when a test case fails, the process
+// crashes or exits. The rings of passing test cases are reduced to the
+// executed statements.
+static uint8_t __aardwolf_recorder = 0;
+
+// Epoch of the last test case reported as passing (plus one, zero if none).
+static uint64_t __aardwolf_passed_epoch = 0;
+
+// Set by the crash handler. The chunks are then written as they are, without
+// anything that is not async-signal-safe.
+static volatile sig_atomic_t __aardwolf_crashed = 0;
+
+// Incremented on every test case marker. Threads compare it with the epoch of
+// their buffer so the events are assigned to correct test case in AARD/D2.
+static uint64_t __aardwolf_epoch = 0;
+
+static uint64_t __aardwolf_next_thread_id = 1;
+
+// Thread ids must be unique even across forked processes which append to the
+// same trace file, therefore the process id is included.
+static inline uint64_t __aardwolf_make_thread_id(void)
+{
+    return ((uint64_t)getpid() << 32) | __aardwolf_next_thread_id++;
+}
+
+// All live buffers. Guarded by __aardwolf_lock, which also serializes writes
+// to the trace file so whole buffers are never interleaved.
+static struct __aardwolf_buffer *__aardwolf_buffers = NULL;
+static pthread_mutex_t __aardwolf_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_once_t __aardwolf_once = PTHREAD_ONCE_INIT;
+static pthread_key_t __aardwolf_key;
+
+static __thread struct __aardwolf_buffer *__aardwolf_local = NULL;
+
+static inline uint64_t __aardwolf_current_epoch(void)
+{
+    return __atomic_load_n(&__aardwolf_epoch, __ATOMIC_RELAXED);
+}
+
+static inline size_t __aardwolf_length(const struct __aardwolf_buffer *buffer)
+{
+    return (size_t)(buffer->cursor->pos - buffer->data);
+}
+
+// Events must not be appended directly to the buffer until its owner calls
+// __aardwolf_update_end. Can be called by any thread.
+static inline void __aardwolf_invalidate_end(struct __aardwolf_buffer *buffer)
+{
+    __atomic_store_n(&buffer->cursor->end, NULL, __ATOMIC_SEQ_CST);
+}
+
+// Allows appending the events directly if the buffer belongs to the current
+// test case. Must be called by the owning thread.
+void __aardwolf_update_end(struct __aardwolf_buffer *buffer)
+{
+    if (__aardwolf_muted) {
+        __aardwolf_invalidate_end(buffer);
+        return;
+    }
+
+    __atomic_store_n(&buffer->cursor->end, buffer->data + buffer->capacity, __ATOMIC_SEQ_CST);
+
+    // If a test case started in the meantime, aardwolf_write_external might
+    // have missed this buffer.
+    if (buffer->epoch != __atomic_load_n(&__aardwolf_epoch, __ATOMIC_SEQ_CST)) {
+        __aardwolf_invalidate_end(buffer);
+    }
+}
+
+void __aardwolf_index_chunk(const uint8_t *chunk, size_t length, uint64_t offset, uint32_t size);
+
+// Returns the offset at which the data were written if the trace is indexed,
+// otherwise (or on failure) -1.
+off_t __aardwolf_write_all(const uint8_t *data, size_t length)
+{
+    const uint8_t *chunk = data;
+    size_t chunk_length = length;
+
+#ifdef HAVE_ZSTD
+    if (__aardwolf_zstd != NULL && length > 0) {
+        size_t bound = ZSTD_compressBound(length);
+
+        if (bound > __aardwolf_compressed_capacity) {
+            uint8_t *compressed = (uint8_t *)realloc(__aardwolf_compressed, bound);
+
+            if (compressed == NULL) {
+                fprintf(stderr, "Aardwolf error: cannot allocate compression buffer.\n");
+                return -1;
+            }
+
+            __aardwolf_compressed = compressed;
+            __aardwolf_compressed_capacity = bound;
+        }
+
+        size_t size = ZSTD_compressCCtx(__aardwolf_zstd, __aardwolf_compressed, bound, data, length, ZSTD_LEVEL);
+
+        if (ZSTD_isError(size)) {
+            fprintf(stderr, "Aardwolf error: cannot compress trace data.\n");
+            return -1;
+        }
+
+        data = __aardwolf_compressed;
+        length = size;
+    }
+#endif
+
+    struct aardwolf_counters *counters = __aardwolf_get_counters();
+    if (counters != NULL) {
+        counters->written += length;
+    }
+
+    size_t stored = length;
+    off_t offset = __aardwolf_index_file >= 0 ? __aardwolf_lock_trace(__aardwolf_file) : -1;
+
+    while (length > 0) {
+        ssize_t written = write(__aardwolf_file, data, length);
+
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            fprintf(stderr, "Aardwolf error: cannot write trace data.\n");
+            offset = -1;
+            break;
+        }
+
+        data += written;
+        length -= (size_t)written;
+    }
+
+    if (__aardwolf_index_file >= 0) {
+        __aardwolf_unlock_trace(__aardwolf_file);
+    }
+
+    // Chunks are indexed by the offset of their (compressed) data.
+    if (offset >= 0 && chunk_length > CHUNK_HEADER_SIZE && chunk[0] == TOKEN_CHUNK) {
+        __aardwolf_index_chunk(chunk, chunk_length, (uint64_t)offset, (uint32_t)stored);
+    }
+
+    return offset;
+}
+
+#ifdef ASYNC
+
+// Full buffers are handed over to the background writer thread through a ring
+// of slots. Their data are swapped with the slot data, which is a spare block
+// left by the previous write from the slot, so the blocks are recycled.
+//
+// The producers are serialized by __aardwolf_lock, which is held during every
+// flush anyway. The ring itself is synchronized only by the semaphores, the
+// writer never takes the lock.
+struct __aardwolf_slot {
+    uint8_t *data;
+    size_t length;
+};
+
+static struct __aardwolf_slot __aardwolf_queue[QUEUE_SIZE];
+static size_t __aardwolf_queue_head = 0;
+static size_t __aardwolf_queue_tail = 0;
+static sem_t __aardwolf_queue_items;
+static sem_t __aardwolf_queue_slots;
+
+static inline void __aardwolf_sem_wait(sem_t *sem)
+{
+    while (sem_wait(sem) != 0 && errno == EINTR) {
+    }
+}
+
+void * __aardwolf_writer(void *arg)
+{
+    (void)arg;
+
+    for (;;) {
+        __aardwolf_sem_wait(&__aardwolf_queue_items);
+
+        struct __aardwolf_slot *slot = &__aardwolf_queue[__aardwolf_queue_head % QUEUE_SIZE];
+        __aardwolf_write_all(slot->data, slot->length);
+        __aardwolf_queue_head++;
+
+        sem_post(&__aardwolf_queue_slots);
+    }
+
+    return NULL;
+}
+
+// Signals are delivered to the threads of the program, not to the writer.
+void __aardwolf_start_writer(void)
+{
+    sem_init(&__aardwolf_queue_items, 0, 0);
+    sem_init(&__aardwolf_queue_slots, 0, QUEUE_SIZE);
+
+    sigset_t all, previous;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &previous);
+
+    pthread_t writer;
+    if (pthread_create(&writer, NULL, __aardwolf_writer, NULL) != 0) {
+        fprintf(stderr, "Aardwolf error: cannot start trace writer.\n");
+        exit(1);
+    }
+
+    pthread_detach(writer);
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+}
+
+// Must be called with __aardwolf_lock held. Blocks only if the queue is full.
+void __aardwolf_enqueue_locked(struct __aardwolf_buffer *buffer)
+{
+    __aardwolf_sem_wait(&__aardwolf_queue_slots);
+
+    struct __aardwolf_slot *slot = &__aardwolf_queue[__aardwolf_queue_tail % QUEUE_SIZE];
+    uint8_t *spare = slot->data;
+
+    if (spare == NULL) {
+        spare = (uint8_t *)malloc(__aardwolf_buffer_size);
+
+        if (spare == NULL) {
+            fprintf(stderr, "Aardwolf error: cannot allocate trace buffer.\n");
+            exit(1);
+        }
+    }
+
+    slot->data = buffer->data;
+    slot->length = __aardwolf_length(buffer);
+    __aardwolf_queue_tail++;
+
+    // The cursor still points to the old data, the owner updates the end after
+    // the buffer is reset.
+    buffer->data = spare;
+    __aardwolf_invalidate_end(buffer);
+
+    sem_post(&__aardwolf_queue_items);
+}
+
+// Waits until all queued buffers are written, so the data written directly
+// are not reordered with them. Must be called with __aardwolf_lock held.
+void __aardwolf_drain_locked(void)
+{
+    for (int i = 0; i < QUEUE_SIZE; i++) {
+        __aardwolf_sem_wait(&__aardwolf_queue_slots);
+    }
+
+    for (int i = 0; i < QUEUE_SIZE; i++) {
+        sem_post(&__aardwolf_queue_slots);
+    }
+}
+
+#else
+
+static inline void __aardwolf_drain_locked(void)
+{
+}
+
+#endif // ASYNC
+
+void __aardwolf_fill_chunk_header(uint8_t *header, uint64_t thread_id, uint64_t epoch, uint32_t size)
+{
+    header += aardwolf_encode_u8(header, TOKEN_CHUNK);
+    header += aardwolf_encode_u64(header, thread_id);
+    header += aardwolf_encode_u64(header, epoch);
+    aardwolf_encode_u32(header, size);
+}
+
+void __aardwolf_reset_buffer(struct __aardwolf_buffer *buffer)
+{
+    buffer->cursor->pos = buffer->data + buffer->start;
+    buffer->n_files = 0;
+    buffer->current_file = FILE_TABLE_SIZE;
+    buffer->last_stmt = 0;
+    memset(buffer->strings, 0, sizeof(buffer->strings));
+}
+
+static inline int __aardwolf_is_empty(const struct __aardwolf_buffer *buffer)
+{
+    return __aardwolf_length(buffer) == buffer->start && buffer->previous_length == 0 && !buffer->dropped;
+}
+
+#ifdef HAVE_ZSTD
+// Size of a zstd frame of raw blocks containing given number of bytes.
+static inline size_t __aardwolf_raw_frame_size(size_t length)
+{
+    size_t n_blocks = length == 0 ? 1 : (length + RAW_BLOCK_SIZE - 1) / RAW_BLOCK_SIZE;
+    return 6 + 3 * n_blocks + length;
+}
+
+// Wraps the data into a zstd frame of raw (uncompressed) blocks, which needs
+// neither the compressor nor an allocation. Returns the size of the frame.
+size_t __aardwolf_fill_raw_frame(uint8_t *frame, const uint8_t *data, size_t length)
+{
+    // Magic number, frame header descriptor (no content size, no checksum)
+    // and window descriptor (128 KiB).
+    static const uint8_t header[6] = {0x28, 0xb5, 0x2f, 0xfd, 0x00, 0x38};
+    size_t size = sizeof(header);
+
+    memcpy(frame, header, sizeof(header));
+
+    do {
+        size_t block = length < RAW_BLOCK_SIZE ? length : RAW_BLOCK_SIZE;
+        // Last block flag, raw block type (zero) and block size.
+        uint32_t block_header = (uint32_t)(block << 3) | (block == length);
+
+        frame[size++] = (uint8_t)block_header;
+        frame[size++] = (uint8_t)(block_header >> 8);
+        frame[size++] = (uint8_t)(block_header >> 16);
+
+        memcpy(frame + size, data, block);
+        size += block;
+        data += block;
+        length -= block;
+    } while (length > 0);
+
+    return size;
+}
+#endif
+
+// Used by the crash handler instead of __aardwolf_write_all, so it only calls
+// write(2). The data are not counted nor indexed.
+void __aardwolf_write_crashed(const uint8_t *data, size_t length)
+{
+#ifdef HAVE_ZSTD
+    if (__aardwolf_zstd != NULL) {
+        if (__aardwolf_raw_frame == NULL || __aardwolf_raw_frame_size(length) > __aardwolf_raw_frame_capacity) {
+            return;
+        }
+
+        length = __aardwolf_fill_raw_frame(__aardwolf_raw_frame, data, length);
+        data = __aardwolf_raw_frame;
+    }
+#endif
+
+    while (length > 0) {
+        ssize_t written = write(__aardwolf_file, data, length);
+
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return;
+        }
+
+        data += written;
+        length -= (size_t)written;
+    }
+}
+
+// Writes the data of given length with a reserved space for the chunk header
+// at the beginning. Must be called with __aardwolf_lock held.
+void __aardwolf_write_chunk_locked(const struct __aardwolf_buffer *buffer, uint8_t *data, size_t length)
+{
+    if (__aardwolf_chunk_header_size > 0) {
+        __aardwolf_fill_chunk_header(data, buffer->thread_id, buffer->epoch, (uint32_t)(length - buffer->start));
+    }
+
+    if (__aardwolf_crashed) {
+        __aardwolf_write_crashed(data, length);
+        return;
+    }
+
+    __aardwolf_write_all(data, length);
+}
+
+void __aardwolf_cover(struct __aardwolf_covered *covered, uint8_t token, file_ref_t file_id, statement_ref_t stmt_id)
+{
+    if (2 * (covered->count + 1) > covered->capacity) {
+        size_t capacity = covered->capacity == 0 ? MIN_COVERED_CAPACITY : 2 * covered->capacity;
+        struct __aardwolf_covered_entry *entries =
+            (struct __aardwolf_covered_entry *)calloc(capacity, sizeof(struct __aardwolf_covered_entry));
+
+        if (entries == NULL) {
+            fprintf(stderr, "Aardwolf error: cannot allocate coverage.\n");
+            return;
+        }
+
+        struct __aardwolf_covered grown = {entries, capacity, 0};
+
+        for (size_t i = 0; i < covered->capacity; i++) {
+            if (covered->entries[i].token != 0) {
+                __aardwolf_cover(&grown, covered->entries[i].token, covered->entries[i].file_id,
+                                 covered->entries[i].stmt_id);
+            }
+        }
+
+        free(covered->entries);
+        *covered = grown;
+    }
+
+    size_t mask = covered->capacity - 1;
+    size_t index = (size_t)((file_id * 0x9e3779b97f4a7c15ull) ^ (stmt_id * 0xc2b2ae3d27d4eb4full) ^ token) & mask;
+
+    while (covered->entries[index].token != 0) {
+        struct __aardwolf_covered_entry *entry = &covered->entries[index];
+
+        if (entry->token == token && entry->file_id == file_id && entry->stmt_id == stmt_id) {
+            return;
+        }
+
+        index = (index + 1) & mask;
+    }
+
+    covered->entries[index].file_id = file_id;
+    covered->entries[index].stmt_id = stmt_id;
+    covered->entries[index].token = token;
+    covered->count++;
+}
+
+static inline const uint8_t * __aardwolf_skip_string(const uint8_t *data, const uint8_t *end)
+{
+    const uint8_t *terminator = (const uint8_t *)memchr(data, 0, (size_t)(end - data));
+    return terminator == NULL ? end : terminator + 1;
+}
+
+static inline void __aardwolf_scanned(struct __aardwolf_covered *covered, struct __aardwolf_index_entry *entry,
+                                      uint8_t token, file_ref_t file_id, statement_ref_t stmt_id)
+{
+    if (covered != NULL) {
+        __aardwolf_cover(covered, token, file_id, stmt_id);
+    }
+
+    if (entry != NULL) {
+        aardwolf_filter_add(entry->files, file_id);
+    }
+}
+
+static inline void __aardwolf_scanned_marker(struct __aardwolf_index_entry *entry, const uint8_t *name, size_t size)
+{
+    if (entry != NULL) {
+        __aardwolf_index_marker(__aardwolf_index_file, INDEX_TOKEN_CHUNK_MARKER, entry->offset, name, size);
+    }
+}
+
+// Collects the statements and blocks of the events encoded by this runtime
+// into the covered set, or their files and the test case markers into the
+// index entry (either may be NULL). The compact encoding state starts from
+// scratch, like in every chunk. Returns zero if the events could not be
+// scanned until the end.
+int __aardwolf_scan_events(struct __aardwolf_covered *covered, struct __aardwolf_index_entry *entry,
+                           const uint8_t *data, size_t length)
+{
+    const uint8_t *end = data + length;
+
+    file_ref_t files[FILE_TABLE_SIZE];
+    uint64_t current_file = FILE_TABLE_SIZE;
+    statement_ref_t last_stmt = 0;
+
+    while (data < end) {
+        uint8_t token = *data++;
+        uint64_t pair[2];
+        uint64_t value;
+
+        switch (token) {
+            case TOKEN_STATEMENT:
+            case TOKEN_BLOCK:
+                if ((size_t)(end - data) < sizeof(pair)) {
+                    return 0;
+                }
+
+                memcpy(pair, data, sizeof(pair));
+                __aardwolf_scanned(covered, entry, token, pair[0], pair[1]);
+                data += sizeof(pair);
+                break;
+            case TOKEN_FILE_INDEX:
+                data = aardwolf_decode_varint(data, end, &current_file);
+
+                if (current_file >= FILE_TABLE_SIZE || (size_t)(end - data) < sizeof(file_ref_t)) {
+                    return 0;
+                }
+
+                memcpy(&files[current_file], data, sizeof(file_ref_t));
+                data += sizeof(file_ref_t);
+                break;
+            case TOKEN_FILE_SWITCH:
+                data = aardwolf_decode_varint(data, end, &current_file);
+                break;
+            case TOKEN_STATEMENT_DELTA:
+                data = aardwolf_decode_varint(data, end, &value);
+
+                if (current_file >= FILE_TABLE_SIZE) {
+                    return 0;
+                }
+
+                last_stmt += (statement_ref_t)aardwolf_zigzag_decode(value);
+                __aardwolf_scanned(covered, entry, TOKEN_STATEMENT, files[current_file], last_stmt);
+                break;
+            case TOKEN_EXTERNAL: {
+                const uint8_t *name = data;
+                data = __aardwolf_skip_string(data, end);
+
+                if (data > name && data[-1] == 0) {
+                    __aardwolf_scanned_marker(entry, name, (size_t)(data - name));
+                }
+                break;
+            }
+            case TOKEN_DATA_NAMED:
+                data = __aardwolf_skip_string(data, end);
+                break;
+            case TOKEN_TEST_STATUS:
+                data = data < end ? __aardwolf_skip_string(data + 1, end) : end;
+                break;
+            case TOKEN_STRING: {
+                data = aardwolf_decode_varint(data, end, &value);
+                const uint8_t *string = data;
+                data = __aardwolf_skip_string(data, end);
+
+                if (entry != NULL && value < STRING_TABLE_SIZE && data > string && data[-1] == 0) {
+                    entry->strings[value] = string;
+                }
+                break;
+            }
+            case TOKEN_EXTERNAL_REF:
+                data = aardwolf_decode_varint(data, end, &value);
+
+                if (entry != NULL && value < STRING_TABLE_SIZE && entry->strings[value] != NULL) {
+                    const uint8_t *name = entry->strings[value];
+                    __aardwolf_scanned_marker(entry, name, strlen((const char *)name) + 1);
+                }
+                break;
+            case TOKEN_DATA_NAMED_REF:
+                data = aardwolf_decode_varint(data, end, &value);
+                break;
+            case TOKEN_TEST_STATUS_REF:
+                data = data < end ? aardwolf_decode_varint(data + 1, end, &value) : end;
+                break;
+            case TOKEN_GAP:
+            case TOKEN_DATA_UNSUPPORTED:
+            case TOKEN_DATA_NULL:
+                break;
+            case TOKEN_DATA_I8:
+            case TOKEN_DATA_U8:
+            case TOKEN_DATA_BOOL:
+                data += 1;
+                break;
+            case TOKEN_DATA_I16:
+            case TOKEN_DATA_U16:
+                data += 2;
+                break;
+            case TOKEN_DATA_I32:
+            case TOKEN_DATA_U32:
+            case TOKEN_DATA_F32:
+                data += 4;
+                break;
+            case TOKEN_DATA_I64:
+            case TOKEN_DATA_U64:
+            case TOKEN_DATA_F64:
+                data += 8;
+                break;
+            case TOKEN_DATA_BLOB: {
+                uint32_t size;
+
+                if ((size_t)(end - data) < sizeof(uint64_t) + sizeof(size)) {
+                    return 0;
+                }
+
+                memcpy(&size, data + sizeof(uint64_t), sizeof(size));
+                data += sizeof(uint64_t) + sizeof(size);
+                data += (size_t)(end - data) < size ? (size_t)(end - data) : size;
+                break;
+            }
+            default:
+                // Not produced by this runtime.
+                return 0;
+        }
+    }
+
+    return 1;
+}
+
+// Records the chunk written at given offset (with given size in the file)
+// together with the filter of the files it touches, preceded by the test case
+// markers in it.
+void __aardwolf_index_chunk(const uint8_t *chunk, size_t length, uint64_t offset, uint32_t size)
+{
+    struct __aardwolf_index_entry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.offset = offset;
+
+    if (!__aardwolf_scan_events(NULL, &entry, chunk + CHUNK_HEADER_SIZE, length - CHUNK_HEADER_SIZE)) {
+        // Events not produced by this runtime may touch any file.
+        memset(entry.files, 0xff, sizeof(entry.files));
+    }
+
+    // INDEX_TOKEN_CHUNK ; 8B offset ; 4B size ; 8B thread id ; 8B epoch ; filter
+    uint8_t record[1 + sizeof(uint64_t) + sizeof(uint32_t) + 2 * sizeof(uint64_t) + sizeof(entry.files)];
+    size_t record_length = aardwolf_encode_u8(record, INDEX_TOKEN_CHUNK);
+    record_length += aardwolf_encode_u64(record + record_length, offset);
+    record_length += aardwolf_encode_u32(record + record_length, size);
+
+    // Thread id and epoch are copied from the chunk header.
+    memcpy(record + record_length, chunk + 1, 2 * sizeof(uint64_t));
+    record_length += 2 * sizeof(uint64_t);
+
+    for (int i = 0; i < INDEX_FILTER_WORDS; i++) {
+        record_length += aardwolf_encode_u64(record + record_length, entry.files[i]);
+    }
+
+    struct iovec parts[1] = {{record, record_length}};
+    __aardwolf_write_index(__aardwolf_index_file, parts, 1);
+}
+
+// Writes the collected statements, each followed by a gap marker since their
+// order is not known. Must be called with __aardwolf_lock held.
+void __aardwolf_write_covered_locked(struct __aardwolf_buffer *buffer)
+{
+    // Does not allocate, so the crash handler can use it.
+    uint8_t chunk[COVERED_CHUNK_SIZE];
+    size_t entry_size = 1 + 2 * sizeof(uint64_t) + 1;
+    size_t length = buffer->start;
+
+    for (size_t i = 0; i < buffer->covered.capacity; i++) {
+        struct __aardwolf_covered_entry *entry = &buffer->covered.entries[i];
+
+        if (entry->token == 0) {
+            continue;
+        }
+
+        if (length + entry_size > sizeof(chunk)) {
+            __aardwolf_write_chunk_locked(buffer, chunk, length);
+            length = buffer->start;
+        }
+
+        length += aardwolf_encode_u8(chunk + length, entry->token);
+        length += aardwolf_encode_u64(chunk + length, entry->file_id);
+        length += aardwolf_encode_u64(chunk + length, entry->stmt_id);
+        length += aardwolf_encode_u8(chunk + length, TOKEN_GAP);
+    }
+
+    if (buffer->covered.count == 0) {
+        // At least the events are missing.
+        chunk[length++] = TOKEN_GAP;
+    }
+
+    __aardwolf_write_chunk_locked(buffer, chunk, length);
+
+    if (buffer->covered.entries != NULL) {
+        memset(buffer->covered.entries, 0, buffer->covered.capacity * sizeof(struct __aardwolf_covered_entry));
+    }
+
+    buffer->covered.count = 0;
+}
+
+// Flight recorder mode. The ring of a passing test case is reduced to its
+// statements, otherwise the evicted statements are followed by the events in
+// the ring. Must be called with __aardwolf_lock held.
+void __aardwolf_dump_locked(struct __aardwolf_buffer *buffer)
+{
+    if (buffer->epoch + 1 == __atomic_load_n(&__aardwolf_passed_epoch, __ATOMIC_SEQ_CST)) {
+        if (buffer->previous_length > buffer->start) {
+            __aardwolf_scan_events(&buffer->covered, NULL, buffer->previous + buffer->start,
+                                   buffer->previous_length - buffer->start);
+        }
+
+        __aardwolf_scan_events(&buffer->covered, NULL, buffer->data + buffer->start,
+                               __aardwolf_length(buffer) - buffer->start);
+        __aardwolf_write_covered_locked(buffer);
+    } else {
+        if (buffer->dropped) {
+            __aardwolf_write_covered_locked(buffer);
+        }
+
+        if (buffer->previous_length > buffer->start) {
+            __aardwolf_write_chunk_locked(buffer, buffer->previous, buffer->previous_length);
+        }
+
+        if (__aardwolf_length(buffer) > buffer->start) {
+            __aardwolf_write_chunk_locked(buffer, buffer->data, __aardwolf_length(buffer));
+        }
+    }
+
+    buffer->previous_length = 0;
+    buffer->dropped = 0;
+    __aardwolf_reset_buffer(buffer);
+}
+
+// Writes (or hands over) the events of the buffer as a single chunk. Must be
+// called with __aardwolf_lock held.
+void __aardwolf_write_buffer_locked(struct __aardwolf_buffer *buffer)
+{
+    if (__aardwolf_chunk_header_size > 0) {
+        __aardwolf_fill_chunk_header(buffer->data, buffer->thread_id, buffer->epoch,
+                                     (uint32_t)(__aardwolf_length(buffer) - buffer->start));
+    }
+
+#ifdef ASYNC
+    __aardwolf_enqueue_locked(buffer);
+#else
+    __aardwolf_write_all(buffer->data, __aardwolf_length(buffer));
+#endif
+    __aardwolf_reset_buffer(buffer);
+}
+
+// Must be called with __aardwolf_lock held.
+void __aardwolf_flush_locked(struct __aardwolf_buffer *buffer)
+{
+    if (__aardwolf_is_empty(buffer)) {
+        return;
+    }
+
+    uint64_t start = __aardwolf_counters_enabled() ? __aardwolf_now_ns() : 0;
+
+    if (__aardwolf_recorder) {
+        __aardwolf_dump_locked(buffer);
+    } else {
+        __aardwolf_write_buffer_locked(buffer);
+    }
+
+    if (start != 0) {
+        __aardwolf_count_flush(start);
+    }
+}
+
+void __aardwolf_flush(struct __aardwolf_buffer *buffer)
+{
+    if (__aardwolf_is_empty(buffer)) {
+        return;
+    }
+
+    pthread_mutex_lock(&__aardwolf_lock);
+    __aardwolf_flush_locked(buffer);
+    pthread_mutex_unlock(&__aardwolf_lock);
+}
+
+// Flight recorder mode. The full buffer becomes the previous contents of the
+// ring and the older contents are evicted, only their statements are kept.
+// Must be called by the owning thread.
+void __aardwolf_rotate(struct __aardwolf_buffer *buffer)
+{
+    if (__aardwolf_length(buffer) == buffer->start) {
+        return;
+    }
+
+    pthread_mutex_lock(&__aardwolf_lock);
+
+    if (buffer->previous_length > buffer->start) {
+        __aardwolf_scan_events(&buffer->covered, NULL, buffer->previous + buffer->start,
+                               buffer->previous_length - buffer->start);
+        buffer->dropped = 1;
+    }
+
+    uint8_t *spare = buffer->previous;
+
+    if (spare == NULL) {
+        spare = (uint8_t *)malloc(__aardwolf_buffer_size);
+
+        if (spare == NULL) {
+            fprintf(stderr, "Aardwolf error: cannot allocate trace buffer.\n");
+            exit(1);
+        }
+    }
+
+    buffer->previous = buffer->data;
+    buffer->previous_length = __aardwolf_length(buffer);
+    buffer->data = spare;
+    __aardwolf_reset_buffer(buffer);
+
+    pthread_mutex_unlock(&__aardwolf_lock);
+    __aardwolf_update_end(buffer);
+}
+
+// Flight recorder mode. Writes the rings of all threads when the process
+// crashes and raises the signal again with the default action. Only
+// async-signal-safe functions are called. The lock is not taken, since the
+// crashing thread might hold it, so the other threads are first stopped from
+// appending to their buffers. The rings are then written with write(2) as they
+// are, without counting, indexing and compressing them (with zstd, they are
+// wrapped in frames of raw blocks in the preallocated buffer).
+void __aardwolf_crash(int signal_number)
+{
+    __aardwolf_crashed = 1;
+
+    // The test case in progress did not pass.
+    __atomic_store_n(&__aardwolf_passed_epoch, 0, __ATOMIC_SEQ_CST);
+
+    struct __aardwolf_buffer *buffers = __atomic_load_n(&__aardwolf_buffers, __ATOMIC_ACQUIRE);
+
+    for (struct __aardwolf_buffer *buffer = buffers; buffer != NULL; buffer = buffer->next) {
+        buffer->capacity = 0;
+        __aardwolf_invalidate_end(buffer);
+    }
+
+    // The set of evicted statements is not grown for a test case which did not
+    // pass, so dumping the rings does not allocate.
+    for (struct __aardwolf_buffer *buffer = buffers; buffer != NULL; buffer = buffer->next) {
+        if (!__aardwolf_is_empty(buffer)) {
+            __aardwolf_dump_locked(buffer);
+        }
+    }
+
+    signal(signal_number, SIG_DFL);
+    raise(signal_number);
+}
+
+// Handler registered by atexit. The events traced in exit handlers that run
+// after this one are written through, therefore the capacity of all buffers is
+// set to zero.
+void __aardwolf_exit(void)
+{
+    __aardwolf_write_coverage();
+
+    pthread_mutex_lock(&__aardwolf_lock);
+
+    for (struct __aardwolf_buffer *buffer = __aardwolf_buffers; buffer != NULL; buffer = buffer->next) {
+        __aardwolf_flush_locked(buffer);
+        buffer->capacity = 0;
+        __aardwolf_invalidate_end(buffer);
+    }
+
+    __aardwolf_drain_locked();
+    pthread_mutex_unlock(&__aardwolf_lock);
+}
+
+// Must be called with __aardwolf_lock held.
+void __aardwolf_unlink_locked(struct __aardwolf_buffer *buffer)
+{
+    struct __aardwolf_buffer **link = &__aardwolf_buffers;
+
+    while (*link != NULL && *link != buffer) {
+        link = &(*link)->next;
+    }
+
+    if (*link != NULL) {
+        *link = buffer->next;
+    }
+}
+
+void __aardwolf_free_buffer(struct __aardwolf_buffer *buffer)
+{
+    free(buffer->data);
+    free(buffer->previous);
+    free(buffer->covered.entries);
+    free(buffer);
+}
+
+// Thread-specific data destructor. Writes out the events of a terminating
+// thread.
+void __aardwolf_thread_exit(void *data)
+{
+    struct __aardwolf_buffer *buffer = (struct __aardwolf_buffer *)data;
+
+    pthread_mutex_lock(&__aardwolf_lock);
+    __aardwolf_flush_locked(buffer);
+    __aardwolf_unlink_locked(buffer);
+    pthread_mutex_unlock(&__aardwolf_lock);
+
+    __aardwolf_local = NULL;
+    aardwolf_cursor.pos = NULL;
+    aardwolf_cursor.end = NULL;
+    __aardwolf_free_buffer(buffer);
+}
+
+void __aardwolf_write_file_header(void)
+{
+    uint8_t header[HEADER_SIZE] = {'A', 'A', 'R', 'D', '/', 'D', __aardwolf_format + ASCII_ZERO};
+    __aardwolf_write_all(header, HEADER_SIZE);
+}
+
+void __aardwolf_open_trace(void)
+{
+    char * filepath = __aardwolf_get_filepath();
+
+#ifndef NO_HEADER
+    int append = __aardwolf_continue_trace(filepath);
+    __aardwolf_file = open(filepath, O_WRONLY | O_CREAT | (append ? 0 : O_TRUNC) | O_APPEND, 0644);
+#else
+    __aardwolf_file = open(filepath, O_WRONLY | O_CREAT | O_APPEND, 0644);
+#endif
+
+    if (__aardwolf_file < 0) {
+        fprintf(stderr, "Aardwolf error: cannot open %s.\n", filepath);
+        free(filepath);
+        exit(1);
+    }
+
+    if (__aardwolf_indexed) {
+        if (__aardwolf_index_file >= 0) {
+            close(__aardwolf_index_file);
+        }
+
+#ifndef NO_HEADER
+        __aardwolf_index_file = __aardwolf_open_index(filepath, append ? 0 : O_TRUNC);
+#else
+        __aardwolf_index_file = __aardwolf_open_index(filepath, 0);
+#endif
+    }
+
+    free(filepath);
+
+#ifndef NO_HEADER
+    if (append) {
+        return;
+    }
+
+    __aardwolf_write_file_header();
+
+    if (__aardwolf_index_file >= 0) {
+        uint8_t header[HEADER_SIZE] = {'A', 'A', 'R', 'D', '/', 'I', INDEX_FORMAT_VERSION + ASCII_ZERO};
+        struct iovec parts[1] = {{header, HEADER_SIZE}};
+        __aardwolf_write_index(__aardwolf_index_file, parts, 1);
+    }
+#endif
+}
+
+// The events of the forking thread and the coverage must be written before the
+// fork, otherwise they would be duplicated by the child.
+void __aardwolf_fork_prepare(void)
+{
+    __aardwolf_write_coverage();
+
+    if (__aardwolf_local != NULL) {
+        __aardwolf_flush(__aardwolf_local);
+    }
+
+    pthread_mutex_lock(&__aardwolf_lock);
+    __aardwolf_drain_locked();
+}
+
+void __aardwolf_fork_parent(void)
+{
+    pthread_mutex_unlock(&__aardwolf_lock);
+}
+
+// Only the forking thread survives in the child. Buffers of the other threads
+// are copies of events which belong to the parent, so they are discarded. The
+// surviving thread gets a new id since it is in a different process now.
+void __aardwolf_fork_child(void)
+{
+    struct __aardwolf_buffer *buffer = __aardwolf_buffers;
+
+    while (buffer != NULL) {
+        struct __aardwolf_buffer *next = buffer->next;
+
+        if (buffer != __aardwolf_local) {
+            __aardwolf_unlink_locked(buffer);
+            __aardwolf_free_buffer(buffer);
+        }
+
+        buffer = next;
+    }
+
+    __aardwolf_next_thread_id = 1;
+    if (__aardwolf_local != NULL) {
+        __aardwolf_local->thread_id = __aardwolf_make_thread_id();
+    }
+
+#ifndef NO_HEADER
+    // The child writes its own trace file, which starts in the test case in
+    // which it was forked (the marker is outside of any chunk).
+    close(__aardwolf_file);
+    __aardwolf_open_trace();
+
+    if (__aardwolf_current_test != NULL) {
+        uint8_t token = TOKEN_EXTERNAL;
+        size_t size = strlen(__aardwolf_current_test) + 1;
+        off_t offset = __aardwolf_write_all(&token, 1);
+        __aardwolf_write_all((const uint8_t *)__aardwolf_current_test, size);
+
+        if (offset >= 0) {
+            __aardwolf_index_marker(__aardwolf_index_file, INDEX_TOKEN_MARKER, (uint64_t)offset,
+                                    __aardwolf_current_test, size);
+        }
+    }
+#endif
+
+#ifdef ASYNC
+    // The writer thread does not survive the fork, the queue has been drained
+    // before it.
+    __aardwolf_start_writer();
+#endif
+
+    pthread_mutex_unlock(&__aardwolf_lock);
+}
+
+void __aardwolf_init(void)
+{
+    char *format = getenv("AARDWOLF_TRACE_FORMAT");
+    if (format != NULL && (strcmp(format, "2") == 0 || strcmp(format, "3") == 0)) {
+        __aardwolf_format = format[0] - ASCII_ZERO;
+        __aardwolf_chunk_header_size = CHUNK_HEADER_SIZE;
+        __aardwolf_indexed = (uint8_t)__aardwolf_index_enabled();
+    }
+
+    char *buffer_size = getenv("AARDWOLF_BUFFER_SIZE");
+    if (buffer_size != NULL && strtoul(buffer_size, NULL, 10) > 0) {
+        __aardwolf_buffer_size = strtoul(buffer_size, NULL, 10);
+    }
+
+    if (__aardwolf_buffer_size < MIN_BUFFER_SIZE) {
+        __aardwolf_buffer_size = MIN_BUFFER_SIZE;
+    }
+
+    char *recorder = getenv("AARDWOLF_FLIGHT_RECORDER");
+    if (recorder != NULL && strcmp(recorder, "1") == 0) {
+        __aardwolf_recorder = 1;
+
+        int signals[] = {SIGSEGV, SIGABRT, SIGBUS, SIGFPE, SIGILL};
+        for (size_t i = 0; i < sizeof(signals) / sizeof(signals[0]); i++) {
+            signal(signals[i], __aardwolf_crash);
+        }
+    }
+
+#ifdef HAVE_ZSTD
+    char *compression = getenv("AARDWOLF_TRACE_COMPRESSION");
+    if (compression != NULL && strcmp(compression, "zstd") == 0) {
+        __aardwolf_zstd = ZSTD_createCCtx();
+    }
+#endif
+
+    // The buffer must always have a space for the chunk header.
+    __aardwolf_buffer_size += __aardwolf_chunk_header_size;
+
+#ifdef HAVE_ZSTD
+    if (__aardwolf_recorder && __aardwolf_zstd != NULL) {
+        size_t largest = __aardwolf_buffer_size > COVERED_CHUNK_SIZE ? __aardwolf_buffer_size : COVERED_CHUNK_SIZE;
+        __aardwolf_raw_frame_capacity = __aardwolf_raw_frame_size(largest);
+        __aardwolf_raw_frame = (uint8_t *)malloc(__aardwolf_raw_frame_capacity);
+    }
+#endif
+
+    // The counters are dumped after the buffers are flushed at the exit.
+    __aardwolf_counters_enabled();
+
+    __aardwolf_open_trace();
+
+#ifdef ASYNC
+    __aardwolf_start_writer();
+#endif
+
+    pthread_key_create(&__aardwolf_key, __aardwolf_thread_exit);
+    pthread_atfork(__aardwolf_fork_prepare, __aardwolf_fork_parent, __aardwolf_fork_child);
+    atexit(__aardwolf_exit);
+}
+
+struct __aardwolf_buffer * __aardwolf_get_buffer(void)
+{
+    if (__aardwolf_local == NULL) {
+        pthread_once(&__aardwolf_once, __aardwolf_init);
+
+        struct __aardwolf_buffer *buffer = (struct __aardwolf_buffer *)malloc(sizeof(struct __aardwolf_buffer));
+        buffer->data = (uint8_t *)malloc(__aardwolf_buffer_size);
+        buffer->cursor = &aardwolf_cursor;
+        buffer->start = __aardwolf_chunk_header_size;
+        buffer->capacity = __aardwolf_buffer_size;
+        buffer->previous = NULL;
+        buffer->previous_length = 0;
+        buffer->covered.entries = NULL;
+        buffer->covered.capacity = 0;
+        buffer->covered.count = 0;
+        buffer->dropped = 0;
+        __aardwolf_reset_buffer(buffer);
+        buffer->epoch = __aardwolf_current_epoch();
+
+        if (buffer->data == NULL) {
+            fprintf(stderr, "Aardwolf error: cannot allocate trace buffer.\n");
+            exit(1);
+        }
+
+        pthread_mutex_lock(&__aardwolf_lock);
+        buffer->thread_id = __aardwolf_make_thread_id();
+        buffer->next = __aardwolf_buffers;
+        __aardwolf_buffers = buffer;
+        pthread_mutex_unlock(&__aardwolf_lock);
+
+        pthread_setspecific(__aardwolf_key, buffer);
+        __aardwolf_local = buffer;
+        __aardwolf_update_end(buffer);
+    }
+
+    return __aardwolf_local;
+}
+
+// Gets the buffer of the calling thread such that it belongs to the current
+// test case and has space for size bytes if possible.
+struct __aardwolf_buffer * __aardwolf_prepare_buffer(size_t size)
+{
+    struct __aardwolf_buffer *buffer = __aardwolf_get_buffer();
+    uint64_t epoch = __aardwolf_current_epoch();
+
+    if (buffer->epoch != epoch) {
+        // A new test case started, the events must go to a new chunk.
+        __aardwolf_flush(buffer);
+        buffer->epoch = epoch;
+        __aardwolf_update_end(buffer);
+    }
+
+    if (__aardwolf_length(buffer) + size > buffer->capacity) {
+        struct aardwolf_counters *counters = __aardwolf_get_counters();
+        if (counters != NULL) {
+            counters->stalls++;
+        }
+
+        if (__aardwolf_recorder) {
+            __aardwolf_rotate(buffer);
+        } else {
+            __aardwolf_flush(buffer);
+        }
+    }
 
-// Opened on the first API use. Closed after the process termination.
-static FILE * __aardwolf_fd = NULL;
+#ifdef ASYNC
+    // Flushing replaces the data of the buffer and invalidates its end.
+    __aardwolf_update_end(buffer);
+#endif
 
-void __write_header(FILE *fd)
+    return buffer;
+}
+
+// Writes a single event directly into the trace file as a chunk of given
+// buffer. Must be called with __aardwolf_lock held.
+void __aardwolf_write_through_locked(const struct __aardwolf_buffer *buffer, uint8_t token, const void *data,
+                                     size_t size)
 {
-    fputs("AARD/D", fd);
-    fputc(FILE_FORMAT_VERSION + ASCII_ZERO, fd);
+    __aardwolf_drain_locked();
+
+    if (__aardwolf_chunk_header_size > 0) {
+        uint8_t header[CHUNK_HEADER_SIZE];
+        __aardwolf_fill_chunk_header(header, buffer->thread_id, buffer->epoch, (uint32_t)(1 + size));
+
+        // Indexed chunks are written at once, so they can be scanned.
+        uint8_t *chunk = __aardwolf_index_file >= 0 ? (uint8_t *)malloc(CHUNK_HEADER_SIZE + 1 + size) : NULL;
+
+        if (chunk != NULL) {
+            memcpy(chunk, header, CHUNK_HEADER_SIZE);
+            chunk[CHUNK_HEADER_SIZE] = token;
+            memcpy(chunk + CHUNK_HEADER_SIZE + 1, data, size);
+            __aardwolf_write_all(chunk, CHUNK_HEADER_SIZE + 1 + size);
+            free(chunk);
+            return;
+        }
+
+        __aardwolf_write_all(header, CHUNK_HEADER_SIZE);
+    }
+
+    __aardwolf_write_all(&token, 1);
+    __aardwolf_write_all((const uint8_t *)data, size);
 }
 
-FILE * __aardwolf_get_fd(void)
+// Appends an event to the buffer of the calling thread. The event is never
+// split between two chunks.
+void __aardwolf_write_event(uint8_t token, const void *data, size_t size)
 {
-    if (__aardwolf_fd == NULL) {
-        char *dest_dir = getenv("AARDWOLF_DATA_DEST");
+    if (__aardwolf_muted) {
+        return;
+    }
 
-        char filename[] = "aard.trace";
-        char * filepath;
+    struct __aardwolf_buffer *buffer = __aardwolf_prepare_buffer(1 + size);
 
-        // NOTE: sizeof(filename) includes null terminator as well.
-        if (dest_dir == NULL) {
-            filepath = (char*)malloc(sizeof(filename));
-            strcpy(filepath, filename);
-        } else {
-            size_t destination_length = strlen(dest_dir) + 1;
+    if (__aardwolf_length(buffer) + 1 + size > buffer->capacity) {
+        // Does not fit even into an empty buffer (e.g., long strings or events
+        // traced after the exit handler).
+        pthread_mutex_lock(&__aardwolf_lock);
+        __aardwolf_write_through_locked(buffer, token, data, size);
+        pthread_mutex_unlock(&__aardwolf_lock);
+        return;
+    }
+
+    buffer->cursor->pos[0] = token;
+
+    if (size > 0) {
+        memcpy(buffer->cursor->pos + 1, data, size);
+    }
+
+    buffer->cursor->pos += 1 + size;
+}
+
+static inline void __aardwolf_emit_data(uint8_t token, const void* data, size_t type_size)
+{
+    struct aardwolf_cursor *cursor = &aardwolf_cursor;
+    uint8_t *end = __atomic_load_n(&cursor->end, __ATOMIC_RELAXED);
 
-            filepath = (char*)malloc(destination_length + sizeof(filename));
-            memset(filepath, 0, destination_length + sizeof(filename));
+    // Fast path: the buffer exists, belongs to the current test case and the
+    // event fits into it. This is what the inline instrumentation does.
+    if (end != NULL && cursor->pos + 1 + type_size <= end) {
+        cursor->pos[0] = token;
 
-            strcpy(filepath, dest_dir);
-            filepath[destination_length - 1] = '/';
-            strcpy(filepath + destination_length, filename);
+        if (type_size > 0) {
+            memcpy(cursor->pos + 1, data, type_size);
         }
 
-#ifndef NO_HEADER
-        __aardwolf_fd = fopen(filepath, "w");
-#else
-        __aardwolf_fd = fopen(filepath, "a");
-#endif
+        cursor->pos += 1 + type_size;
+    } else {
+        __aardwolf_write_event(token, data, type_size);
+    }
+}
 
-        if (__aardwolf_fd == NULL) {
-            fprintf(stderr, "Aardwolf error: cannot open %s.\n", filepath);
-            free(filepath);
-            exit(1);
+// Compact encoding (AARD/D3). The file identifiers are replaced by indices to
+// the file table of the chunk and statement identifiers are encoded as
+// zigzag-encoded differences from the previous statement.
+void __aardwolf_write_compact_statement(file_ref_t file_id, statement_ref_t stmt_id)
+{
+    if (__aardwolf_muted) {
+        return;
+    }
+
+    struct __aardwolf_buffer *buffer = __aardwolf_local;
+
+    if (buffer == NULL || buffer->epoch != __aardwolf_current_epoch()
+            || __aardwolf_length(buffer) + MAX_COMPACT_STATEMENT_SIZE > buffer->capacity) {
+        buffer = __aardwolf_prepare_buffer(MAX_COMPACT_STATEMENT_SIZE);
+
+        if (__aardwolf_length(buffer) + MAX_COMPACT_STATEMENT_SIZE > buffer->capacity) {
+            // Buffers are write-through after the exit handler.
+            uint64_t pair[2] = {file_id, stmt_id};
+            __aardwolf_write_event(TOKEN_STATEMENT, &pair, sizeof(pair));
+            return;
+        }
+    }
+
+    uint8_t *data = buffer->cursor->pos;
+    size_t size = 0;
+
+    if (buffer->current_file == FILE_TABLE_SIZE || buffer->files[buffer->current_file] != file_id) {
+        uint32_t index = 0;
+
+        while (index < buffer->n_files && buffer->files[index] != file_id) {
+            index++;
         }
 
-#ifndef NO_HEADER
-        __write_header(__aardwolf_fd);
-#endif
+        if (index < buffer->n_files) {
+            data[size++] = TOKEN_FILE_SWITCH;
+            size += aardwolf_encode_varint(data + size, index);
+        } else {
+            if (buffer->n_files < FILE_TABLE_SIZE) {
+                index = buffer->n_files++;
+            } else {
+                // The table is full, reuse the indices. Always different from
+                // the current one.
+                index = (buffer->current_file + 1) % FILE_TABLE_SIZE;
+            }
 
-        free(filepath);
+            buffer->files[index] = file_id;
+
+            data[size++] = TOKEN_FILE_INDEX;
+            size += aardwolf_encode_varint(data + size, index);
+            memcpy(data + size, &file_id, sizeof(file_ref_t));
+            size += sizeof(file_ref_t);
+        }
+
+        buffer->current_file = index;
     }
 
-    return __aardwolf_fd;
+    int64_t delta = (int64_t)(stmt_id - buffer->last_stmt);
+
+    data[size++] = TOKEN_STATEMENT_DELTA;
+    size += aardwolf_encode_varint(data + size, aardwolf_zigzag_encode(delta));
+
+    buffer->last_stmt = stmt_id;
+    buffer->cursor->pos += size;
+    __aardwolf_count_event(TOKEN_STATEMENT_DELTA, size);
+}
+
+static inline uint64_t __aardwolf_hash_string(const char *value, size_t *length)
+{
+    // FNV-1a, the length is computed on the way.
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t i = 0;
+
+    for (; value[i] != 0; i++) {
+        hash ^= (uint8_t)value[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    *length = i;
+
+    // Zero marks unused entries of the table.
+    return hash != 0 ? hash : 1;
+}
+
+// Compact encoding (AARD/D3). The first occurrence of a string in a chunk
+// defines it in the string table of the chunk, the event itself (token, given
+// prefix and the index) refers to the table. Returns zero if the event does
+// not fit into the buffer and must be written in the full form.
+int __aardwolf_write_interned(uint8_t token, const void *prefix, size_t prefix_size, const char *value)
+{
+    if (__aardwolf_muted) {
+        return 1;
+    }
+
+    size_t length;
+    uint64_t hash = __aardwolf_hash_string(value, &length);
+    uint32_t index = (uint32_t)(hash % STRING_TABLE_SIZE);
+
+    // The definition and the reference must be in the same chunk. The indices
+    // always fit into a single byte.
+    size_t max_size = 2 + length + 1 + 1 + prefix_size + 1;
+    struct __aardwolf_buffer *buffer = __aardwolf_prepare_buffer(max_size);
+
+    if (__aardwolf_length(buffer) + max_size > buffer->capacity) {
+        return 0;
+    }
+
+    uint8_t *data = buffer->cursor->pos;
+    size_t size = 0;
+
+    if (buffer->strings[index] != hash) {
+        buffer->strings[index] = hash;
+
+        data[size++] = TOKEN_STRING;
+        size += aardwolf_encode_varint(data + size, index);
+        memcpy(data + size, value, length + 1);
+        size += length + 1;
+    }
+
+    data[size++] = token;
+
+    if (prefix_size > 0) {
+        memcpy(data + size, prefix, prefix_size);
+        size += prefix_size;
+    }
+
+    size += aardwolf_encode_varint(data + size, index);
+
+    buffer->cursor->pos += size;
+    __aardwolf_count_event(token, size);
+    return 1;
+}
+
+// Starts a new test case epoch.
+void __aardwolf_next_epoch(void)
+{
+    __aardwolf_get_buffer();
+    __atomic_fetch_add(&__aardwolf_epoch, 1, __ATOMIC_SEQ_CST);
+
+    // Other threads must notice the new test case even if they append the
+    // events directly.
+    pthread_mutex_lock(&__aardwolf_lock);
+    for (struct __aardwolf_buffer *buffer = __aardwolf_buffers; buffer != NULL; buffer = buffer->next) {
+        __aardwolf_invalidate_end(buffer);
+    }
+    pthread_mutex_unlock(&__aardwolf_lock);
 }
 
+#endif // BUFFERED
+
 void __aardwolf_write_data(uint8_t token, const void* data, size_t type_size)
 {
 #ifndef NO_DATA
-    FILE *fd = __aardwolf_get_fd();
-    fputc(token, fd);
-    fwrite(data, type_size, 1, fd);
-#ifdef NO_HEADER
-    // Important when multiple sources (aardwolf_external, instrumented library,
-    // etc.) write into one file.
-    fflush(fd);
-#endif
+    if (__builtin_expect(__aardwolf_counters_enabled(), 0) && !__aardwolf_muted) {
+        uint64_t start = __aardwolf_now_ns();
+        __aardwolf_emit_data(token, data, type_size);
+
+        struct aardwolf_counters *counters = __aardwolf_get_counters();
+        if (counters != NULL) {
+            counters->events[token]++;
+            counters->bytes += 1 + type_size;
+            counters->write_data_ns += __aardwolf_now_ns() - start;
+        }
+
+        return;
+    }
 #endif
+
+    __aardwolf_emit_data(token, data, type_size);
+}
+
+// Sampling is configured on the first use. Zero until then.
+static uint32_t __aardwolf_sample_rate = 0;
+// Tracing window toggled by the signal in AARDWOLF_SAMPLE_SIGNAL or by
+// aardwolf_sample_window.
+static volatile sig_atomic_t __aardwolf_sample_window = 1;
+
+void __aardwolf_toggle_window(int signal_number)
+{
+    (void)signal_number;
+    __aardwolf_sample_window = !__aardwolf_sample_window;
+}
+
+void __aardwolf_sample_init(void)
+{
+    uint32_t rate = 1;
+
+    char *rate_env = getenv("AARDWOLF_SAMPLE_RATE");
+    if (rate_env != NULL && strtoul(rate_env, NULL, 10) > 0) {
+        rate = (uint32_t)strtoul(rate_env, NULL, 10);
+    }
+
+    // The window is closed until the first signal.
+    char *signal_env = getenv("AARDWOLF_SAMPLE_SIGNAL");
+    if (signal_env != NULL && atoi(signal_env) > 0) {
+        __aardwolf_sample_window = 0;
+        signal(atoi(signal_env), __aardwolf_toggle_window);
+    }
+
+    __atomic_store_n(&__aardwolf_sample_rate, rate, __ATOMIC_RELEASE);
 }
 
+// Writes a gap marker when the events of the calling thread start to be
+// dropped, so Aardwolf knows the trace is incomplete at that place.
+void __aardwolf_set_muted(uint8_t muted)
+{
+    if (muted == __aardwolf_muted) {
+        return;
+    }
+
+    if (muted) {
+        __aardwolf_write_data(TOKEN_GAP, NULL, 0);
+    }
+
+    __aardwolf_muted = muted;
+
+#ifdef BUFFERED
+    if (__aardwolf_local != NULL) {
+        __aardwolf_update_end(__aardwolf_local);
+    }
+#endif
+}
 
 void aardwolf_write_statement(file_ref_t file_id, statement_ref_t stmt_id)
 {
+#ifdef BUFFERED
+    if (__aardwolf_format == 3) {
+        __aardwolf_write_compact_statement(file_id, stmt_id);
+        return;
+    }
+#endif
+
     uint64_t pair[2] = {file_id, stmt_id};
     __aardwolf_write_data(TOKEN_STATEMENT, &pair, sizeof(pair));
 }
 
+void aardwolf_write_block(file_ref_t file_id, statement_ref_t block_id)
+{
+    uint64_t pair[2] = {file_id, block_id};
+    __aardwolf_write_data(TOKEN_BLOCK, &pair, sizeof(pair));
+}
+
+void aardwolf_register_coverage(uint8_t *map, const uint64_t *stmts, uint64_t count)
+{
+#ifndef NO_DATA
+    struct __aardwolf_coverage *coverage = (struct __aardwolf_coverage *)malloc(sizeof(struct __aardwolf_coverage));
+    coverage->map = map;
+    coverage->stmts = stmts;
+    coverage->count = count;
+    coverage->next = __aardwolf_coverage;
+
+#ifndef BUFFERED
+    if (__aardwolf_coverage == NULL) {
+        atexit(__aardwolf_write_coverage);
+    }
+#else
+    // The coverage is written by the exit handler, which is registered during
+    // the initialization. The instrumented code itself does not write anything
+    // which would trigger it.
+    pthread_once(&__aardwolf_once, __aardwolf_init);
+#endif
+
+    __aardwolf_coverage = coverage;
+#endif
+}
+
 void aardwolf_write_external(const char *external)
 {
 #ifndef NO_DATA
+    // Test case markers are never sampled out. If called from an invocation
+    // which is not sampled, the rest of it is traced after the gap.
+    __aardwolf_set_muted(0);
+
+    // Covered statements belong to the previous test case.
+    __aardwolf_write_coverage();
+    __aardwolf_set_current_test(external);
+
+#ifndef BUFFERED
+#ifndef NO_HEADER
+    if (__aardwolf_mmap_enabled()) {
+        __aardwolf_mmap_write(TOKEN_EXTERNAL, external, strlen(external) + 1);
+        return;
+    }
+#endif
+
     FILE *fd = __aardwolf_get_fd();
+#ifdef NO_HEADER
+    // The marker is appended between the chunks of the traced program (e.g.,
+    // by aardwolf_external), whose index is appended as well. The events are
+    // flushed one by one, so nothing but the marker is written under the lock.
+    off_t offset = __aardwolf_index_enabled() ? __aardwolf_lock_trace(fileno(fd)) : -1;
+#endif
     fseek(fd, 0, SEEK_END);
     fputc(TOKEN_EXTERNAL, fd);
     fputs(external, fd);
     fputc(0, fd); // null terminator
+    __aardwolf_count_event(TOKEN_EXTERNAL, 1 + strlen(external) + 1);
+
+    uint64_t start = __aardwolf_counters_enabled() ? __aardwolf_now_ns() : 0;
     fflush(fd);
+
+    if (start != 0) {
+        __aardwolf_count_flush(start);
+    }
+
+#ifdef NO_HEADER
+    if (offset >= 0) {
+        __aardwolf_unlock_trace(fileno(fd));
+
+        char *filepath = __aardwolf_get_filepath();
+        int index = __aardwolf_open_index(filepath, 0);
+
+        if (index >= 0) {
+            __aardwolf_index_marker(index, INDEX_TOKEN_MARKER, (uint64_t)offset, external, strlen(external) + 1);
+            close(index);
+        }
+
+        free(filepath);
+    }
+#endif
+#else
+    __aardwolf_next_epoch();
+
+    // Flush the buffer immediately so the test case markers written from other
+    // processes (e.g., aardwolf_external) are kept in order.
+    __aardwolf_write_data(TOKEN_EXTERNAL, external, strlen(external) + 1);
+    __aardwolf_flush(__aardwolf_get_buffer());
+#endif
+#endif
+}
+
+void aardwolf_test_start(const char *name)
+{
+#ifndef NO_DATA
+    __aardwolf_set_muted(0);
+
+    // Covered statements belong to the previous test case.
+    __aardwolf_write_coverage();
+    __aardwolf_set_current_test(name);
+
+#ifdef BUFFERED
+    __aardwolf_next_epoch();
+
+    if (__aardwolf_recorder) {
+        // The marker must not be evicted from the ring.
+        struct __aardwolf_buffer *own = __aardwolf_prepare_buffer(0);
+
+        pthread_mutex_lock(&__aardwolf_lock);
+        __aardwolf_write_through_locked(own, TOKEN_EXTERNAL, name, strlen(name) + 1);
+        pthread_mutex_unlock(&__aardwolf_lock);
+        return;
+    }
+
+    if (__aardwolf_format == 3 && __aardwolf_write_interned(TOKEN_EXTERNAL_REF, NULL, 0, name)) {
+        return;
+    }
+#endif
+
+    // Unlike aardwolf_write_external, the marker is written like any other
+    // event, since there is no other process writing into the trace file.
+    __aardwolf_write_data(TOKEN_EXTERNAL, name, strlen(name) + 1);
+#endif
+}
+
+void aardwolf_test_end(const char *name, uint8_t status)
+{
+#ifndef NO_DATA
+    __aardwolf_set_muted(0);
+
+    // Covered statements belong to the finished test case.
+    __aardwolf_write_coverage();
+
+    // Status and the name form a single event.
+    uint8_t buffer[256];
+    size_t size = 1 + strlen(name) + 1;
+    uint8_t *data = size <= sizeof(buffer) ? buffer : (uint8_t *)malloc(size);
+
+    if (data == NULL) {
+        fprintf(stderr, "Aardwolf error: cannot allocate test status.\n");
+        return;
+    }
+
+    data[0] = status;
+    memcpy(data + 1, name, size - 1);
+
+#ifdef BUFFERED
+    if (__aardwolf_recorder) {
+        // The ring of the calling thread is written (or reduced to coverage if
+        // the test case passed) right away, the rings of other threads when
+        // they notice the next test case. The status follows it directly.
+        struct __aardwolf_buffer *own = __aardwolf_get_buffer();
+
+        pthread_mutex_lock(&__aardwolf_lock);
+
+        if (status == AARDWOLF_TEST_PASSED) {
+            __atomic_store_n(&__aardwolf_passed_epoch, __aardwolf_current_epoch() + 1, __ATOMIC_SEQ_CST);
+        }
+
+        __aardwolf_flush_locked(own);
+        own->epoch = __aardwolf_current_epoch();
+        __aardwolf_write_through_locked(own, TOKEN_TEST_STATUS, data, size);
+
+        pthread_mutex_unlock(&__aardwolf_lock);
+        __aardwolf_update_end(own);
+    } else if (__aardwolf_format != 3 || !__aardwolf_write_interned(TOKEN_TEST_STATUS_REF, &status, 1, name)) {
+        __aardwolf_write_data(TOKEN_TEST_STATUS, data, size);
+    }
+#else
+    __aardwolf_write_data(TOKEN_TEST_STATUS, data, size);
+#endif
+
+    if (data != buffer) {
+        free(data);
+    }
+#endif
+}
+
+uint8_t aardwolf_sample_enter(uint32_t *counter)
+{
+    uint8_t muted = __aardwolf_muted;
+
+#ifndef NO_DATA
+    uint32_t rate = __atomic_load_n(&__aardwolf_sample_rate, __ATOMIC_ACQUIRE);
+
+    if (rate == 0) {
+        __aardwolf_sample_init();
+        rate = __aardwolf_sample_rate;
+    }
+
+    uint8_t sampled = __aardwolf_sample_window
+        && (rate == 1 || __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED) % rate == 0);
+
+    __aardwolf_set_muted(!sampled);
+#else
+    (void)counter;
+#endif
+
+    return muted;
+}
+
+void aardwolf_sample_exit(uint8_t muted)
+{
+#ifndef NO_DATA
+    __aardwolf_set_muted(muted);
+#else
+    (void)muted;
 #endif
 }
 
+void aardwolf_sample_window(uint8_t open)
+{
+    __aardwolf_sample_window = open;
+}
+
 void aardwolf_write_header()
 {
+#ifndef BUFFERED
+#ifndef NO_HEADER
+    if (__aardwolf_mmap_enabled()) {
+        __aardwolf_mmap_write_header();
+        return;
+    }
+#endif
+
     __write_header(__aardwolf_get_fd());
+#else
+    __aardwolf_get_buffer();
+
+    pthread_mutex_lock(&__aardwolf_lock);
+    __aardwolf_drain_locked();
+    __aardwolf_write_file_header();
+    pthread_mutex_unlock(&__aardwolf_lock);
+#endif
 }
 
 void aardwolf_write_data_unsupported()
@@ -163,6 +2690,12 @@ void aardwolf_write_data_bool(uint8_t value)
 
 void aardwolf_write_data_named(const char *value)
 {
+#ifdef BUFFERED
+    if (__aardwolf_format == 3 && __aardwolf_write_interned(TOKEN_DATA_NAMED_REF, NULL, 0, value)) {
+        return;
+    }
+#endif
+
     __aardwolf_write_data(TOKEN_DATA_NAMED, value, sizeof(char) * (strlen(value) + 1));
 }
 
@@ -170,3 +2703,58 @@ void aardwolf_write_data_null()
 {
     __aardwolf_write_data(TOKEN_DATA_NULL, NULL, 0);
 }
+
+void aardwolf_write_data_blob(uint64_t type_id, const void *data, uint32_t size)
+{
+#ifndef NO_DATA
+    // The type identifier, the size and the bytes form a single event.
+    uint8_t buffer[256 + sizeof(uint64_t) + sizeof(uint32_t)];
+    size_t total = sizeof(uint64_t) + sizeof(uint32_t) + size;
+    uint8_t *blob = total <= sizeof(buffer) ? buffer : (uint8_t *)malloc(total);
+
+    if (blob == NULL) {
+        fprintf(stderr, "Aardwolf error: cannot allocate data blob.\n");
+        return;
+    }
+
+    memcpy(blob, &type_id, sizeof(uint64_t));
+    memcpy(blob + sizeof(uint64_t), &size, sizeof(uint32_t));
+    memcpy(blob + sizeof(uint64_t) + sizeof(uint32_t), data, size);
+
+    __aardwolf_write_data(TOKEN_DATA_BLOB, blob, total);
+
+    if (blob != buffer) {
+        free(blob);
+    }
+#endif
+}
+
+int aardwolf_read_counters(struct aardwolf_counters *counters)
+{
+    memset(counters, 0, sizeof(struct aardwolf_counters));
+
+#ifndef NO_DATA
+    if (!__aardwolf_counters_enabled()) {
+        return 0;
+    }
+
+    struct __aardwolf_thread_counters *local = __atomic_load_n(&__aardwolf_all_counters, __ATOMIC_ACQUIRE);
+
+    for (; local != NULL; local = local->next) {
+        for (int token = 0; token < AARDWOLF_N_TOKENS; token++) {
+            counters->events[token] += local->counters.events[token];
+        }
+
+        counters->bytes += local->counters.bytes;
+        counters->written += local->counters.written;
+        counters->flushes += local->counters.flushes;
+        counters->flush_ns += local->counters.flush_ns;
+        counters->stalls += local->counters.stalls;
+        counters->write_data_ns += local->counters.write_data_ns;
+    }
+
+    return 1;
+#else
+    return 0;
+#endif
+}
@@ -3,42 +3,76 @@
 
 #include <stdint.h>
 
-#define TOKEN_STATEMENT 0xff
-#define TOKEN_EXTERNAL 0xfe
-#define TOKEN_DATA_UNSUPPORTED 0x10
-#define TOKEN_DATA_I8 0x11
-#define TOKEN_DATA_I16 0x12
-#define TOKEN_DATA_I32 0x13
-#define TOKEN_DATA_I64 0x14
-#define TOKEN_DATA_U8 0x15
-#define TOKEN_DATA_U16 0x16
-#define TOKEN_DATA_U32 0x17
-#define TOKEN_DATA_U64 0x18
-#define TOKEN_DATA_F32 0x19
-#define TOKEN_DATA_F64 0x20
-#define TOKEN_DATA_BOOL 0x21
-#define TOKEN_DATA_NAMED 0x28
-#define TOKEN_DATA_NULL 0x29
+#include "encoding.h"
 
 typedef uint64_t file_ref_t;
 typedef uint64_t statement_ref_t;
 
+// Write position in the trace buffer of the calling thread. The frontend can
+// emit inline code which appends an event directly at `pos` if it ends before
+// `end`, otherwise it calls the corresponding runtime function. The runtime
+// sets `end` to NULL whenever the events must not be appended directly (e.g.,
+// in unbuffered runtimes or when a new test case started).
+struct aardwolf_cursor {
+    uint8_t *pos;
+    uint8_t *end;
+};
+
+extern __thread struct aardwolf_cursor aardwolf_cursor;
+
 // Log executed statement.
 void aardwolf_write_statement(file_ref_t file_id, statement_ref_t stmt_id);
 
+// Log executed trace block (a sequence of statements exported in static data
+// by the frontend). It is identified by its first statement.
+void aardwolf_write_block(file_ref_t file_id, statement_ref_t block_id);
+
+// Register coverage map of an instrumented module. The map has a flag for every
+// statement in `stmts` (`count` pairs of file and statement identifiers) which
+// the instrumented code sets when the statement is executed. The runtime logs
+// the covered statements (each once, in the order of `stmts`) and clears the
+// flags before every test case marker and at the process exit.
+void aardwolf_register_coverage(uint8_t *map, const uint64_t *stmts, uint64_t count);
+
 // Log external identifier. This is intended for differentiating individual test
 // cases such that aardwolf can assign blocks of traces to these test cases
 // and use this information along with test case status given later for the
 // analysis.
 void aardwolf_write_external(const char *external);
 
+// In-process alternative to `aardwolf_write_external` for test frameworks
+// linked with the runtime. `aardwolf_test_start` marks the beginning of a test
+// case, `aardwolf_test_end` records its status (`AARDWOLF_TEST_PASSED` or
+// `AARDWOLF_TEST_FAILED`) into the trace, so the test results file is not
+// needed. The markers are written without seeking and flushing the trace file,
+// so they must not be combined with test markers from external processes.
+#define AARDWOLF_TEST_FAILED 0
+#define AARDWOLF_TEST_PASSED 1
+
+void aardwolf_test_start(const char *name);
+void aardwolf_test_end(const char *name, uint8_t status);
+
+// Sampling guards emitted by the frontend at every entry and return of an
+// instrumented function. `aardwolf_sample_enter` decides whether the invocation
+// is traced using the per-function invocation counter and returns the previous
+// state of the calling thread, which `aardwolf_sample_exit` restores. When the
+// events start to be dropped, a gap marker is written into the trace.
+//
+// Every invocation is traced by default. `AARDWOLF_SAMPLE_RATE=N` traces only
+// every Nth invocation of each function. `AARDWOLF_SAMPLE_SIGNAL` (a signal
+// number) makes the tracing start disabled, every delivery of the signal then
+// toggles it. `aardwolf_sample_window` opens or closes the window directly.
+uint8_t aardwolf_sample_enter(uint32_t *counter);
+void aardwolf_sample_exit(uint8_t muted);
+void aardwolf_sample_window(uint8_t open);
+
 // Separated function for generating the header. It is called automatically in
 // normal version of runtime. This should be only called when bare runtime is
 // used and the file header must be generated explicitly.
 void aardwolf_write_header();
 
-// Only primitive types. It is the responsibility of the frontend to correctly
-// write serialize complex types (e.g., arrays or structures).
+// Primitive types. It is the responsibility of the frontend to correctly
+// serialize other types, or dump them as blobs (see below).
 //
 // Before every data dump, there must be indication of what types they are.
 // It cannot be done beforehand just once, because in dynamically-typed
@@ -57,6 +91,43 @@ void aardwolf_write_data_f64(double value);
 void aardwolf_write_data_bool(uint8_t value);
 void aardwolf_write_data_named(const char *value);
 void aardwolf_write_data_null();
+
+// Self-instrumentation of the runtime, enabled by AARDWOLF_RUNTIME_COUNTERS=1.
+// Every thread counts the events it traces, the bytes of the encoded events,
+// the flushes of the trace and the time spent in them, and how many times its
+// buffer got full. At the exit, the counters of every thread are appended as a
+// JSON line to aard.counters in AARDWOLF_DATA_DEST.
+//
+// Events appended by inline instrumentation are not counted, as they do not
+// enter the runtime. Timing of every event with the monotonic clock adds
+// noticeable overhead, so the counters should not be enabled for regular runs.
+#define AARDWOLF_N_TOKENS 256
+
+struct aardwolf_counters {
+    // Indexed by token.
+    uint64_t events[AARDWOLF_N_TOKENS];
+    // Bytes of the encoded events.
+    uint64_t bytes;
+    // Bytes written into the trace file (after compression, buffered runtimes
+    // only).
+    uint64_t written;
+    uint64_t flushes;
+    uint64_t flush_ns;
+    // Number of times the buffer was full and had to be flushed before an
+    // event could be appended.
+    uint64_t stalls;
+    // Time spent in tracing the events, including the flushes they triggered.
+    uint64_t write_data_ns;
+};
+
+// Sums the counters of all threads (including finished ones) of the process.
+// Returns zero if the counters are not enabled.
+int aardwolf_read_counters(struct aardwolf_counters *counters);
+
+// Composite values (structures, arrays, vectors) are dumped at once as raw
+// bytes. The layout of the type, which is identified by `type_id`, is exported
+// by the frontend to the static data so the bytes can be decoded later.
+void aardwolf_write_data_blob(uint64_t type_id, const void *data, uint32_t size);
 // TODO: Others
 
 #endif // AARDWOLF_RUNTIME_H
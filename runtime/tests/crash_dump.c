@@ -0,0 +1,157 @@
+// Crashes a process traced in flight recorder mode and checks that the crash
+// handler wrote the rings of all threads as complete chunks, including the last
+// events before the crash.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../encoding.h"
+#include "../runtime.h"
+
+#define N_THREADS 2
+#define N_STATEMENTS 100000
+
+#define HEADER_SIZE 7
+#define CHUNK_HEADER_SIZE 21
+
+static pthread_barrier_t traced;
+
+static void * trace_events(void *arg)
+{
+    uint64_t thread = (uint64_t)(uintptr_t)arg;
+
+    for (uint64_t i = 0; i < N_STATEMENTS; i++) {
+        aardwolf_write_statement(thread, i);
+    }
+
+    // Keeps the buffer of the thread alive until the crash.
+    pthread_barrier_wait(&traced);
+    pause();
+
+    return NULL;
+}
+
+// Executed in the child process.
+static void run_and_crash(void)
+{
+    pthread_t threads[N_THREADS];
+    pthread_barrier_init(&traced, NULL, N_THREADS + 1);
+
+    aardwolf_write_external("crashing");
+
+    for (unsigned i = 0; i < N_THREADS; i++) {
+        pthread_create(&threads[i], NULL, trace_events, (void *)(uintptr_t)(i + 1));
+    }
+
+    pthread_barrier_wait(&traced);
+    aardwolf_write_statement(N_THREADS + 1, 0);
+    abort();
+}
+
+// The trace must consist of whole chunks, and the last statement of every
+// thread must be in it.
+static int check_trace(const uint8_t *trace, size_t length)
+{
+    if (length < HEADER_SIZE || memcmp(trace, "AARD/D2", HEADER_SIZE) != 0) {
+        fprintf(stderr, "invalid header\n");
+        return 0;
+    }
+
+    size_t pos = HEADER_SIZE;
+    while (pos < length) {
+        uint32_t size;
+        memcpy(&size, trace + pos + 17, sizeof(size));
+
+        if (trace[pos] != TOKEN_CHUNK || pos + CHUNK_HEADER_SIZE + size > length) {
+            fprintf(stderr, "invalid chunk at %zu\n", pos);
+            return 0;
+        }
+
+        pos += CHUNK_HEADER_SIZE + size;
+    }
+
+    for (uint64_t thread = 1; thread <= N_THREADS + 1; thread++) {
+        uint8_t event[1 + 2 * sizeof(uint64_t)];
+        uint64_t last = thread <= N_THREADS ? N_STATEMENTS - 1 : 0;
+
+        event[0] = TOKEN_STATEMENT;
+        memcpy(event + 1, &thread, sizeof(uint64_t));
+        memcpy(event + 1 + sizeof(uint64_t), &last, sizeof(uint64_t));
+
+        int found = 0;
+        for (size_t i = HEADER_SIZE; i + sizeof(event) <= length && !found; i++) {
+            found = memcmp(trace + i, event, sizeof(event)) == 0;
+        }
+
+        if (!found) {
+            fprintf(stderr, "last statement of thread %llu not found\n", (unsigned long long)thread);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int main(void)
+{
+    char dest[] = "/tmp/aardwolf-test-XXXXXX";
+    if (mkdtemp(dest) == NULL) {
+        fprintf(stderr, "cannot create temporary directory\n");
+        return 1;
+    }
+
+    // The runtime is never used by this process, only by the child. It became
+    // the owner of the trace when the runtime was loaded, so the child would
+    // write aard.trace.<pid> otherwise.
+    unsetenv("AARDWOLF_TRACE_OWNER");
+    setenv("AARDWOLF_DATA_DEST", dest, 1);
+    setenv("AARDWOLF_TRACE_FORMAT", "2", 1);
+    setenv("AARDWOLF_FLIGHT_RECORDER", "1", 1);
+    setenv("AARDWOLF_BUFFER_SIZE", "65536", 1);
+
+    char path[sizeof(dest) + 16];
+    snprintf(path, sizeof(path), "%s/aard.trace", dest);
+
+    int ok = 0;
+    pid_t child = fork();
+
+    if (child == 0) {
+        run_and_crash();
+    }
+
+    int status = 0;
+    if (child < 0 || waitpid(child, &status, 0) < 0 || !WIFSIGNALED(status) || WTERMSIG(status) != SIGABRT) {
+        fprintf(stderr, "traced process did not crash\n");
+    } else {
+        FILE *file = fopen(path, "rb");
+
+        if (file == NULL) {
+            fprintf(stderr, "cannot open %s\n", path);
+        } else {
+            fseek(file, 0, SEEK_END);
+            size_t length = (size_t)ftell(file);
+            fseek(file, 0, SEEK_SET);
+
+            uint8_t *trace = (uint8_t *)malloc(length);
+            if (trace != NULL && fread(trace, 1, length, file) == length) {
+                ok = check_trace(trace, length);
+            }
+
+            free(trace);
+            fclose(file);
+        }
+    }
+
+    unlink(path);
+    rmdir(dest);
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,170 @@
+// The owner of the trace executes another program, which keeps its process id
+// and must continue the trace instead of truncating it. The program is this
+// test itself, executed with "continued" argument. Run with the full runtime
+// (also with AARDWOLF_TRACE_MMAP=1) and the buffered one.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../encoding.h"
+#include "../runtime.h"
+
+#define HEADER_SIZE 7
+
+// Executed in the child process before and after exec.
+static void run_owner(const char *program)
+{
+    char pid[32];
+    snprintf(pid, sizeof(pid), "%ld", (long)getpid());
+    setenv("AARDWOLF_TRACE_OWNER", pid, 1);
+
+    // The marker flushes the events, exec would discard them otherwise.
+    aardwolf_write_statement(1, 1);
+    aardwolf_write_external("before");
+
+    execl(program, program, "continued", (char *)NULL);
+    exit(1);
+}
+
+static void run_continued(void)
+{
+    aardwolf_write_statement(1, 2);
+    aardwolf_write_external("after");
+}
+
+static size_t find(const uint8_t *data, size_t length, const void *pattern, size_t size, size_t from)
+{
+    for (size_t i = from; i + size <= length; i++) {
+        if (memcmp(data + i, pattern, size) == 0) {
+            return i;
+        }
+    }
+
+    return length;
+}
+
+static int check_trace(const uint8_t *trace, size_t length)
+{
+    if (length < HEADER_SIZE || memcmp(trace, "AARD/D", 6) != 0) {
+        fprintf(stderr, "invalid header\n");
+        return 0;
+    }
+
+    if (find(trace, length, "AARD/D", 6, 1) != length) {
+        fprintf(stderr, "trace started again\n");
+        return 0;
+    }
+
+    size_t before = find(trace, length, "\xfe" "before", 8, HEADER_SIZE);
+    size_t after = find(trace, length, "\xfe" "after", 7, HEADER_SIZE);
+
+    if (before == length || after == length || after < before) {
+        fprintf(stderr, "markers before and after exec not found in order\n");
+        return 0;
+    }
+
+    return 1;
+}
+
+// Returns whether the directory contains only the main trace (and its index).
+static int only_main_trace(const char *dest)
+{
+    DIR *dir = opendir(dest);
+    struct dirent *entry;
+    int ok = dir != NULL;
+
+    while (ok && (entry = readdir(dir)) != NULL) {
+        const char *name = entry->d_name;
+        ok = name[0] == '.' || strcmp(name, "aard.trace") == 0 || strcmp(name, "aard.trace.index") == 0;
+    }
+
+    if (dir != NULL) {
+        closedir(dir);
+    }
+
+    return ok;
+}
+
+static void remove_dir(const char *dest)
+{
+    DIR *dir = opendir(dest);
+    struct dirent *entry;
+    char path[64 + sizeof(entry->d_name)];
+
+    while (dir != NULL && (entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.') {
+            snprintf(path, sizeof(path), "%.62s/%s", dest, entry->d_name);
+            unlink(path);
+        }
+    }
+
+    if (dir != NULL) {
+        closedir(dir);
+    }
+
+    rmdir(dest);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc == 2 && strcmp(argv[1], "continued") == 0) {
+        run_continued();
+        return 0;
+    }
+
+    char dest[] = "/tmp/aardwolf-test-XXXXXX";
+    if (mkdtemp(dest) == NULL) {
+        fprintf(stderr, "cannot create temporary directory\n");
+        return 1;
+    }
+
+    // The runtime is never used by this process, only by the child, which
+    // claims the trace itself.
+    setenv("AARDWOLF_DATA_DEST", dest, 1);
+
+    char path[sizeof(dest) + 16];
+    snprintf(path, sizeof(path), "%s/aard.trace", dest);
+
+    int ok = 0;
+    pid_t child = fork();
+
+    if (child == 0) {
+        run_owner(argv[0]);
+    }
+
+    int status = 0;
+    if (child < 0 || waitpid(child, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "traced process failed\n");
+    } else if (!only_main_trace(dest)) {
+        fprintf(stderr, "executed program wrote its own trace\n");
+    } else {
+        FILE *file = fopen(path, "rb");
+
+        if (file == NULL) {
+            fprintf(stderr, "cannot open %s\n", path);
+        } else {
+            fseek(file, 0, SEEK_END);
+            size_t length = (size_t)ftell(file);
+            fseek(file, 0, SEEK_SET);
+
+            uint8_t *trace = (uint8_t *)malloc(length);
+            if (trace != NULL && fread(trace, 1, length, file) == length) {
+                ok = check_trace(trace, length);
+            }
+
+            free(trace);
+            fclose(file);
+        }
+    }
+
+    remove_dir(dest);
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,153 @@
+// Traces events from several threads in memory-mapped mode and checks that
+// every event is intact in the trace file. The events span several extents,
+// so the threads also map and unmap them concurrently.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../encoding.h"
+#include "../runtime.h"
+
+#define N_THREADS 4
+#define N_STATEMENTS 400000
+
+static void * trace_events(void *arg)
+{
+    uint64_t thread = (uint64_t)(uintptr_t)arg;
+
+    for (uint64_t i = 0; i < N_STATEMENTS; i++) {
+        aardwolf_write_statement(thread, i);
+        // Identifies the thread and the statement it follows.
+        aardwolf_write_data_u64(thread << 32 | i);
+    }
+
+    return NULL;
+}
+
+// Executed in the child process.
+static void run_threads(void)
+{
+    pthread_t threads[N_THREADS];
+
+    for (unsigned i = 0; i < N_THREADS; i++) {
+        pthread_create(&threads[i], NULL, trace_events, (void *)(uintptr_t)(i + 1));
+    }
+
+    for (unsigned i = 0; i < N_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+// The events of different threads are interleaved, but the events of every
+// thread must be complete and in order.
+static int check_trace(FILE *trace)
+{
+    char header[7];
+    if (fread(header, 1, sizeof(header), trace) != sizeof(header) || memcmp(header, "AARD/D1", 7) != 0) {
+        fprintf(stderr, "invalid header\n");
+        return 0;
+    }
+
+    uint64_t statements[N_THREADS + 1] = {0};
+    uint64_t values[N_THREADS + 1] = {0};
+    int token;
+
+    while ((token = fgetc(trace)) != EOF) {
+        uint64_t thread;
+        uint64_t index;
+
+        if (token == TOKEN_STATEMENT) {
+            uint64_t pair[2];
+            if (fread(pair, sizeof(uint64_t), 2, trace) != 2) {
+                break;
+            }
+
+            thread = pair[0];
+            index = pair[1];
+
+            if (thread >= 1 && thread <= N_THREADS && index == statements[thread]) {
+                statements[thread]++;
+                continue;
+            }
+        } else if (token == TOKEN_DATA_U64) {
+            uint64_t value;
+            if (fread(&value, sizeof(uint64_t), 1, trace) != 1) {
+                break;
+            }
+
+            thread = value >> 32;
+            index = value & 0xffffffff;
+
+            if (thread >= 1 && thread <= N_THREADS && index == values[thread]) {
+                values[thread]++;
+                continue;
+            }
+        }
+
+        fprintf(stderr, "unexpected event at %ld\n", ftell(trace));
+        return 0;
+    }
+
+    for (unsigned i = 1; i <= N_THREADS; i++) {
+        if (statements[i] != N_STATEMENTS || values[i] != N_STATEMENTS) {
+            fprintf(stderr, "thread %u: %llu statements and %llu values\n", i, (unsigned long long)statements[i],
+                    (unsigned long long)values[i]);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int main(void)
+{
+    char dest[] = "/tmp/aardwolf-test-XXXXXX";
+    if (mkdtemp(dest) == NULL) {
+        fprintf(stderr, "cannot create temporary directory\n");
+        return 1;
+    }
+
+    // The runtime is never used by this process, only by the child. It became
+    // the owner of the trace when the runtime was loaded, so the child would
+    // write aard.trace.<pid> otherwise.
+    unsetenv("AARDWOLF_TRACE_OWNER");
+    setenv("AARDWOLF_DATA_DEST", dest, 1);
+    setenv("AARDWOLF_TRACE_MMAP", "1", 1);
+
+    char path[sizeof(dest) + 16];
+    snprintf(path, sizeof(path), "%s/aard.trace", dest);
+
+    int ok = 0;
+    pid_t child = fork();
+
+    if (child == 0) {
+        run_threads();
+        exit(0);
+    }
+
+    int status = 0;
+    if (child < 0 || waitpid(child, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "traced process failed\n");
+    } else {
+        FILE *trace = fopen(path, "rb");
+
+        if (trace == NULL) {
+            fprintf(stderr, "cannot open %s\n", path);
+        } else {
+            ok = check_trace(trace);
+            fclose(trace);
+        }
+    }
+
+    unlink(path);
+    rmdir(dest);
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,283 @@
+// Traces events from several threads of a buffered process while other
+// processes append test case markers to the same trace file with
+// aardwolf_external, and checks that every record of the index points to the
+// chunk or the marker in the trace and that together they cover the whole
+// trace.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../encoding.h"
+#include "../runtime.h"
+
+#define N_THREADS 4
+#define N_STATEMENTS 1000000
+#define N_EXTERNAL 40
+
+#define HEADER_SIZE 7
+#define CHUNK_HEADER_SIZE 21
+
+static void * trace_events(void *arg)
+{
+    uint64_t thread = (uint64_t)(uintptr_t)arg;
+
+    for (uint64_t i = 0; i < N_STATEMENTS; i++) {
+        aardwolf_write_statement(thread, i);
+
+        if (thread == 1 && i % (N_STATEMENTS / 10) == 0) {
+            char name[32];
+            snprintf(name, sizeof(name), "internal %llu", (unsigned long long)i);
+            aardwolf_write_external(name);
+        }
+    }
+
+    return NULL;
+}
+
+// Executed in the traced process.
+static void run_threads(void)
+{
+    pthread_t threads[N_THREADS];
+
+    for (unsigned i = 0; i < N_THREADS; i++) {
+        pthread_create(&threads[i], NULL, trace_events, (void *)(uintptr_t)(i + 1));
+    }
+
+    for (unsigned i = 0; i < N_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+static int run_external(const char *external, const char *name)
+{
+    pid_t child = fork();
+
+    if (child == 0) {
+        execl(external, external, name, (char *)NULL);
+        _exit(127);
+    }
+
+    int status = 0;
+    return child > 0 && waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static uint8_t * read_file(const char *path, size_t *length)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "cannot open %s\n", path);
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    *length = (size_t)ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t *data = (uint8_t *)malloc(*length + 1);
+    if (data != NULL && fread(data, 1, *length, file) != *length) {
+        free(data);
+        data = NULL;
+    }
+
+    fclose(file);
+    return data;
+}
+
+static uint64_t read_u64(const uint8_t *data)
+{
+    uint64_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static uint32_t read_u32(const uint8_t *data)
+{
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+// Part of the trace referenced by the index.
+struct range {
+    uint64_t start;
+    uint64_t end;
+};
+
+static int compare_ranges(const void *a, const void *b)
+{
+    const struct range *left = (const struct range *)a;
+    const struct range *right = (const struct range *)b;
+    return left->start < right->start ? -1 : left->start > right->start;
+}
+
+static int check_index(const uint8_t *trace, size_t trace_length, const uint8_t *index, size_t index_length)
+{
+    if (index_length < HEADER_SIZE || memcmp(index, "AARD/I1", HEADER_SIZE) != 0) {
+        fprintf(stderr, "invalid index header\n");
+        return 0;
+    }
+
+    // Every record takes more than 10 bytes.
+    struct range *ranges = (struct range *)malloc(index_length / 10 * sizeof(struct range));
+    size_t n_ranges = 0;
+    size_t n_markers = 0;
+    size_t pos = HEADER_SIZE;
+
+    while (pos < index_length) {
+        uint8_t token = index[pos];
+        uint64_t offset = read_u64(index + pos + 1);
+
+        if (offset >= trace_length) {
+            fprintf(stderr, "offset %llu out of the trace\n", (unsigned long long)offset);
+            return 0;
+        }
+
+        if (token == INDEX_TOKEN_CHUNK) {
+            uint32_t size = read_u32(index + pos + 9);
+            const uint8_t *chunk = trace + offset;
+
+            if (offset + CHUNK_HEADER_SIZE > trace_length || chunk[0] != TOKEN_CHUNK
+                || memcmp(chunk + 1, index + pos + 13, 2 * sizeof(uint64_t)) != 0
+                || size != CHUNK_HEADER_SIZE + read_u32(chunk + 17) || offset + size > trace_length) {
+                fprintf(stderr, "no indexed chunk at %llu\n", (unsigned long long)offset);
+                return 0;
+            }
+
+            ranges[n_ranges++] = (struct range){offset, offset + size};
+            pos += 1 + 8 + 4 + 16 + 8 * INDEX_FILTER_WORDS;
+        } else if (token == INDEX_TOKEN_MARKER || token == INDEX_TOKEN_CHUNK_MARKER) {
+            const char *name = (const char *)(index + pos + 9);
+            size_t size = strlen(name) + 1;
+
+            if (token == INDEX_TOKEN_MARKER) {
+                if (trace[offset] != TOKEN_EXTERNAL || offset + 1 + size > trace_length
+                    || memcmp(trace + offset + 1, name, size) != 0) {
+                    fprintf(stderr, "no marker %s at %llu\n", name, (unsigned long long)offset);
+                    return 0;
+                }
+
+                ranges[n_ranges++] = (struct range){offset, offset + 1 + size};
+                n_markers++;
+            } else if (trace[offset] != TOKEN_CHUNK) {
+                fprintf(stderr, "no chunk with marker %s at %llu\n", name, (unsigned long long)offset);
+                return 0;
+            }
+
+            pos += 9 + size;
+        } else {
+            fprintf(stderr, "unexpected index token %u\n", token);
+            return 0;
+        }
+    }
+
+    if (n_markers != N_EXTERNAL) {
+        fprintf(stderr, "%zu external markers indexed\n", n_markers);
+        return 0;
+    }
+
+    qsort(ranges, n_ranges, sizeof(struct range), compare_ranges);
+
+    uint64_t end = HEADER_SIZE;
+    for (size_t i = 0; i < n_ranges; i++) {
+        if (ranges[i].start != end) {
+            fprintf(stderr, "trace not indexed at %llu\n", (unsigned long long)end);
+            return 0;
+        }
+
+        end = ranges[i].end;
+    }
+
+    free(ranges);
+
+    if (end != trace_length) {
+        fprintf(stderr, "trace not indexed from %llu\n", (unsigned long long)end);
+        return 0;
+    }
+
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <aardwolf_external>\n", argv[0]);
+        return 1;
+    }
+
+    char dest[] = "/tmp/aardwolf-test-XXXXXX";
+    if (mkdtemp(dest) == NULL) {
+        fprintf(stderr, "cannot create temporary directory\n");
+        return 1;
+    }
+
+    // The runtime is never used by this process, only by the children. It became
+    // the owner of the trace when the runtime was loaded, so the children would
+    // write aard.trace.<pid> otherwise.
+    unsetenv("AARDWOLF_TRACE_OWNER");
+    setenv("AARDWOLF_DATA_DEST", dest, 1);
+    setenv("AARDWOLF_TRACE_FORMAT", "2", 1);
+    setenv("AARDWOLF_TRACE_INDEX", "1", 1);
+    setenv("AARDWOLF_BUFFER_SIZE", "4096", 1);
+
+    char trace_path[sizeof(dest) + 16];
+    char index_path[sizeof(dest) + 24];
+    snprintf(trace_path, sizeof(trace_path), "%s/aard.trace", dest);
+    snprintf(index_path, sizeof(index_path), "%s/aard.trace.index", dest);
+
+    int ok = 0;
+    pid_t child = fork();
+
+    if (child == 0) {
+        run_threads();
+        exit(0);
+    }
+
+    // The traced process creates the trace file, the markers are appended to
+    // it while it is written.
+    struct timespec delay = {0, 1000000};
+    while (child > 0 && access(index_path, F_OK) != 0) {
+        nanosleep(&delay, NULL);
+    }
+
+    int externals_ok = 1;
+    for (int i = 0; i < N_EXTERNAL; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "external %d", i);
+        externals_ok = externals_ok && run_external(argv[1], name);
+    }
+
+    int status = 0;
+    if (child < 0 || waitpid(child, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "traced process failed\n");
+    } else if (!externals_ok) {
+        fprintf(stderr, "aardwolf_external failed\n");
+    } else {
+        size_t trace_length = 0;
+        size_t index_length = 0;
+        uint8_t *trace = read_file(trace_path, &trace_length);
+        uint8_t *index = read_file(index_path, &index_length);
+
+        if (trace != NULL && index != NULL) {
+            // Names in the index are null-terminated.
+            index[index_length] = 0;
+            ok = check_index(trace, trace_length, index, index_length);
+        }
+
+        free(trace);
+        free(index);
+    }
+
+    unlink(trace_path);
+    unlink(index_path);
+    rmdir(dest);
+
+    return ok ? 0 : 1;
+}
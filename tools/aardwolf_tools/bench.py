@@ -0,0 +1,306 @@
+"""End-to-end benchmark of the tracing overhead on the example projects.
+
+Every example is built in several variants (uninstrumented, instrumented with
+the noop runtime and instrumented with a tracing runtime in each
+instrumentation mode), its test suite is executed and Aardwolf core analyzes
+the produced data. One JSON object is printed per example and variant.
+
+Usage: python -m aardwolf_tools.bench [options] (from the tools directory)
+"""
+
+import argparse
+import glob
+import json
+import os
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+ROOT_DIR = os.path.realpath(os.path.join(os.path.dirname(__file__), '..', '..'))
+EXAMPLES_DIR = os.path.join(ROOT_DIR, 'examples')
+
+MODES = ['statement', 'block', 'coverage']
+VARIANTS = ['plain', 'noop'] + MODES
+
+
+class Example:
+    def __init__(self, name, sources, runner=None, cases=None):
+        self.name = name
+        # Sources of the program under test, they are instrumented.
+        self.sources = sources
+        # Test runner linked with the program. If it is missing, the program
+        # is executed once per test case with the arguments read from the
+        # `.in` file and the case passes if it prints the `.out` file.
+        self.runner = runner
+        self.cases = cases or []
+        # Only the instrumentation is measured for examples which cannot run.
+        self.runnable = runner is not None or cases
+
+    def test_commands(self, binary):
+        if self.runner is not None:
+            return [(None, [binary], None)]
+
+        commands = []
+        for case in self.cases:
+            name, _ = os.path.splitext(case)
+            with open(case) as fh:
+                commands.append((os.path.basename(case), [binary] + fh.read().split(),
+                                 name + '.out'))
+
+        return commands
+
+
+def get_examples():
+    examples = [
+        Example('c', glob.glob(os.path.join(EXAMPLES_DIR, 'c', 'src', '*.c')),
+                runner=os.path.join(EXAMPLES_DIR, 'c', 'tests', 'test.c')),
+        Example('literature', [os.path.join(EXAMPLES_DIR, 'literature', 'src', 'ppdg.c')],
+                runner=os.path.join(EXAMPLES_DIR, 'literature', 'tests', 'ppdg.c')),
+        Example('adt', glob.glob(os.path.join(EXAMPLES_DIR, 'adt', 'src', '*.c')),
+                cases=sorted(glob.glob(os.path.join(EXAMPLES_DIR, 'adt', 'tests', '*.in')))),
+    ]
+
+    # Test programs of the LLVM frontend are not meant to be executed.
+    for source in sorted(glob.glob(os.path.join(ROOT_DIR, 'frontends', 'llvm', 'tests', '*.c'))):
+        name, _ = os.path.splitext(os.path.basename(source))
+        examples.append(Example(f'llvm/{name}', [source]))
+
+    return examples
+
+
+def run_measured(args, cwd, env, stdout=subprocess.DEVNULL):
+    """Runs the command and returns its wall time in seconds and peak RSS in kB.
+
+    Linux keeps the peak RSS of the process across exec, so the RSS is never
+    lower than that of this interpreter (about 10 MB). It is meaningful only
+    for the analysis, not for the small test programs.
+    """
+    start = time.perf_counter()
+    process = subprocess.Popen(args, cwd=cwd, env=env, stdout=stdout, stderr=subprocess.DEVNULL)
+    _, status, usage = os.wait4(process.pid, 0)
+    elapsed = time.perf_counter() - start
+
+    if os.WIFEXITED(status):
+        process.returncode = os.WEXITSTATUS(status)
+    else:
+        process.returncode = -os.WTERMSIG(status)
+
+    return elapsed, usage.ru_maxrss, process.returncode
+
+
+def total_size(pattern):
+    return sum(os.path.getsize(path) for path in glob.glob(pattern))
+
+
+def clean_data(directory):
+    for path in glob.glob(os.path.join(directory, 'aard.*')):
+        os.remove(path)
+
+
+class Bench:
+    def __init__(self, args):
+        self.aardwolf_dir = os.path.expanduser(args.aardwolf_dir)
+        self.work_dir = args.work_dir
+        self.repeat = args.repeat
+        self.runtime = args.runtime
+        self.plugin = args.plugin
+        self.analysis = not args.no_analysis
+        self.cc = args.cc
+        # Run times of the uninstrumented variants, the baseline of slowdown.
+        self.baseline = {}
+
+    def library(self, runtime):
+        name = 'aardwolf_runtime' if runtime == 'full' else f'aardwolf_runtime_{runtime}'
+        return os.path.join(self.aardwolf_dir, f'lib{name}.a')
+
+    def env(self, dest, variant):
+        env = dict(os.environ)
+        env['AARDWOLF_DATA_DEST'] = dest
+
+        if variant in MODES:
+            env['AARDWOLF_INSTRUMENTATION'] = variant
+
+        return env
+
+    def build(self, example, variant, dest):
+        env = self.env(dest, variant)
+        flags = ['-g', '-O0']
+
+        if variant != 'plain':
+            flags += ['-Xclang', '-load', '-Xclang',
+                      os.path.join(self.aardwolf_dir, 'libAardwolfLLVM.so')]
+
+        objects = []
+        compile_time = 0
+
+        for source in example.sources:
+            name, _ = os.path.splitext(os.path.basename(source))
+            obj = os.path.join(dest, f'{name}.o')
+            elapsed, _, code = run_measured([self.cc] + flags + ['-c', '-o', obj, source],
+                                            dest, env)
+            if code != 0:
+                raise RuntimeError(f'compilation of {source} failed')
+
+            compile_time += elapsed
+            objects.append(obj)
+
+        if not example.runnable:
+            return None, compile_time
+
+        runtime = self.runtime if variant in MODES else 'noop'
+        binary = os.path.join(dest, 'run')
+        sources = [example.runner] if example.runner is not None else []
+        _, _, code = run_measured([self.cc, '-g', '-o', binary] + sources + objects +
+                                  [self.library(runtime), '-pthread'], dest, env)
+        if code != 0:
+            raise RuntimeError(f'linking of {example.name} failed')
+
+        return binary, compile_time
+
+    def run_tests(self, example, binary, dest, env):
+        external = os.path.join(self.aardwolf_dir, 'aardwolf_external')
+        elapsed = 0
+
+        with open(os.path.join(dest, 'aard.result'), 'w') as result:
+            commands = example.test_commands(binary)
+            if example.runner is None:
+                subprocess.run([external], cwd=dest, env=env, check=True)
+
+            for case, args, expected in commands:
+                if case is None:
+                    # The test runner reports the results itself, failing
+                    # cases are expected.
+                    case_time, _, _ = run_measured(args, dest, env, stdout=result)
+                else:
+                    subprocess.run([external, case], cwd=dest, env=env, check=True)
+
+                    actual = os.path.join(dest, 'case.out')
+                    with open(actual, 'w') as fh:
+                        case_time, _, _ = run_measured(args, dest, env, stdout=fh)
+
+                    with open(actual) as fh, open(expected) as expected_fh:
+                        status = 'PASS' if fh.read() == expected_fh.read() else 'FAIL'
+                    result.write(f'{status}: {case}\n')
+
+                elapsed += case_time
+
+        return elapsed
+
+    def analyze(self, dest):
+        config = os.path.join(dest, '.aardwolf.yml')
+        with open(config, 'w') as fh:
+            fh.write(f'output_dir: .\n\nscript:\n  - "true"\n\nplugins:\n  - {self.plugin}\n')
+
+        elapsed, max_rss, code = run_measured([os.path.join(self.aardwolf_dir, 'aardwolf'),
+                                               '--reuse', '--ui', 'json', '--config', config],
+                                              dest, dict(os.environ))
+
+        return elapsed, max_rss, code == 0
+
+    def measure(self, example, variant):
+        dest = os.path.join(self.work_dir, example.name.replace('/', '_'), variant)
+        shutil.rmtree(dest, ignore_errors=True)
+        os.makedirs(dest)
+
+        binary, compile_time = self.build(example, variant, dest)
+
+        result = {
+            'example': example.name,
+            'variant': variant,
+            'runtime': self.runtime if variant in MODES else None,
+            'compile_seconds': round(compile_time, 6),
+            'static_bytes': total_size(os.path.join(dest, '*.aard')),
+        }
+
+        if binary is None:
+            return result
+
+        env = self.env(dest, variant)
+        times = []
+
+        for _ in range(self.repeat):
+            clean_data(dest)
+            times.append(self.run_tests(example, binary, dest, env))
+
+        run_time = statistics.median(times)
+        baseline = self.baseline.get(example.name)
+
+        if variant == 'plain':
+            self.baseline[example.name] = run_time
+
+        result.update({
+            'run_seconds': round(run_time, 6),
+            'slowdown': round(run_time / baseline, 3) if baseline else None,
+            'trace_bytes': total_size(os.path.join(dest, 'aard.trace*')),
+        })
+
+        if self.analysis and variant in MODES:
+            elapsed, rss, ok = self.analyze(dest)
+            result.update({
+                'analysis_seconds': round(elapsed, 6),
+                'analysis_max_rss_kb': rss,
+                'analysis_ok': ok,
+            })
+
+        return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--aardwolf-dir', default='~/.aardwolf',
+                        help='installation directory of Aardwolf (default: ~/.aardwolf)')
+    parser.add_argument('--examples', nargs='+', metavar='NAME',
+                        help='examples to benchmark (default: all)')
+    parser.add_argument('--variants', nargs='+', choices=VARIANTS, default=VARIANTS,
+                        help='build variants (default: all)')
+    parser.add_argument('--runtime', default='full',
+                        choices=['full', 'buffered', 'async'],
+                        help='runtime linked with instrumented variants (default: full)')
+    parser.add_argument('--plugin', default='sbfl',
+                        help='plugin used for the analysis (default: sbfl)')
+    parser.add_argument('--repeat', type=int, default=5,
+                        help='number of test suite runs, the median is reported (default: 5)')
+    parser.add_argument('--no-analysis', action='store_true',
+                        help='do not run Aardwolf core on the data')
+    parser.add_argument('--cc', default='clang', help='compiler (default: clang)')
+    parser.add_argument('--work-dir', help='directory for the builds (default: temporary)')
+    parser.add_argument('--output', help='file for the results (default: standard output)')
+    args = parser.parse_args()
+
+    examples = get_examples()
+    if args.examples is not None:
+        examples = [example for example in examples if example.name in args.examples]
+
+    # The baseline must be measured first.
+    variants = sorted(args.variants, key=VARIANTS.index)
+
+    temporary = None
+    if args.work_dir is None:
+        temporary = tempfile.TemporaryDirectory(prefix='aardwolf-bench-')
+        args.work_dir = temporary.name
+
+    output = open(args.output, 'w') if args.output else sys.stdout
+    bench = Bench(args)
+
+    try:
+        for example in examples:
+            for variant in variants:
+                try:
+                    result = bench.measure(example, variant)
+                except (RuntimeError, subprocess.CalledProcessError) as error:
+                    result = {'example': example.name, 'variant': variant, 'error': str(error)}
+
+                output.write(json.dumps(result) + '\n')
+                output.flush()
+    finally:
+        if output is not sys.stdout:
+            output.close()
+        if temporary is not None:
+            temporary.cleanup()
+
+
+if __name__ == '__main__':
+    main()
@@ -3,11 +3,35 @@ import os
 import struct
 
 HEADER_STATIC = b'AARD/S1'
+HEADER_STATIC_SECTIONS = b'AARD/S2'
+HEADER_STATIC_COMPACT = b'AARD/S3'
 HEADER_DYNAMIC = b'AARD/D1'
+HEADER_DYNAMIC_THREADS = b'AARD/D2'
+HEADER_DYNAMIC_COMPACT = b'AARD/D3'
+
+ZSTD_MAGIC = b'\x28\xb5\x2f\xfd'
 
 TOKEN_STATEMENT = b'\xff'
 TOKEN_FUNCTION = TOKEN_EXTERNAL = b'\xfe'
-TOKEN_FILENAMES = b'\xfd'
+TOKEN_FILENAMES = TOKEN_CHUNK = b'\xfd'
+TOKEN_FILE_INDEX = TOKEN_TRACE_BLOCK = b'\xfc'
+TOKEN_FILE_SWITCH = TOKEN_UNTRACED_FUNCTION = b'\xfb'
+TOKEN_STATEMENT_DELTA = TOKEN_INDUCTION_STEP = b'\xfa'
+TOKEN_BLOCK = b'\xf9'
+TOKEN_TEST_STATUS = b'\xf8'
+TOKEN_GAP = b'\xf7'
+TOKEN_STRING = b'\xf6'
+TOKEN_EXTERNAL_REF = b'\xf5'
+TOKEN_TEST_STATUS_REF = b'\xf4'
+
+SECTION_FUNCTIONS = 0x01
+SECTION_STATEMENTS = 0x02
+SECTION_FILES = 0x03
+SECTION_TYPES = 0x04
+
+FUNCTION_UNTRACED = 0x01
+
+SUCC_NEXT = 0xff
 
 TOKEN_VALUE_SCALAR = b'\xe0'
 TOKEN_VALUE_STRUCTURAL = b'\xe1'
@@ -32,6 +56,8 @@ TOKEN_DATA_F64 = b'\x20'
 TOKEN_DATA_BOOL = b'\x21'
 TOKEN_DATA_NAMED = b'\x28'
 TOKEN_DATA_NULL = b'\x29'
+TOKEN_DATA_BLOB = b'\x2a'
+TOKEN_DATA_NAMED_REF = b'\x2b'
 
 
 def read_stmt(f):
@@ -94,6 +120,17 @@ def read_cstr(f):
     return result
 
 
+def read_varint(f):
+    value = 0
+    shift = 0
+    while True:
+        byte = read_u8(f)
+        value |= (byte & 0x7f) << shift
+        shift += 7
+        if byte & 0x80 == 0:
+            return value
+
+
 def read_str(f):
     return f'"{read_cstr(f)}"'
 
@@ -140,7 +177,8 @@ def get_static_handlers():
         stmt_id = read_stmt(f)
 
         n_succ = read_u8(f)
-        succ_ids = ', '.join(sorted([read_stmt(f) for _ in range(n_succ)]))
+        implied = n_succ == SUCC_NEXT
+        succ_ids = '' if implied else ', '.join(sorted([read_stmt(f) for _ in range(n_succ)]))
 
         n_defs = read_u8(f)
         defs = ', '.join(sorted([read_access(f) for _ in range(n_defs)]))
@@ -152,12 +190,32 @@ def get_static_handlers():
 
         metadata = read_metadata(f)
 
+        if implied:
+            # The successor is the next statement, peek at its id.
+            pos = f.tell()
+            assert f.read(1) == TOKEN_STATEMENT, 'implied successor is not a statement'
+            succ_ids = read_stmt(f)
+            f.seek(pos)
+
         return f'{stmt_id} -> {succ_ids}  ::  defs: {defs} / uses: {uses} [{loc}]{metadata}'
 
     def _parse_func(f):
         name = read_cstr(f)
         return f'\nfunction: {name}\n'
 
+    def _parse_trace_block(f):
+        block_id = read_stmt(f)
+        n_stmts = read_u32(f)
+        stmt_ids = ', '.join([read_stmt(f) for _ in range(n_stmts)])
+        return f'block {block_id}: {stmt_ids}'
+
+    def _parse_induction_step(f):
+        stmt_id = read_stmt(f)
+        step = read_i64(f)
+        n_defs = read_u32(f)
+        def_ids = ', '.join([read_stmt(f) for _ in range(n_defs)])
+        return f'induction {stmt_id}: step {step}, defs {def_ids}'
+
     def _parse_filenames(f):
         n_filenames = read_u32(f)
         filenames = '\n'.join(
@@ -168,6 +226,9 @@ def get_static_handlers():
         TOKEN_STATEMENT: _parse_stmt,
         TOKEN_FUNCTION: _parse_func,
         TOKEN_FILENAMES: _parse_filenames,
+        TOKEN_TRACE_BLOCK: _parse_trace_block,
+        TOKEN_UNTRACED_FUNCTION: lambda f: '(untraced)',
+        TOKEN_INDUCTION_STEP: _parse_induction_step,
     }
 
 
@@ -175,9 +236,67 @@ def get_dynamic_handlers():
     def _prepend(prefix, handler):
         return lambda f: f'{prefix}: {handler(f)}'
 
+    # State of compact encoding, reset in every chunk.
+    state = {'files': {}, 'file': None, 'stmt': 0, 'strings': {}}
+
+    def _parse_chunk(f):
+        thread_id = read_u64(f)
+        epoch = read_u64(f)
+        size = read_u32(f)
+        state.update({'files': {}, 'file': None, 'stmt': 0, 'strings': {}})
+        return f'thread {thread_id:x}, epoch {epoch}, {size} bytes'
+
+    def _parse_file_index(f):
+        index = read_varint(f)
+        file_id = read_u64(f)
+        state['files'][index] = file_id
+        state['file'] = file_id
+        return f'{index} = #{file_id}'
+
+    def _parse_file_switch(f):
+        index = read_varint(f)
+        state['file'] = state['files'][index]
+        return f'{index} (#{state["file"]})'
+
+    def _parse_test_status(f):
+        status = 'passed' if read_u8(f) else 'failed'
+        return f'{read_str(f)} {status}'
+
+    def _parse_string(f):
+        index = read_varint(f)
+        state['strings'][index] = read_cstr(f)
+        return f'{index} = {state["strings"][index]}'
+
+    def _parse_string_ref(f):
+        return state['strings'][read_varint(f)]
+
+    def _parse_test_status_ref(f):
+        status = 'passed' if read_u8(f) else 'failed'
+        return f'"{_parse_string_ref(f)}" {status}'
+
+    def _parse_blob(f):
+        type_id = read_u64(f)
+        size = read_u32(f)
+        return f'{type_id:x} {f.read(size).hex()}'
+
+    def _parse_statement_delta(f):
+        zigzag = read_varint(f)
+        state['stmt'] += (zigzag >> 1) ^ -(zigzag & 1)
+        return f'#{state["file"]}:{state["stmt"]}'
+
     return {
+        TOKEN_CHUNK: _prepend('chunk', _parse_chunk),
+        TOKEN_FILE_INDEX: _prepend('file index', _parse_file_index),
+        TOKEN_FILE_SWITCH: _prepend('file switch', _parse_file_switch),
+        TOKEN_STATEMENT_DELTA: _prepend('statement', _parse_statement_delta),
         TOKEN_STATEMENT: _prepend('statement', read_stmt),
+        TOKEN_BLOCK: _prepend('block', read_stmt),
         TOKEN_EXTERNAL: _prepend('external', read_str),
+        TOKEN_TEST_STATUS: _prepend('test', _parse_test_status),
+        TOKEN_STRING: _prepend('string', _parse_string),
+        TOKEN_EXTERNAL_REF: _prepend('external', lambda f: f'"{_parse_string_ref(f)}"'),
+        TOKEN_TEST_STATUS_REF: _prepend('test', _parse_test_status_ref),
+        TOKEN_GAP: lambda f: 'gap',
         TOKEN_DATA_UNSUPPORTED: lambda f: 'unsupported data type',
         TOKEN_DATA_I8: _prepend('i8', read_i8),
         TOKEN_DATA_I16: _prepend('i16', read_i16),
@@ -192,27 +311,93 @@ def get_dynamic_handlers():
         TOKEN_DATA_BOOL: _prepend('bool', read_bool),
         TOKEN_DATA_NAMED: _prepend('named', read_cstr),
         TOKEN_DATA_NULL: lambda f: 'null',
+        TOKEN_DATA_BLOB: _prepend('blob', _parse_blob),
+        TOKEN_DATA_NAMED_REF: _prepend('named', _parse_string_ref),
     }
 
 
-def parse(filename):
+def parse_tokens(fh, handlers, end=None):
     output = ''
 
-    with open(filename, 'rb') as fh:
-        header = fh.read(7)
-        assert header == HEADER_STATIC or header == HEADER_DYNAMIC, 'invalid header'
+    while end is None or fh.tell() < end:
+        token = fh.read(1)
+        if len(token) != 1:
+            break
 
-        handlers = get_static_handlers() if header == HEADER_STATIC else get_dynamic_handlers()
+        token_value = int.from_bytes(token, byteorder=sys.byteorder)
+        message = 'invalid token identifier: 0x{:02x}'.format(token_value)
+        assert token in handlers, message
 
-        token = fh.read(1)
-        while token is not None and token != 0 and len(token) == 1:
-            token_value = int.from_bytes(token, byteorder=sys.byteorder)
-            message = 'invalid token identifier: 0x{:02x}'.format(token_value)
-            assert token in handlers, message
+        handler = handlers[token]
+        output += handler(fh) + '\n'
 
-            handler = handlers[token]
-            output += handler(fh) + '\n'
+    return output
 
-            token = fh.read(1)
+
+def parse_sections(fh):
+    output = ''
+    handlers = get_static_handlers()
+
+    n_sections = read_u32(fh)
+    sections = {}
+    for _ in range(n_sections):
+        kind = read_u8(fh)
+        sections[kind] = (read_u64(fh), read_u64(fh))
+
+    offset, _ = sections[SECTION_FUNCTIONS]
+    fh.seek(offset)
+    functions = []
+    for _ in range(read_u32(fh)):
+        functions.append((read_cstr(fh), read_u8(fh), read_u64(fh), read_u64(fh)))
+
+    offset, _ = sections[SECTION_STATEMENTS]
+    for name, flags, func_offset, func_size in functions:
+        untraced = ' (untraced)' if flags & FUNCTION_UNTRACED else ''
+        output += f'\nfunction: {name}{untraced}\n\n'
+        fh.seek(offset + func_offset)
+        output += parse_tokens(fh, handlers, offset + func_offset + func_size)
+
+    offset, _ = sections[SECTION_FILES]
+    fh.seek(offset)
+    output += handlers[TOKEN_FILENAMES](fh) + '\n'
+
+    if SECTION_TYPES in sections:
+        offset, _ = sections[SECTION_TYPES]
+        fh.seek(offset)
+        output += '\n'
+        for _ in range(read_u32(fh)):
+            type_id = read_u64(fh)
+            name = read_cstr(fh)
+            size = read_u32(fh)
+            fields = ', '.join([f'{read_u32(fh)}: 0x{read_u8(fh):02x} {read_cstr(fh)}'
+                                for _ in range(read_u32(fh))])
+            output += f'type {type_id:x} = {name} ({size} bytes): {fields}\n'
 
     return output
+
+
+def parse(filename):
+    with open(filename, 'rb') as fh:
+        if fh.read(4) == ZSTD_MAGIC:
+            # Compressed traces require zstandard package.
+            import zstandard
+
+            fh.seek(0)
+            decompressor = zstandard.ZstdDecompressor()
+            with decompressor.stream_reader(fh, read_across_frames=True) as stream:
+                return parse_stream(stream)
+
+        fh.seek(0)
+        return parse_stream(fh)
+
+
+def parse_stream(fh):
+    header = fh.read(7)
+    assert header in [HEADER_STATIC, HEADER_STATIC_SECTIONS, HEADER_STATIC_COMPACT,
+                      HEADER_DYNAMIC, HEADER_DYNAMIC_THREADS, HEADER_DYNAMIC_COMPACT], 'invalid header'
+
+    if header in [HEADER_STATIC_SECTIONS, HEADER_STATIC_COMPACT]:
+        return parse_sections(fh)
+
+    handlers = get_static_handlers() if header == HEADER_STATIC else get_dynamic_handlers()
+    return parse_tokens(fh, handlers)